@@ -0,0 +1,511 @@
+#include "AsyncRedis.h"
+
+#include <algorithm>
+
+static timeval ToTimeval(int milliseconds) {
+  timeval value;
+  value.tv_sec = milliseconds / 1000;
+  value.tv_usec = (milliseconds % 1000) * 1000;
+  return value;
+}
+
+//! Maps the error a context closed with, which is set, to an HRESULT.
+static HRESULT GetContextError(const redisAsyncContext *context) {
+  return context->err == REDIS_ERR_TIMEOUT ? HRESULT_FROM_WIN32(ERROR_TIMEOUT)
+                                           : E_FAIL;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Connection.
+
+HRESULT AsyncRedisConnection::Connect(const char *host, int port,
+                                      const char *password,
+                                      const AsyncRedisOptions &options,
+                                      StatusCallback onReady,
+                                      StatusCallback onClosed) {
+  HRESULT hr = S_OK;
+  redisOptions redisOptions = {};
+  const timeval connectTimeout = ToTimeval(options.connectTimeoutMs);
+  const timeval commandTimeout = ToTimeval(options.commandTimeoutMs);
+  REDIS_OPTIONS_SET_TCP(&redisOptions, host, port);
+  redisOptions.connect_timeout = &connectTimeout;
+  redisOptions.command_timeout = &commandTimeout;
+
+  m_onReady = std::move(onReady);
+  m_onClosed = std::move(onClosed);
+  m_status = S_OK;
+  m_hasPassword = password != nullptr;
+  m_isReadyReported = false;
+  m_isReading = false;
+  m_isWriting = false;
+  m_context = redisAsyncConnectWithOptions(&redisOptions);
+  if (!m_context) {
+    printf("Failed to create redis context\n");
+    IFC(E_OUTOFMEMORY);
+  }
+  if (m_context->err) {
+    printf("Failed to connect: %s\n", m_context->errstr);
+    hr = E_FAIL;
+  } else {
+    hr = m_loop->AddHandler(m_context->c.fd, this);
+  }
+  if (FAILED(hr)) {
+    // No hooks are attached yet, so this calls nothing back.
+    redisAsyncFree(m_context);
+    m_context = nullptr;
+    IFC(hr);
+  }
+
+  // Attach to the loop. Setting the connect callback starts watching for
+  // the connect to complete.
+  m_context->data = this;
+  m_context->ev.data = this;
+  m_context->ev.addRead = AddRead;
+  m_context->ev.delRead = DelRead;
+  m_context->ev.addWrite = AddWrite;
+  m_context->ev.delWrite = DelWrite;
+  m_context->ev.cleanup = Cleanup;
+  m_context->ev.scheduleTimer = ScheduleTimer;
+  redisAsyncSetConnectCallback(m_context, OnConnect);
+  redisAsyncSetDisconnectCallback(m_context, OnDisconnect);
+
+  // Commands wait in the context until the connect completes.
+  if (password &&
+      redisAsyncCommand(m_context, OnAuthReply, this, "AUTH %s", password) !=
+          REDIS_OK) {
+    Disconnect();
+    IFC(E_FAIL);
+  }
+
+Cleanup:
+  return hr;
+}
+
+HRESULT AsyncRedisConnection::Subscribe(const char *channel,
+                                        const ReplyCallback *onReply) {
+  if (!m_context || redisAsyncCommand(m_context, OnReply, (void *)onReply,
+                                      "SUBSCRIBE %s", channel) != REDIS_OK) {
+    return E_FAIL;
+  }
+  return S_OK;
+}
+
+HRESULT AsyncRedisConnection::Publish(const char *channel, const void *data,
+                                      size_t bytes,
+                                      const ReplyCallback *onReply) {
+  if (!m_context ||
+      redisAsyncCommand(m_context, OnReply, (void *)onReply, "PUBLISH %s %b",
+                        channel, data, bytes) != REDIS_OK) {
+    return E_FAIL;
+  }
+  return S_OK;
+}
+
+void AsyncRedisConnection::Disconnect() {
+  // May free the context, and call Cleanup, before returning.
+  if (m_context) {
+    redisAsyncDisconnect(m_context);
+  }
+}
+
+void AsyncRedisConnection::Free() {
+  if (m_context) {
+    m_onReady = nullptr;
+    m_onClosed = nullptr;
+    redisAsyncFree(m_context);
+  }
+}
+
+void AsyncRedisConnection::ReportReady(HRESULT hr) {
+  if (!m_isReadyReported) {
+    m_isReadyReported = true;
+    if (m_onReady) {
+      m_onReady(hr);
+    }
+  }
+}
+
+void AsyncRedisConnection::UpdateInterest() {
+  m_loop->SetInterest(this, m_isReading, m_isWriting);
+}
+
+void AsyncRedisConnection::OnReadable() { redisAsyncHandleRead(m_context); }
+
+void AsyncRedisConnection::OnWritable() { redisAsyncHandleWrite(m_context); }
+
+void AsyncRedisConnection::OnTimer() { redisAsyncHandleTimeout(m_context); }
+
+void AsyncRedisConnection::OnCancel() { Disconnect(); }
+
+void AsyncRedisConnection::OnConnect(const redisAsyncContext *context,
+                                     int status) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)context->data;
+  if (status != REDIS_OK) {
+    // hiredis frees the context once this returns.
+    printf("Failed to connect: %s\n", context->errstr);
+    self->m_status = GetContextError(context);
+    self->ReportReady(self->m_status);
+  } else if (!self->m_hasPassword) {
+    self->ReportReady(S_OK);
+  }
+}
+
+void AsyncRedisConnection::OnDisconnect(const redisAsyncContext *context,
+                                        int status) {
+  // hiredis calls Cleanup first, which records why the connection went and
+  // detaches the context from it, since its owner may destroy it as soon as
+  // it is closed. Only a hiredis that called back in the other order would
+  // get past this.
+  AsyncRedisConnection *self = (AsyncRedisConnection *)context->data;
+  if (!self || status == REDIS_OK || FAILED(self->m_status)) {
+    return;
+  }
+  printf("Lost redis connection: %s\n", context->errstr);
+  self->m_status = GetContextError(context);
+}
+
+void AsyncRedisConnection::OnAuthReply(redisAsyncContext *context,
+                                       void *reply, void *privdata) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  redisReply *r = (redisReply *)reply;
+  (void)context;
+  if (!r) {
+    // Closing; Cleanup reports why.
+    return;
+  }
+  if (r->type == REDIS_REPLY_ERROR) {
+    printf("Failed redis authorization: %s\n", r->str);
+    self->ReportReady(E_FAIL);
+    self->Disconnect();
+    return;
+  }
+  self->ReportReady(S_OK);
+}
+
+void AsyncRedisConnection::OnReply(redisAsyncContext *context, void *reply,
+                                   void *privdata) {
+  const ReplyCallback *onReply = (const ReplyCallback *)privdata;
+  (void)context;
+  (*onReply)((redisReply *)reply);
+}
+
+void AsyncRedisConnection::AddRead(void *privdata) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  self->m_isReading = true;
+  self->UpdateInterest();
+}
+
+void AsyncRedisConnection::DelRead(void *privdata) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  self->m_isReading = false;
+  self->UpdateInterest();
+}
+
+void AsyncRedisConnection::AddWrite(void *privdata) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  self->m_isWriting = true;
+  self->UpdateInterest();
+}
+
+void AsyncRedisConnection::DelWrite(void *privdata) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  self->m_isWriting = false;
+  self->UpdateInterest();
+}
+
+void AsyncRedisConnection::Cleanup(void *privdata) {
+  // The context is being freed; its socket closes once this returns.
+  // hiredis calls this before the disconnect callback, so the reason a
+  // connection dropped or timed out is read from the context here. Nothing
+  // calls back into the connection once the context is detached from it:
+  // onClosed may let its owner destroy it.
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  redisAsyncContext *context = self->m_context;
+  StatusCallback onClosed = std::move(self->m_onClosed);
+  if (context->err && SUCCEEDED(self->m_status)) {
+    printf("Lost redis connection: %s\n", context->errstr);
+    self->m_status = GetContextError(context);
+  }
+  context->data = nullptr;
+  context->ev.data = nullptr;
+  self->m_loop->RemoveHandler(self);
+  self->m_context = nullptr;
+  // Closed before it was ready, by request if nothing went wrong.
+  self->ReportReady(FAILED(self->m_status)
+                        ? self->m_status
+                        : HRESULT_FROM_WIN32(ERROR_CANCELLED));
+  if (onClosed) {
+    onClosed(self->m_status);
+  }
+}
+
+void AsyncRedisConnection::ScheduleTimer(void *privdata,
+                                         struct timeval timeout) {
+  AsyncRedisConnection *self = (AsyncRedisConnection *)privdata;
+  self->m_loop->SetTimer(self, (int)(timeout.tv_sec * 1000 +
+                                     (timeout.tv_usec + 999) / 1000));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Client.
+
+HRESULT AsyncRedisClient::Open(const char *host, int port,
+                               const char *password) {
+  HRESULT hr = S_OK;
+  const std::string hostName = host;
+  const std::string passwordText = password ? password : "";
+  const bool hasPassword = password != nullptr;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_status = S_OK;
+    m_isReady = false;
+    m_isClosed = false;
+  }
+
+  printf("Connecting to redis server %s...\n", host);
+  hr = m_loop->Post([this, hostName, port, passwordText, hasPassword]() {
+    const HRESULT connectResult = m_connection.Connect(
+        hostName.c_str(), port, hasPassword ? passwordText.c_str() : nullptr,
+        m_options,
+        [this](HRESULT readyResult) {
+          if (FAILED(readyResult)) {
+            SetReady(readyResult);
+          } else {
+            OnConnected();
+          }
+        },
+        [this](HRESULT closeResult) { HandleClosed(closeResult); });
+    if (FAILED(connectResult)) {
+      HandleClosed(connectResult);
+    }
+  });
+  if (FAILED(hr)) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_status = hr;
+    m_isClosed = true;
+    IFC(hr);
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_changed.wait(lock, [this]() { return m_isReady || m_isClosed; });
+    hr = m_status;
+  }
+  if (FAILED(hr)) {
+    Close();
+    IFC(hr);
+  }
+  printf("Connected to redis server\n");
+
+Cleanup:
+  return hr;
+}
+
+void AsyncRedisClient::Close() {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_isClosed) {
+      return;
+    }
+  }
+  // The connection may close by itself before the task runs, so the client
+  // must outlive the task as well.
+  bool isTaskDone = false;
+  const HRESULT hr = m_loop->Post([this, &isTaskDone]() {
+    m_connection.Disconnect();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    isTaskDone = true;
+    m_changed.notify_all();
+  });
+  if (FAILED(hr)) {
+    // The loop has ended, maybe on an error that left the connection open;
+    // nothing else will close it. The replies still due are called back
+    // while the derived client that owns their callbacks is alive.
+    m_connection.Free();
+    HandleClosed(hr);
+    return;
+  }
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock,
+                 [this, &isTaskDone]() { return isTaskDone && m_isClosed; });
+}
+
+HRESULT AsyncRedisClient::GetStatus() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_status;
+}
+
+bool AsyncRedisClient::IsClosed() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_isClosed;
+}
+
+void AsyncRedisClient::SetReady(HRESULT hr) {
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_isReady) {
+      return;
+    }
+    m_isReady = true;
+    if (FAILED(hr) && SUCCEEDED(m_status)) {
+      m_status = hr;
+    }
+    m_changed.notify_all();
+  }
+  // A client that failed to open waits in Close for this.
+  if (FAILED(hr)) {
+    m_connection.Disconnect();
+  }
+}
+
+void AsyncRedisClient::HandleClosed(HRESULT hr) {
+  // Notified under the lock: once Close sees the flag, the client may be
+  // destroyed.
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_isClosed = true;
+  if (SUCCEEDED(m_status)) {
+    m_status = FAILED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_CANCELLED);
+  }
+  m_changed.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Publisher.
+
+AsyncRedisPublisher::AsyncRedisPublisher(EventLoop *loop, const char *channel,
+                                         const AsyncRedisOptions &options)
+    : AsyncRedisClient(loop, options), m_channel(channel),
+      m_onReply([this](redisReply *reply) { OnPublishReply(reply); }) {}
+
+HRESULT AsyncRedisPublisher::Publish(const uint8_t *packet, size_t bytes) {
+  HRESULT hr = S_OK;
+  bool isPostNeeded;
+  const int maxInFlight = std::max(m_options.maxInFlight, 1);
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_inFlight >= maxInFlight) {
+    m_stats.windowWaits++;
+    if (!m_changed.wait_for(
+            lock, std::chrono::milliseconds(m_options.commandTimeoutMs),
+            [this, maxInFlight]() {
+              return m_inFlight < maxInFlight || m_isClosed;
+            })) {
+      printf("Timed out waiting for redis\n");
+      IFC(HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+    }
+  }
+  if (m_isClosed) {
+    IFC(FAILED(m_status) ? m_status : E_UNEXPECTED);
+  }
+
+  m_outbox.insert(m_outbox.end(), packet, packet + bytes);
+  m_outboxSizes.push_back(bytes);
+  m_inFlight++;
+  m_stats.commands++;
+  m_stats.maxInFlight = std::max(m_stats.maxInFlight, m_inFlight);
+  isPostNeeded = !m_isSendPosted;
+  m_isSendPosted = true;
+  lock.unlock();
+
+  // One task drains everything published until it runs.
+  if (isPostNeeded) {
+    IFC(m_loop->Post([this]() { SendQueued(); }));
+  }
+
+Cleanup:
+  return hr;
+}
+
+HRESULT AsyncRedisPublisher::Finish() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_changed.wait(lock, [this]() { return m_inFlight == 0 || m_isClosed; });
+  if (m_inFlight > 0) {
+    return FAILED(m_status) ? m_status : E_UNEXPECTED;
+  }
+  return S_OK;
+}
+
+RedisPipelineStats AsyncRedisPublisher::GetStats() {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  return m_stats;
+}
+
+void AsyncRedisPublisher::SendQueued() {
+  const uint8_t *packet;
+  size_t sent = 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sending.swap(m_outbox);
+    m_sendingSizes.swap(m_outboxSizes);
+    m_isSendPosted = false;
+    m_stats.flushes++;
+  }
+
+  packet = m_sending.data();
+  for (size_t bytes : m_sendingSizes) {
+    if (FAILED(m_connection.Publish(m_channel.c_str(), packet, bytes,
+                                    &m_onReply))) {
+      break;
+    }
+    packet += bytes;
+    sent++;
+  }
+  if (sent < m_sendingSizes.size()) {
+    // The connection is closing; these will never be answered.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_inFlight -= (int)(m_sendingSizes.size() - sent);
+    m_changed.notify_all();
+  }
+  m_sending.clear();
+  m_sendingSizes.clear();
+}
+
+void AsyncRedisPublisher::OnPublishReply(redisReply *reply) {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  m_inFlight--;
+  m_stats.replies++;
+  if (reply && reply->type == REDIS_REPLY_ERROR) {
+    printf("Failed to publish: %s\n", reply->str);
+    m_stats.errors++;
+  }
+  m_changed.notify_all();
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Subscriber.
+
+AsyncRedisSubscriber::AsyncRedisSubscriber(EventLoop *loop,
+                                           const char *channel,
+                                           MessageCallback onMessage,
+                                           const AsyncRedisOptions &options)
+    : AsyncRedisClient(loop, options), m_channel(channel),
+      m_onMessage(std::move(onMessage)),
+      m_onReply([this](redisReply *reply) { OnSubscribeReply(reply); }) {}
+
+void AsyncRedisSubscriber::OnConnected() {
+  if (FAILED(m_connection.Subscribe(m_channel.c_str(), &m_onReply))) {
+    SetReady(E_FAIL);
+  }
+}
+
+void AsyncRedisSubscriber::OnSubscribeReply(redisReply *reply) {
+  if (!reply) {
+    return;
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    printf("Failed to subscribe: %s\n", reply->str);
+    SetReady(E_FAIL);
+    return;
+  }
+  if (reply->type != REDIS_REPLY_ARRAY || reply->elements != 3 ||
+      reply->element[0]->type != REDIS_REPLY_STRING) {
+    printf("did not understand reply\n");
+    return;
+  }
+  if (strcmp(reply->element[0]->str, "subscribe") == 0) {
+    SetReady(S_OK);
+  } else if (strcmp(reply->element[0]->str, "message") == 0 &&
+             reply->element[2]->type == REDIS_REPLY_STRING) {
+    m_onMessage((const uint8_t *)reply->element[2]->str,
+                reply->element[2]->len);
+  }
+}
@@ -0,0 +1,215 @@
+#pragma once
+
+#include "EventLoop.h"
+#include "RedisPublisher.h"
+#include "SenderPipeline.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "async.h"
+
+// Redis clients on hiredis' asynchronous API, driven by an EventLoop.
+//
+// Connecting, AUTH, SUBSCRIBE and PUBLISH never block: hiredis queues
+// commands in the context and the loop writes them out and reads replies
+// as the socket allows. One loop thread can drive any number of clients.
+// The threads that use a client only wait on the client, for its
+// connection to come up or go away or for room in a publisher's window,
+// and never on a socket.
+//
+// Connects and commands time out after the configured limits. Cancelling
+// the loop disconnects every client; a publisher's pending PUBLISHes are
+// answered first. Either way the client's waiters wake with the reason.
+
+//! Options for the async clients.
+struct AsyncRedisOptions {
+  int connectTimeoutMs = 5000;
+  //! How long a command may wait for its reply before the connection is
+  //! dropped.
+  int commandTimeoutMs = 5000;
+  //! Most PUBLISHes queued or sent without a reply; anything under 1 is
+  //! taken as 1. Publishers only.
+  int maxInFlight = 64;
+};
+
+//! One hiredis async context attached to an EventLoop. Loop thread only.
+class AsyncRedisConnection : private EventHandler {
+public:
+  using StatusCallback = std::function<void(HRESULT)>;
+  //! Receives a command's reply, or null when the connection went away
+  //! before it was answered.
+  using ReplyCallback = std::function<void(redisReply *reply)>;
+
+  explicit AsyncRedisConnection(EventLoop *loop) : m_loop(loop) {}
+  AsyncRedisConnection(const AsyncRedisConnection &) = delete;
+  AsyncRedisConnection &operator=(const AsyncRedisConnection &) = delete;
+  //! Frees a context that is still open, as Free does.
+  ~AsyncRedisConnection() { Free(); }
+
+  //! Starts connecting and, given a password, authenticating. onReady runs
+  //! once both are done or either fails. onClosed runs once the context is
+  //! gone for good, whatever the reason: S_OK after Disconnect or a cancel,
+  //! otherwise the error. It runs while hiredis tears the context down, so
+  //! it mustn't issue commands.
+  HRESULT Connect(const char *host, int port, const char *password,
+                  const AsyncRedisOptions &options, StatusCallback onReady,
+                  StatusCallback onClosed);
+
+  // onReply must stay alive until it has been called, or the connection has
+  // closed.
+  HRESULT Subscribe(const char *channel, const ReplyCallback *onReply);
+  HRESULT Publish(const char *channel, const void *data, size_t bytes,
+                  const ReplyCallback *onReply);
+
+  //! Closes once the replies still due have arrived.
+  void Disconnect();
+  //! Frees the context at once. Replies still due are called back with
+  //! null, but onReady and onClosed are not called. Only safe once the loop
+  //! has ended, from whichever thread.
+  void Free();
+
+  bool IsOpen() const { return m_context != nullptr; }
+
+private:
+  void ReportReady(HRESULT hr);
+  void UpdateInterest();
+
+  // EventHandler.
+  void OnReadable() override;
+  void OnWritable() override;
+  void OnTimer() override;
+  void OnCancel() override;
+
+  // hiredis callbacks.
+  static void OnConnect(const redisAsyncContext *context, int status);
+  static void OnDisconnect(const redisAsyncContext *context, int status);
+  static void OnAuthReply(redisAsyncContext *context, void *reply,
+                          void *privdata);
+  static void OnReply(redisAsyncContext *context, void *reply,
+                      void *privdata);
+  static void AddRead(void *privdata);
+  static void DelRead(void *privdata);
+  static void AddWrite(void *privdata);
+  static void DelWrite(void *privdata);
+  static void Cleanup(void *privdata);
+  static void ScheduleTimer(void *privdata, struct timeval timeout);
+
+  EventLoop *m_loop;
+  redisAsyncContext *m_context{nullptr};
+  StatusCallback m_onReady;
+  StatusCallback m_onClosed;
+  HRESULT m_status{S_OK}; // why the context closed, once it has
+  bool m_hasPassword{false};
+  bool m_isReadyReported{false};
+  bool m_isReading{false};
+  bool m_isWriting{false};
+};
+
+//! A connection owned by a client that runs on another thread, which can
+//! wait for it to come up or go away.
+class AsyncRedisClient {
+public:
+  AsyncRedisClient(EventLoop *loop, const AsyncRedisOptions &options)
+      : m_loop(loop), m_options(options), m_connection(loop) {}
+  AsyncRedisClient(const AsyncRedisClient &) = delete;
+  AsyncRedisClient &operator=(const AsyncRedisClient &) = delete;
+  virtual ~AsyncRedisClient() = default;
+
+  //! Connects and waits until the client is ready to use, printing progress
+  //! as it goes. A null password skips AUTH. The loop must be running, on
+  //! another thread.
+  HRESULT Open(const char *host, int port, const char *password);
+  //! Disconnects and waits until the connection is gone. Once the loop has
+  //! ended there is nothing to wait for, and a connection it left open is
+  //! freed on the calling thread. Derived classes call this from their
+  //! destructors, while the reply callbacks they own are still alive.
+  void Close();
+
+  //! S_OK while the connection is up, or why it went away.
+  HRESULT GetStatus();
+  bool IsClosed();
+
+protected:
+  //! Loop thread: the connection is up. The client calls SetReady once it
+  //! is ready to use; by default, straight away.
+  virtual void OnConnected() { SetReady(S_OK); }
+
+  //! Loop thread. Wakes Open, with a failure disconnecting again.
+  void SetReady(HRESULT hr);
+
+  EventLoop *m_loop;
+  const AsyncRedisOptions m_options;
+  AsyncRedisConnection m_connection; // loop thread only
+
+  std::mutex m_mutex;
+  std::condition_variable m_changed;
+  HRESULT m_status{S_OK}; // guarded by m_mutex, like the flags below
+  bool m_isReady{false};
+  bool m_isClosed{true};
+
+private:
+  void HandleClosed(HRESULT hr);
+};
+
+//! Publishes packets from the sender's publish thread. Publish copies the
+//! packet into an outbox and returns; the loop drains the outbox into
+//! PUBLISHes whenever it gets to it, so packets published while it is busy
+//! go out together. Publish only waits when maxInFlight packets are queued
+//! or awaiting a reply.
+class AsyncRedisPublisher : public AsyncRedisClient, public PacketPublisher {
+public:
+  AsyncRedisPublisher(EventLoop *loop, const char *channel,
+                      const AsyncRedisOptions &options = {});
+  ~AsyncRedisPublisher() override { Close(); }
+
+  HRESULT Publish(const uint8_t *packet, size_t bytes) override;
+  //! Waits for replies to every packet published so far.
+  HRESULT Finish();
+
+  //! flushes counts outbox drains.
+  RedisPipelineStats GetStats();
+
+private:
+  void SendQueued();
+  void OnPublishReply(redisReply *reply);
+
+  const std::string m_channel;
+  const AsyncRedisConnection::ReplyCallback m_onReply;
+
+  // Guarded by m_mutex. The outbox holds the packets back to back.
+  std::vector<uint8_t> m_outbox;
+  std::vector<size_t> m_outboxSizes;
+  bool m_isSendPosted{false};
+  int m_inFlight{0}; // in the outbox or awaiting a reply
+  RedisPipelineStats m_stats;
+
+  // Loop thread; swapped with the outbox so both keep their capacity.
+  std::vector<uint8_t> m_sending;
+  std::vector<size_t> m_sendingSizes;
+};
+
+//! Subscribes to a channel and hands each message to a callback on the
+//! loop thread, which should pass it on rather than work on it there.
+class AsyncRedisSubscriber : public AsyncRedisClient {
+public:
+  //! The message is only valid during the call.
+  using MessageCallback =
+      std::function<void(const uint8_t *message, size_t bytes)>;
+
+  AsyncRedisSubscriber(EventLoop *loop, const char *channel,
+                       MessageCallback onMessage,
+                       const AsyncRedisOptions &options = {});
+  ~AsyncRedisSubscriber() override { Close(); }
+
+private:
+  void OnConnected() override;
+  void OnSubscribeReply(redisReply *reply);
+
+  const std::string m_channel;
+  const MessageCallback m_onMessage;
+  const AsyncRedisConnection::ReplyCallback m_onReply;
+};
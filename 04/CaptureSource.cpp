@@ -0,0 +1,138 @@
+#include "CaptureSource.h"
+
+#include <algorithm>
+#include <thread>
+
+HRESULT WavCaptureSource::SetOptions(const WavCaptureOptions &options) {
+  const WAVEFORMATEX *format = GetFormat();
+  if (options.packetDurationUs <= 0 || options.speed < 0 ||
+      format->nBlockAlign == 0 || format->nSamplesPerSec == 0) {
+    return E_INVALIDARG;
+  }
+  m_options = options;
+  m_packetFrames = (uint32_t)std::max<int64_t>(
+      1, (int64_t)format->nSamplesPerSec * options.packetDurationUs / 1000000);
+  return S_OK;
+}
+
+HRESULT WavCaptureSource::Open(const wchar_t *fileName,
+                               const WavCaptureOptions &options) {
+  HRESULT hr = S_OK;
+  Close();
+  IFC(m_reader.Open(fileName));
+  IFC(SetOptions(options));
+
+Cleanup:
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+HRESULT WavCaptureSource::OpenStream(FILE *stream, const WAVEFORMATEX *format,
+                                     const WavCaptureOptions &options) {
+  HRESULT hr = S_OK;
+  const size_t formatSize = sizeof(WAVEFORMATEX) + format->cbSize;
+  Close();
+  m_streamFormat.reset(new uint8_t[formatSize]);
+  memcpy(m_streamFormat.get(), format, formatSize);
+  m_stream = stream;
+  IFC(SetOptions(options));
+  // Streams can't seek back to their start.
+  m_options.isLooping = false;
+  m_packet.resize((size_t)m_packetFrames * format->nBlockAlign);
+
+Cleanup:
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+void WavCaptureSource::Close() {
+  m_reader.Close();
+  m_stream = nullptr;
+  m_streamFormat.reset();
+  m_packetFrames = 0;
+  m_framesRead = 0;
+}
+
+const WAVEFORMATEX *WavCaptureSource::GetFormat() const {
+  return m_stream ? (const WAVEFORMATEX *)m_streamFormat.get()
+                  : m_reader.GetFormat();
+}
+
+HRESULT WavCaptureSource::Start() {
+  m_startTime = std::chrono::steady_clock::now();
+  m_framesRead = 0;
+  return S_OK;
+}
+
+HRESULT WavCaptureSource::ReadFromReader(const uint8_t **data, size_t *bytes) {
+  HRESULT hr = S_OK;
+  const size_t packetBytes =
+      (size_t)m_packetFrames * GetFormat()->nBlockAlign;
+  IFC(m_reader.ReadBlock(packetBytes, data, bytes));
+  if (*bytes == 0 && m_options.isLooping && m_reader.GetAudioBytes() > 0) {
+    IFC(m_reader.Seek(0));
+    IFC(m_reader.ReadBlock(packetBytes, data, bytes));
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Fills the staging packet, short only at the end of the stream. A partial
+//! frame left at the end is dropped.
+HRESULT WavCaptureSource::ReadFromStream(const uint8_t **data, size_t *bytes) {
+  const size_t blockAlign = GetFormat()->nBlockAlign;
+  size_t filled = 0;
+  while (filled < m_packet.size()) {
+    const size_t read =
+        fread(m_packet.data() + filled, 1, m_packet.size() - filled, m_stream);
+    if (read == 0) {
+      if (ferror(m_stream)) {
+        return HRESULT_FROM_ERRNO(errno);
+      }
+      break;
+    }
+    filled += read;
+  }
+  *data = m_packet.data();
+  *bytes = filled - filled % blockAlign;
+  return S_OK;
+}
+
+HRESULT WavCaptureSource::ReadPacket(const uint8_t **data,
+                                     uint32_t *frameCount) {
+  HRESULT hr = S_OK;
+  size_t bytes = 0;
+  const WAVEFORMATEX *format = GetFormat();
+  *data = nullptr;
+  *frameCount = 0;
+  if (m_stream) {
+    IFC(ReadFromStream(data, &bytes));
+  } else {
+    IFC(ReadFromReader(data, &bytes));
+  }
+  if (bytes == 0) {
+    return S_FALSE;
+  }
+  *frameCount = (uint32_t)(bytes / format->nBlockAlign);
+  m_framesRead += *frameCount;
+
+  // A device has the packet once its last frame is captured. Deadlines are
+  // kept from the start, so a reader that falls behind gets packets straight
+  // away until it catches up, as it would from a device's buffer.
+  if (m_options.speed > 0) {
+    const double dueSeconds =
+        (double)m_framesRead / format->nSamplesPerSec / m_options.speed;
+    std::this_thread::sleep_until(
+        m_startTime + std::chrono::duration_cast<
+                          std::chrono::steady_clock::duration>(
+                          std::chrono::duration<double>(dueSeconds)));
+  }
+
+Cleanup:
+  return hr;
+}
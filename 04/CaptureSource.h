@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Common.h"
+#include "WAVFileReader.h"
+
+#include <chrono>
+#include <memory>
+
+// Where the sender's audio comes from. play captures from the default
+// microphone through WASAPI; WavCaptureSource plays a WAV file or a raw PCM
+// pipe at the pace a device would deliver it, so the sender can be run and
+// load-tested headless, on any platform.
+
+//! A stream of captured packets of interleaved PCM. Packets are whatever
+//! size the source produces; the sender reassembles them into frames.
+class CaptureSource {
+public:
+  virtual ~CaptureSource() = default;
+
+  //! Format of every packet. Valid once the source is open.
+  virtual const WAVEFORMATEX *GetFormat() const = 0;
+
+  //! Frames the source buffers between reads, which is how far behind the
+  //! reader may fall before audio is lost on the source's side.
+  virtual uint32_t GetBufferFrameCount() const = 0;
+
+  virtual HRESULT Start() = 0;
+  virtual void Stop() = 0;
+
+  //! Waits up to about a packet's duration for captured audio. Returns S_OK
+  //! with a view of *frameCount frames, which is zero when nothing arrived
+  //! in that time so callers can check whether to stop, or S_FALSE once the
+  //! source has ended. The view stays valid until ReleasePacket.
+  virtual HRESULT ReadPacket(const uint8_t **data, uint32_t *frameCount) = 0;
+  //! Hands back a packet that had frames in it.
+  virtual HRESULT ReleasePacket() = 0;
+};
+
+//! Options for WavCaptureSource.
+struct WavCaptureOptions {
+  //! Audio handed out per packet, in microseconds.
+  int packetDurationUs = 10000;
+  //! Pace relative to real time; 2 delivers audio twice as fast as a device
+  //! would, and 0 as fast as it can be read.
+  double speed = 1.0;
+  //! Start the file over at its end. Streams can't loop.
+  bool isLooping = false;
+};
+
+//! Hands out a WAV file or a stream of raw PCM one packet at a time, each
+//! packet once the clock says a device would have captured it.
+class WavCaptureSource : public CaptureSource {
+public:
+  WavCaptureSource() = default;
+  WavCaptureSource(const WavCaptureSource &) = delete;
+  WavCaptureSource &operator=(const WavCaptureSource &) = delete;
+
+  HRESULT Open(const wchar_t *fileName, const WavCaptureOptions &options = {});
+  //! Reads interleaved PCM in format from stream, such as stdin fed by a
+  //! recorder or decoder. The stream is not closed.
+  HRESULT OpenStream(FILE *stream, const WAVEFORMATEX *format,
+                     const WavCaptureOptions &options = {});
+  void Close();
+
+  const WAVEFORMATEX *GetFormat() const override;
+  uint32_t GetBufferFrameCount() const override { return m_packetFrames; }
+  HRESULT Start() override;
+  void Stop() override {}
+  HRESULT ReadPacket(const uint8_t **data, uint32_t *frameCount) override;
+  HRESULT ReleasePacket() override { return S_OK; }
+
+private:
+  HRESULT SetOptions(const WavCaptureOptions &options);
+  HRESULT ReadFromReader(const uint8_t **data, size_t *bytes);
+  HRESULT ReadFromStream(const uint8_t **data, size_t *bytes);
+
+  DirectX::WAVStreamReader m_reader;
+  FILE *m_stream{nullptr};
+  std::unique_ptr<uint8_t[]> m_streamFormat;
+  WavCaptureOptions m_options;
+  uint32_t m_packetFrames{0};
+  std::vector<uint8_t> m_packet; // staging for stream reads
+  std::chrono::steady_clock::time_point m_startTime;
+  uint64_t m_framesRead{0};
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+// Declarations shared by the sample's translation units: error handling
+// macros, small file helpers and audio format checks.
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#include <mmreg.h>
+#include <ks.h>
+#include <ksmedia.h>
+#else
+#include "WinCompat.h"
+#endif
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// Error codes from C libraries (0n150) - 0x8096xxxx
+#ifndef FACILITY_ERRNO
+#define FACILITY_ERRNO (0x96)
+#define HRESULT_FROM_ERRNO(x) MAKE_HRESULT(1, FACILITY_ERRNO, (x))
+#endif
+
+// Error handling.
+#define IFC(x)                                                                 \
+  do {                                                                         \
+    hr = x;                                                                    \
+    if (FAILED(hr)) {                                                          \
+      printf("Failed with 0x%08x at %d\n", hr, __LINE__);                      \
+      goto Cleanup;                                                            \
+    }                                                                          \
+  } while (false)
+#define IFC_OPUS(x)                                                            \
+  do {                                                                         \
+    int __opus_err = (x);                                                      \
+    if (__opus_err < 0) {                                                      \
+      hr = E_FAIL;                                                             \
+      goto Cleanup;                                                            \
+    }                                                                          \
+  } while (false)
+#define IFC_RESAMPLER(x)                                                       \
+  do {                                                                         \
+    int __resampler_err = (x);                                                 \
+    if (__resampler_err != RESAMPLER_ERR_SUCCESS) {                            \
+      hr = E_FAIL;                                                             \
+      goto Cleanup;                                                            \
+    }                                                                          \
+  } while (false)
+
+inline bool IsFormatOrSubFormat(const WAVEFORMATEX *wfx, WORD format,
+                                const GUID &subFormat) {
+  return wfx->wFormatTag == format ||
+         (wfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+          IsEqualGUID(((const WAVEFORMATEXTENSIBLE *)wfx)->SubFormat,
+                      subFormat));
+}
+
+// Opus only runs at these rates; anything else needs resampling first.
+inline bool IsOpusSampleRate(int samplesPerSec) {
+  return samplesPerSec == 8000 || samplesPerSec == 12000 ||
+         samplesPerSec == 16000 || samplesPerSec == 24000 ||
+         samplesPerSec == 48000;
+}
+
+// Opus frames last 2.5, 5, 10, 20, 40, 60, 80, 100 or 120 ms.
+inline bool IsOpusFrameDuration(int frameDurationUs) {
+  return frameDurationUs == 2500 || frameDurationUs == 5000 ||
+         frameDurationUs == 10000 || frameDurationUs == 20000 ||
+         frameDurationUs == 40000 || frameDurationUs == 60000 ||
+         frameDurationUs == 80000 || frameDurationUs == 100000 ||
+         frameDurationUs == 120000;
+}
+
+// Samples per channel in one frame; exact for every Opus rate and duration.
+inline int GetFrameSizeInSamples(int samplesPerSec, int frameDurationUs) {
+  return (int)((int64_t)samplesPerSec * frameDurationUs / 1000000);
+}
+
+inline HRESULT WriteToFile(const void *ptr, size_t len, FILE *fp) {
+  size_t written = fwrite(ptr, 1, len, fp);
+  if (written != len) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+  return S_OK;
+}
+
+template <typename T> HRESULT WriteValueToFile(const T &value, FILE *fp) {
+  return WriteToFile(&value, sizeof(T), fp);
+}
+
+inline HRESULT ReadFromFile(void *ptr, size_t len, FILE *fp) {
+  size_t read = fread(ptr, 1, len, fp);
+  if (read != len) {
+    return feof(fp) ? HRESULT_FROM_WIN32(ERROR_HANDLE_EOF)
+                    : HRESULT_FROM_ERRNO(errno);
+  }
+  return S_OK;
+}
+
+template <typename T> HRESULT ReadValueFromFile(T &value, FILE *fp) {
+  return ReadFromFile(&value, sizeof(T), fp);
+}
+
+// Seeks to an absolute 64-bit offset; fseek takes a long, which is 32 bits on
+// Windows.
+inline HRESULT SeekFile(FILE *fp, uint64_t offset) {
+#ifdef _WIN32
+  int result = _fseeki64(fp, (__int64)offset, SEEK_SET);
+#else
+  int result = fseeko(fp, (off_t)offset, SEEK_SET);
+#endif
+  return result == 0 ? S_OK : HRESULT_FROM_ERRNO(errno);
+}
+
+// Seeks to the end of the file and returns its size.
+inline HRESULT SeekFileToEnd(FILE *fp, uint64_t *size) {
+#ifdef _WIN32
+  int result = _fseeki64(fp, 0, SEEK_END);
+  __int64 position = result == 0 ? _ftelli64(fp) : -1;
+#else
+  int result = fseeko(fp, 0, SEEK_END);
+  off_t position = result == 0 ? ftello(fp) : -1;
+#endif
+  if (position < 0) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+  *size = (uint64_t)position;
+  return S_OK;
+}
+
+template <typename T, typename TOther>
+void AppendBufferByMemcpy(std::vector<T> &value, const TOther *ptr,
+                          size_t elementCount) {
+  static_assert(sizeof(TOther) % sizeof(T) == 0);
+  size_t s = value.size();
+  size_t destSize = elementCount * sizeof(TOther) / sizeof(T);
+  value.resize(value.size() + destSize);
+  memcpy(value.data() + s, ptr, elementCount * sizeof(TOther));
+}
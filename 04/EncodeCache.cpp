@@ -0,0 +1,447 @@
+#include "EncodeCache.h"
+
+#include <algorithm>
+#include <filesystem>
+
+#include "WAVFileReader.h"
+
+namespace fs = std::filesystem;
+
+static const char *IndexFileName = "index";
+static const char *IndexHeader = "opusfun-encode-cache 1";
+
+// Entries are named by two 64-bit hashes in hex.
+static const size_t EntryNameLength = 32;
+
+////////////////////////////////////////////////////////////////////////////
+// Hashing.
+
+// XXH64: four independent multiply-rotate lanes over 32-byte stripes, so it
+// runs at close to memory bandwidth, which matters when every source in a
+// library is hashed on every run.
+static const uint64_t HashPrime1 = 0x9E3779B185EBCA87ull;
+static const uint64_t HashPrime2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t HashPrime3 = 0x165667B19E3779F9ull;
+static const uint64_t HashPrime4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t HashPrime5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t RotateLeft(uint64_t x, int bits) {
+  return (x << bits) | (x >> (64 - bits));
+}
+
+static inline uint64_t Read64(const uint8_t *p) {
+  uint64_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint32_t Read32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+static inline uint64_t HashRound(uint64_t acc, uint64_t input) {
+  acc += input * HashPrime2;
+  return RotateLeft(acc, 31) * HashPrime1;
+}
+
+static inline uint64_t HashMerge(uint64_t acc, uint64_t lane) {
+  acc ^= HashRound(0, lane);
+  return acc * HashPrime1 + HashPrime4;
+}
+
+static uint64_t Hash64(const void *data, size_t size, uint64_t seed) {
+  const uint8_t *p = (const uint8_t *)data;
+  const uint8_t *end = p + size;
+  uint64_t h;
+
+  if (size >= 32) {
+    uint64_t v1 = seed + HashPrime1 + HashPrime2;
+    uint64_t v2 = seed + HashPrime2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - HashPrime1;
+    const uint8_t *limit = end - 32;
+    do {
+      v1 = HashRound(v1, Read64(p));
+      v2 = HashRound(v2, Read64(p + 8));
+      v3 = HashRound(v3, Read64(p + 16));
+      v4 = HashRound(v4, Read64(p + 24));
+      p += 32;
+    } while (p <= limit);
+    h = RotateLeft(v1, 1) + RotateLeft(v2, 7) + RotateLeft(v3, 12) +
+        RotateLeft(v4, 18);
+    h = HashMerge(h, v1);
+    h = HashMerge(h, v2);
+    h = HashMerge(h, v3);
+    h = HashMerge(h, v4);
+  } else {
+    h = seed + HashPrime5;
+  }
+  h += (uint64_t)size;
+
+  for (; p + 8 <= end; p += 8) {
+    h ^= HashRound(0, Read64(p));
+    h = RotateLeft(h, 27) * HashPrime1 + HashPrime4;
+  }
+  if (p + 4 <= end) {
+    h ^= (uint64_t)Read32(p) * HashPrime1;
+    h = RotateLeft(h, 23) * HashPrime2 + HashPrime3;
+    p += 4;
+  }
+  for (; p < end; ++p) {
+    h ^= (uint64_t)*p * HashPrime5;
+    h = RotateLeft(h, 11) * HashPrime1;
+  }
+
+  h ^= h >> 33;
+  h *= HashPrime2;
+  h ^= h >> 29;
+  h *= HashPrime3;
+  h ^= h >> 32;
+  return h;
+}
+
+static void AppendKey(std::vector<uint8_t> *key, const void *data,
+                      size_t size) {
+  const uint8_t *bytes = (const uint8_t *)data;
+  key->insert(key->end(), bytes, bytes + size);
+}
+
+static void AppendKey(std::vector<uint8_t> *key, int64_t value) {
+  AppendKey(key, &value, sizeof(value));
+}
+
+//! Names the entry for a source's audio encoded with options. The format
+//! fields are hashed one by one because a plain PCM format chunk stops
+//! before cbSize.
+static std::string GetEntryName(const DirectX::WAVData64 &data,
+                                const FileCompressOptions &options) {
+  const WAVEFORMATEX *wfx = data.wfx;
+  const uint64_t contentHash =
+      Hash64(data.startAudio, (size_t)data.audioBytes, 0);
+  std::vector<uint8_t> key;
+  char name[EntryNameLength + 1];
+
+  AppendKey(&key, wfx->wFormatTag);
+  AppendKey(&key, wfx->nChannels);
+  AppendKey(&key, wfx->nSamplesPerSec);
+  AppendKey(&key, wfx->nBlockAlign);
+  AppendKey(&key, wfx->wBitsPerSample);
+  if (wfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
+      wfx->cbSize >= sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) {
+    const WAVEFORMATEXTENSIBLE *wfex = (const WAVEFORMATEXTENSIBLE *)wfx;
+    AppendKey(&key, wfex->Samples.wValidBitsPerSample);
+    AppendKey(&key, wfex->dwChannelMask);
+    AppendKey(&key, &wfex->SubFormat, sizeof(wfex->SubFormat));
+  }
+
+  AppendKey(&key, (int64_t)options.container);
+  AppendKey(&key, options.oggSerialNumber);
+  AppendKey(&key, options.frameDurationUs);
+  AppendKey(&key, options.encoder.complexity);
+  AppendKey(&key, options.encoder.bitrate);
+  AppendKey(&key, options.encoder.vbr);
+  AppendKey(&key, options.encoder.constrainedVbr);
+  AppendKey(&key, options.encoder.dtx);
+  AppendKey(&key, options.encoder.signal);
+  AppendKey(&key, options.encoder.maxBandwidth);
+  AppendKey(&key, options.mappingFamily);
+  // Segmented encodes differ slightly from single-encoder ones.
+  AppendKey(&key, std::max(1, options.threadCount));
+  AppendKey(&key, (int64_t)GetResamplerType());
+  const char *version = opus_get_version_string();
+  AppendKey(&key, version, strlen(version));
+
+  snprintf(name, sizeof(name), "%016llx%016llx",
+           (unsigned long long)contentHash,
+           (unsigned long long)Hash64(key.data(), key.size(), contentHash));
+  return name;
+}
+
+static bool IsEntryName(const std::string &name) {
+  return name.size() == EntryNameLength &&
+         name.find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+static HRESULT HResultFromErrorCode(const std::error_code &ec) {
+#ifdef _WIN32
+  return HRESULT_FROM_WIN32(ec.value());
+#else
+  return HRESULT_FROM_ERRNO(ec.value());
+#endif
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Cache directory.
+
+HRESULT EncodeCache::Open(const char *directory, uint64_t maxBytes) {
+  HRESULT hr = S_OK;
+  std::error_code ec;
+
+  IFC(Close());
+  fs::create_directories(directory, ec);
+  if (ec) {
+    IFC(HResultFromErrorCode(ec));
+  }
+  m_directory = directory;
+  m_maxBytes = maxBytes;
+  m_stats = EncodeCacheStats();
+  IFC(LoadIndex());
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    EvictLocked();
+  }
+  m_isOpen = true;
+
+Cleanup:
+  return hr;
+}
+
+HRESULT EncodeCache::Close() {
+  HRESULT hr = S_OK;
+  if (!m_isOpen) {
+    return S_OK;
+  }
+  hr = SaveIndex();
+  m_entries.clear();
+  m_entryMap.clear();
+  m_isOpen = false;
+  return hr;
+}
+
+EncodeCacheStats EncodeCache::GetStats() const {
+  std::lock_guard<std::mutex> lock(m_mutex);
+  EncodeCacheStats stats = m_stats;
+  stats.entries = m_entries.size();
+  return stats;
+}
+
+std::string EncodeCache::GetEntryPath(const std::string &name) const {
+  return (fs::path(m_directory) / name).string();
+}
+
+//! Reads the index, most recent entry first, keeping the entries whose
+//! files are still there at the recorded size. Entry files the index
+//! doesn't list go at the old end; leftovers of interrupted insertions are
+//! removed.
+HRESULT EncodeCache::LoadIndex() {
+  std::error_code ec;
+  const std::string indexPath = GetEntryPath(IndexFileName);
+  FILE *file = fopen(indexPath.c_str(), "r");
+  if (file) {
+    char header[64];
+    char name[64];
+    unsigned long long bytes;
+    if (fgets(header, sizeof(header), file) &&
+        strncmp(header, IndexHeader, strlen(IndexHeader)) == 0) {
+      while (fscanf(file, "%63s %llu", name, &bytes) == 2) {
+        if (!IsEntryName(name) || m_entryMap.count(name) != 0 ||
+            fs::file_size(GetEntryPath(name), ec) != bytes || ec) {
+          continue;
+        }
+        m_entries.push_back({name, bytes});
+        m_entryMap[name] = std::prev(m_entries.end());
+        m_stats.bytes += bytes;
+      }
+    }
+    fclose(file);
+  }
+
+  fs::directory_iterator it(m_directory, ec);
+  if (ec) {
+    return HResultFromErrorCode(ec);
+  }
+  for (; it != fs::directory_iterator(); it.increment(ec)) {
+    const std::string name = it->path().filename().string();
+    if (name.size() > EntryNameLength &&
+        name.compare(EntryNameLength, 4, ".tmp") == 0) {
+      fs::remove(it->path(), ec);
+      continue;
+    }
+    if (!IsEntryName(name) || m_entryMap.count(name) != 0) {
+      continue;
+    }
+    const uint64_t bytes = it->file_size(ec);
+    if (ec) {
+      continue;
+    }
+    m_entries.push_back({name, bytes});
+    m_entryMap[name] = std::prev(m_entries.end());
+    m_stats.bytes += bytes;
+  }
+  return S_OK;
+}
+
+//! Writes the index beside the old one and renames it into place, so an
+//! interrupted write leaves the previous index intact.
+HRESULT EncodeCache::SaveIndex() {
+  std::error_code ec;
+  const std::string indexPath = GetEntryPath(IndexFileName);
+  const std::string tempPath = indexPath + ".new";
+  FILE *file = fopen(tempPath.c_str(), "w");
+  if (!file) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+  bool isWritten = fprintf(file, "%s\n", IndexHeader) > 0;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const Entry &entry : m_entries) {
+      isWritten = isWritten && fprintf(file, "%s %llu\n", entry.name.c_str(),
+                                       (unsigned long long)entry.bytes) > 0;
+    }
+  }
+  isWritten = fclose(file) == 0 && isWritten;
+  if (!isWritten) {
+    fs::remove(tempPath, ec);
+    return E_FAIL;
+  }
+  fs::rename(tempPath, indexPath, ec);
+  return ec ? HResultFromErrorCode(ec) : S_OK;
+}
+
+//! Drops least recently used entries until the cache fits its cap.
+void EncodeCache::EvictLocked() {
+  std::error_code ec;
+  while (m_stats.bytes > m_maxBytes && !m_entries.empty()) {
+    const Entry &entry = m_entries.back();
+    fs::remove(GetEntryPath(entry.name), ec);
+    m_stats.bytes -= entry.bytes;
+    ++m_stats.evictions;
+    m_stats.evictedBytes += entry.bytes;
+    m_entryMap.erase(entry.name);
+    m_entries.pop_back();
+  }
+}
+
+//! Puts the entry called name at the output path if the cache has it.
+bool EncodeCache::TryUseEntry(const std::string &name,
+                              const char *outputFileName) {
+  std::error_code ec;
+  uint64_t bytes;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto found = m_entryMap.find(name);
+    if (found == m_entryMap.end()) {
+      ++m_stats.misses;
+      return false;
+    }
+    m_entries.splice(m_entries.begin(), m_entries, found->second);
+    bytes = found->second->bytes;
+  }
+
+  // A rerun over unchanged outputs finds them already linked to the entry.
+  const fs::path entryPath = GetEntryPath(name);
+  const fs::path outputPath = outputFileName;
+  const bool isEntryIntact = fs::file_size(entryPath, ec) == bytes && !ec;
+  bool isUsed = isEntryIntact && fs::equivalent(entryPath, outputPath, ec);
+  if (isEntryIntact && !isUsed) {
+    fs::remove(outputPath, ec);
+    fs::create_hard_link(entryPath, outputPath, ec);
+    if (ec) {
+      fs::copy_file(entryPath, outputPath,
+                    fs::copy_options::overwrite_existing, ec);
+    }
+    isUsed = !ec;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (!isUsed) {
+    ++m_stats.misses;
+    auto found = m_entryMap.find(name);
+    if (!isEntryIntact && found != m_entryMap.end()) {
+      fs::remove(entryPath, ec);
+      m_stats.bytes -= found->second->bytes;
+      m_entries.erase(found->second);
+      m_entryMap.erase(found);
+    }
+    return false;
+  }
+  ++m_stats.hits;
+  m_stats.hitBytes += bytes;
+  return true;
+}
+
+//! Adds a freshly encoded output as the entry called name. The file is
+//! linked or copied under a temporary name and renamed into place, so a
+//! reader never sees a partial entry.
+void EncodeCache::AddEntry(const std::string &name,
+                           const char *outputFileName) {
+  std::error_code ec;
+  const fs::path outputPath = outputFileName;
+  const std::string entryPath = GetEntryPath(name);
+  std::string tempPath;
+  // An output bigger than the whole cache would only push everything else
+  // out before being evicted itself.
+  const uint64_t bytes = fs::file_size(outputPath, ec);
+  if (ec || bytes > m_maxBytes) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    tempPath = entryPath + ".tmp" + std::to_string(m_nextTempId++);
+  }
+  fs::create_hard_link(outputPath, tempPath, ec);
+  if (ec) {
+    fs::copy_file(outputPath, tempPath, ec);
+  }
+  if (!ec) {
+    fs::rename(tempPath, entryPath, ec);
+  }
+  if (ec) {
+    fs::remove(tempPath, ec);
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto found = m_entryMap.find(name);
+  if (found != m_entryMap.end()) {
+    m_stats.bytes -= found->second->bytes;
+    m_entries.erase(found->second);
+  }
+  m_entries.push_front({name, bytes});
+  m_entryMap[name] = m_entries.begin();
+  m_stats.bytes += bytes;
+  ++m_stats.insertions;
+  EvictLocked();
+}
+
+HRESULT EncodeCache::Compress(const wchar_t *inputFileName,
+                              const char *outputFileName,
+                              const FileCompressOptions &options,
+                              FileCodecState *state, bool *isHit) {
+  HRESULT hr = S_OK;
+  DirectX::WAVFileMapping mapping;
+  DirectX::WAVData64 data;
+  std::string name;
+  std::error_code ec;
+
+  if (isHit) {
+    *isHit = false;
+  }
+  if (!m_isOpen) {
+    IFC(E_UNEXPECTED);
+  }
+
+  // The hash reads the mapped 'data' chunk; the mapping is dropped before
+  // a miss opens the file again to encode it.
+  IFC(DirectX::LoadWAVAudioFromFileEx(inputFileName, mapping, data));
+  name = GetEntryName(data, options);
+  mapping.Close();
+
+  if (TryUseEntry(name, outputFileName)) {
+    if (isHit) {
+      *isHit = true;
+    }
+    goto Cleanup;
+  }
+
+  // The output may still be linked to the entry for an older version of the
+  // source; unlink it so encoding doesn't truncate the shared file.
+  fs::remove(outputFileName, ec);
+  IFC(RunFileCompress(inputFileName, outputFileName, options, state));
+  AddEntry(name, outputFileName);
+
+Cleanup:
+  return hr;
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Common.h"
+#include "FileCodec.h"
+
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// Content-addressed cache of compressed files, so batch jobs only encode the
+// sources that changed since the last run.
+//
+// An entry's key is a 64-bit hash of the WAV 'data' chunk together with a
+// hash of everything else that shapes the output: the format chunk, the
+// compress options, the resampler in use and the Opus library version.
+// Entries are whole output files named by their key in the cache directory.
+// On a hit the entry is hard-linked to the output path, or copied where the
+// file system can't link; on a miss the file is encoded as usual and the
+// output added to the cache.
+//
+// The cache holds at most a given number of bytes; past that the least
+// recently used entries are removed. Recency is kept in an index file that
+// is rewritten on Close. Entries found in the directory but missing from the
+// index count as the oldest.
+//
+// Linked outputs share storage with their entry. Compress removes an output
+// before encoding over it, but anything else that rewrites outputs in place
+// rewrites the cached copy too; the size check on lookup only catches some
+// of that.
+
+//! Counters since the cache was opened.
+struct EncodeCacheStats {
+  uint64_t hits = 0;
+  uint64_t misses = 0;
+  uint64_t hitBytes = 0; //!< output bytes served from the cache
+  uint64_t insertions = 0;
+  uint64_t evictions = 0;
+  uint64_t evictedBytes = 0;
+  uint64_t entries = 0; //!< entries held now
+  uint64_t bytes = 0;   //!< bytes held now
+};
+
+//! An encode cache directory. Compress may be called from several threads
+//! at once; one process at a time should use a directory.
+class EncodeCache {
+public:
+  static const uint64_t DefaultMaxBytes = 10ull * 1024 * 1024 * 1024;
+
+  EncodeCache() = default;
+  EncodeCache(const EncodeCache &) = delete;
+  EncodeCache &operator=(const EncodeCache &) = delete;
+  ~EncodeCache() { (void)Close(); }
+
+  //! Creates the directory if needed and loads its index. Entries past
+  //! maxBytes are evicted straight away.
+  HRESULT Open(const char *directory, uint64_t maxBytes = DefaultMaxBytes);
+
+  //! Writes the index. Safe to call twice.
+  HRESULT Close();
+
+  //! RunFileCompress through the cache. isHit, when given, says whether the
+  //! output came from the cache. Failing to add a fresh output to the cache
+  //! does not fail the call.
+  HRESULT Compress(const wchar_t *inputFileName, const char *outputFileName,
+                   const FileCompressOptions &options = {},
+                   FileCodecState *state = nullptr, bool *isHit = nullptr);
+
+  EncodeCacheStats GetStats() const;
+
+private:
+  struct Entry {
+    std::string name;
+    uint64_t bytes;
+  };
+  // Front is the most recently used.
+  using EntryList = std::list<Entry>;
+
+  std::string GetEntryPath(const std::string &name) const;
+  HRESULT LoadIndex();
+  HRESULT SaveIndex();
+  bool TryUseEntry(const std::string &name, const char *outputFileName);
+  void AddEntry(const std::string &name, const char *outputFileName);
+  void EvictLocked();
+
+  mutable std::mutex m_mutex;
+  std::string m_directory;
+  uint64_t m_maxBytes{0};
+  EntryList m_entries;
+  std::unordered_map<std::string, EntryList::iterator> m_entryMap;
+  uint64_t m_nextTempId{0};
+  EncodeCacheStats m_stats;
+  bool m_isOpen{false};
+};
@@ -0,0 +1,461 @@
+#include "EventLoop.h"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#elif !defined(_WIN32)
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+EventLoop::~EventLoop() {
+  (void)Stop();
+  Close();
+}
+
+#ifdef __linux__
+
+////////////////////////////////////////////////////////////////////////////////
+// epoll and eventfd.
+
+HRESULT EventLoop::Open() {
+  HRESULT hr = S_OK;
+  epoll_event event = {};
+  m_epoll = epoll_create1(EPOLL_CLOEXEC);
+  if (m_epoll < 0) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  m_wakeEvent = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (m_wakeEvent < 0) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  event.events = EPOLLIN;
+  event.data.ptr = nullptr; // the wake event; watches carry their Watch
+  if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_wakeEvent, &event) != 0) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+
+Cleanup:
+  return hr;
+}
+
+void EventLoop::Close() {
+  if (m_wakeEvent >= 0) {
+    close(m_wakeEvent);
+    m_wakeEvent = -1;
+  }
+  if (m_epoll >= 0) {
+    close(m_epoll);
+    m_epoll = -1;
+  }
+}
+
+HRESULT EventLoop::UpdateWatch(Watch *watch) {
+  epoll_event event = {};
+  int op = EPOLL_CTL_MOD;
+  if (!watch->handler) {
+    // The socket may already be closed, which removes it by itself.
+    (void)epoll_ctl(m_epoll, EPOLL_CTL_DEL, watch->socket, &event);
+    return S_OK;
+  }
+  event.events = (watch->isReading ? (uint32_t)EPOLLIN : 0) |
+                 (watch->isWriting ? (uint32_t)EPOLLOUT : 0);
+  event.data.ptr = watch;
+  if (epoll_ctl(m_epoll, op, watch->socket, &event) != 0) {
+    if (errno != ENOENT) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    op = EPOLL_CTL_ADD;
+    if (epoll_ctl(m_epoll, op, watch->socket, &event) != 0) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+  }
+  return S_OK;
+}
+
+HRESULT EventLoop::WaitForEvents(int timeoutMs) {
+  epoll_event events[64];
+  const int count = epoll_wait(m_epoll, events, 64, timeoutMs);
+  if (count < 0) {
+    return errno == EINTR ? S_OK : HRESULT_FROM_ERRNO(errno);
+  }
+  for (int i = 0; i < count; ++i) {
+    Watch *watch = (Watch *)events[i].data.ptr;
+    if (!watch) {
+      DrainWake();
+      continue;
+    }
+    // Errors and hangups are reported to the reader, which finds out what
+    // happened when it reads.
+    const uint32_t flags = events[i].events;
+    Dispatch(watch, (flags & (EPOLLIN | EPOLLERR | EPOLLHUP)) != 0,
+             (flags & EPOLLOUT) != 0);
+  }
+  return S_OK;
+}
+
+void EventLoop::Wake() {
+  const uint64_t one = 1;
+  if (m_wakeEvent < 0) {
+    return;
+  }
+  // Fails only when the counter is saturated, which still wakes the loop.
+  (void)!write(m_wakeEvent, &one, sizeof(one));
+}
+
+void EventLoop::DrainWake() {
+  uint64_t count;
+  (void)!read(m_wakeEvent, &count, sizeof(count));
+}
+
+#else
+
+////////////////////////////////////////////////////////////////////////////////
+// poll and a loopback wake socket.
+
+#ifdef _WIN32
+static HRESULT GetLastSocketError() {
+  return HRESULT_FROM_WIN32(WSAGetLastError());
+}
+#define closesocket_ closesocket
+#define poll_ WSAPoll
+using pollfd_ = WSAPOLLFD;
+using socklen_t = int;
+static const short PollRead = POLLRDNORM;
+static const short PollWrite = POLLWRNORM;
+#else
+static HRESULT GetLastSocketError() { return HRESULT_FROM_ERRNO(errno); }
+#define closesocket_ close
+#define poll_ poll
+using pollfd_ = pollfd;
+static const short PollRead = POLLIN;
+static const short PollWrite = POLLOUT;
+#endif
+
+HRESULT EventLoop::Open() {
+  HRESULT hr = S_OK;
+  sockaddr_in address = {};
+  socklen_t addressSize = sizeof(address);
+#ifdef _WIN32
+  WSADATA wsaData;
+  u_long isNonBlocking = 1;
+  if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+    IFC(E_FAIL);
+  }
+  m_isWinsockStarted = true;
+#endif
+
+  // A datagram socket connected to itself: whatever it sends, it receives.
+  m_wakeSocket = socket(AF_INET, SOCK_DGRAM, 0);
+#ifdef _WIN32
+  if (m_wakeSocket == INVALID_SOCKET) {
+#else
+  if (m_wakeSocket < 0) {
+#endif
+    IFC(GetLastSocketError());
+  }
+  m_isWakeOpen = true;
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  if (bind(m_wakeSocket, (const sockaddr *)&address, sizeof(address)) != 0 ||
+      getsockname(m_wakeSocket, (sockaddr *)&address, &addressSize) != 0 ||
+      connect(m_wakeSocket, (const sockaddr *)&address, sizeof(address)) !=
+          0) {
+    IFC(GetLastSocketError());
+  }
+#ifdef _WIN32
+  if (ioctlsocket(m_wakeSocket, FIONBIO, &isNonBlocking) != 0) {
+#else
+  if (fcntl(m_wakeSocket, F_SETFL,
+            fcntl(m_wakeSocket, F_GETFL) | O_NONBLOCK) != 0) {
+#endif
+    IFC(GetLastSocketError());
+  }
+
+Cleanup:
+  return hr;
+}
+
+void EventLoop::Close() {
+  if (m_isWakeOpen) {
+    closesocket_(m_wakeSocket);
+    m_isWakeOpen = false;
+  }
+#ifdef _WIN32
+  if (m_isWinsockStarted) {
+    WSACleanup();
+    m_isWinsockStarted = false;
+  }
+#endif
+}
+
+HRESULT EventLoop::UpdateWatch(Watch *watch) {
+  // The poll set is rebuilt on every pass.
+  (void)watch;
+  return S_OK;
+}
+
+HRESULT EventLoop::WaitForEvents(int timeoutMs) {
+  std::vector<pollfd_> pollSet;
+  std::vector<Watch *> polled;
+  pollSet.reserve(m_watches.size() + 1);
+  polled.reserve(m_watches.size() + 1);
+  pollSet.push_back({});
+  pollSet.back().fd = m_wakeSocket;
+  pollSet.back().events = PollRead;
+  polled.push_back(nullptr);
+  for (const std::unique_ptr<Watch> &watch : m_watches) {
+    if (watch->handler) {
+      pollSet.push_back({});
+      pollSet.back().fd = watch->socket;
+      pollSet.back().events = (watch->isReading ? PollRead : 0) |
+                              (watch->isWriting ? PollWrite : 0);
+      polled.push_back(watch.get());
+    }
+  }
+
+  const int count = poll_(pollSet.data(), (unsigned long)pollSet.size(),
+                          timeoutMs);
+  if (count < 0) {
+#ifndef _WIN32
+    if (errno == EINTR) {
+      return S_OK;
+    }
+#endif
+    return GetLastSocketError();
+  }
+  for (size_t i = 0; i < pollSet.size(); ++i) {
+    const short flags = pollSet[i].revents;
+    if (flags == 0) {
+      continue;
+    }
+    if (!polled[i]) {
+      DrainWake();
+      continue;
+    }
+    Dispatch(polled[i], (flags & (PollRead | POLLERR | POLLHUP)) != 0,
+             (flags & PollWrite) != 0);
+  }
+  return S_OK;
+}
+
+void EventLoop::Wake() {
+  const char one = 1;
+  if (!m_isWakeOpen) {
+    return;
+  }
+  // Fails only when the socket's buffer is full, which still wakes the loop.
+  (void)send(m_wakeSocket, &one, 1, 0);
+}
+
+void EventLoop::DrainWake() {
+  char buffer[64];
+  while (recv(m_wakeSocket, buffer, sizeof(buffer), 0) > 0) {
+  }
+}
+
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+// Running.
+
+HRESULT EventLoop::Run() {
+  HRESULT hr = S_OK;
+  for (;;) {
+    RunTasks();
+
+    // Cancellation is handled once; handlers added later are refused.
+    if (IsCancelled() && !m_isCancelHandled) {
+      std::vector<EventHandler *> handlers;
+      m_isCancelHandled = true;
+      for (const std::unique_ptr<Watch> &watch : m_watches) {
+        if (watch->handler) {
+          handlers.push_back(watch->handler);
+        }
+      }
+      for (EventHandler *handler : handlers) {
+        if (FindWatch(handler)) {
+          handler->OnCancel();
+        }
+      }
+    }
+
+    m_watches.erase(std::remove_if(m_watches.begin(), m_watches.end(),
+                                   [](const std::unique_ptr<Watch> &watch) {
+                                     return !watch->handler;
+                                   }),
+                    m_watches.end());
+    if (m_isCancelHandled && m_watches.empty()) {
+      std::lock_guard<std::mutex> lock(m_taskMutex);
+      if (m_tasks.empty()) {
+        m_isEnded = true;
+        break;
+      }
+      continue;
+    }
+
+    IFC(WaitForEvents(GetTimeoutMs(Clock::now())));
+    FireTimers(Clock::now());
+  }
+
+Cleanup:
+  if (FAILED(hr)) {
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    m_isEnded = true;
+  }
+  return hr;
+}
+
+HRESULT EventLoop::Start() {
+  m_thread = std::thread([this]() { m_result = Run(); });
+  return S_OK;
+}
+
+HRESULT EventLoop::Stop() {
+  Cancel();
+  if (m_thread.joinable()) {
+    m_thread.join();
+  }
+  return m_result;
+}
+
+HRESULT EventLoop::Post(Task task) {
+  bool isFirst;
+  {
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    if (m_isEnded) {
+      return HRESULT_FROM_WIN32(ERROR_CANCELLED);
+    }
+    isFirst = m_tasks.empty();
+    m_tasks.push_back(std::move(task));
+  }
+  // A loop with tasks already waiting has been woken for them.
+  if (isFirst) {
+    Wake();
+  }
+  return S_OK;
+}
+
+void EventLoop::Cancel() {
+  if (!m_isCancelRequested.exchange(true, std::memory_order_acq_rel)) {
+    Wake();
+  }
+}
+
+void EventLoop::RunTasks() {
+  std::vector<Task> tasks;
+  {
+    std::lock_guard<std::mutex> lock(m_taskMutex);
+    tasks.swap(m_tasks);
+  }
+  for (Task &task : tasks) {
+    task();
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Handlers and timers.
+
+EventLoop::Watch *EventLoop::FindWatch(EventHandler *handler) const {
+  const auto found = m_watchesByHandler.find(handler);
+  return found == m_watchesByHandler.end() ? nullptr : found->second;
+}
+
+HRESULT EventLoop::AddHandler(EventSocket socket, EventHandler *handler) {
+  HRESULT hr = S_OK;
+  Watch *watch;
+  if (m_isCancelHandled || IsCancelled()) {
+    IFC(HRESULT_FROM_WIN32(ERROR_CANCELLED));
+  }
+  m_watches.push_back(std::make_unique<Watch>());
+  watch = m_watches.back().get();
+  watch->socket = socket;
+  watch->handler = handler;
+  m_watchesByHandler[handler] = watch;
+  hr = UpdateWatch(watch);
+  if (FAILED(hr)) {
+    RemoveHandler(handler);
+    IFC(hr);
+  }
+
+Cleanup:
+  return hr;
+}
+
+void EventLoop::RemoveHandler(EventHandler *handler) {
+  Watch *watch = FindWatch(handler);
+  if (watch) {
+    m_watchesByHandler.erase(handler);
+    watch->handler = nullptr;
+    (void)UpdateWatch(watch);
+  }
+}
+
+void EventLoop::SetInterest(EventHandler *handler, bool isReading,
+                            bool isWriting) {
+  Watch *watch = FindWatch(handler);
+  if (watch &&
+      (watch->isReading != isReading || watch->isWriting != isWriting)) {
+    watch->isReading = isReading;
+    watch->isWriting = isWriting;
+    if (FAILED(UpdateWatch(watch))) {
+      printf("Failed to watch socket %d\n", (int)watch->socket);
+    }
+  }
+}
+
+void EventLoop::SetTimer(EventHandler *handler, int timeoutMs) {
+  Watch *watch = FindWatch(handler);
+  if (watch) {
+    watch->deadline = timeoutMs < 0
+                          ? Clock::time_point::max()
+                          : Clock::now() + std::chrono::milliseconds(timeoutMs);
+  }
+}
+
+void EventLoop::Dispatch(Watch *watch, bool isReadable, bool isWritable) {
+  // Either callback may remove the handler, or close and reuse the socket.
+  if (isReadable && watch->handler) {
+    watch->handler->OnReadable();
+  }
+  if (isWritable && watch->handler && watch->isWriting) {
+    watch->handler->OnWritable();
+  }
+}
+
+int EventLoop::GetTimeoutMs(Clock::time_point now) const {
+  Clock::time_point deadline = Clock::time_point::max();
+  for (const std::unique_ptr<Watch> &watch : m_watches) {
+    if (watch->handler) {
+      deadline = std::min(deadline, watch->deadline);
+    }
+  }
+  if (deadline == Clock::time_point::max()) {
+    return -1;
+  }
+  if (deadline <= now) {
+    return 0;
+  }
+  // Round up, so the wait doesn't end just short of the deadline.
+  return (int)std::chrono::ceil<std::chrono::milliseconds>(deadline - now)
+      .count();
+}
+
+void EventLoop::FireTimers(Clock::time_point now) {
+  // Handlers added by a timer are in the vector too; none of them is due.
+  for (size_t i = 0; i < m_watches.size(); ++i) {
+    Watch *watch = m_watches[i].get();
+    if (watch->handler && watch->deadline <= now) {
+      watch->deadline = Clock::time_point::max();
+      watch->handler->OnTimer();
+    }
+  }
+}
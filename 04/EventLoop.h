@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Common.h"
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#endif
+
+// A single-threaded event loop for sockets, so one thread can drive any
+// number of network connections while the threads that produce and consume
+// their data never touch a socket.
+//
+// Each handler watches one socket for readability, writability or both,
+// and may have one timer armed. Other threads talk to the loop through Post,
+// which queues a task for the loop thread, and Cancel, which asks every
+// handler to wind down; Run returns once the last handler has gone. Both
+// wake the loop through an eventfd on Linux, where sockets are watched with
+// epoll. Elsewhere the loop polls, and is woken by a datagram sent to a
+// loopback socket of its own.
+
+#ifdef _WIN32
+using EventSocket = SOCKET;
+#else
+using EventSocket = int;
+#endif
+
+//! Receives a socket's events. Every method runs on the loop thread.
+class EventHandler {
+public:
+  virtual ~EventHandler() = default;
+  virtual void OnReadable() = 0;
+  virtual void OnWritable() = 0;
+  //! The timer armed with SetTimer has expired.
+  virtual void OnTimer() = 0;
+  //! The loop was cancelled. The handler should close its socket, which it
+  //! may take a while over, and remove itself once it has.
+  virtual void OnCancel() = 0;
+};
+
+class EventLoop {
+public:
+  using Task = std::function<void()>;
+
+  EventLoop() = default;
+  EventLoop(const EventLoop &) = delete;
+  EventLoop &operator=(const EventLoop &) = delete;
+  //! Stops the loop thread, if Start began one.
+  ~EventLoop();
+
+  HRESULT Open();
+
+  //! Runs the loop on the calling thread until it is cancelled and every
+  //! handler has been removed.
+  HRESULT Run();
+  //! Runs the loop on a thread of its own.
+  HRESULT Start();
+  //! Cancels the loop and waits for the thread Start began. Returns the
+  //! loop's result.
+  HRESULT Stop();
+
+  // Any thread.
+
+  //! Queues task to run on the loop thread. Fails once the loop has ended,
+  //! in which case task never runs.
+  HRESULT Post(Task task);
+  //! Asks every handler, present and future, to close. Safe to call more
+  //! than once.
+  void Cancel();
+  bool IsCancelled() const {
+    return m_isCancelRequested.load(std::memory_order_acquire);
+  }
+
+  // Loop thread only.
+
+  //! Starts delivering socket's events to handler, with no interest in
+  //! either direction yet. Fails once the loop is cancelled.
+  HRESULT AddHandler(EventSocket socket, EventHandler *handler);
+  //! Stops delivering events to handler, including any pending in the
+  //! current pass. Safe to call from the handler's own callbacks.
+  void RemoveHandler(EventHandler *handler);
+  void SetInterest(EventHandler *handler, bool isReading, bool isWriting);
+  //! Arms handler's timer to fire after timeoutMs, replacing any armed
+  //! before, or disarms it when timeoutMs is negative.
+  void SetTimer(EventHandler *handler, int timeoutMs);
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  struct Watch {
+    EventSocket socket;
+    EventHandler *handler; // null once removed
+    bool isReading{false};
+    bool isWriting{false};
+    Clock::time_point deadline{Clock::time_point::max()};
+  };
+
+  Watch *FindWatch(EventHandler *handler) const;
+  HRESULT UpdateWatch(Watch *watch);
+  HRESULT WaitForEvents(int timeoutMs);
+  void Dispatch(Watch *watch, bool isReadable, bool isWritable);
+  int GetTimeoutMs(Clock::time_point now) const;
+  void FireTimers(Clock::time_point now);
+  void RunTasks();
+  void Wake();
+  void DrainWake();
+  void Close();
+
+#ifdef __linux__
+  int m_epoll{-1};
+  int m_wakeEvent{-1}; // eventfd
+#else
+  EventSocket m_wakeSocket; // loopback datagram socket connected to itself
+  bool m_isWakeOpen{false};
+#ifdef _WIN32
+  bool m_isWinsockStarted{false};
+#endif
+#endif
+
+  // Loop thread. Removed watches stay allocated until the end of the pass,
+  // since events for them may still be waiting to be dispatched.
+  std::vector<std::unique_ptr<Watch>> m_watches;
+  std::unordered_map<EventHandler *, Watch *> m_watchesByHandler;
+  bool m_isCancelHandled{false};
+
+  // Shared with other threads.
+  std::mutex m_taskMutex;
+  std::vector<Task> m_tasks;
+  bool m_isEnded{false}; // guarded by m_taskMutex
+  std::atomic<bool> m_isCancelRequested{false};
+  std::thread m_thread;
+  HRESULT m_result{S_OK};
+};
@@ -0,0 +1,1151 @@
+#include "FileCodec.h"
+
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <thread>
+
+#include <opus.h>
+#include <opus_multistream.h>
+
+#include "OggOpus.h"
+#include "OpusContainer.h"
+#include "Resampler.h"
+#include "WAVFileReader.h"
+
+// Could be OPUS_APPLICATION_VOIP instead
+static const int FileEncoderApplication = OPUS_APPLICATION_AUDIO;
+
+// Audio a segment encoder runs over before its first kept frame. The packets
+// are thrown away; they only bring the encoder's lookahead buffer and adaptive
+// state close to where a single encoder would be at the segment boundary.
+static const int SegmentPreRollUs = 40000;
+
+// Room for the largest packet a 120 ms frame can produce, per stream.
+static const int MaxEncodedPacketBytes = 1275 * 6 + 12;
+
+// Frames handed to the resampler per call when a whole file is resampled at
+// once; its counts are 32-bit, and long archives run past that.
+static const uint32_t WholeBufferChunkFrames = 1 << 20;
+
+//! Creates a surround encoder, which splits channels into streams as
+//! mappingFamily says, and returns the mapping it chose.
+static HRESULT CreateEncoder(int sampleRate, int channels, int mappingFamily,
+                             int application, OpusMSEncoder **enc,
+                             OpusChannelMapping *mapping) {
+  HRESULT hr = S_OK;
+  int error;
+  *enc = nullptr;
+  if (!IsChannelMappingFamilySupported(mappingFamily, channels)) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  mapping->family = mappingFamily;
+  mapping->channels = channels;
+  *enc = opus_multistream_surround_encoder_create(
+      sampleRate, channels, mappingFamily, &mapping->streamCount,
+      &mapping->coupledStreamCount, mapping->mapping, application, &error);
+  IFC_OPUS(error);
+
+Cleanup:
+  return hr;
+}
+
+//! Encodes frames in WAV channel order with a multistream encoder. Surround
+//! encoders take Vorbis order, so for layouts where the two differ each
+//! frame is permuted into a scratch frame first.
+class FrameEncoder {
+public:
+  FrameEncoder(OpusMSEncoder *enc, bool isFloat,
+               const OpusChannelMapping &mapping, int maxFrameSize)
+      : m_enc(enc), m_isFloat(isFloat), m_channels(mapping.channels),
+        m_channelOrder(
+            GetVorbisChannelOrder(mapping.family, mapping.channels)),
+        m_packet((size_t)MaxEncodedPacketBytes * mapping.streamCount) {
+    if (m_channelOrder) {
+      m_reordered.resize((size_t)maxFrameSize * m_channels * GetSampleSize());
+    }
+  }
+
+  //! Encodes one frame into GetPacket(), returning the packet length or an
+  //! Opus error code.
+  opus_int32 Encode(const void *frameData, int frameSize) {
+    if (m_channelOrder) {
+      ReorderChannels(frameData, m_reordered.data(), frameSize, m_channels,
+                      GetSampleSize(), m_channelOrder);
+      frameData = m_reordered.data();
+    }
+    const opus_int32 capacity = (opus_int32)m_packet.size();
+    return m_isFloat
+               ? opus_multistream_encode_float(m_enc, (const float *)frameData,
+                                               frameSize, m_packet.data(),
+                                               capacity)
+               : opus_multistream_encode(m_enc, (const opus_int16 *)frameData,
+                                         frameSize, m_packet.data(),
+                                         capacity);
+  }
+
+  const unsigned char *GetPacket() const { return m_packet.data(); }
+
+private:
+  size_t GetSampleSize() const {
+    return m_isFloat ? sizeof(float) : sizeof(opus_int16);
+  }
+
+  OpusMSEncoder *m_enc;
+  bool m_isFloat;
+  int m_channels;
+  const uint8_t *m_channelOrder; // null when no reordering is needed
+  std::vector<uint8_t> m_reordered;
+  std::vector<unsigned char> m_packet;
+};
+
+static HRESULT EncodeFrameToContainer(FrameEncoder &encoder,
+                                      const void *frameData, int frameSize,
+                                      OpusPacketWriter *writer) {
+  opus_int32 lenOrErr = encoder.Encode(frameData, frameSize);
+  if (lenOrErr < 0) {
+    return E_FAIL;
+  }
+  return writer->WritePacket(encoder.GetPacket(), lenOrErr, frameSize);
+}
+
+static HRESULT EncodeFrameToBuffer(FrameEncoder &encoder,
+                                   const void *frameData, int frameSize,
+                                   std::vector<uint8_t> *encoded) {
+  opus_int32 lenOrErr = encoder.Encode(frameData, frameSize);
+  if (lenOrErr < 0) {
+    return E_FAIL;
+  }
+  const uint8_t *length = (const uint8_t *)&lenOrErr;
+  encoded->insert(encoded->end(), length, length + sizeof(lenOrErr));
+  encoded->insert(encoded->end(), encoder.GetPacket(),
+                  encoder.GetPacket() + lenOrErr);
+  return S_OK;
+}
+
+//! Follows a stream of inputSamples samples per channel, already encoded
+//! with its last frame padded out, with silent frames until the encoder has
+//! also put out the lookahead it was holding back.
+static HRESULT EncodeLookaheadTail(FrameEncoder &encoder, bool isFloat,
+                                   int channels, int frameSize,
+                                   uint64_t inputSamples, int lookahead,
+                                   OpusPacketWriter *writer) {
+  HRESULT hr = S_OK;
+  const uint64_t encodedFrames = (inputSamples + frameSize - 1) / frameSize;
+  const uint64_t neededFrames =
+      (inputSamples + lookahead + frameSize - 1) / frameSize;
+  std::vector<uint8_t> silence((size_t)frameSize * channels *
+                               (isFloat ? sizeof(float) : sizeof(opus_int16)));
+  for (uint64_t frame = encodedFrames; frame < neededFrames; ++frame) {
+    IFC(EncodeFrameToContainer(encoder, silence.data(), frameSize, writer));
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Returns the mapping an encoder for the configuration would use, and the
+//! samples it holds back before its output lines up with the input, which
+//! Ogg Opus records as the pre-skip.
+static HRESULT GetEncoderLayout(int sampleRate, int channels,
+                                int mappingFamily, int application,
+                                OpusChannelMapping *mapping,
+                                opus_int32 *lookahead) {
+  HRESULT hr = S_OK;
+  OpusMSEncoder *enc = nullptr;
+  IFC(CreateEncoder(sampleRate, channels, mappingFamily, application, &enc,
+                    mapping));
+  IFC_OPUS(opus_multistream_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(lookahead)));
+
+Cleanup:
+  opus_multistream_encoder_destroy(enc);
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Encoder settings.
+
+//! Both encoder types take the same requests; only the ctl entry point
+//! differs.
+template <typename Encoder>
+static HRESULT ApplyEncoderSettingsWith(int (*ctl)(Encoder *, int, ...),
+                                        Encoder *enc,
+                                        const OpusEncoderSettings &settings) {
+  HRESULT hr = S_OK;
+  IFC_OPUS(ctl(enc, OPUS_SET_VBR(settings.vbr ? 1 : 0)));
+  IFC_OPUS(
+      ctl(enc, OPUS_SET_VBR_CONSTRAINT(settings.constrainedVbr ? 1 : 0)));
+  IFC_OPUS(ctl(enc, OPUS_SET_BITRATE(settings.bitrate)));
+  IFC_OPUS(ctl(enc, OPUS_SET_COMPLEXITY(settings.complexity)));
+  IFC_OPUS(ctl(enc, OPUS_SET_DTX(settings.dtx ? 1 : 0)));
+  IFC_OPUS(ctl(enc, OPUS_SET_SIGNAL(settings.signal)));
+  IFC_OPUS(ctl(enc, OPUS_SET_MAX_BANDWIDTH(settings.maxBandwidth)));
+
+Cleanup:
+  return hr;
+}
+
+HRESULT ApplyEncoderSettings(OpusEncoder *enc,
+                             const OpusEncoderSettings &settings) {
+  return ApplyEncoderSettingsWith(opus_encoder_ctl, enc, settings);
+}
+
+HRESULT ApplyEncoderSettings(OpusMSEncoder *enc,
+                             const OpusEncoderSettings &settings) {
+  return ApplyEncoderSettingsWith(opus_multistream_encoder_ctl, enc,
+                                  settings);
+}
+
+static bool ParseOnOff(const char *value, bool *result) {
+  if (strcmp(value, "on") == 0) {
+    *result = true;
+  } else if (strcmp(value, "off") == 0) {
+    *result = false;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+static bool ParseInt(const char *value, int minValue, int maxValue,
+                     int *result) {
+  char *end;
+  long parsed = strtol(value, &end, 10);
+  if (end == value || *end != '\0' || parsed < minValue ||
+      parsed > maxValue) {
+    return false;
+  }
+  *result = (int)parsed;
+  return true;
+}
+
+HRESULT ParseEncoderSetting(const char *name, const char *value,
+                            OpusEncoderSettings *settings) {
+  struct NamedValue {
+    const char *name;
+    int value;
+  };
+  static const NamedValue Signals[] = {{"auto", OPUS_AUTO},
+                                       {"voice", OPUS_SIGNAL_VOICE},
+                                       {"music", OPUS_SIGNAL_MUSIC}};
+  static const NamedValue Bandwidths[] = {
+      {"nb", OPUS_BANDWIDTH_NARROWBAND},
+      {"mb", OPUS_BANDWIDTH_MEDIUMBAND},
+      {"wb", OPUS_BANDWIDTH_WIDEBAND},
+      {"swb", OPUS_BANDWIDTH_SUPERWIDEBAND},
+      {"fb", OPUS_BANDWIDTH_FULLBAND}};
+  bool parsed = false;
+  if (strcmp(name, "complexity") == 0) {
+    parsed = ParseInt(value, 0, 10, &settings->complexity);
+  } else if (strcmp(name, "bitrate") == 0) {
+    parsed = true;
+    if (strcmp(value, "auto") == 0) {
+      settings->bitrate = OPUS_AUTO;
+    } else if (strcmp(value, "max") == 0) {
+      settings->bitrate = OPUS_BITRATE_MAX;
+    } else {
+      parsed = ParseInt(value, 500, 512000, &settings->bitrate);
+    }
+  } else if (strcmp(name, "vbr") == 0) {
+    if (strcmp(value, "constrained") == 0) {
+      settings->vbr = true;
+      settings->constrainedVbr = true;
+      parsed = true;
+    } else if (ParseOnOff(value, &settings->vbr)) {
+      settings->constrainedVbr = false;
+      parsed = true;
+    }
+  } else if (strcmp(name, "dtx") == 0) {
+    parsed = ParseOnOff(value, &settings->dtx);
+  } else if (strcmp(name, "signal") == 0) {
+    for (const NamedValue &signal : Signals) {
+      if (strcmp(value, signal.name) == 0) {
+        settings->signal = signal.value;
+        parsed = true;
+      }
+    }
+  } else if (strcmp(name, "bandwidth") == 0) {
+    for (const NamedValue &bandwidth : Bandwidths) {
+      if (strcmp(value, bandwidth.name) == 0) {
+        settings->maxBandwidth = bandwidth.value;
+        parsed = true;
+      }
+    }
+  }
+  return parsed ? S_OK : E_INVALIDARG;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Codec state.
+
+FileCodecState::~FileCodecState() {
+  opus_multistream_encoder_destroy(m_encoder);
+  opus_multistream_decoder_destroy(m_decoder);
+}
+
+HRESULT FileCodecState::GetEncoder(int sampleRate, int channels,
+                                   int mappingFamily, int application,
+                                   OpusMSEncoder **enc,
+                                   OpusChannelMapping *mapping) {
+  HRESULT hr = S_OK;
+  *enc = nullptr;
+  if (m_encoder && m_encoderRate == sampleRate &&
+      m_encoderMapping.channels == channels &&
+      m_encoderMapping.family == mappingFamily &&
+      m_encoderApplication == application) {
+    IFC_OPUS(opus_multistream_encoder_ctl(m_encoder, OPUS_RESET_STATE));
+  } else {
+    opus_multistream_encoder_destroy(m_encoder);
+    m_encoder = nullptr;
+    IFC(CreateEncoder(sampleRate, channels, mappingFamily, application,
+                      &m_encoder, &m_encoderMapping));
+    m_encoderRate = sampleRate;
+    m_encoderApplication = application;
+  }
+  *enc = m_encoder;
+  *mapping = m_encoderMapping;
+
+Cleanup:
+  return hr;
+}
+
+HRESULT FileCodecState::GetDecoder(int sampleRate,
+                                   const OpusChannelMapping &mapping,
+                                   OpusMSDecoder **dec) {
+  HRESULT hr = S_OK;
+  int error;
+  *dec = nullptr;
+  if (m_decoder && m_decoderRate == sampleRate &&
+      IsSameChannelMapping(m_decoderMapping, mapping)) {
+    IFC_OPUS(opus_multistream_decoder_ctl(m_decoder, OPUS_RESET_STATE));
+  } else {
+    opus_multistream_decoder_destroy(m_decoder);
+    m_decoder = opus_multistream_decoder_create(
+        sampleRate, mapping.channels, mapping.streamCount,
+        mapping.coupledStreamCount, mapping.mapping, &error);
+    IFC_OPUS(error);
+    m_decoderRate = sampleRate;
+    m_decoderMapping = mapping;
+  }
+  *dec = m_decoder;
+
+Cleanup:
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Segmented encoding.
+
+//! A run of frames encoded by one encoder on one thread.
+struct EncodeSegment {
+  size_t firstFrame;
+  size_t frameCount;
+  std::vector<uint8_t> encoded;
+  HRESULT hr;
+};
+
+static void EncodeSegmentFrames(const uint8_t *samples,
+                                PcmSampleType sampleType, int sampleRate,
+                                int channels, int mappingFamily,
+                                int frameDurationUs, size_t sampleCount,
+                                const OpusEncoderSettings *settings,
+                                EncodeSegment *segment) {
+  HRESULT hr = S_OK;
+  OpusMSEncoder *enc = nullptr;
+  OpusChannelMapping mapping;
+  const int frameSize = GetFrameSizeInSamples(sampleRate, frameDurationUs);
+  const size_t frameSizeInBytes =
+      frameSize * channels * GetPcmSampleSize(sampleType);
+  const bool isFloat = sampleType != PcmSampleType::Int16;
+  const bool needsConversion = isFloat && sampleType != PcmSampleType::Float32;
+  const size_t preRollFrames = std::min<size_t>(
+      segment->firstFrame,
+      (SegmentPreRollUs + frameDurationUs - 1) / frameDurationUs);
+  const size_t endFrame = segment->firstFrame + segment->frameCount;
+  std::vector<float> convertedFrame(needsConversion ? frameSize * channels
+                                                    : 0);
+  std::vector<uint8_t> paddedFrame;
+
+  IFC(CreateEncoder(
+      sampleRate, channels, mappingFamily,
+      GetEncoderApplication(FileEncoderApplication, frameDurationUs), &enc,
+      &mapping));
+  IFC(ApplyEncoderSettings(enc, *settings));
+  {
+    FrameEncoder encoder(enc, isFloat, mapping, frameSize);
+
+    for (size_t frame = segment->firstFrame - preRollFrames;
+         frame < endFrame; ++frame) {
+      const size_t frameStart = frame * frameSize;
+      const void *frameData;
+      if (frameStart + frameSize <= sampleCount) {
+        frameData = samples + frame * frameSizeInBytes;
+      } else {
+        // The audio runs out in or before this frame; the rest is silence.
+        const size_t available =
+            frameStart < sampleCount ? sampleCount - frameStart : 0;
+        paddedFrame.assign(frameSizeInBytes, 0);
+        if (available > 0) {
+          memcpy(paddedFrame.data(), samples + frame * frameSizeInBytes,
+                 available * (frameSizeInBytes / frameSize));
+        }
+        frameData = paddedFrame.data();
+      }
+      if (needsConversion) {
+        ConvertPcmToFloat(sampleType, frameData, convertedFrame.data(),
+                          convertedFrame.size());
+        frameData = convertedFrame.data();
+      }
+      if (frame < segment->firstFrame) {
+        IFC_OPUS(encoder.Encode(frameData, frameSize));
+      } else {
+        IFC(EncodeFrameToBuffer(encoder, frameData, frameSize,
+                                &segment->encoded));
+      }
+    }
+  }
+
+Cleanup:
+  opus_multistream_encoder_destroy(enc);
+  segment->hr = hr;
+}
+
+HRESULT EncodePcmSegmented(const void *samples, PcmSampleType sampleType,
+                           int sampleRate, int channels, int mappingFamily,
+                           int frameDurationUs, size_t sampleCount,
+                           size_t frameCount, int threadCount,
+                           const OpusEncoderSettings &settings,
+                           std::vector<uint8_t> *encoded) {
+  if (!IsOpusFrameDuration(frameDurationUs)) {
+    return E_INVALIDARG;
+  }
+  const size_t segmentCount =
+      std::max<size_t>(1, std::min<size_t>(std::max(threadCount, 1),
+                                           frameCount));
+  std::vector<EncodeSegment> segments(segmentCount);
+  size_t firstFrame = 0;
+  for (size_t i = 0; i < segmentCount; ++i) {
+    segments[i].firstFrame = firstFrame;
+    segments[i].frameCount =
+        frameCount / segmentCount + (i < frameCount % segmentCount ? 1 : 0);
+    segments[i].hr = S_OK;
+    firstFrame += segments[i].frameCount;
+  }
+
+  // The calling thread takes the first segment.
+  std::vector<std::thread> workers;
+  for (size_t i = 1; i < segmentCount; ++i) {
+    workers.emplace_back(EncodeSegmentFrames, (const uint8_t *)samples,
+                         sampleType, sampleRate, channels, mappingFamily,
+                         frameDurationUs, sampleCount, &settings,
+                         &segments[i]);
+  }
+  EncodeSegmentFrames((const uint8_t *)samples, sampleType, sampleRate,
+                      channels, mappingFamily, frameDurationUs, sampleCount,
+                      &settings, &segments[0]);
+  for (std::thread &worker : workers) {
+    worker.join();
+  }
+
+  for (const EncodeSegment &segment : segments) {
+    if (FAILED(segment.hr)) {
+      return segment.hr;
+    }
+    encoded->insert(encoded->end(), segment.encoded.begin(),
+                    segment.encoded.end());
+  }
+  return S_OK;
+}
+
+//! Reads the next frameBytes of audio from reader. One read never returns
+//! more than the reader's staging buffer, which a multistream frame can
+//! outgrow, so reads that come back short are gathered into scratch until
+//! the frame is full. *bytes is short of frameBytes only at the end of the
+//! data.
+static HRESULT ReadFrame(DirectX::WAVStreamReader &reader, size_t frameBytes,
+                         std::vector<uint8_t> *scratch, const uint8_t **data,
+                         size_t *bytes) {
+  HRESULT hr = S_OK;
+  IFC(reader.ReadBlock(frameBytes, data, bytes));
+  if (*bytes == frameBytes || reader.GetRemainingBytes() == 0) {
+    goto Cleanup;
+  }
+  scratch->assign(*data, *data + *bytes);
+  while (scratch->size() < frameBytes) {
+    const uint8_t *block;
+    size_t blockBytes;
+    IFC(reader.ReadBlock(frameBytes - scratch->size(), &block, &blockBytes));
+    if (blockBytes == 0) {
+      break;
+    }
+    scratch->insert(scratch->end(), block, block + blockBytes);
+  }
+  *data = scratch->data();
+  *bytes = scratch->size();
+
+Cleanup:
+  return hr;
+}
+
+//! Streams the rest of reader through a resampler into the encoder. Audio is
+//! read, converted and resampled about a frame at a time, and each frame is
+//! encoded as soon as it fills, so memory stays fixed however long the file
+//! is. A partial frame at the end is padded with silence when padLastFrame
+//! is set, and dropped otherwise. *outputFrames receives the resampled
+//! length, partial frame included.
+static HRESULT EncodeResampledStream(DirectX::WAVStreamReader &reader,
+                                     PcmSampleType sampleType, int inRate,
+                                     int outRate, int channels,
+                                     int frameDurationUs, bool padLastFrame,
+                                     FrameEncoder &encoder,
+                                     ResamplerCache *cache,
+                                     OpusPacketWriter *writer,
+                                     uint64_t *outputFrames) {
+  HRESULT hr = S_OK;
+  const bool isFloat = sampleType != PcmSampleType::Int16;
+  const bool needsConversion = isFloat && sampleType != PcmSampleType::Float32;
+  const size_t blockAlign = channels * GetPcmSampleSize(sampleType);
+  // Resampler input and output frames are int16 or float.
+  const size_t frameBytes =
+      channels * (isFloat ? sizeof(float) : sizeof(int16_t));
+  const uint32_t chunkFrames = GetFrameSizeInSamples(inRate, frameDurationUs);
+  const uint32_t frameSize = GetFrameSizeInSamples(outRate, frameDurationUs);
+  uint32_t pendingFrames = 0; // resampled frames waiting in frameData
+  bool isDraining = false;
+  StreamingResampler resampler;
+  std::vector<float> convertedData(needsConversion ? chunkFrames * channels
+                                                   : 0);
+  std::vector<uint8_t> frameData(frameSize * frameBytes);
+
+  *outputFrames = 0;
+  IFC(resampler.Open(channels, inRate, outRate, isFloat, cache));
+  while (!isDraining) {
+    const uint8_t *chunk;
+    size_t chunkBytes;
+    uint32_t inFrames;
+    IFC(reader.ReadBlock(chunkFrames * blockAlign, &chunk, &chunkBytes));
+    inFrames = (uint32_t)(chunkBytes / blockAlign);
+    if (needsConversion) {
+      ConvertPcmToFloat(sampleType, chunk, convertedData.data(),
+                        inFrames * channels);
+      chunk = (const uint8_t *)convertedData.data();
+    }
+
+    // Once the file runs out, flush what the filter still holds.
+    isDraining = inFrames == 0;
+    for (;;) {
+      uint8_t *out = frameData.data() + pendingFrames * frameBytes;
+      uint32_t inProcessed = 0;
+      uint32_t outFrames;
+      if (isDraining) {
+        IFC(resampler.Drain(out, frameSize - pendingFrames, &outFrames));
+      } else {
+        IFC(resampler.Process(chunk, inFrames, &inProcessed, out,
+                              frameSize - pendingFrames, &outFrames));
+        chunk += inProcessed * frameBytes;
+        inFrames -= inProcessed;
+      }
+      pendingFrames += outFrames;
+      *outputFrames += outFrames;
+      if (pendingFrames == frameSize) {
+        IFC(EncodeFrameToContainer(encoder, frameData.data(), frameSize,
+                                   writer));
+        pendingFrames = 0;
+      }
+      if (isDraining ? outFrames == 0 : inFrames == 0) {
+        break;
+      }
+    }
+  }
+  if (padLastFrame && pendingFrames > 0) {
+    memset(frameData.data() + pendingFrames * frameBytes, 0,
+           (frameSize - pendingFrames) * frameBytes);
+    IFC(EncodeFrameToContainer(encoder, frameData.data(), frameSize, writer));
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Resamples a whole buffer of int16 or float frames for the segmented
+//! encoder. Like EncodeResampledStream, the output is aligned with the input
+//! and the filter is drained at the end, so both modes encode the same audio.
+//! The input is fed through in chunks until all of it has been consumed.
+static HRESULT ResampleWholeBuffer(const void *in, uint64_t inFrames,
+                                   int inRate, int outRate, int channels,
+                                   bool isFloat, ResamplerCache *cache,
+                                   std::vector<uint8_t> *out) {
+  HRESULT hr = S_OK;
+  const size_t frameBytes =
+      channels * (isFloat ? sizeof(float) : sizeof(int16_t));
+  // The filter's delay comes back out of the drain; 100 ms is far more.
+  const uint64_t capacity = inFrames * outRate / inRate + outRate / 10;
+  const uint8_t *input = (const uint8_t *)in;
+  uint64_t inOffset = 0;
+  uint64_t outCount = 0;
+  bool isDraining = false;
+  StreamingResampler resampler;
+
+  if (capacity > SIZE_MAX / frameBytes) {
+    IFC(E_OUTOFMEMORY);
+  }
+  out->resize((size_t)capacity * frameBytes);
+  IFC(resampler.Open(channels, inRate, outRate, isFloat, cache));
+  for (;;) {
+    const uint32_t room = (uint32_t)std::min<uint64_t>(
+        capacity - outCount, WholeBufferChunkFrames);
+    uint8_t *output = out->data() + (size_t)outCount * frameBytes;
+    uint32_t inProcessed = 0;
+    uint32_t outFrames = 0;
+    if (room == 0) {
+      // Only reachable if the estimate above is wrong.
+      IFC(E_UNEXPECTED);
+    }
+    isDraining = inOffset == inFrames;
+    if (isDraining) {
+      IFC(resampler.Drain(output, room, &outFrames));
+    } else {
+      const uint32_t chunk = (uint32_t)std::min<uint64_t>(
+          inFrames - inOffset, WholeBufferChunkFrames);
+      IFC(resampler.Process(input + (size_t)inOffset * frameBytes, chunk,
+                            &inProcessed, output, room, &outFrames));
+      if (inProcessed == 0 && outFrames == 0) {
+        // Neither side moved, so the rest of the input would be lost.
+        IFC(E_UNEXPECTED);
+      }
+      inOffset += inProcessed;
+    }
+    outCount += outFrames;
+    if (isDraining && outFrames < room) {
+      break;
+    }
+  }
+  out->resize((size_t)outCount * frameBytes);
+
+Cleanup:
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// File compression.
+
+HRESULT RunFileCompress(const wchar_t *inputFileName,
+                        const char *outputFileName,
+                        const FileCompressOptions &options,
+                        FileCodecState *state) {
+  HRESULT hr = S_OK;
+  const bool isParallel = options.threadCount > 1;
+  const bool isOgg = options.container == FileContainerFormat::Ogg;
+  const int application =
+      GetEncoderApplication(FileEncoderApplication, options.frameDurationUs);
+  FileCodecState localState;
+  FileCodecState *codec = state ? state : &localState;
+  DirectX::WAVStreamReader reader;
+  DirectX::WAVFileMapping mapping;
+  DirectX::WAVData64 mappedData;
+  const WAVEFORMATEX *wfx;
+  OpusMSEncoder *enc = nullptr; // owned by codec
+  std::unique_ptr<FrameEncoder> frameEncoder;
+  OpusChannelMapping channelMapping;
+  int mappingFamily;
+  int maxFrameSizeInSamples = 0; // per channel
+  size_t frameSizeInBytes;
+  PcmSampleType sampleType;
+  bool isFloat;         // encode through the float API
+  bool needsConversion; // source samples are neither int16 nor float
+  std::vector<float> convertedData;
+  std::vector<uint8_t> paddedFrame;
+  std::vector<uint8_t> gatheredFrame;
+  std::vector<uint8_t> encodedData;
+  bool isOpusSampleRate;
+  std::vector<uint8_t> resampledData;
+  const int resampleTargetRate = 24000;
+  int audioSamplesPerSec;
+  int encodeSamplesPerSec;
+  int channels;
+  opus_int32 lookahead = 0;
+  uint64_t inputSamples = 0; // per channel, at the encoding rate
+  OpusContainerWriter containerWriter;
+  OggOpusWriter oggWriter;
+  OpusPacketWriter *writer;
+
+  if (!IsOpusFrameDuration(options.frameDurationUs)) {
+    IFC(E_INVALIDARG);
+  }
+
+  // Segments are encoded out of order, so the parallel mode maps the whole
+  // file instead of streaming it through the reader.
+  if (isParallel) {
+    IFC(DirectX::LoadWAVAudioFromFileEx(inputFileName, mapping, mappedData));
+    wfx = mappedData.wfx;
+  } else {
+    IFC(reader.Open(inputFileName));
+    wfx = reader.GetFormat();
+  }
+  IFC(GetPcmSampleType(wfx, &sampleType));
+  audioSamplesPerSec = wfx->nSamplesPerSec;
+  channels = wfx->nChannels;
+  if (wfx->nBlockAlign != channels * GetPcmSampleSize(sampleType)) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+
+  // Opus takes int16 or float; every other layout is widened to float so
+  // 24- and 32-bit sources keep their precision.
+  isFloat = sampleType != PcmSampleType::Int16;
+  needsConversion = isFloat && sampleType != PcmSampleType::Float32;
+
+  // should resample if not one of 8000, 12000, 16000, 24000, or 48000
+  isOpusSampleRate = IsOpusSampleRate(audioSamplesPerSec);
+  encodeSamplesPerSec =
+      isOpusSampleRate ? audioSamplesPerSec : resampleTargetRate;
+
+  // The parallel mode's segment encoders are made on their threads, so it
+  // only asks a throwaway encoder for the layout the headers need.
+  mappingFamily = options.mappingFamily >= 0 ? options.mappingFamily
+                                             : GetDefaultMappingFamily(wfx);
+  if (!isParallel) {
+    IFC(codec->GetEncoder(encodeSamplesPerSec, channels, mappingFamily,
+                          application, &enc, &channelMapping));
+    IFC(ApplyEncoderSettings(enc, options.encoder));
+    IFC_OPUS(
+        opus_multistream_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead)));
+    frameEncoder = std::make_unique<FrameEncoder>(
+        enc, isFloat, channelMapping,
+        GetFrameSizeInSamples(encodeSamplesPerSec, options.frameDurationUs));
+  } else {
+    IFC(GetEncoderLayout(encodeSamplesPerSec, channels, mappingFamily,
+                         application, &channelMapping, &lookahead));
+  }
+
+  if (isOgg) {
+    const uint32_t serialNumber = options.oggSerialNumber != 0
+                                      ? options.oggSerialNumber
+                                      : std::random_device()();
+    IFC(oggWriter.Open(outputFileName, encodeSamplesPerSec, channelMapping,
+                       lookahead * (OggOpusGranuleRate / encodeSamplesPerSec),
+                       audioSamplesPerSec, serialNumber));
+    writer = &oggWriter;
+  } else {
+    IFC(containerWriter.Open(outputFileName, encodeSamplesPerSec,
+                             channelMapping));
+    writer = &containerWriter;
+  }
+
+  if (!isParallel && !isOpusSampleRate) {
+    IFC(EncodeResampledStream(reader, sampleType, audioSamplesPerSec,
+                              encodeSamplesPerSec, channels,
+                              options.frameDurationUs, isOgg, *frameEncoder,
+                              codec->GetResamplerCache(), writer,
+                              &inputSamples));
+  } else if (!isParallel) {
+    // Pull the audio through the reader a frame at a time; only the reader's
+    // staging buffer is ever resident.
+    maxFrameSizeInSamples =
+        GetFrameSizeInSamples(audioSamplesPerSec, options.frameDurationUs);
+    frameSizeInBytes = maxFrameSizeInSamples * wfx->nBlockAlign;
+    if (needsConversion) {
+      convertedData.resize(maxFrameSizeInSamples * channels);
+    }
+    for (bool isLastFrame = false; !isLastFrame;) {
+      const uint8_t *frameData;
+      size_t frameDataBytes;
+      IFC(ReadFrame(reader, frameSizeInBytes, &gatheredFrame, &frameData,
+                    &frameDataBytes));
+      inputSamples += frameDataBytes / wfx->nBlockAlign;
+      if (frameDataBytes < frameSizeInBytes) {
+        // The last frame might not be an acceptable frame size. Ogg pads it
+        // with silence; the packet container drops the last few
+        // milliseconds.
+        if (!isOgg || frameDataBytes == 0) {
+          break;
+        }
+        paddedFrame.assign(frameSizeInBytes, 0);
+        memcpy(paddedFrame.data(), frameData, frameDataBytes);
+        frameData = paddedFrame.data();
+        isLastFrame = true;
+      }
+      if (needsConversion) {
+        ConvertPcmToFloat(sampleType, frameData, convertedData.data(),
+                          convertedData.size());
+        frameData = (const uint8_t *)convertedData.data();
+      }
+      IFC(EncodeFrameToContainer(*frameEncoder, frameData,
+                                 maxFrameSizeInSamples, writer));
+    }
+  } else {
+    const void *encodeSamples = mappedData.startAudio;
+    PcmSampleType encodeSampleType = sampleType;
+    size_t encodeSampleCount =
+        (size_t)mappedData.audioBytes / GetPcmSampleSize(sampleType);
+    if (!isOpusSampleRate) {
+      // Segments need random access, so the mapped file is resampled in one
+      // pass up front.
+      const void *resampleInput = mappedData.startAudio;
+      if (needsConversion) {
+        convertedData.resize(encodeSampleCount);
+        ConvertPcmToFloat(sampleType, mappedData.startAudio,
+                          convertedData.data(), encodeSampleCount);
+        resampleInput = convertedData.data();
+      }
+      IFC(ResampleWholeBuffer(resampleInput, encodeSampleCount / channels,
+                              audioSamplesPerSec, resampleTargetRate,
+                              channels, isFloat, codec->GetResamplerCache(),
+                              &resampledData));
+      encodeSamples = resampledData.data();
+      encodeSampleType =
+          isFloat ? PcmSampleType::Float32 : PcmSampleType::Int16;
+      encodeSampleCount =
+          resampledData.size() / GetPcmSampleSize(encodeSampleType);
+    }
+
+    // As in the streaming paths, Ogg runs on past the end of the audio and
+    // the packet container drops a partial last frame.
+    maxFrameSizeInSamples =
+        GetFrameSizeInSamples(encodeSamplesPerSec, options.frameDurationUs);
+    inputSamples = encodeSampleCount / channels;
+    const uint64_t samplesToEncode =
+        isOgg ? inputSamples + lookahead + maxFrameSizeInSamples - 1
+              : inputSamples;
+    size_t frameCount = (size_t)(samplesToEncode / maxFrameSizeInSamples);
+    IFC(EncodePcmSegmented(encodeSamples, encodeSampleType,
+                           encodeSamplesPerSec, channels, mappingFamily,
+                           options.frameDurationUs, (size_t)inputSamples,
+                           frameCount, options.threadCount, options.encoder,
+                           &encodedData));
+
+    // Move the [length][payload] records into the container.
+    const uint8_t *record = encodedData.data();
+    const uint8_t *recordsEnd = record + encodedData.size();
+    while (record < recordsEnd) {
+      int32_t packetLength;
+      memcpy(&packetLength, record, sizeof(packetLength));
+      IFC(writer->WritePacket(record + sizeof(packetLength), packetLength,
+                              maxFrameSizeInSamples));
+      record += sizeof(packetLength) + packetLength;
+    }
+  }
+
+  if (isOgg) {
+    if (!isParallel) {
+      IFC(EncodeLookaheadTail(
+          *frameEncoder, isFloat, channels,
+          GetFrameSizeInSamples(encodeSamplesPerSec, options.frameDurationUs),
+          inputSamples, lookahead, writer));
+    }
+    oggWriter.SetPlayableSamples(inputSamples *
+                                 (OggOpusGranuleRate / encodeSamplesPerSec));
+  }
+  IFC(isOgg ? oggWriter.Close() : containerWriter.Close());
+
+Cleanup:
+  return hr;
+}
+
+// Longest packet the decoders have to make room for.
+static const int MaxDecodedFrameUs = 120000;
+
+// Smallest buffer a decoded WAV is written through.
+static const size_t MinDecodedWavBufferBytes = 4096;
+
+//! Opens a WAV writer for decoded audio. The writer's buffer is sized from
+//! estimatedFrames, the expected length of the output, so short files are
+//! written in one go, header included, and long ones in default-sized
+//! blocks.
+static HRESULT OpenDecodedWav(const wchar_t *outputFileName, int sampleRate,
+                              int channels, bool isFloat,
+                              uint64_t estimatedFrames,
+                              DirectX::WAVStreamWriter *writer) {
+  HRESULT hr = S_OK;
+  WAVEFORMATEX localFormat;
+  const size_t sampleSize = isFloat ? sizeof(float) : sizeof(opus_int16);
+  size_t bufferBytes = DirectX::WAVStreamWriter::DefaultBufferBytes;
+
+  localFormat.wFormatTag = isFloat ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+  localFormat.nChannels = (WORD)channels;
+  localFormat.nSamplesPerSec = sampleRate;
+  localFormat.nBlockAlign = (WORD)(channels * sampleSize);
+  localFormat.nAvgBytesPerSec =
+      localFormat.nSamplesPerSec * localFormat.nBlockAlign;
+  localFormat.wBitsPerSample = (WORD)(sampleSize * 8);
+  localFormat.cbSize = 0;
+  if (estimatedFrames > 0) {
+    const uint64_t fileBytes =
+        DirectX::WAVStreamWriter::GetHeaderBytes(&localFormat) +
+        estimatedFrames * localFormat.nBlockAlign;
+    bufferBytes = (size_t)std::min<uint64_t>(
+        std::max<uint64_t>(fileBytes, MinDecodedWavBufferBytes), bufferBytes);
+  }
+  IFC(writer->Open(outputFileName, &localFormat, bufferBytes));
+
+Cleanup:
+  return hr;
+}
+
+//! Decodes every packet from reader into writer, dropping the first
+//! skipSamples samples per channel and anything past remainingSamples.
+//! pcmBuffer is sized once for the longest packet and reused throughout.
+template <typename PacketReader>
+static HRESULT DecodePacketsToWav(PacketReader &reader, OpusMSDecoder *dec,
+                                  int sampleRate, int channels, bool isFloat,
+                                  uint64_t skipSamples,
+                                  uint64_t remainingSamples,
+                                  DirectX::WAVStreamWriter *writer) {
+  HRESULT hr = S_OK;
+  const int maxFrameSize = GetFrameSizeInSamples(sampleRate, MaxDecodedFrameUs);
+  const size_t frameBytes =
+      channels * (isFloat ? sizeof(float) : sizeof(opus_int16));
+  std::vector<uint8_t> pcmBuffer((size_t)maxFrameSize * frameBytes);
+  while (remainingSamples > 0) {
+    const uint8_t *packet;
+    int32_t packetLen;
+    IFC(reader.ReadPacket(&packet, &packetLen));
+    if (hr == S_FALSE) {
+      hr = S_OK;
+      break;
+    }
+
+    // Lost packets can be replaced with loss concealment by calling
+    // the decoder with a null pointer and zero length for the missing packet.
+    int sampleCount =
+        isFloat ? opus_multistream_decode_float(dec, packet, packetLen,
+                                                (float *)pcmBuffer.data(),
+                                                maxFrameSize, 0)
+                : opus_multistream_decode(dec, packet, packetLen,
+                                          (opus_int16 *)pcmBuffer.data(),
+                                          maxFrameSize, 0);
+    IFC_OPUS(sampleCount);
+    const uint64_t skipped = std::min<uint64_t>(skipSamples, sampleCount);
+    const uint64_t kept =
+        std::min<uint64_t>(sampleCount - skipped, remainingSamples);
+    skipSamples -= skipped;
+    remainingSamples -= kept;
+    IFC(writer->Write(pcmBuffer.data() + skipped * frameBytes,
+                      kept * frameBytes));
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Decodes an Ogg Opus file, dropping the pre-skip at the start and whatever
+//! the last page trims off the end. Both are counted at 48 kHz and scaled to
+//! the output rate.
+static HRESULT DecompressOggOpus(const char *inputFileName,
+                                 const wchar_t *outputFileName,
+                                 const FileDecompressOptions &options,
+                                 FileCodecState *codec) {
+  HRESULT hr = S_OK;
+  OpusMSDecoder *dec = nullptr; // owned by codec
+  const int sampleRate = options.outputSampleRate ? options.outputSampleRate
+                                                  : OggOpusGranuleRate;
+  int channels;
+  OpusChannelMapping mapping;
+  uint64_t skipSamples;
+  uint64_t totalSamples;
+  OggOpusReader reader;
+  DirectX::WAVStreamWriter writer;
+  if (!IsOpusSampleRate(sampleRate)) {
+    IFC(E_INVALIDARG);
+  }
+  IFC(reader.Open(inputFileName));
+  channels = reader.GetChannels();
+  mapping = GetWavOrderMapping(reader.GetChannelMapping());
+  skipSamples = ((uint64_t)reader.GetPreSkip() * sampleRate +
+                 OggOpusGranuleRate / 2) /
+                OggOpusGranuleRate;
+  totalSamples = (reader.GetTotalSamples() * sampleRate +
+                  OggOpusGranuleRate / 2) /
+                 OggOpusGranuleRate;
+
+  IFC(codec->GetDecoder(sampleRate, mapping, &dec));
+  IFC_OPUS(opus_multistream_decoder_ctl(
+      dec, OPUS_SET_GAIN(reader.GetOutputGain())));
+  IFC(OpenDecodedWav(outputFileName, sampleRate, channels, options.isFloat,
+                     totalSamples, &writer));
+  IFC(DecodePacketsToWav(reader, dec, sampleRate, channels, options.isFloat,
+                         skipSamples, totalSamples, &writer));
+  IFC(writer.Close());
+
+Cleanup:
+  return hr;
+}
+
+HRESULT RunFileDecompress(const char *inputFileName,
+                          const wchar_t *outputFileName,
+                          const FileDecompressOptions &options,
+                          FileCodecState *state) {
+  HRESULT hr = S_OK;
+  FileCodecState localState;
+  FileCodecState *codec = state ? state : &localState;
+  OpusMSDecoder *dec = nullptr; // owned by codec
+  OpusChannelMapping mapping;
+  int sampleRate;
+  int channels;
+  uint64_t estimatedFrames;
+  bool isOgg;
+  OpusContainerReader reader;
+  DirectX::WAVStreamWriter writer;
+  IFC(IsOggFile(inputFileName, &isOgg));
+  if (isOgg) {
+    IFC(DecompressOggOpus(inputFileName, outputFileName, options, codec));
+    goto Cleanup;
+  }
+  IFC(reader.Open(inputFileName));
+  sampleRate = options.outputSampleRate ? options.outputSampleRate
+                                        : reader.GetSampleRate();
+  mapping = GetWavOrderMapping(reader.GetChannelMapping());
+  channels = mapping.channels;
+  if (!IsOpusSampleRate(sampleRate) ||
+      !IsOpusSampleRate(reader.GetSampleRate())) {
+    IFC(E_INVALIDARG);
+  }
+  IFC(codec->GetDecoder(sampleRate, mapping, &dec));
+
+  // Version 2 trailers give the length up front; version 1 files have no
+  // trailer and get the writer's default buffer.
+  estimatedFrames =
+      reader.GetTotalSamples() * sampleRate / reader.GetSampleRate();
+  IFC(OpenDecodedWav(outputFileName, sampleRate, channels, options.isFloat,
+                     estimatedFrames, &writer));
+  IFC(DecodePacketsToWav(reader, dec, sampleRate, channels, options.isFloat, 0,
+                         UINT64_MAX, &writer));
+  IFC(writer.Close());
+
+Cleanup:
+  return hr;
+}
+
+HRESULT DecodeContainerRange(OpusContainerReader &reader, uint64_t startSample,
+                             uint64_t sampleCount, std::vector<int16_t> *pcm) {
+  HRESULT hr = S_OK;
+  OpusMSDecoder *dec = nullptr;
+  const int sampleRate = reader.GetSampleRate();
+  const OpusChannelMapping mapping =
+      GetWavOrderMapping(reader.GetChannelMapping());
+  const int channels = mapping.channels;
+  const uint64_t endSample = startSample + sampleCount;
+  // Decode from a little before the range so the decoder has converged by
+  // the first sample we keep.
+  const uint64_t preRollSamples = (uint64_t)sampleRate * 80 / 1000;
+  uint64_t packetSample;
+  int error;
+  std::vector<opus_int16> pcmBuffer;
+
+  pcm->clear();
+  if (!reader.IsSeekable()) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  if (sampleCount == 0) {
+    goto Cleanup;
+  }
+  IFC(reader.SeekToSample(
+      startSample > preRollSamples ? startSample - preRollSamples : 0,
+      &packetSample));
+
+  dec = opus_multistream_decoder_create(sampleRate, channels,
+                                        mapping.streamCount,
+                                        mapping.coupledStreamCount,
+                                        mapping.mapping, &error);
+  IFC_OPUS(error);
+  pcm->reserve((size_t)sampleCount * channels);
+  pcmBuffer.resize((size_t)sampleRate * 120 / 1000 * channels); // 120 ms max
+
+  while (packetSample < endSample) {
+    const uint8_t *packet;
+    int32_t packetLen;
+    IFC(reader.ReadPacket(&packet, &packetLen));
+    if (hr == S_FALSE) {
+      hr = S_OK;
+      break;
+    }
+
+    int decoded =
+        opus_multistream_decode(dec, packet, packetLen, pcmBuffer.data(),
+                                (int)(pcmBuffer.size() / channels), 0);
+    IFC_OPUS(decoded);
+
+    // Keep the part of this packet that overlaps the requested range.
+    const uint64_t keepFrom = std::max(packetSample, startSample);
+    const uint64_t keepTo = std::min(packetSample + decoded, endSample);
+    if (keepFrom < keepTo) {
+      const opus_int16 *first =
+          pcmBuffer.data() + (keepFrom - packetSample) * channels;
+      pcm->insert(pcm->end(), first, first + (keepTo - keepFrom) * channels);
+    }
+    packetSample += decoded;
+  }
+
+Cleanup:
+  opus_multistream_decoder_destroy(dec);
+  return hr;
+}
+
+HRESULT DecodeOggRange(OggOpusReader &reader, uint64_t startSample,
+                       uint64_t sampleCount, std::vector<int16_t> *pcm) {
+  HRESULT hr = S_OK;
+  OpusMSDecoder *dec = nullptr;
+  const OpusChannelMapping mapping =
+      GetWavOrderMapping(reader.GetChannelMapping());
+  const int channels = mapping.channels;
+  // Work in granule positions, which count the pre-skip too. The range stops
+  // where the last page trims the stream.
+  const uint64_t preSkip = (uint64_t)reader.GetPreSkip();
+  const uint64_t startGranule = preSkip + startSample;
+  const uint64_t endGranule =
+      preSkip + std::min(startSample + sampleCount, reader.GetTotalSamples());
+  // RFC 7845 asks for at least 80 ms of pre-roll before the first sample
+  // kept after a seek.
+  const uint64_t preRollSamples = (uint64_t)OggOpusGranuleRate * 80 / 1000;
+  uint64_t packetGranule;
+  int error;
+  std::vector<opus_int16> pcmBuffer;
+
+  pcm->clear();
+  if (startGranule >= endGranule) {
+    goto Cleanup;
+  }
+  IFC(reader.SeekToGranule(
+      startGranule > preRollSamples ? startGranule - preRollSamples : 0,
+      &packetGranule));
+
+  dec = opus_multistream_decoder_create(OggOpusGranuleRate, channels,
+                                        mapping.streamCount,
+                                        mapping.coupledStreamCount,
+                                        mapping.mapping, &error);
+  IFC_OPUS(error);
+  IFC_OPUS(opus_multistream_decoder_ctl(
+      dec, OPUS_SET_GAIN(reader.GetOutputGain())));
+  pcm->reserve((size_t)(endGranule - startGranule) * channels);
+  pcmBuffer.resize(
+      (size_t)GetFrameSizeInSamples(OggOpusGranuleRate, MaxDecodedFrameUs) *
+      channels);
+
+  while (packetGranule < endGranule) {
+    const uint8_t *packet;
+    int32_t packetLen;
+    IFC(reader.ReadPacket(&packet, &packetLen));
+    if (hr == S_FALSE) {
+      hr = S_OK;
+      break;
+    }
+
+    int decoded =
+        opus_multistream_decode(dec, packet, packetLen, pcmBuffer.data(),
+                                (int)(pcmBuffer.size() / channels), 0);
+    IFC_OPUS(decoded);
+
+    // Keep the part of this packet that overlaps the requested range.
+    const uint64_t keepFrom = std::max(packetGranule, startGranule);
+    const uint64_t keepTo = std::min(packetGranule + decoded, endGranule);
+    if (keepFrom < keepTo) {
+      const opus_int16 *first =
+          pcmBuffer.data() + (keepFrom - packetGranule) * channels;
+      pcm->insert(pcm->end(), first, first + (keepTo - keepFrom) * channels);
+    }
+    packetGranule += decoded;
+  }
+
+Cleanup:
+  opus_multistream_decoder_destroy(dec);
+  return hr;
+}
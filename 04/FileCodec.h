@@ -0,0 +1,186 @@
+#pragma once
+
+#include "Common.h"
+#include "OggOpus.h"
+#include "OpusChannelMapping.h"
+#include "OpusContainer.h"
+#include "PcmConvert.h"
+#include "Resampler.h"
+
+#include <vector>
+
+#include <opus.h>
+#include <opus_multistream.h>
+
+//! Frame duration used unless a caller asks for another, in microseconds.
+static const int DefaultFrameDurationUs = 10000;
+
+//! Frames shorter than 10 ms can only be coded by CELT. Other applications
+//! accept them too but keep SILK's extra lookahead, so those frames use the
+//! restricted low-delay application instead of the one asked for.
+inline int GetEncoderApplication(int application, int frameDurationUs) {
+  return frameDurationUs < 10000 ? OPUS_APPLICATION_RESTRICTED_LOWDELAY
+                                 : application;
+}
+
+//! Encoder settings applied through opus_encoder_ctl. The defaults are the
+//! library's own, so a default-constructed value leaves an encoder as
+//! opus_encoder_create made it. Every field is applied every time, which
+//! keeps reused encoders from carrying a previous file's settings.
+struct OpusEncoderSettings {
+  //! 0 (cheapest) to 10 (best quality per bit).
+  int complexity = 9;
+  //! Target bits per second, or OPUS_AUTO or OPUS_BITRATE_MAX.
+  int bitrate = OPUS_AUTO;
+  //! Off gives hard CBR, where every packet of a stream is the same size.
+  bool vbr = true;
+  //! Keeps VBR packets close to the target, bounding the buffering a
+  //! constant-rate link needs.
+  bool constrainedVbr = true;
+  //! Discontinuous transmission: silence is sent as one- or two-byte
+  //! packets.
+  bool dtx = false;
+  //! OPUS_SIGNAL_VOICE, OPUS_SIGNAL_MUSIC or OPUS_AUTO.
+  int signal = OPUS_AUTO;
+  //! Widest audio bandwidth the encoder may pick, an OPUS_BANDWIDTH_ value.
+  int maxBandwidth = OPUS_BANDWIDTH_FULLBAND;
+};
+
+//! Applies every field of settings to enc. A multistream encoder spreads
+//! the bitrate across its streams.
+HRESULT ApplyEncoderSettings(OpusEncoder *enc,
+                             const OpusEncoderSettings &settings);
+HRESULT ApplyEncoderSettings(OpusMSEncoder *enc,
+                             const OpusEncoderSettings &settings);
+
+//! Parses one setting from the command line into settings. name is one of
+//! complexity (0-10), bitrate (bits per second, auto or max), vbr (on, off
+//! or constrained), dtx (on or off), signal (auto, voice or music) and
+//! bandwidth (nb, mb, wb, swb or fb). Returns E_INVALIDARG for an unknown
+//! name or a bad value.
+HRESULT ParseEncoderSetting(const char *name, const char *value,
+                            OpusEncoderSettings *settings);
+
+//! Layout of compressed files.
+enum class FileContainerFormat {
+  Packet, //!< the indexed packet container (OpusContainer.h)
+  Ogg,    //!< standard Ogg Opus, readable by other tools (OggOpus.h)
+};
+
+//! Options for RunFileCompress.
+struct FileCompressOptions {
+  FileContainerFormat container = FileContainerFormat::Packet;
+  //! Ogg logical stream serial number; zero picks a random one.
+  uint32_t oggSerialNumber = 0;
+
+  //! Opus frame duration in microseconds (see IsOpusFrameDuration). Archival
+  //! encodes want 40-60 ms frames, which cut per-packet overhead and encoder
+  //! CPU; frames under 10 ms trade bytes for latency.
+  int frameDurationUs = DefaultFrameDurationUs;
+
+  OpusEncoderSettings encoder;
+
+  //! Channel mapping family (see OpusChannelMapping.h), or -1 to pick one
+  //! from the source format with GetDefaultMappingFamily. Sources with more
+  //! than two channels are encoded as multistream packets.
+  int mappingFamily = -1;
+
+  //! Encoder threads. Above one, the file is mapped and split into
+  //! frame-aligned segments that are encoded concurrently and stitched back
+  //! together in order.
+  int threadCount = 1;
+};
+
+//! Options for RunFileDecompress.
+struct FileDecompressOptions {
+  //! Opus rate to decode at; zero keeps the stream's own rate (48 kHz for
+  //! Ogg Opus). The decoder synthesizes straight at this rate, so no
+  //! resample pass is needed to get, say, 48 kHz out of a 24 kHz file.
+  int outputSampleRate = 0;
+  //! Decode with opus_decode_float and write 32-bit float samples instead of
+  //! 16-bit PCM.
+  bool isFloat = false;
+};
+
+//! Codec state that outlives a single file. A worker that transcodes many
+//! files keeps one, so encoders, decoders and resampler filter tables are
+//! created once per format and reset between files rather than rebuilt.
+//! Not thread-safe; give each worker its own.
+class FileCodecState {
+public:
+  FileCodecState() = default;
+  FileCodecState(const FileCodecState &) = delete;
+  FileCodecState &operator=(const FileCodecState &) = delete;
+  ~FileCodecState();
+
+  //! Returns a surround encoder for the configuration, freshly reset, and
+  //! the channel mapping it uses.
+  HRESULT GetEncoder(int sampleRate, int channels, int mappingFamily,
+                     int application, OpusMSEncoder **enc,
+                     OpusChannelMapping *mapping);
+  //! Returns a decoder for the configuration, freshly reset.
+  HRESULT GetDecoder(int sampleRate, const OpusChannelMapping &mapping,
+                     OpusMSDecoder **dec);
+  ResamplerCache *GetResamplerCache() { return &m_resamplers; }
+
+private:
+  OpusMSEncoder *m_encoder{nullptr};
+  int m_encoderRate{0};
+  int m_encoderApplication{0};
+  OpusChannelMapping m_encoderMapping;
+  OpusMSDecoder *m_decoder{nullptr};
+  int m_decoderRate{0};
+  OpusChannelMapping m_decoderMapping;
+  ResamplerCache m_resamplers;
+};
+
+// Compresses a WAV file into a version 2 packet container (see
+// OpusContainer.h) or an Ogg Opus file, as options.container asks. Ogg files
+// keep every input sample: the last frame is padded with silence, the
+// encoder runs on past its lookahead, and the last page's granule position
+// trims the padding off again. The packet container has no way to trim, so
+// it drops a partial last frame. State is optional; without it the codecs
+// live for the call only.
+HRESULT RunFileCompress(const wchar_t *inputFileName,
+                        const char *outputFileName,
+                        const FileCompressOptions &options = {},
+                        FileCodecState *state = nullptr);
+
+// Decompresses a version 1 or 2 packet container or an Ogg Opus file back
+// into a WAV file with the stream's channel count, at the rate and in the
+// sample format options ask for. Version 1 containers do not record their
+// channel count and are decoded as mono.
+HRESULT RunFileDecompress(const char *inputFileName,
+                          const wchar_t *outputFileName,
+                          const FileDecompressOptions &options = {},
+                          FileCodecState *state = nullptr);
+
+// Decodes sampleCount samples per channel starting at startSample from a
+// version 2 container into interleaved 16-bit PCM. The reader seeks through
+// the index, so the cost does not depend on where the range starts. pcm may
+// come back short if the range runs past the end of the file.
+HRESULT DecodeContainerRange(OpusContainerReader &reader, uint64_t startSample,
+                             uint64_t sampleCount, std::vector<int16_t> *pcm);
+
+// Decodes sampleCount samples per channel at 48 kHz, starting startSample
+// samples past the pre-skip, from an Ogg Opus file into interleaved 16-bit
+// PCM. The reader bisects over the pages for where to start, so the cost
+// barely depends on where the range starts. pcm comes back short if the
+// range runs past the end of the stream.
+HRESULT DecodeOggRange(OggOpusReader &reader, uint64_t startSample,
+                       uint64_t sampleCount, std::vector<int16_t> *pcm);
+
+// Encodes frameCount frames of frameDurationUs each, from sampleCount
+// interleaved samples per channel at an Opus rate, into [int32 length]
+// [payload] records appended to encoded. Frames that run past sampleCount are
+// padded with silence, which lets a caller encode the end of the audio and
+// the encoder's lookahead after it. The frames are split into up to
+// threadCount segments, each warmed up with about 40 ms of pre-roll and
+// encoded on its own thread. Samples are in WAV channel order and coded with
+// mappingFamily.
+HRESULT EncodePcmSegmented(const void *samples, PcmSampleType sampleType,
+                           int sampleRate, int channels, int mappingFamily,
+                           int frameDurationUs, size_t sampleCount,
+                           size_t frameCount, int threadCount,
+                           const OpusEncoderSettings &settings,
+                           std::vector<uint8_t> *encoded);
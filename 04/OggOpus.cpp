@@ -0,0 +1,640 @@
+#include "OggOpus.h"
+
+#include <algorithm>
+#include <cstddef>
+
+#include <opus.h>
+
+static const char OggCapturePattern[4] = {'O', 'g', 'g', 'S'};
+static const char OpusHeadMagic[8] = {'O', 'p', 'u', 's', 'H', 'e', 'a', 'd'};
+static const char OpusTagsMagic[8] = {'O', 'p', 'u', 's', 'T', 'a', 'g', 's'};
+static const char OggOpusVendor[] = "opusfun";
+
+static const uint8_t OggFlagContinued = 0x01;
+static const uint8_t OggFlagFirstPage = 0x02;
+static const uint8_t OggFlagLastPage = 0x04;
+
+// Pages are closed at whichever limit comes first. Smaller pages cost more
+// header overhead; larger ones make seeking and streaming coarser.
+static const size_t PageTargetBytes = 4096;
+static const uint64_t PageMaxGranules = OggOpusGranuleRate; // one second
+static const int MaxSegments = 255;
+
+// How far back from the end of the file to look for the last page.
+static const uint64_t LastPageSearchBytes = 64 * 1024;
+
+// Below this many bytes, bisection gives way to a forward scan of the pages.
+static const uint64_t BisectionScanBytes = 16 * 1024;
+
+#pragma pack(push, 1)
+struct OggPageHeader {
+  char capturePattern[4];
+  uint8_t version;
+  uint8_t flags;
+  int64_t granulePosition;
+  uint32_t serialNumber;
+  uint32_t sequenceNumber;
+  uint32_t checksum;
+  uint8_t segmentCount;
+};
+
+struct OpusHeadPacket {
+  char magic[8];
+  uint8_t version;
+  uint8_t channels;
+  uint16_t preSkip;
+  uint32_t inputSampleRate;
+  int16_t outputGain;
+  uint8_t mappingFamily;
+};
+#pragma pack(pop)
+
+static_assert(sizeof(OggPageHeader) == 27, "structure size mismatch");
+static_assert(sizeof(OpusHeadPacket) == 19, "structure size mismatch");
+
+//! CRC-32 with polynomial 0x04c11db7, no reflection and a zero initial value,
+//! as the Ogg framing requires.
+struct OggCrcTable {
+  uint32_t values[256];
+  constexpr OggCrcTable() : values() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t r = i << 24;
+      for (int bit = 0; bit < 8; ++bit) {
+        r = (r & 0x80000000u) ? (r << 1) ^ 0x04c11db7u : (r << 1);
+      }
+      values[i] = r;
+    }
+  }
+};
+static constexpr OggCrcTable OggCrc;
+
+static uint32_t OggChecksum(const uint8_t *data, size_t size) {
+  uint32_t crc = 0;
+  for (size_t i = 0; i < size; ++i) {
+    crc = (crc << 8) ^ OggCrc.values[((crc >> 24) ^ data[i]) & 0xff];
+  }
+  return crc;
+}
+
+HRESULT IsOggFile(const char *fileName, bool *isOgg) {
+  *isOgg = false;
+  FILE *file = fopen(fileName, "rb");
+  if (!file) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+  char capturePattern[4];
+  *isOgg = fread(capturePattern, 1, sizeof(capturePattern), file) ==
+               sizeof(capturePattern) &&
+           memcmp(capturePattern, OggCapturePattern,
+                  sizeof(capturePattern)) == 0;
+  fclose(file);
+  return S_OK;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Writer.
+
+HRESULT OggOpusWriter::Open(const char *fileName, int sampleRate,
+                            const OpusChannelMapping &mapping, int preSkip,
+                            int inputSampleRate, uint32_t serialNumber) {
+  HRESULT hr = S_OK;
+  OpusHeadPacket head = {};
+  uint8_t headPacket[sizeof(OpusHeadPacket) + 2 + MaxOpusChannels];
+  const uint32_t vendorLength = sizeof(OggOpusVendor) - 1;
+  const uint32_t commentCount = 0;
+
+  (void)Close();
+  if (!IsOpusSampleRate(sampleRate) ||
+      !IsChannelMappingFamilySupported(mapping.family, mapping.channels) ||
+      preSkip < 0 || preSkip > UINT16_MAX || inputSampleRate < 0) {
+    IFC(E_INVALIDARG);
+  }
+
+  m_granuleScale = OggOpusGranuleRate / sampleRate;
+  m_serialNumber = serialNumber;
+  m_pageSequence = 0;
+  m_preSkip = preSkip;
+  m_playableSamples = 0;
+  m_hasPlayableSamples = false;
+  m_granule = 0;
+  m_pageStartGranule = 0;
+  m_lacing.clear();
+  m_body.clear();
+  m_hr = S_OK;
+
+  m_file = fopen(fileName, "wb");
+  if (!m_file) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  // Let stdio gather several pages per write.
+  setvbuf(m_file, nullptr, _IOFBF, 64 * 1024);
+
+  // The identification and comment headers each get a page of their own.
+  memcpy(head.magic, OpusHeadMagic, sizeof(head.magic));
+  head.version = 1;
+  head.channels = (uint8_t)mapping.channels;
+  head.preSkip = (uint16_t)preSkip;
+  head.inputSampleRate = (uint32_t)inputSampleRate;
+  head.outputGain = 0;
+  head.mappingFamily = (uint8_t)mapping.family;
+  memcpy(headPacket, &head, sizeof(head));
+  WriteChannelMappingTable(mapping, headPacket + sizeof(head));
+  IFC(WritePacket(headPacket,
+                  (int32_t)(sizeof(head) + GetChannelMappingTableSize(mapping)),
+                  0));
+  IFC(WritePage(OggFlagFirstPage, 0));
+
+  m_body.insert(m_body.end(), OpusTagsMagic,
+                OpusTagsMagic + sizeof(OpusTagsMagic));
+  AppendBufferByMemcpy(m_body, &vendorLength, 1);
+  m_body.insert(m_body.end(), OggOpusVendor, OggOpusVendor + vendorLength);
+  AppendBufferByMemcpy(m_body, &commentCount, 1);
+  m_lacing.assign(m_body.size() / 255, 255);
+  m_lacing.push_back((uint8_t)(m_body.size() % 255));
+  IFC(WritePage(0, 0));
+
+Cleanup:
+  if (FAILED(hr)) {
+    m_hr = hr;
+  }
+  return hr;
+}
+
+HRESULT OggOpusWriter::WritePacket(const uint8_t *data, int32_t length,
+                                   uint32_t sampleCount) {
+  if (!m_file) {
+    return E_UNEXPECTED;
+  }
+  const size_t segments = (size_t)length / 255 + 1;
+  if (length < 0 || (length > 0 && !data) || segments > MaxSegments) {
+    return E_INVALIDARG;
+  }
+  if (FAILED(m_hr)) {
+    return m_hr;
+  }
+
+  // Packets never straddle pages, so every page starts on a packet.
+  if (!m_lacing.empty() &&
+      (m_lacing.size() + segments > MaxSegments ||
+       m_body.size() + length > PageTargetBytes ||
+       m_granule - m_pageStartGranule >= PageMaxGranules)) {
+    HRESULT hr = WritePage(0, m_granule);
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  m_lacing.insert(m_lacing.end(), segments - 1, 255);
+  m_lacing.push_back((uint8_t)(length % 255));
+  m_body.insert(m_body.end(), data, data + length);
+  m_granule += (uint64_t)sampleCount * m_granuleScale;
+  return S_OK;
+}
+
+HRESULT OggOpusWriter::Close() {
+  if (!m_file) {
+    return m_hr;
+  }
+
+  // The last page carries the end-of-stream flag even if it has no packets.
+  // End trimming can only take samples off packets on that page, so the
+  // granule position never goes back past where the previous page ended.
+  if (SUCCEEDED(m_hr)) {
+    uint64_t granule = m_granule;
+    if (m_hasPlayableSamples) {
+      granule = std::max(m_pageStartGranule,
+                         std::min(granule, m_preSkip + m_playableSamples));
+    }
+    (void)WritePage(OggFlagLastPage, granule);
+  }
+
+  if (fclose(m_file) != 0 && SUCCEEDED(m_hr)) {
+    m_hr = HRESULT_FROM_ERRNO(errno);
+  }
+  m_file = nullptr;
+  return m_hr;
+}
+
+HRESULT OggOpusWriter::WritePage(uint8_t flags, uint64_t granule) {
+  OggPageHeader header;
+  memcpy(header.capturePattern, OggCapturePattern,
+         sizeof(header.capturePattern));
+  header.version = 0;
+  header.flags = flags;
+  header.granulePosition = (int64_t)granule;
+  header.serialNumber = m_serialNumber;
+  header.sequenceNumber = m_pageSequence++;
+  header.checksum = 0;
+  header.segmentCount = (uint8_t)m_lacing.size();
+
+  m_page.clear();
+  AppendBufferByMemcpy(m_page, &header, 1);
+  m_page.insert(m_page.end(), m_lacing.begin(), m_lacing.end());
+  m_page.insert(m_page.end(), m_body.begin(), m_body.end());
+  const uint32_t checksum = OggChecksum(m_page.data(), m_page.size());
+  memcpy(m_page.data() + offsetof(OggPageHeader, checksum), &checksum,
+         sizeof(checksum));
+
+  m_hr = WriteToFile(m_page.data(), m_page.size(), m_file);
+  m_lacing.clear();
+  m_body.clear();
+  m_pageStartGranule = granule;
+  return m_hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Reader.
+
+HRESULT OggOpusReader::Open(const char *fileName) {
+  HRESULT hr = S_OK;
+  OpusHeadPacket head;
+  size_t headLength = 0;
+  const uint8_t *packet;
+  int32_t packetLength;
+  Page lastPage;
+  uint64_t searchOffset;
+  int64_t lastGranule = -1;
+
+  Close();
+  m_file = fopen(fileName, "rb");
+  if (!m_file) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  setvbuf(m_file, nullptr, _IOFBF, 64 * 1024);
+  IFC(SeekFileToEnd(m_file, &m_fileSize));
+  m_filePosition = m_fileSize;
+
+  // The identification header is alone on the first page. With a mapping
+  // table for many channels it can run past one lacing segment.
+  IFC(ReadPageAt(0, m_fileSize, &m_page));
+  if (hr == S_FALSE || !(m_page.flags & OggFlagFirstPage) ||
+      m_page.segmentCount == 0 ||
+      m_page.Lacing()[m_page.segmentCount - 1] == 255) {
+    IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+  }
+  for (int segment = 0; segment < m_page.segmentCount; ++segment) {
+    headLength += m_page.Lacing()[segment];
+  }
+  if (headLength < sizeof(head) ||
+      memcmp(m_page.Body(), OpusHeadMagic, sizeof(OpusHeadMagic)) != 0) {
+    IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+  }
+  memcpy(&head, m_page.Body(), sizeof(head));
+  if ((head.version >> 4) != 0 || head.channels == 0) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  IFC(ReadChannelMappingTable(head.mappingFamily, head.channels,
+                              m_page.Body() + sizeof(head),
+                              headLength - sizeof(head), &m_mapping));
+  m_serialNumber = m_page.serialNumber;
+  m_channels = head.channels;
+  m_preSkip = head.preSkip;
+  m_inputSampleRate = (int)head.inputSampleRate;
+  m_outputGain = head.outputGain;
+  m_nextPageOffset = m_page.nextOffset;
+  StartPage(false);
+  m_segment = m_page.segmentCount;
+
+  // The comment header follows and ends its last page; audio starts on the
+  // next page.
+  IFC(ReadPacket(&packet, &packetLength));
+  if (hr == S_FALSE || packetLength < (int32_t)sizeof(OpusTagsMagic) ||
+      memcmp(packet, OpusTagsMagic, sizeof(OpusTagsMagic)) != 0) {
+    IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+  }
+  m_audioStart = m_nextPageOffset;
+
+  // The last page's granule position gives the length, so players can show a
+  // duration without reading the whole file.
+  searchOffset = m_fileSize > LastPageSearchBytes + m_audioStart
+                     ? m_fileSize - LastPageSearchBytes
+                     : m_audioStart;
+  for (;;) {
+    IFC(FindPage(searchOffset, m_fileSize, &lastPage));
+    if (hr == S_FALSE) {
+      hr = S_OK;
+      break;
+    }
+    if (lastPage.granule >= 0) {
+      lastGranule = lastPage.granule;
+    }
+    searchOffset = lastPage.nextOffset;
+  }
+  m_totalSamples = lastGranule > m_preSkip ? lastGranule - m_preSkip : 0;
+
+Cleanup:
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+void OggOpusReader::Close() {
+  if (m_file) {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+  m_fileSize = 0;
+  m_filePosition = 0;
+  m_serialNumber = 0;
+  m_channels = 0;
+  m_mapping = OpusChannelMapping();
+  m_preSkip = 0;
+  m_inputSampleRate = 0;
+  m_outputGain = 0;
+  m_totalSamples = 0;
+  m_audioStart = 0;
+  m_page = Page{};
+  m_segment = 0;
+  m_bodyOffset = 0;
+  m_partial.clear();
+  m_hasPartial = false;
+  m_returnedPartial = false;
+  m_nextPageOffset = 0;
+}
+
+HRESULT OggOpusReader::ReadPacket(const uint8_t **data, int32_t *length) {
+  *data = nullptr;
+  *length = 0;
+  if (!m_file) {
+    return E_UNEXPECTED;
+  }
+  if (m_returnedPartial) {
+    m_partial.clear();
+    m_hasPartial = false;
+    m_returnedPartial = false;
+  }
+
+  for (;;) {
+    if (m_segment == m_page.segmentCount) {
+      if (m_page.flags & OggFlagLastPage) {
+        return S_FALSE;
+      }
+      HRESULT hr = NextPage();
+      if (hr != S_OK) {
+        return hr;
+      }
+      continue;
+    }
+
+    // Lacing values of 255 mean the packet goes on into the next segment.
+    const size_t start = m_bodyOffset;
+    bool isComplete = false;
+    while (m_segment < m_page.segmentCount) {
+      const uint8_t lacing = m_page.Lacing()[m_segment++];
+      m_bodyOffset += lacing;
+      if (lacing < 255) {
+        isComplete = true;
+        break;
+      }
+    }
+
+    const uint8_t *body = m_page.Body() + start;
+    const size_t size = m_bodyOffset - start;
+    if (isComplete && !m_hasPartial) {
+      *data = body;
+      *length = (int32_t)size;
+      return S_OK;
+    }
+    m_partial.insert(m_partial.end(), body, body + size);
+    m_hasPartial = true;
+    if (isComplete) {
+      *data = m_partial.data();
+      *length = (int32_t)m_partial.size();
+      m_returnedPartial = true;
+      return S_OK;
+    }
+  }
+}
+
+HRESULT OggOpusReader::SeekToGranule(uint64_t granule,
+                                     uint64_t *packetGranule) {
+  HRESULT hr = S_OK;
+  Page page;
+  uint64_t low = m_audioStart;
+  uint64_t high = m_fileSize;
+  uint64_t found = m_audioStart;
+  int64_t fullPacketSamples = 0;
+
+  *packetGranule = 0;
+  if (!m_file) {
+    return E_UNEXPECTED;
+  }
+
+  // Bisect for the last page whose granule position is at or before the
+  // target, then finish with a short forward scan.
+  while (high - low > BisectionScanBytes) {
+    const uint64_t mid = low + (high - low) / 2;
+    IFC(FindPage(mid, high, &page));
+    while (hr == S_OK && page.granule < 0) {
+      IFC(FindPage(page.nextOffset, high, &page));
+    }
+    if (hr == S_FALSE) {
+      high = mid;
+    } else if ((uint64_t)page.granule <= granule) {
+      found = page.offset;
+      low = page.nextOffset;
+    } else {
+      high = mid;
+    }
+  }
+  for (uint64_t offset = low;;) {
+    IFC(FindPage(offset, high, &page));
+    if (hr == S_FALSE || (page.granule >= 0 &&
+                          (uint64_t)page.granule > granule)) {
+      break;
+    }
+    if (page.granule >= 0) {
+      found = page.offset;
+    }
+    offset = page.nextOffset;
+  }
+
+  // Start at the first packet that begins on the found page. Its granule
+  // position is where the last packet completed on the page ends.
+  IFC(ReadPageAt(found, m_fileSize, &m_page));
+  if (hr == S_FALSE) {
+    IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+  }
+  m_nextPageOffset = m_page.nextOffset;
+  m_partial.clear();
+  m_hasPartial = false;
+  m_returnedPartial = false;
+  StartPage(true);
+
+  {
+    int segment = m_segment;
+    size_t bodyOffset = m_bodyOffset;
+    size_t packetStart = bodyOffset;
+    while (segment < m_page.segmentCount) {
+      const uint8_t lacing = m_page.Lacing()[segment++];
+      bodyOffset += lacing;
+      if (lacing < 255) {
+        int samples = opus_packet_get_nb_samples(
+            m_page.Body() + packetStart, (opus_int32)(bodyOffset - packetStart),
+            OggOpusGranuleRate);
+        IFC_OPUS(samples);
+        fullPacketSamples += samples;
+        packetStart = bodyOffset;
+      }
+    }
+  }
+  if (m_page.granule >= fullPacketSamples) {
+    *packetGranule = (uint64_t)(m_page.granule - fullPacketSamples);
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Reads and verifies the page at offset. Returns S_FALSE if there is no
+//! valid page of this stream there, or it would run past limit.
+HRESULT OggOpusReader::ReadPageAt(uint64_t offset, uint64_t limit,
+                                  Page *page) {
+  OggPageHeader header;
+  if (offset + sizeof(header) > limit) {
+    return S_FALSE;
+  }
+  if (m_filePosition != offset) {
+    HRESULT hr = SeekFile(m_file, offset);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    m_filePosition = offset;
+  }
+
+  page->data.resize(sizeof(header) + MaxSegments);
+  size_t read = fread(page->data.data(), 1, sizeof(header), m_file);
+  m_filePosition += read;
+  if (read != sizeof(header)) {
+    return ferror(m_file) ? HRESULT_FROM_ERRNO(errno) : S_FALSE;
+  }
+  memcpy(&header, page->data.data(), sizeof(header));
+  if (memcmp(header.capturePattern, OggCapturePattern,
+             sizeof(header.capturePattern)) != 0 ||
+      header.version != 0 ||
+      offset + sizeof(header) + header.segmentCount > limit) {
+    return S_FALSE;
+  }
+
+  read = fread(page->data.data() + sizeof(header), 1, header.segmentCount,
+               m_file);
+  m_filePosition += read;
+  if (read != header.segmentCount) {
+    return ferror(m_file) ? HRESULT_FROM_ERRNO(errno) : S_FALSE;
+  }
+  size_t bodySize = 0;
+  for (int i = 0; i < header.segmentCount; ++i) {
+    bodySize += page->data[sizeof(header) + i];
+  }
+  const size_t pageSize = sizeof(header) + header.segmentCount + bodySize;
+  if (offset + pageSize > limit) {
+    return S_FALSE;
+  }
+
+  page->data.resize(pageSize);
+  read = fread(page->data.data() + sizeof(header) + header.segmentCount, 1,
+               bodySize, m_file);
+  m_filePosition += read;
+  if (read != bodySize) {
+    return ferror(m_file) ? HRESULT_FROM_ERRNO(errno) : S_FALSE;
+  }
+
+  memset(page->data.data() + offsetof(OggPageHeader, checksum), 0,
+         sizeof(header.checksum));
+  const bool isValid =
+      OggChecksum(page->data.data(), pageSize) == header.checksum;
+  memcpy(page->data.data() + offsetof(OggPageHeader, checksum),
+         &header.checksum, sizeof(header.checksum));
+  // Pages of other logical streams are skipped; the stream is known once
+  // the identification header has been parsed.
+  if (!isValid ||
+      (m_channels != 0 && header.serialNumber != m_serialNumber)) {
+    return S_FALSE;
+  }
+
+  page->offset = offset;
+  page->nextOffset = offset + pageSize;
+  page->flags = header.flags;
+  page->granule = header.granulePosition;
+  page->serialNumber = header.serialNumber;
+  page->segmentCount = header.segmentCount;
+  return S_OK;
+}
+
+//! Finds the first valid page starting in [offset, limit) by scanning for
+//! the capture pattern, the way a reader that landed mid-page resyncs.
+HRESULT OggOpusReader::FindPage(uint64_t offset, uint64_t limit, Page *page) {
+  uint8_t window[4096];
+  while (offset < limit) {
+    HRESULT hr = SeekFile(m_file, offset);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    const size_t toRead =
+        (size_t)std::min<uint64_t>(sizeof(window), limit - offset);
+    const size_t read = fread(window, 1, toRead, m_file);
+    m_filePosition = offset + read;
+    if (read < sizeof(OggCapturePattern)) {
+      return ferror(m_file) ? HRESULT_FROM_ERRNO(errno) : S_FALSE;
+    }
+
+    const size_t last = read - sizeof(OggCapturePattern);
+    for (size_t i = 0; i <= last; ++i) {
+      if (window[i] != 'O' ||
+          memcmp(window + i, OggCapturePattern, sizeof(OggCapturePattern))) {
+        continue;
+      }
+      hr = ReadPageAt(offset + i, limit, page);
+      if (hr != S_FALSE) {
+        return hr;
+      }
+    }
+    // A capture pattern may straddle the window edge.
+    offset += last + 1;
+  }
+  return S_FALSE;
+}
+
+//! Loads the page after the current one.
+HRESULT OggOpusReader::NextPage() {
+  HRESULT hr = ReadPageAt(m_nextPageOffset, m_fileSize, &m_page);
+  if (hr == S_FALSE) {
+    // Missing or damaged page: resync on the next good one, and don't glue
+    // a packet together across the gap.
+    hr = FindPage(m_nextPageOffset, m_fileSize, &m_page);
+    m_partial.clear();
+    m_hasPartial = false;
+  }
+  if (hr != S_OK) {
+    m_page.segmentCount = 0;
+    m_page.flags = OggFlagLastPage;
+    return hr;
+  }
+  m_nextPageOffset = m_page.nextOffset;
+  StartPage(!m_hasPartial);
+  return S_OK;
+}
+
+//! Resets the segment cursor for a freshly loaded page. A continued packet
+//! whose start was never seen is skipped when dropContinued is set; one that
+//! was seen is dropped if this page does not continue it.
+void OggOpusReader::StartPage(bool dropContinued) {
+  m_segment = 0;
+  m_bodyOffset = 0;
+  if (!(m_page.flags & OggFlagContinued)) {
+    m_partial.clear();
+    m_hasPartial = false;
+    return;
+  }
+  if (!dropContinued) {
+    return;
+  }
+  while (m_segment < m_page.segmentCount) {
+    const uint8_t lacing = m_page.Lacing()[m_segment++];
+    m_bodyOffset += lacing;
+    if (lacing < 255) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "Common.h"
+#include "OpusContainer.h"
+
+#include <vector>
+
+// Ogg Opus files (RFC 7845), the layout opusenc, browsers and media players
+// expect. Packets are grouped into Ogg pages; each page records the granule
+// position (a 48 kHz sample count, including the pre-skip) at the end of the
+// last packet completed on it. A reader holding only a byte range can find
+// its place by locating the next 'OggS' capture pattern and checking the
+// page's granule position, which is what bisection seeking relies on.
+//
+// Channel mapping families 0 (mono or stereo), 1 (Vorbis surround layouts)
+// and 255 (independent channels) are handled; see OpusChannelMapping.h.
+
+//! Granule positions always count samples at 48 kHz.
+static const int OggOpusGranuleRate = 48000;
+
+//! Writes an Ogg Opus file with one logical stream. Packets are collected
+//! into pages of up to about 4 KB or one second of audio; each page is
+//! written with one call into a 64 KB stdio buffer.
+class OggOpusWriter : public OpusPacketWriter {
+public:
+  OggOpusWriter() = default;
+  OggOpusWriter(const OggOpusWriter &) = delete;
+  OggOpusWriter &operator=(const OggOpusWriter &) = delete;
+  ~OggOpusWriter() { (void)Close(); }
+
+  //! Writes the identification and comment headers. sampleRate is the rate
+  //! packets are encoded at; mapping is the encoder's channel mapping;
+  //! preSkip is the encoder's lookahead in 48 kHz samples; inputSampleRate
+  //! is the original rate, recorded for players that want to resample back
+  //! to it.
+  HRESULT Open(const char *fileName, int sampleRate,
+               const OpusChannelMapping &mapping, int preSkip,
+               int inputSampleRate, uint32_t serialNumber);
+
+  //! Appends one packet that decodes to sampleCount samples per channel at
+  //! the encoding rate.
+  HRESULT WritePacket(const uint8_t *data, int32_t length,
+                      uint32_t sampleCount) override;
+
+  //! Sets how many samples per channel at 48 kHz the stream plays, not
+  //! counting the pre-skip. The last page's granule position then ends the
+  //! stream there, and decoders drop whatever the final packets hold past
+  //! it, such as the silence that pads out the last frame. Without it the
+  //! stream plays every sample of every packet.
+  void SetPlayableSamples(uint64_t samples) {
+    m_playableSamples = samples;
+    m_hasPlayableSamples = true;
+  }
+
+  //! Writes the last page with the end-of-stream flag. Safe to call twice.
+  HRESULT Close();
+
+  uint64_t GetGranulePosition() const { return m_granule; }
+
+private:
+  HRESULT WritePage(uint8_t flags, uint64_t granule);
+
+  FILE *m_file{nullptr};
+  int m_granuleScale{1}; // 48 kHz samples per sample at the encoding rate
+  uint32_t m_serialNumber{0};
+  uint32_t m_pageSequence{0};
+  int m_preSkip{0};
+  uint64_t m_playableSamples{0};
+  bool m_hasPlayableSamples{false};
+  uint64_t m_granule{0};
+  uint64_t m_pageStartGranule{0};
+  std::vector<uint8_t> m_lacing;
+  std::vector<uint8_t> m_body;
+  std::vector<uint8_t> m_page;
+  HRESULT m_hr{S_OK};
+};
+
+//! Reads an Ogg Opus file with one logical stream packet by packet, and
+//! seeks by bisecting over page granule positions.
+class OggOpusReader {
+public:
+  OggOpusReader() = default;
+  OggOpusReader(const OggOpusReader &) = delete;
+  OggOpusReader &operator=(const OggOpusReader &) = delete;
+  ~OggOpusReader() { Close(); }
+
+  //! Parses the headers and reads the final granule position, leaving the
+  //! reader at the first audio packet.
+  HRESULT Open(const char *fileName);
+  void Close();
+
+  int GetChannels() const { return m_channels; }
+  //! The channel mapping from the identification header.
+  const OpusChannelMapping &GetChannelMapping() const { return m_mapping; }
+  //! Samples at 48 kHz to drop from the start of the decoded output.
+  int GetPreSkip() const { return m_preSkip; }
+  int GetInputSampleRate() const { return m_inputSampleRate; }
+  //! Output gain in Q7.8 dB, to be applied by the decoder.
+  int GetOutputGain() const { return m_outputGain; }
+  //! Playable samples per channel at 48 kHz, after the pre-skip and any
+  //! end trimming the last page asks for.
+  uint64_t GetTotalSamples() const { return m_totalSamples; }
+
+  //! Returns a view of the next packet that stays valid until the next call.
+  //! Returns S_FALSE with *length set to zero at the end of the stream.
+  HRESULT ReadPacket(const uint8_t **data, int32_t *length);
+
+  //! Positions the reader at a packet that starts at or before granule,
+  //! found by bisecting over the file. *packetGranule receives the granule
+  //! position the next packet starts at.
+  HRESULT SeekToGranule(uint64_t granule, uint64_t *packetGranule);
+
+private:
+  struct Page {
+    uint64_t offset;
+    uint64_t nextOffset;
+    uint8_t flags;
+    int64_t granule;
+    uint32_t serialNumber;
+    int segmentCount;
+    std::vector<uint8_t> data; // header, lacing values and body
+    const uint8_t *Lacing() const { return data.data() + 27; }
+    const uint8_t *Body() const { return Lacing() + segmentCount; }
+  };
+
+  HRESULT ReadPageAt(uint64_t offset, uint64_t limit, Page *page);
+  HRESULT FindPage(uint64_t offset, uint64_t limit, Page *page);
+  HRESULT NextPage();
+  void StartPage(bool dropContinued);
+
+  FILE *m_file{nullptr};
+  uint64_t m_fileSize{0};
+  uint64_t m_filePosition{0};
+  uint32_t m_serialNumber{0};
+  int m_channels{0};
+  OpusChannelMapping m_mapping;
+  int m_preSkip{0};
+  int m_inputSampleRate{0};
+  int m_outputGain{0};
+  uint64_t m_totalSamples{0};
+  uint64_t m_audioStart{0}; // offset of the first audio page
+  Page m_page{};
+  int m_segment{0};
+  size_t m_bodyOffset{0};
+  std::vector<uint8_t> m_partial; // packet continued across pages
+  bool m_hasPartial{false};
+  bool m_returnedPartial{false};
+  uint64_t m_nextPageOffset{0};
+};
+
+//! Checks for the 'OggS' capture pattern at the start of a file.
+HRESULT IsOggFile(const char *fileName, bool *isOgg);
@@ -0,0 +1,196 @@
+#include "OpusChannelMapping.h"
+
+// WAVE_FORMAT_EXTENSIBLE speaker bits.
+static const uint32_t SpeakerFrontLeft = 0x1;
+static const uint32_t SpeakerFrontRight = 0x2;
+static const uint32_t SpeakerFrontCenter = 0x4;
+static const uint32_t SpeakerLowFrequency = 0x8;
+static const uint32_t SpeakerBackLeft = 0x10;
+static const uint32_t SpeakerBackRight = 0x20;
+static const uint32_t SpeakerBackCenter = 0x100;
+static const uint32_t SpeakerSideLeft = 0x200;
+static const uint32_t SpeakerSideRight = 0x400;
+
+static const uint32_t SpeakerFrontPair = SpeakerFrontLeft | SpeakerFrontRight;
+static const uint32_t SpeakerBackPair = SpeakerBackLeft | SpeakerBackRight;
+static const uint32_t SpeakerSidePair = SpeakerSideLeft | SpeakerSideRight;
+
+//! Layouts family 1 can code from 3 channels up, by channel count. Either
+//! the back or the side pair serves as the surround pair.
+struct SurroundLayout {
+  uint32_t masks[2];
+  uint8_t vorbisOrder[8]; // WAV channel for each Vorbis channel
+};
+
+static const SurroundLayout SurroundLayouts[] = {
+    // 3.0: FL FR FC
+    {{SpeakerFrontPair | SpeakerFrontCenter, 0}, {0, 2, 1}},
+    // quad: FL FR BL BR, already in Vorbis order
+    {{SpeakerFrontPair | SpeakerBackPair, SpeakerFrontPair | SpeakerSidePair},
+     {0, 1, 2, 3}},
+    // 5.0: FL FR FC BL BR
+    {{SpeakerFrontPair | SpeakerFrontCenter | SpeakerBackPair,
+      SpeakerFrontPair | SpeakerFrontCenter | SpeakerSidePair},
+     {0, 2, 1, 3, 4}},
+    // 5.1: FL FR FC LFE BL BR
+    {{SpeakerFrontPair | SpeakerFrontCenter | SpeakerLowFrequency |
+          SpeakerBackPair,
+      SpeakerFrontPair | SpeakerFrontCenter | SpeakerLowFrequency |
+          SpeakerSidePair},
+     {0, 2, 1, 4, 5, 3}},
+    // 6.1: FL FR FC LFE BC SL SR
+    {{SpeakerFrontPair | SpeakerFrontCenter | SpeakerLowFrequency |
+          SpeakerBackCenter | SpeakerSidePair,
+      0},
+     {0, 2, 1, 5, 6, 4, 3}},
+    // 7.1: FL FR FC LFE BL BR SL SR
+    {{SpeakerFrontPair | SpeakerFrontCenter | SpeakerLowFrequency |
+          SpeakerBackPair | SpeakerSidePair,
+      0},
+     {0, 2, 1, 6, 7, 4, 5, 3}},
+};
+
+static const SurroundLayout *GetSurroundLayout(int channels) {
+  return channels >= 3 && channels <= 8 ? &SurroundLayouts[channels - 3]
+                                        : nullptr;
+}
+
+OpusChannelMapping GetMonoStereoMapping(int channels) {
+  OpusChannelMapping mapping;
+  mapping.family = 0;
+  mapping.channels = channels;
+  mapping.streamCount = 1;
+  mapping.coupledStreamCount = channels > 1 ? 1 : 0;
+  for (int i = 0; i < channels; ++i) {
+    mapping.mapping[i] = (uint8_t)i;
+  }
+  return mapping;
+}
+
+bool IsSameChannelMapping(const OpusChannelMapping &a,
+                          const OpusChannelMapping &b) {
+  return a.family == b.family && a.channels == b.channels &&
+         a.streamCount == b.streamCount &&
+         a.coupledStreamCount == b.coupledStreamCount &&
+         memcmp(a.mapping, b.mapping, a.channels) == 0;
+}
+
+bool IsChannelMappingFamilySupported(int family, int channels) {
+  switch (family) {
+  case 0:
+    return channels == 1 || channels == 2;
+  case 1:
+    return channels >= 1 && channels <= 8;
+  case 255:
+    return channels >= 1 && channels <= MaxOpusChannels;
+  default:
+    return false;
+  }
+}
+
+int GetDefaultMappingFamily(const WAVEFORMATEX *wfx) {
+  const int channels = wfx->nChannels;
+  if (channels <= 2) {
+    return 0;
+  }
+  const SurroundLayout *layout = GetSurroundLayout(channels);
+  if (!layout) {
+    return 255;
+  }
+  // Without a mask the channels are taken to be the usual layout for their
+  // count, as players do.
+  if (wfx->wFormatTag != WAVE_FORMAT_EXTENSIBLE ||
+      wfx->cbSize < sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX)) {
+    return 1;
+  }
+  const uint32_t channelMask =
+      ((const WAVEFORMATEXTENSIBLE *)wfx)->dwChannelMask;
+  return channelMask != 0 && (channelMask == layout->masks[0] ||
+                              channelMask == layout->masks[1])
+             ? 1
+             : 255;
+}
+
+const uint8_t *GetVorbisChannelOrder(int family, int channels) {
+  const SurroundLayout *layout = GetSurroundLayout(channels);
+  // Quad is the one layout both orders agree on.
+  if (family != 1 || !layout || channels == 4) {
+    return nullptr;
+  }
+  return layout->vorbisOrder;
+}
+
+void ReorderChannels(const void *in, void *out, size_t frames, int channels,
+                     size_t sampleSize, const uint8_t *order) {
+  const uint8_t *src = (const uint8_t *)in;
+  uint8_t *dst = (uint8_t *)out;
+  const size_t frameBytes = channels * sampleSize;
+  for (size_t frame = 0; frame < frames; ++frame) {
+    for (int c = 0; c < channels; ++c) {
+      memcpy(dst + c * sampleSize, src + order[c] * sampleSize, sampleSize);
+    }
+    src += frameBytes;
+    dst += frameBytes;
+  }
+}
+
+OpusChannelMapping GetWavOrderMapping(const OpusChannelMapping &mapping) {
+  const uint8_t *order = GetVorbisChannelOrder(mapping.family,
+                                               mapping.channels);
+  OpusChannelMapping wavMapping = mapping;
+  if (order) {
+    for (int c = 0; c < mapping.channels; ++c) {
+      wavMapping.mapping[order[c]] = mapping.mapping[c];
+    }
+  }
+  return wavMapping;
+}
+
+size_t GetChannelMappingTableSize(const OpusChannelMapping &mapping) {
+  return mapping.family == 0 ? 0 : 2 + (size_t)mapping.channels;
+}
+
+void WriteChannelMappingTable(const OpusChannelMapping &mapping,
+                              uint8_t *table) {
+  if (mapping.family == 0) {
+    return;
+  }
+  table[0] = (uint8_t)mapping.streamCount;
+  table[1] = (uint8_t)mapping.coupledStreamCount;
+  memcpy(table + 2, mapping.mapping, mapping.channels);
+}
+
+HRESULT ReadChannelMappingTable(int family, int channels,
+                                const uint8_t *table, size_t size,
+                                OpusChannelMapping *mapping) {
+  if (!IsChannelMappingFamilySupported(family, channels)) {
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+  }
+  if (family == 0) {
+    *mapping = GetMonoStereoMapping(channels);
+    return S_OK;
+  }
+
+  if (size < 2 + (size_t)channels) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  const int streamCount = table[0];
+  const int coupledStreamCount = table[1];
+  const int decodedChannels = streamCount + coupledStreamCount;
+  if (streamCount == 0 || coupledStreamCount > streamCount ||
+      decodedChannels > MaxOpusChannels) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+  for (int c = 0; c < channels; ++c) {
+    if (table[2 + c] != 255 && table[2 + c] >= decodedChannels) {
+      return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+  }
+
+  mapping->family = family;
+  mapping->channels = channels;
+  mapping->streamCount = streamCount;
+  mapping->coupledStreamCount = coupledStreamCount;
+  memcpy(mapping->mapping, table + 2, channels);
+  return S_OK;
+}
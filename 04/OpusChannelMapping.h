@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Common.h"
+
+// Opus channel mappings (RFC 7845 section 5.1.1), which say how a stream's
+// channels are split across the Opus streams of a multistream packet.
+//
+// Family 0 is a single stream: mono, or stereo as one coupled pair.
+// Family 1 covers the Vorbis speaker layouts from 1 to 8 channels (up to
+// 7.1). The surround encoder couples the front and rear pairs, gives the
+// centre and LFE streams of their own, and shares a masking analysis across
+// all of them, so 5.1 costs far less than six independent channels.
+// Family 255 is one uncoupled stream per channel with no assumed speaker
+// positions, for microphone arrays and other sets of independent signals.
+//
+// WAV files and capture devices order speakers by their WAVE_FORMAT channel
+// mask (FL FR FC LFE BL BR SL SR), while family 1 expects Vorbis order
+// (FL FC FR SL SR BL BR LFE). Encoders permute input frames into Vorbis
+// order; decoders avoid the copy by permuting the mapping table instead, so
+// they write WAV order directly.
+
+static const int MaxOpusChannels = 255;
+
+//! A channel mapping as carried in stream headers.
+struct OpusChannelMapping {
+  int family = 0;
+  int channels = 1;
+  int streamCount = 1;
+  int coupledStreamCount = 0;
+  //! Decoded stream channel each output channel comes from: coupled streams
+  //! first, two channels each, then the uncoupled ones. 255 means silence.
+  uint8_t mapping[MaxOpusChannels] = {};
+};
+
+//! The family 0 mapping for one or two channels.
+OpusChannelMapping GetMonoStereoMapping(int channels);
+
+//! Whether two mappings describe the same streams and channel order.
+bool IsSameChannelMapping(const OpusChannelMapping &a,
+                          const OpusChannelMapping &b);
+
+//! Whether the encoder can code channels channels with family.
+bool IsChannelMappingFamilySupported(int family, int channels);
+
+//! Picks a family for a WAV or capture format: 0 for mono and stereo, 1 for
+//! up to 8 channels unless a channel mask says they are not a standard
+//! speaker layout, and 255 otherwise.
+int GetDefaultMappingFamily(const WAVEFORMATEX *wfx);
+
+//! Returns the WAV channel each Vorbis-ordered channel is taken from when
+//! encoding with family, or null when the orders already agree.
+const uint8_t *GetVorbisChannelOrder(int family, int channels);
+
+//! Gathers frames of interleaved samples so that out channel i holds in
+//! channel order[i].
+void ReorderChannels(const void *in, void *out, size_t frames, int channels,
+                     size_t sampleSize, const uint8_t *order);
+
+//! Rewrites the mapping a stream header carries into one that makes a
+//! multistream decoder write WAV channel order.
+OpusChannelMapping GetWavOrderMapping(const OpusChannelMapping &mapping);
+
+//! Size of the header form of a mapping: the stream count, the coupled
+//! stream count and one mapping entry per channel. Family 0 has none.
+size_t GetChannelMappingTableSize(const OpusChannelMapping &mapping);
+
+//! Writes the header form of mapping, GetChannelMappingTableSize bytes.
+void WriteChannelMappingTable(const OpusChannelMapping &mapping,
+                              uint8_t *table);
+
+//! Parses and validates the header form of a mapping for family and
+//! channels from size bytes of table. Family 0 needs no table.
+HRESULT ReadChannelMappingTable(int family, int channels,
+                                const uint8_t *table, size_t size,
+                                OpusChannelMapping *mapping);
@@ -0,0 +1,451 @@
+#include "OpusContainer.h"
+
+#include <algorithm>
+#include <new>
+
+static const char ContainerHeaderTag[4] = {'O', 'P', 'F', 'C'};
+static const char ContainerTrailerTag[4] = {'O', 'P', 'F', 'X'};
+static const uint32_t ContainerVersion = 2;
+static const uint32_t MultistreamContainerVersion = 3;
+
+// Largest record accepted by the reader; well above any Opus packet.
+static const int32_t MaxPacketBytes = 1024 * 1024;
+
+#pragma pack(push, 1)
+struct ContainerHeader {
+  char tag[4];
+  uint32_t version;
+  uint32_t sampleRate;
+  uint16_t channels;
+  uint8_t mappingFamily;
+  uint8_t reserved;
+};
+
+struct ContainerTrailer {
+  uint64_t indexOffset;
+  uint64_t packetCount;
+  uint64_t totalSamples;
+  char tag[4];
+};
+#pragma pack(pop)
+
+static_assert(sizeof(ContainerHeader) == 16, "structure size mismatch");
+static_assert(sizeof(ContainerTrailer) == 28, "structure size mismatch");
+static_assert(sizeof(OpusContainerIndexEntry) == 16,
+              "structure size mismatch");
+
+////////////////////////////////////////////////////////////////////////////
+// Writer.
+
+HRESULT OpusContainerWriter::Open(const char *fileName, int sampleRate,
+                                  const OpusChannelMapping &mapping,
+                                  size_t bufferBytes) {
+  HRESULT hr = S_OK;
+  ContainerHeader header = {};
+  uint8_t mappingTable[2 + MaxOpusChannels];
+
+  (void)Close();
+  if (sampleRate <= 0 ||
+      !IsChannelMappingFamilySupported(mapping.family, mapping.channels) ||
+      bufferBytes == 0) {
+    IFC(E_INVALIDARG);
+  }
+
+  m_buffer.reset(new (std::nothrow) uint8_t[bufferBytes]);
+  if (!m_buffer) {
+    IFC(E_OUTOFMEMORY);
+  }
+  m_bufferBytes = bufferBytes;
+  m_bufferUsed = 0;
+  m_fileOffset = 0;
+  m_totalSamples = 0;
+  m_index.clear();
+  m_hr = S_OK;
+
+  m_file = fopen(fileName, "wb");
+  if (!m_file) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  // Whole blocks go straight to the file; no need for stdio's buffer too.
+  setvbuf(m_file, nullptr, _IONBF, 0);
+
+  memcpy(header.tag, ContainerHeaderTag, sizeof(header.tag));
+  header.version =
+      mapping.family == 0 ? ContainerVersion : MultistreamContainerVersion;
+  header.sampleRate = (uint32_t)sampleRate;
+  header.channels = (uint16_t)mapping.channels;
+  header.mappingFamily = (uint8_t)mapping.family;
+  IFC(Append(&header, sizeof(header)));
+  WriteChannelMappingTable(mapping, mappingTable);
+  IFC(Append(mappingTable, GetChannelMappingTableSize(mapping)));
+
+Cleanup:
+  return hr;
+}
+
+HRESULT OpusContainerWriter::WritePacket(const uint8_t *data, int32_t length,
+                                         uint32_t sampleCount) {
+  if (!m_file) {
+    return E_UNEXPECTED;
+  }
+  if (length < 0 || (length > 0 && !data)) {
+    return E_INVALIDARG;
+  }
+  if (FAILED(m_hr)) {
+    return m_hr;
+  }
+
+  m_index.push_back({m_fileOffset + m_bufferUsed, m_totalSamples});
+  m_totalSamples += sampleCount;
+  HRESULT hr = Append(&length, sizeof(length));
+  if (SUCCEEDED(hr)) {
+    hr = Append(data, length);
+  }
+  return hr;
+}
+
+HRESULT OpusContainerWriter::Close() {
+  if (!m_file) {
+    return m_hr;
+  }
+
+  if (SUCCEEDED(m_hr)) {
+    ContainerTrailer trailer;
+    trailer.indexOffset = m_fileOffset + m_bufferUsed;
+    trailer.packetCount = m_index.size();
+    trailer.totalSamples = m_totalSamples;
+    memcpy(trailer.tag, ContainerTrailerTag, sizeof(trailer.tag));
+    if (SUCCEEDED(Append(m_index.data(),
+                         m_index.size() * sizeof(OpusContainerIndexEntry))) &&
+        SUCCEEDED(Append(&trailer, sizeof(trailer)))) {
+      (void)Flush();
+    }
+  }
+
+  if (fclose(m_file) != 0 && SUCCEEDED(m_hr)) {
+    m_hr = HRESULT_FROM_ERRNO(errno);
+  }
+  m_file = nullptr;
+  m_buffer.reset();
+  return m_hr;
+}
+
+HRESULT OpusContainerWriter::Append(const void *data, size_t size) {
+  if (size == 0) {
+    return S_OK;
+  }
+  if (m_bufferUsed + size > m_bufferBytes) {
+    HRESULT hr = Flush();
+    if (FAILED(hr)) {
+      return hr;
+    }
+  }
+
+  // Larger than a whole block: skip the staging copy.
+  if (size > m_bufferBytes) {
+    m_hr = WriteToFile(data, size, m_file);
+    if (SUCCEEDED(m_hr)) {
+      m_fileOffset += size;
+    }
+    return m_hr;
+  }
+
+  memcpy(m_buffer.get() + m_bufferUsed, data, size);
+  m_bufferUsed += size;
+  return S_OK;
+}
+
+HRESULT OpusContainerWriter::Flush() {
+  if (m_bufferUsed == 0) {
+    return m_hr;
+  }
+  m_hr = WriteToFile(m_buffer.get(), m_bufferUsed, m_file);
+  if (SUCCEEDED(m_hr)) {
+    m_fileOffset += m_bufferUsed;
+    m_bufferUsed = 0;
+  }
+  return m_hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Reader.
+
+HRESULT OpusContainerReader::Open(const char *fileName, size_t bufferBytes) {
+  HRESULT hr = S_OK;
+  ContainerHeader header;
+  uint64_t fileSize;
+  uint64_t packetsStart;
+
+  Close();
+  if (bufferBytes < sizeof(int32_t)) {
+    IFC(E_INVALIDARG);
+  }
+
+  m_file = fopen(fileName, "rb");
+  if (!m_file) {
+    IFC(HRESULT_FROM_ERRNO(errno));
+  }
+  setvbuf(m_file, nullptr, _IONBF, 0);
+  IFC(SeekFileToEnd(m_file, &fileSize));
+  IFC(SeekFile(m_file, 0));
+
+  IFC(ReadFromFile(header.tag, sizeof(header.tag), m_file));
+  if (memcmp(header.tag, ContainerHeaderTag, sizeof(header.tag)) == 0) {
+    ContainerTrailer trailer;
+    uint8_t mappingTable[2 + MaxOpusChannels];
+    size_t mappingTableSize = 0;
+    IFC(ReadFromFile(&header.version, sizeof(header) - sizeof(header.tag),
+                     m_file));
+    if (header.version != ContainerVersion &&
+        header.version != MultistreamContainerVersion) {
+      IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+    }
+    if ((header.version == ContainerVersion) != (header.mappingFamily == 0)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+    if (header.mappingFamily != 0) {
+      mappingTableSize = 2 + (size_t)header.channels;
+      if (header.channels > MaxOpusChannels ||
+          fileSize < sizeof(header) + mappingTableSize) {
+        IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+      }
+      IFC(ReadFromFile(mappingTable, mappingTableSize, m_file));
+    }
+    IFC(ReadChannelMappingTable(header.mappingFamily, header.channels,
+                                mappingTable, mappingTableSize, &m_mapping));
+    packetsStart = sizeof(header) + mappingTableSize;
+    if (fileSize < packetsStart + sizeof(trailer)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+
+    IFC(SeekFile(m_file, fileSize - sizeof(trailer)));
+    IFC(ReadValueFromFile(trailer, m_file));
+    const uint64_t indexEnd = fileSize - sizeof(trailer);
+    if (memcmp(trailer.tag, ContainerTrailerTag, sizeof(trailer.tag)) != 0 ||
+        trailer.indexOffset < packetsStart ||
+        trailer.indexOffset > indexEnd ||
+        trailer.packetCount != (indexEnd - trailer.indexOffset) /
+                                   sizeof(OpusContainerIndexEntry) ||
+        (indexEnd - trailer.indexOffset) % sizeof(OpusContainerIndexEntry)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+
+    m_version = (int)header.version;
+    m_sampleRate = (int)header.sampleRate;
+    m_channels = header.channels;
+    m_packetCount = trailer.packetCount;
+    m_totalSamples = trailer.totalSamples;
+    m_indexOffset = trailer.indexOffset;
+    m_packetsEnd = trailer.indexOffset;
+  } else {
+    // Version 1: the first four bytes are the sample rate.
+    int32_t sampleRate;
+    memcpy(&sampleRate, header.tag, sizeof(sampleRate));
+    m_version = 1;
+    m_sampleRate = sampleRate;
+    m_mapping = GetMonoStereoMapping(1);
+    m_packetsEnd = fileSize;
+    packetsStart = sizeof(sampleRate);
+  }
+
+  m_buffer.reset(new (std::nothrow) uint8_t[bufferBytes]);
+  if (!m_buffer) {
+    IFC(E_OUTOFMEMORY);
+  }
+  m_bufferBytes = bufferBytes;
+  IFC(SeekTo(packetsStart));
+
+Cleanup:
+  if (FAILED(hr)) {
+    Close();
+  }
+  return hr;
+}
+
+void OpusContainerReader::Close() {
+  if (m_file) {
+    fclose(m_file);
+    m_file = nullptr;
+  }
+  m_version = 0;
+  m_sampleRate = 0;
+  m_channels = 0;
+  m_mapping = OpusChannelMapping();
+  m_packetCount = 0;
+  m_totalSamples = 0;
+  m_packetsEnd = 0;
+  m_indexOffset = 0;
+  m_buffer.reset();
+  m_bufferBytes = 0;
+  m_bufferStart = 0;
+  m_bufferEnd = 0;
+  m_fileOffset = 0;
+}
+
+HRESULT OpusContainerReader::ReadPacket(const uint8_t **data,
+                                        int32_t *length) {
+  *data = nullptr;
+  *length = 0;
+  if (!m_file) {
+    return E_UNEXPECTED;
+  }
+
+  HRESULT hr = Fill(sizeof(int32_t));
+  if (hr == S_FALSE) {
+    return S_FALSE;
+  }
+  if (FAILED(hr)) {
+    return hr;
+  }
+
+  int32_t packetLength;
+  memcpy(&packetLength, m_buffer.get() + m_bufferStart, sizeof(packetLength));
+  if (packetLength < 0 || packetLength > MaxPacketBytes) {
+    return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+  }
+
+  hr = Fill(sizeof(int32_t) + packetLength);
+  if (hr != S_OK) {
+    return FAILED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  }
+
+  *data = m_buffer.get() + m_bufferStart + sizeof(int32_t);
+  *length = packetLength;
+  m_bufferStart += sizeof(int32_t) + packetLength;
+  return S_OK;
+}
+
+HRESULT OpusContainerReader::GetIndexEntry(uint64_t packetIndex,
+                                           OpusContainerIndexEntry *entry) {
+  if (!IsSeekable()) {
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+  }
+  if (packetIndex >= m_packetCount) {
+    return E_INVALIDARG;
+  }
+  HRESULT hr = SeekFile(m_file, m_indexOffset + packetIndex *
+                                                    sizeof(*entry));
+  if (SUCCEEDED(hr)) {
+    hr = ReadValueFromFile(*entry, m_file);
+  }
+  return hr;
+}
+
+HRESULT OpusContainerReader::SeekToPacket(uint64_t packetIndex) {
+  if (!IsSeekable()) {
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+  }
+  if (packetIndex == m_packetCount) {
+    return SeekTo(m_packetsEnd);
+  }
+
+  OpusContainerIndexEntry entry;
+  HRESULT hr = GetIndexEntry(packetIndex, &entry);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  return SeekTo(entry.fileOffset);
+}
+
+HRESULT OpusContainerReader::SeekToSample(uint64_t sample,
+                                          uint64_t *packetSample) {
+  *packetSample = 0;
+  if (!IsSeekable()) {
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+  }
+  if (sample >= m_totalSamples) {
+    return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  }
+
+  // Find the last packet starting at or before sample.
+  OpusContainerIndexEntry found;
+  HRESULT hr = GetIndexEntry(0, &found);
+  if (FAILED(hr)) {
+    return hr;
+  }
+  uint64_t low = 0;
+  uint64_t high = m_packetCount;
+  while (high - low > 1) {
+    const uint64_t mid = low + (high - low) / 2;
+    OpusContainerIndexEntry entry;
+    hr = GetIndexEntry(mid, &entry);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    if (entry.sampleOffset <= sample) {
+      low = mid;
+      found = entry;
+    } else {
+      high = mid;
+    }
+  }
+
+  *packetSample = found.sampleOffset;
+  return SeekTo(found.fileOffset);
+}
+
+HRESULT OpusContainerReader::SeekTo(uint64_t fileOffset) {
+  if (fileOffset > m_packetsEnd) {
+    return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  }
+
+  // Short jumps within the current block don't touch the file.
+  const uint64_t bufferOffset = m_fileOffset - m_bufferEnd;
+  if (fileOffset >= bufferOffset && fileOffset <= m_fileOffset) {
+    m_bufferStart = (size_t)(fileOffset - bufferOffset);
+    return S_OK;
+  }
+
+  m_bufferStart = 0;
+  m_bufferEnd = 0;
+  m_fileOffset = fileOffset;
+  return S_OK;
+}
+
+//! Makes sure needed bytes are buffered. Returns S_FALSE when no bytes are
+//! left before the end of the packets, ERROR_HANDLE_EOF when some but not
+//! enough are.
+HRESULT OpusContainerReader::Fill(size_t needed) {
+  size_t available = m_bufferEnd - m_bufferStart;
+  if (available >= needed) {
+    return S_OK;
+  }
+  if (available == 0 && m_fileOffset >= m_packetsEnd) {
+    return S_FALSE;
+  }
+
+  if (needed > m_bufferBytes) {
+    std::unique_ptr<uint8_t[]> larger(new (std::nothrow) uint8_t[needed]);
+    if (!larger) {
+      return E_OUTOFMEMORY;
+    }
+    memcpy(larger.get(), m_buffer.get() + m_bufferStart, available);
+    m_buffer = std::move(larger);
+    m_bufferBytes = needed;
+  } else {
+    memmove(m_buffer.get(), m_buffer.get() + m_bufferStart, available);
+  }
+  m_bufferStart = 0;
+  m_bufferEnd = available;
+
+  // Index lookups move the file position, so always seek before reading.
+  const size_t toRead = (size_t)std::min<uint64_t>(
+      m_bufferBytes - m_bufferEnd, m_packetsEnd - m_fileOffset);
+  if (toRead > 0) {
+    HRESULT hr = SeekFile(m_file, m_fileOffset);
+    if (FAILED(hr)) {
+      return hr;
+    }
+    size_t read = fread(m_buffer.get() + m_bufferEnd, 1, toRead, m_file);
+    if (read != toRead && ferror(m_file)) {
+      return HRESULT_FROM_ERRNO(errno);
+    }
+    m_bufferEnd += read;
+    m_fileOffset += read;
+  }
+
+  if (m_bufferEnd < needed) {
+    return m_bufferEnd == 0 ? S_FALSE : HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+  }
+  return S_OK;
+}
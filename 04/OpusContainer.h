@@ -0,0 +1,145 @@
+#pragma once
+
+#include "Common.h"
+#include "OpusChannelMapping.h"
+
+#include <memory>
+#include <vector>
+
+// Packet container for compressed files.
+//
+// Version 1 (the original scratch format) is a 32-bit sample rate followed by
+// [int32 length][payload] records; it can only be read front to back.
+//
+// Version 2 keeps the same records and adds a header and an index footer, so
+// a reader can find any packet by number or sample offset with a binary
+// search over the index instead of walking every length prefix:
+//
+//   header:  'OPFC' u32 version u32 sampleRate u16 channels
+//            u8 mappingFamily u8 reserved
+//   mapping: u8 streamCount u8 coupledStreamCount u8 mapping[channels]
+//   packets: [int32 length][payload] ...
+//   index:   one {u64 fileOffset, u64 sampleOffset} entry per packet
+//   trailer: u64 indexOffset u64 packetCount u64 totalSamples 'OPFX'
+//
+// Version 3 is version 2 with multistream packets. Its header names a
+// channel mapping family other than 0 and is followed by the mapping table,
+// laid out as in Ogg Opus (see OpusChannelMapping.h). Mono and stereo files
+// are still written as version 2, which has no mapping table.
+//
+// Sample offsets count samples per channel at the container's sample rate.
+
+struct OpusContainerIndexEntry {
+  uint64_t fileOffset;   //!< offset of the packet's length prefix
+  uint64_t sampleOffset; //!< first sample the packet decodes to
+};
+
+//! Destination for encoded packets, so the compressor can feed either
+//! container format.
+class OpusPacketWriter {
+public:
+  virtual ~OpusPacketWriter() = default;
+
+  //! Appends one packet that decodes to sampleCount samples per channel.
+  virtual HRESULT WritePacket(const uint8_t *data, int32_t length,
+                              uint32_t sampleCount) = 0;
+};
+
+//! Writes a version 2 or 3 container. Packets are staged in a fixed-size
+//! block and written a block at a time; the index is kept in memory until
+//! Close.
+class OpusContainerWriter : public OpusPacketWriter {
+public:
+  static const size_t DefaultBufferBytes = 64 * 1024;
+
+  OpusContainerWriter() = default;
+  OpusContainerWriter(const OpusContainerWriter &) = delete;
+  OpusContainerWriter &operator=(const OpusContainerWriter &) = delete;
+  ~OpusContainerWriter() { (void)Close(); }
+
+  //! mapping describes the packets: family 0 for plain mono or stereo
+  //! packets, anything else for multistream ones.
+  HRESULT Open(const char *fileName, int sampleRate,
+               const OpusChannelMapping &mapping,
+               size_t bufferBytes = DefaultBufferBytes);
+
+  HRESULT WritePacket(const uint8_t *data, int32_t length,
+                      uint32_t sampleCount) override;
+
+  //! Flushes the last block and writes the index. Safe to call twice.
+  HRESULT Close();
+
+  uint64_t GetPacketCount() const { return m_index.size(); }
+
+private:
+  HRESULT Append(const void *data, size_t size);
+  HRESULT Flush();
+
+  FILE *m_file{nullptr};
+  std::unique_ptr<uint8_t[]> m_buffer;
+  size_t m_bufferBytes{0};
+  size_t m_bufferUsed{0};
+  uint64_t m_fileOffset{0}; // file offset of m_buffer[0]
+  uint64_t m_totalSamples{0};
+  std::vector<OpusContainerIndexEntry> m_index;
+  HRESULT m_hr{S_OK};
+};
+
+//! Reads version 1, 2 and 3 containers. Packets are read through a block
+//! buffer; seeking needs the version 2 index.
+class OpusContainerReader {
+public:
+  static const size_t DefaultBufferBytes = 64 * 1024;
+
+  OpusContainerReader() = default;
+  OpusContainerReader(const OpusContainerReader &) = delete;
+  OpusContainerReader &operator=(const OpusContainerReader &) = delete;
+  ~OpusContainerReader() { Close(); }
+
+  HRESULT Open(const char *fileName, size_t bufferBytes = DefaultBufferBytes);
+  void Close();
+
+  int GetVersion() const { return m_version; }
+  int GetSampleRate() const { return m_sampleRate; }
+  //! Channel count, or zero for version 1 files, which do not record it.
+  int GetChannels() const { return m_channels; }
+  //! How the packets' streams map to channels. Version 1 and 2 files are
+  //! family 0, and version 1 files are taken to be mono.
+  const OpusChannelMapping &GetChannelMapping() const { return m_mapping; }
+  bool IsSeekable() const { return m_version >= 2; }
+  uint64_t GetPacketCount() const { return m_packetCount; }
+  uint64_t GetTotalSamples() const { return m_totalSamples; }
+
+  //! Returns a view of the next packet that stays valid until the next call.
+  //! Returns S_FALSE with *length set to zero at the end of the packets.
+  HRESULT ReadPacket(const uint8_t **data, int32_t *length);
+
+  //! Positions the reader at the given packet.
+  HRESULT SeekToPacket(uint64_t packetIndex);
+
+  //! Positions the reader at the packet containing sample, found with a binary
+  //! search over the index (O(log n) reads). *packetSample receives the
+  //! packet's first sample.
+  HRESULT SeekToSample(uint64_t sample, uint64_t *packetSample);
+
+  HRESULT GetIndexEntry(uint64_t packetIndex, OpusContainerIndexEntry *entry);
+
+private:
+  HRESULT SeekTo(uint64_t fileOffset);
+  HRESULT Fill(size_t needed);
+
+  FILE *m_file{nullptr};
+  int m_version{0};
+  int m_sampleRate{0};
+  int m_channels{0};
+  OpusChannelMapping m_mapping;
+  uint64_t m_packetCount{0};
+  uint64_t m_totalSamples{0};
+  uint64_t m_packetsEnd{0}; // end of the packet records
+  uint64_t m_indexOffset{0};
+  std::unique_ptr<uint8_t[]> m_buffer;
+  size_t m_bufferBytes{0};
+  size_t m_bufferStart{0};
+  size_t m_bufferEnd{0};
+  uint64_t m_fileOffset{0}; // file offset of m_buffer[m_bufferEnd]
+};
@@ -0,0 +1,99 @@
+#include "PacketQueue.h"
+
+#include <new>
+#include <thread>
+
+HRESULT PacketQueue::Open(size_t capacity, size_t maxPacketBytes) {
+  if (capacity == 0 || maxPacketBytes == 0 || maxPacketBytes > UINT32_MAX) {
+    return E_INVALIDARG;
+  }
+  m_slotCount = capacity + 1;
+  m_slotBytes = (sizeof(uint32_t) + maxPacketBytes + 7) / 8 * 8;
+  m_slots.reset(new (std::nothrow) uint8_t[m_slotCount * m_slotBytes]);
+  if (!m_slots) {
+    return E_OUTOFMEMORY;
+  }
+  m_capacity = capacity;
+  m_maxPacketBytes = maxPacketBytes;
+  m_pushPosition.store(0, std::memory_order_relaxed);
+  m_popPosition.store(0, std::memory_order_relaxed);
+  m_copyPosition.store(NoCopy, std::memory_order_relaxed);
+  return S_OK;
+}
+
+size_t PacketQueue::GetSize() const {
+  const uint64_t popPosition = m_popPosition.load(std::memory_order_acquire);
+  const uint64_t pushPosition = m_pushPosition.load(std::memory_order_acquire);
+  return pushPosition > popPosition ? (size_t)(pushPosition - popPosition) : 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Producer.
+
+bool PacketQueue::TryPush(const void *packet, size_t bytes) {
+  const uint64_t pushPosition =
+      m_pushPosition.load(std::memory_order_relaxed);
+  if (bytes > m_maxPacketBytes ||
+      pushPosition - m_popPosition.load(std::memory_order_acquire) >=
+          m_capacity) {
+    return false;
+  }
+  // The queue has room, but after a drop the consumer can still be copying
+  // out of the slot that comes next. Copies are short, so wait it out. The
+  // drop read the pop position the consumer's claim wrote, so the copy
+  // position it set before claiming is visible here.
+  for (;;) {
+    const uint64_t copyPosition =
+        m_copyPosition.load(std::memory_order_acquire);
+    if (copyPosition == NoCopy || pushPosition - copyPosition < m_slotCount) {
+      break;
+    }
+    std::this_thread::yield();
+  }
+  uint8_t *slot = GetSlot(pushPosition);
+  const uint32_t packetBytes = (uint32_t)bytes;
+  memcpy(slot, &packetBytes, sizeof(packetBytes));
+  memcpy(slot + sizeof(packetBytes), packet, bytes);
+  m_pushPosition.store(pushPosition + 1, std::memory_order_release);
+  return true;
+}
+
+bool PacketQueue::TryDropOldest() {
+  const uint64_t pushPosition =
+      m_pushPosition.load(std::memory_order_relaxed);
+  uint64_t popPosition = m_popPosition.load(std::memory_order_acquire);
+  while (popPosition < pushPosition) {
+    if (m_popPosition.compare_exchange_weak(popPosition, popPosition + 1,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Consumer.
+
+bool PacketQueue::TryPop(void *packet, size_t *bytes) {
+  uint64_t popPosition = m_popPosition.load(std::memory_order_acquire);
+  for (;;) {
+    if (popPosition >= m_pushPosition.load(std::memory_order_acquire)) {
+      m_copyPosition.store(NoCopy, std::memory_order_relaxed);
+      return false;
+    }
+    m_copyPosition.store(popPosition, std::memory_order_relaxed);
+    if (m_popPosition.compare_exchange_weak(popPosition, popPosition + 1,
+                                            std::memory_order_acq_rel,
+                                            std::memory_order_acquire)) {
+      break;
+    }
+  }
+  const uint8_t *slot = GetSlot(popPosition);
+  uint32_t packetBytes;
+  memcpy(&packetBytes, slot, sizeof(packetBytes));
+  memcpy(packet, slot + sizeof(packetBytes), packetBytes);
+  *bytes = packetBytes;
+  m_copyPosition.store(NoCopy, std::memory_order_release);
+  return true;
+}
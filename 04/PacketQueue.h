@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Common.h"
+
+#include <atomic>
+#include <memory>
+
+// Bounded single-producer/single-consumer queue of variable-size packets, up
+// to a fixed maximum, used to hand encoded packets to the publisher.
+//
+// Packets are copied into fixed-size slots, so nothing is allocated once
+// Open returns. Positions only ever grow. The consumer claims the packet at
+// the pop position with a compare-and-swap and copies it out; the producer
+// can take the oldest packet the same way without copying it, which is how
+// a full queue drops its oldest packet instead of holding up the producer.
+// There is one more slot than the queue holds, so the slot the consumer is
+// copying from only comes round to the producer again if it drops a packet
+// in the meantime; the consumer says which slot it is copying before it
+// claims it, and the producer waits for that copy in that one case.
+
+class PacketQueue {
+public:
+  static const size_t CacheLineSize = 64;
+
+  PacketQueue() = default;
+  PacketQueue(const PacketQueue &) = delete;
+  PacketQueue &operator=(const PacketQueue &) = delete;
+
+  //! Makes room for capacity packets of up to maxPacketBytes each. Not
+  //! thread-safe; call before the producer and consumer start.
+  HRESULT Open(size_t capacity, size_t maxPacketBytes);
+
+  size_t GetCapacity() const { return m_capacity; }
+  //! Packets waiting. Exact only when neither side is running.
+  size_t GetSize() const;
+
+  // Producer side.
+
+  //! Copies a packet in, or returns false when the queue is full.
+  bool TryPush(const void *packet, size_t bytes);
+  //! Discards the oldest packet, or returns false when there is none.
+  bool TryDropOldest();
+
+  // Consumer side.
+
+  //! Copies the oldest packet into packet, which holds maxPacketBytes, or
+  //! returns false when the queue is empty.
+  bool TryPop(void *packet, size_t *bytes);
+
+private:
+  uint8_t *GetSlot(uint64_t position) const {
+    return m_slots.get() + (size_t)(position % m_slotCount) * m_slotBytes;
+  }
+
+  // Storage, fixed between Open and destruction. Each slot starts with the
+  // packet's size.
+  std::unique_ptr<uint8_t[]> m_slots;
+  size_t m_slotCount{0};
+  size_t m_slotBytes{0};
+  size_t m_capacity{0};
+  size_t m_maxPacketBytes{0};
+
+  // Producer state.
+  alignas(CacheLineSize) std::atomic<uint64_t> m_pushPosition{0};
+
+  // Claimed by the consumer, and by the producer when it drops a packet.
+  alignas(CacheLineSize) std::atomic<uint64_t> m_popPosition{0};
+
+  // Consumer state: the position being copied out, or NoCopy.
+  static const uint64_t NoCopy = UINT64_MAX;
+  alignas(CacheLineSize) std::atomic<uint64_t> m_copyPosition{NoCopy};
+};
@@ -0,0 +1,529 @@
+#include "PcmConvert.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||              \
+    defined(__i386__)
+#define PCM_CONVERT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+// MSVC emits any intrinsic regardless of /arch; dispatch guards their use.
+#define PCM_TARGET_SSE2
+#define PCM_TARGET_AVX2
+#else
+#define PCM_TARGET_SSE2 __attribute__((target("sse2")))
+#define PCM_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+HRESULT GetPcmSampleType(const WAVEFORMATEX *wfx, PcmSampleType *type) {
+  if (IsFormatOrSubFormat(wfx, WAVE_FORMAT_IEEE_FLOAT,
+                          KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)) {
+    if (wfx->wBitsPerSample == 32) {
+      *type = PcmSampleType::Float32;
+      return S_OK;
+    }
+    if (wfx->wBitsPerSample == 64) {
+      *type = PcmSampleType::Float64;
+      return S_OK;
+    }
+  } else if (IsFormatOrSubFormat(wfx, WAVE_FORMAT_PCM,
+                                 KSDATAFORMAT_SUBTYPE_PCM)) {
+    // The container size decides the layout; for WAVE_FORMAT_EXTENSIBLE,
+    // wValidBitsPerSample only says how many of the top bits carry signal.
+    switch (wfx->wBitsPerSample) {
+    case 16:
+      *type = PcmSampleType::Int16;
+      return S_OK;
+    case 24:
+      *type = PcmSampleType::Int24;
+      return S_OK;
+    case 32:
+      *type = PcmSampleType::Int32;
+      return S_OK;
+    }
+  }
+  return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Scalar kernels.
+
+namespace {
+
+using ToFloatKernel = void (*)(const void *src, float *dst, size_t count);
+using ToInt16Kernel = void (*)(const void *src, int16_t *dst, size_t count);
+
+//! One kernel per PcmSampleType, in declaration order.
+struct PcmKernels {
+  ToFloatKernel toFloat[5];
+  ToInt16Kernel toInt16[5];
+};
+
+const float Int16Scale = 1.0f / 32768.0f;
+const float Int32Scale = 1.0f / 2147483648.0f;
+
+//! Loads a packed 24-bit sample into the top three bytes of an int32.
+inline int32_t LoadInt24High(const uint8_t *p) {
+  return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+                   (uint32_t)p[2] << 24);
+}
+
+//! Matches the SIMD kernels: NaN saturates low, rounding is to nearest even.
+inline int16_t FloatToInt16(float value) {
+  float scaled = value * 32768.0f;
+  scaled = scaled > -32768.0f ? scaled : -32768.0f;
+  scaled = scaled < 32767.0f ? scaled : 32767.0f;
+  return (int16_t)lrintf(scaled);
+}
+
+void Int16ToFloatScalar(const void *src, float *dst, size_t count) {
+  const int16_t *in = (const int16_t *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = in[i] * Int16Scale;
+  }
+}
+
+void Int24ToFloatScalar(const void *src, float *dst, size_t count) {
+  const uint8_t *in = (const uint8_t *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = (float)LoadInt24High(in + i * 3) * Int32Scale;
+  }
+}
+
+void Int32ToFloatScalar(const void *src, float *dst, size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = (float)in[i] * Int32Scale;
+  }
+}
+
+void Float32ToFloat(const void *src, float *dst, size_t count) {
+  memcpy(dst, src, count * sizeof(float));
+}
+
+void Float64ToFloatScalar(const void *src, float *dst, size_t count) {
+  const double *in = (const double *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = (float)in[i];
+  }
+}
+
+void Int16ToInt16(const void *src, int16_t *dst, size_t count) {
+  memcpy(dst, src, count * sizeof(int16_t));
+}
+
+void Int24ToInt16Scalar(const void *src, int16_t *dst, size_t count) {
+  const uint8_t *in = (const uint8_t *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = (int16_t)(LoadInt24High(in + i * 3) >> 16);
+  }
+}
+
+void Int32ToInt16Scalar(const void *src, int16_t *dst, size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = (int16_t)(in[i] >> 16);
+  }
+}
+
+void Float32ToInt16Scalar(const void *src, int16_t *dst, size_t count) {
+  const float *in = (const float *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = FloatToInt16(in[i]);
+  }
+}
+
+void Float64ToInt16Scalar(const void *src, int16_t *dst, size_t count) {
+  const double *in = (const double *)src;
+  for (size_t i = 0; i < count; ++i) {
+    dst[i] = FloatToInt16((float)in[i]);
+  }
+}
+
+const PcmKernels ScalarKernels = {
+    {Int16ToFloatScalar, Int24ToFloatScalar, Int32ToFloatScalar,
+     Float32ToFloat, Float64ToFloatScalar},
+    {Int16ToInt16, Int24ToInt16Scalar, Int32ToInt16Scalar,
+     Float32ToInt16Scalar, Float64ToInt16Scalar},
+};
+
+#ifdef PCM_CONVERT_X86
+
+////////////////////////////////////////////////////////////////////////////
+// SSE2 kernels. Each handles whole vectors and leaves the tail to the scalar
+// kernel. Packed 24-bit input needs a byte shuffle, which SSE2 lacks, so that
+// conversion stays scalar at this level.
+
+PCM_TARGET_SSE2 void Int16ToFloatSse2(const void *src, float *dst,
+                                      size_t count) {
+  const int16_t *in = (const int16_t *)src;
+  const __m128 scale = _mm_set1_ps(Int16Scale);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+    __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+  }
+  Int16ToFloatScalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_SSE2 void Int32ToFloatSse2(const void *src, float *dst,
+                                      size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  const __m128 scale = _mm_set1_ps(Int32Scale);
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 4));
+    _mm_storeu_ps(dst + i, _mm_mul_ps(_mm_cvtepi32_ps(a), scale));
+    _mm_storeu_ps(dst + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(b), scale));
+  }
+  Int32ToFloatScalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_SSE2 void Float64ToFloatSse2(const void *src, float *dst,
+                                        size_t count) {
+  const double *in = (const double *)src;
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m128 lo = _mm_cvtpd_ps(_mm_loadu_pd(in + i));
+    __m128 hi = _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2));
+    _mm_storeu_ps(dst + i, _mm_movelh_ps(lo, hi));
+  }
+  Float64ToFloatScalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_SSE2 void Int32ToInt16Sse2(const void *src, int16_t *dst,
+                                      size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(in + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(in + i + 4));
+    __m128i packed =
+        _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+    _mm_storeu_si128((__m128i *)(dst + i), packed);
+  }
+  Int32ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+//! Scales, clamps and rounds four floats to int32 in the int16 range.
+PCM_TARGET_SSE2 inline __m128i FloatToInt16RangeSse2(__m128 v) {
+  v = _mm_mul_ps(v, _mm_set1_ps(32768.0f));
+  v = _mm_max_ps(v, _mm_set1_ps(-32768.0f));
+  v = _mm_min_ps(v, _mm_set1_ps(32767.0f));
+  return _mm_cvtps_epi32(v);
+}
+
+PCM_TARGET_SSE2 void Float32ToInt16Sse2(const void *src, int16_t *dst,
+                                        size_t count) {
+  const float *in = (const float *)src;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = FloatToInt16RangeSse2(_mm_loadu_ps(in + i));
+    __m128i b = FloatToInt16RangeSse2(_mm_loadu_ps(in + i + 4));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+  }
+  Float32ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_SSE2 void Float64ToInt16Sse2(const void *src, int16_t *dst,
+                                        size_t count) {
+  const double *in = (const double *)src;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128 a = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(in + i)),
+                             _mm_cvtpd_ps(_mm_loadu_pd(in + i + 2)));
+    __m128 b = _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(in + i + 4)),
+                             _mm_cvtpd_ps(_mm_loadu_pd(in + i + 6)));
+    _mm_storeu_si128((__m128i *)(dst + i),
+                     _mm_packs_epi32(FloatToInt16RangeSse2(a),
+                                     FloatToInt16RangeSse2(b)));
+  }
+  Float64ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+const PcmKernels Sse2Kernels = {
+    {Int16ToFloatSse2, Int24ToFloatScalar, Int32ToFloatSse2, Float32ToFloat,
+     Float64ToFloatSse2},
+    {Int16ToInt16, Int24ToInt16Scalar, Int32ToInt16Sse2, Float32ToInt16Sse2,
+     Float64ToInt16Sse2},
+};
+
+////////////////////////////////////////////////////////////////////////////
+// AVX2 kernels.
+
+PCM_TARGET_AVX2 void Int16ToFloatAvx2(const void *src, float *dst,
+                                      size_t count) {
+  const int16_t *in = (const int16_t *)src;
+  const __m256 scale = _mm256_set1_ps(Int16Scale);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a =
+        _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+    __m256i b =
+        _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+    _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+  }
+  Int16ToFloatScalar(in + i, dst + i, count - i);
+}
+
+//! Loads eight packed 24-bit samples into the top bytes of eight int32 lanes.
+//! Reads 28 bytes, four past the last sample.
+PCM_TARGET_AVX2 inline __m256i LoadInt24HighAvx2(const uint8_t *p) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, //
+      -1, 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11);
+  __m256i v = _mm256_inserti128_si256(
+      _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)p)),
+      _mm_loadu_si128((const __m128i *)(p + 12)), 1);
+  return _mm256_shuffle_epi8(v, shuffle);
+}
+
+PCM_TARGET_AVX2 void Int24ToFloatAvx2(const void *src, float *dst,
+                                      size_t count) {
+  const uint8_t *in = (const uint8_t *)src;
+  const __m256 scale = _mm256_set1_ps(Int32Scale);
+  size_t i = 0;
+  // Stop early enough that the over-read stays inside the buffer.
+  for (; i + 10 <= count; i += 8) {
+    __m256i v = LoadInt24HighAvx2(in + i * 3);
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(v), scale));
+  }
+  Int24ToFloatScalar(in + i * 3, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 void Int32ToFloatAvx2(const void *src, float *dst,
+                                      size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  const __m256 scale = _mm256_set1_ps(Int32Scale);
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 8));
+    _mm256_storeu_ps(dst + i, _mm256_mul_ps(_mm256_cvtepi32_ps(a), scale));
+    _mm256_storeu_ps(dst + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(b), scale));
+  }
+  Int32ToFloatScalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 void Float64ToFloatAvx2(const void *src, float *dst,
+                                        size_t count) {
+  const double *in = (const double *)src;
+  size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    _mm_storeu_ps(dst + i, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i)));
+    _mm_storeu_ps(dst + i + 4, _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 4)));
+  }
+  Float64ToFloatScalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 void Int24ToInt16Avx2(const void *src, int16_t *dst,
+                                      size_t count) {
+  const uint8_t *in = (const uint8_t *)src;
+  size_t i = 0;
+  for (; i + 10 <= count; i += 8) {
+    __m256i v = _mm256_srai_epi32(LoadInt24HighAvx2(in + i * 3), 16);
+    __m256i packed = _mm256_packs_epi32(v, v);
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(packed));
+  }
+  Int24ToInt16Scalar(in + i * 3, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 void Int32ToInt16Avx2(const void *src, int16_t *dst,
+                                      size_t count) {
+  const int32_t *in = (const int32_t *)src;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(in + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(in + i + 8));
+    __m256i packed =
+        _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+    // packs works within 128-bit lanes; restore sample order.
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)(dst + i), packed);
+  }
+  Int32ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 inline __m256i FloatToInt16RangeAvx2(__m256 v) {
+  v = _mm256_mul_ps(v, _mm256_set1_ps(32768.0f));
+  v = _mm256_max_ps(v, _mm256_set1_ps(-32768.0f));
+  v = _mm256_min_ps(v, _mm256_set1_ps(32767.0f));
+  return _mm256_cvtps_epi32(v);
+}
+
+PCM_TARGET_AVX2 void Float32ToInt16Avx2(const void *src, int16_t *dst,
+                                        size_t count) {
+  const float *in = (const float *)src;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = FloatToInt16RangeAvx2(_mm256_loadu_ps(in + i));
+    __m256i b = FloatToInt16RangeAvx2(_mm256_loadu_ps(in + i + 8));
+    __m256i packed = _mm256_packs_epi32(a, b);
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)(dst + i), packed);
+  }
+  Float32ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+PCM_TARGET_AVX2 void Float64ToInt16Avx2(const void *src, int16_t *dst,
+                                        size_t count) {
+  const double *in = (const double *)src;
+  size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256 a = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(in + i))),
+        _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 4)), 1);
+    __m256 b = _mm256_insertf128_ps(
+        _mm256_castps128_ps256(_mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 8))),
+        _mm256_cvtpd_ps(_mm256_loadu_pd(in + i + 12)), 1);
+    __m256i packed = _mm256_packs_epi32(FloatToInt16RangeAvx2(a),
+                                        FloatToInt16RangeAvx2(b));
+    packed = _mm256_permute4x64_epi64(packed, _MM_SHUFFLE(3, 1, 2, 0));
+    _mm256_storeu_si256((__m256i *)(dst + i), packed);
+  }
+  Float64ToInt16Scalar(in + i, dst + i, count - i);
+}
+
+const PcmKernels Avx2Kernels = {
+    {Int16ToFloatAvx2, Int24ToFloatAvx2, Int32ToFloatAvx2, Float32ToFloat,
+     Float64ToFloatAvx2},
+    {Int16ToInt16, Int24ToInt16Avx2, Int32ToInt16Avx2, Float32ToInt16Avx2,
+     Float64ToInt16Avx2},
+};
+
+#endif // PCM_CONVERT_X86
+
+////////////////////////////////////////////////////////////////////////////
+// Dispatch.
+
+PcmConvertIsa DetectPcmConvertIsa() {
+#ifdef PCM_CONVERT_X86
+  bool hasSse2;
+  bool hasAvx2;
+#ifdef _MSC_VER
+  int info[4];
+  __cpuid(info, 0);
+  const int maxLeaf = info[0];
+  __cpuid(info, 1);
+  hasSse2 = (info[3] & (1 << 26)) != 0;
+  // AVX2 also needs the OS to save the upper YMM state (OSXSAVE + XCR0).
+  const bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) &&
+                          (_xgetbv(0) & 6) == 6;
+  hasAvx2 = false;
+  if (maxLeaf >= 7 && osSavesYmm) {
+    __cpuidex(info, 7, 0);
+    hasAvx2 = (info[1] & (1 << 5)) != 0;
+  }
+#else
+  __builtin_cpu_init();
+  hasSse2 = __builtin_cpu_supports("sse2");
+  hasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+  if (hasAvx2) {
+    return PcmConvertIsa::Avx2;
+  }
+  if (hasSse2) {
+    return PcmConvertIsa::Sse2;
+  }
+#endif
+  return PcmConvertIsa::Scalar;
+}
+
+const PcmKernels *GetKernelsForIsa(PcmConvertIsa isa) {
+#ifdef PCM_CONVERT_X86
+  switch (isa) {
+  case PcmConvertIsa::Avx2:
+    return &Avx2Kernels;
+  case PcmConvertIsa::Sse2:
+    return &Sse2Kernels;
+  case PcmConvertIsa::Scalar:
+    break;
+  }
+#else
+  (void)isa;
+#endif
+  return &ScalarKernels;
+}
+
+const PcmConvertIsa g_bestPcmConvertIsa = DetectPcmConvertIsa();
+PcmConvertIsa g_pcmConvertIsa = g_bestPcmConvertIsa;
+const PcmKernels *g_pcmKernels = GetKernelsForIsa(g_pcmConvertIsa);
+
+//! Frames converted per channel before interleaving; keeps the staging
+//! buffer in L1.
+const size_t PlanarBlockFrames = 256;
+
+template <typename TOut, typename TConvert>
+void ConvertPlanar(PcmSampleType type, const void *const *planes, int channels,
+                   TOut *dst, size_t frameCount, TConvert convert) {
+  const size_t sampleSize = GetPcmSampleSize(type);
+  if (channels == 1) {
+    convert(planes[0], dst, frameCount);
+    return;
+  }
+
+  TOut block[PlanarBlockFrames];
+  for (size_t frame = 0; frame < frameCount; frame += PlanarBlockFrames) {
+    const size_t blockFrames = std::min(PlanarBlockFrames, frameCount - frame);
+    for (int channel = 0; channel < channels; ++channel) {
+      convert((const uint8_t *)planes[channel] + frame * sampleSize, block,
+              blockFrames);
+      TOut *out = dst + frame * channels + channel;
+      for (size_t i = 0; i < blockFrames; ++i) {
+        out[i * channels] = block[i];
+      }
+    }
+  }
+}
+
+} // namespace
+
+PcmConvertIsa GetPcmConvertIsa() { return g_pcmConvertIsa; }
+
+void SetPcmConvertIsa(PcmConvertIsa isa) {
+  g_pcmConvertIsa = std::min(isa, g_bestPcmConvertIsa);
+  g_pcmKernels = GetKernelsForIsa(g_pcmConvertIsa);
+}
+
+const char *GetPcmConvertIsaName(PcmConvertIsa isa) {
+  switch (isa) {
+  case PcmConvertIsa::Scalar:
+    return "scalar";
+  case PcmConvertIsa::Sse2:
+    return "sse2";
+  case PcmConvertIsa::Avx2:
+    return "avx2";
+  }
+  return "unknown";
+}
+
+void ConvertPcmToFloat(PcmSampleType type, const void *src, float *dst,
+                       size_t sampleCount) {
+  g_pcmKernels->toFloat[(int)type](src, dst, sampleCount);
+}
+
+void ConvertPcmToInt16(PcmSampleType type, const void *src, int16_t *dst,
+                       size_t sampleCount) {
+  g_pcmKernels->toInt16[(int)type](src, dst, sampleCount);
+}
+
+void ConvertPlanarPcmToFloat(PcmSampleType type, const void *const *planes,
+                             int channels, float *dst, size_t frameCount) {
+  ConvertPlanar(type, planes, channels, dst, frameCount,
+                g_pcmKernels->toFloat[(int)type]);
+}
+
+void ConvertPlanarPcmToInt16(PcmSampleType type, const void *const *planes,
+                             int channels, int16_t *dst, size_t frameCount) {
+  ConvertPlanar(type, planes, channels, dst, frameCount,
+                g_pcmKernels->toInt16[(int)type]);
+}
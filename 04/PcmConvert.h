@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Common.h"
+
+// Sample format conversion for PCM audio. The kernels are picked once at
+// startup from the instruction sets the CPU reports (AVX2, SSE2 or plain C++),
+// so callers never deal with dispatch.
+
+//! Storage type of a single PCM sample.
+enum class PcmSampleType {
+  Int16,   //!< 16-bit signed integer
+  Int24,   //!< 24-bit signed integer, packed in 3 bytes
+  Int32,   //!< 32-bit signed integer (also 24-in-32 and 20-in-32 layouts)
+  Float32, //!< 32-bit IEEE float, nominal range [-1, 1]
+  Float64, //!< 64-bit IEEE float, nominal range [-1, 1]
+};
+
+//! Instruction set used by the conversion kernels.
+enum class PcmConvertIsa {
+  Scalar,
+  Sse2,
+  Avx2,
+};
+
+//! Size of one sample of the given type, in bytes.
+inline size_t GetPcmSampleSize(PcmSampleType type) {
+  switch (type) {
+  case PcmSampleType::Int16:
+    return 2;
+  case PcmSampleType::Int24:
+    return 3;
+  case PcmSampleType::Int32:
+  case PcmSampleType::Float32:
+    return 4;
+  case PcmSampleType::Float64:
+    return 8;
+  }
+  return 0;
+}
+
+//! Maps a WAVE_FORMAT_PCM, WAVE_FORMAT_IEEE_FLOAT or WAVE_FORMAT_EXTENSIBLE
+//! description to a sample type. Fails with ERROR_NOT_SUPPORTED otherwise.
+HRESULT GetPcmSampleType(const WAVEFORMATEX *wfx, PcmSampleType *type);
+
+//! Returns the instruction set currently used by the kernels.
+PcmConvertIsa GetPcmConvertIsa();
+
+//! Overrides kernel selection, e.g. to benchmark the fallbacks. Requests for
+//! an instruction set the CPU lacks fall back to the best supported one.
+//! Not thread-safe with respect to concurrent conversions.
+void SetPcmConvertIsa(PcmConvertIsa isa);
+
+const char *GetPcmConvertIsaName(PcmConvertIsa isa);
+
+//! Converts sampleCount samples to float in [-1, 1]. Interleaved data is
+//! converted as a flat run of samples, so channel count does not matter.
+void ConvertPcmToFloat(PcmSampleType type, const void *src, float *dst,
+                       size_t sampleCount);
+
+//! Converts sampleCount samples to 16-bit integers. Float input is scaled,
+//! rounded and saturated; wider integers keep their top 16 bits.
+void ConvertPcmToInt16(PcmSampleType type, const void *src, int16_t *dst,
+                       size_t sampleCount);
+
+//! Converts frameCount frames of planar audio (one buffer per channel) into
+//! interleaved float.
+void ConvertPlanarPcmToFloat(PcmSampleType type, const void *const *planes,
+                             int channels, float *dst, size_t frameCount);
+
+//! Converts frameCount frames of planar audio into interleaved int16.
+void ConvertPlanarPcmToInt16(PcmSampleType type, const void *const *planes,
+                             int channels, int16_t *dst, size_t frameCount);
@@ -0,0 +1,239 @@
+#include "PcmRingBuffer.h"
+
+#include <algorithm>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+static size_t RoundUp(size_t value, size_t granularity) {
+  return (value + granularity - 1) / granularity * granularity;
+}
+
+//! Maps capacityBytes of shared memory at two adjacent addresses. The
+//! system picks the address for the reservation, which is released and
+//! immediately mapped over; another thread can take the range in between,
+//! so the mapping is retried a few times before giving up.
+HRESULT PcmRingBuffer::MapMirrored(size_t capacityBytes) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  const size_t size = RoundUp(capacityBytes, info.dwAllocationGranularity);
+  m_section = CreateFileMappingW(INVALID_HANDLE_VALUE, nullptr,
+                                 PAGE_READWRITE, (DWORD)((uint64_t)size >> 32),
+                                 (DWORD)size, nullptr);
+  if (!m_section) {
+    return HRESULT_FROM_WIN32(GetLastError());
+  }
+  for (int attempt = 0; attempt < 8; ++attempt) {
+    uint8_t *base = (uint8_t *)VirtualAlloc(nullptr, size * 2, MEM_RESERVE,
+                                            PAGE_NOACCESS);
+    if (!base) {
+      break;
+    }
+    VirtualFree(base, 0, MEM_RELEASE);
+    void *first = MapViewOfFileEx(m_section, FILE_MAP_ALL_ACCESS, 0, 0, size,
+                                  base);
+    void *second = first ? MapViewOfFileEx(m_section, FILE_MAP_ALL_ACCESS, 0,
+                                           0, size, base + size)
+                         : nullptr;
+    if (first && second) {
+      m_data = base;
+      m_capacity = size;
+      return S_OK;
+    }
+    if (first) {
+      UnmapViewOfFile(first);
+    }
+  }
+  CloseHandle(m_section);
+  m_section = nullptr;
+  return E_OUTOFMEMORY;
+#elif defined(__linux__)
+  const size_t size = RoundUp(capacityBytes, (size_t)sysconf(_SC_PAGESIZE));
+  const int fd = memfd_create("PcmRingBuffer", MFD_CLOEXEC);
+  if (fd < 0) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+  HRESULT hr = S_OK;
+  uint8_t *base = nullptr;
+  if (ftruncate(fd, (off_t)size) != 0) {
+    hr = HRESULT_FROM_ERRNO(errno);
+  } else {
+    // Reserve both halves at once, then replace each with the file; the
+    // fixed mappings land inside the reservation, so there is no race.
+    void *reserved = mmap(nullptr, size * 2, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reserved == MAP_FAILED) {
+      hr = HRESULT_FROM_ERRNO(errno);
+    } else {
+      base = (uint8_t *)reserved;
+      if (mmap(base, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+               fd, 0) == MAP_FAILED ||
+          mmap(base + size, size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        hr = HRESULT_FROM_ERRNO(errno);
+        munmap(base, size * 2);
+        base = nullptr;
+      }
+    }
+  }
+  // The mappings keep the memory alive.
+  close(fd);
+  if (SUCCEEDED(hr)) {
+    m_data = base;
+    m_capacity = size;
+  }
+  return hr;
+#else
+  (void)capacityBytes;
+  return E_NOTIMPL;
+#endif
+}
+
+//! One plain buffer holding the ring followed by the write and read scratch
+//! areas.
+HRESULT PcmRingBuffer::MapCopied(size_t capacityBytes, size_t maxViewBytes) {
+  m_copiedStorage.reset(new (std::nothrow)
+                            uint8_t[capacityBytes + maxViewBytes * 2]);
+  if (!m_copiedStorage) {
+    return E_OUTOFMEMORY;
+  }
+  m_data = m_copiedStorage.get();
+  m_capacity = capacityBytes;
+  m_writeScratch = m_data + capacityBytes;
+  m_readScratch = m_writeScratch + maxViewBytes;
+  return S_OK;
+}
+
+HRESULT PcmRingBuffer::Open(size_t capacityBytes, size_t maxViewBytes,
+                            PcmRingMapping mapping) {
+  HRESULT hr = S_OK;
+  Close();
+  if (capacityBytes == 0 || maxViewBytes == 0 ||
+      maxViewBytes > capacityBytes) {
+    IFC(E_INVALIDARG);
+  }
+  m_maxView = maxViewBytes;
+  m_mapping = PcmRingMapping::Mirrored;
+  if (mapping != PcmRingMapping::Mirrored ||
+      FAILED(MapMirrored(capacityBytes))) {
+    m_mapping = PcmRingMapping::Copied;
+    IFC(MapCopied(capacityBytes, maxViewBytes));
+  }
+  m_writePosition.store(0, std::memory_order_relaxed);
+  m_readPosition.store(0, std::memory_order_relaxed);
+  m_cachedReadPosition = 0;
+  m_cachedWritePosition = 0;
+  m_isWriteCopied = false;
+
+Cleanup:
+  return hr;
+}
+
+void PcmRingBuffer::Close() {
+  if (m_data && m_mapping == PcmRingMapping::Mirrored) {
+#ifdef _WIN32
+    UnmapViewOfFile(m_data);
+    UnmapViewOfFile(m_data + m_capacity);
+    CloseHandle(m_section);
+    m_section = nullptr;
+#else
+    munmap(m_data, m_capacity * 2);
+#endif
+  }
+  m_copiedStorage.reset();
+  m_data = nullptr;
+  m_writeScratch = nullptr;
+  m_readScratch = nullptr;
+  m_capacity = 0;
+  m_maxView = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Producer.
+
+size_t PcmRingBuffer::GetWritableBytes() {
+  m_cachedReadPosition = m_readPosition.load(std::memory_order_acquire);
+  return m_capacity -
+         (size_t)(m_writePosition.load(std::memory_order_relaxed) -
+                  m_cachedReadPosition);
+}
+
+uint8_t *PcmRingBuffer::BeginWrite(size_t bytes) {
+  const uint64_t writePosition =
+      m_writePosition.load(std::memory_order_relaxed);
+  if (bytes > m_maxView) {
+    return nullptr;
+  }
+  if (m_capacity - (size_t)(writePosition - m_cachedReadPosition) < bytes &&
+      GetWritableBytes() < bytes) {
+    return nullptr;
+  }
+  const size_t offset = (size_t)(writePosition % m_capacity);
+  m_isWriteCopied = m_mapping == PcmRingMapping::Copied &&
+                    offset + bytes > m_capacity;
+  return m_isWriteCopied ? m_writeScratch : m_data + offset;
+}
+
+void PcmRingBuffer::EndWrite(size_t bytes) {
+  const uint64_t writePosition =
+      m_writePosition.load(std::memory_order_relaxed);
+  if (m_isWriteCopied) {
+    const size_t offset = (size_t)(writePosition % m_capacity);
+    const size_t head = std::min(bytes, m_capacity - offset);
+    memcpy(m_data + offset, m_writeScratch, head);
+    memcpy(m_data, m_writeScratch + head, bytes - head);
+    m_isWriteCopied = false;
+  }
+  m_writePosition.store(writePosition + bytes, std::memory_order_release);
+}
+
+size_t PcmRingBuffer::Write(const void *data, size_t bytes) {
+  const uint64_t writePosition =
+      m_writePosition.load(std::memory_order_relaxed);
+  bytes = std::min(bytes, GetWritableBytes());
+  const size_t offset = (size_t)(writePosition % m_capacity);
+  const size_t head = m_mapping == PcmRingMapping::Mirrored
+                          ? bytes
+                          : std::min(bytes, m_capacity - offset);
+  memcpy(m_data + offset, data, head);
+  memcpy(m_data, (const uint8_t *)data + head, bytes - head);
+  m_writePosition.store(writePosition + bytes, std::memory_order_release);
+  return bytes;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Consumer.
+
+size_t PcmRingBuffer::GetReadableBytes() {
+  m_cachedWritePosition = m_writePosition.load(std::memory_order_acquire);
+  return (size_t)(m_cachedWritePosition -
+                  m_readPosition.load(std::memory_order_relaxed));
+}
+
+const uint8_t *PcmRingBuffer::BeginRead(size_t bytes) {
+  const uint64_t readPosition = m_readPosition.load(std::memory_order_relaxed);
+  if (bytes > m_maxView) {
+    return nullptr;
+  }
+  if ((size_t)(m_cachedWritePosition - readPosition) < bytes &&
+      GetReadableBytes() < bytes) {
+    return nullptr;
+  }
+  const size_t offset = (size_t)(readPosition % m_capacity);
+  if (m_mapping == PcmRingMapping::Mirrored || offset + bytes <= m_capacity) {
+    return m_data + offset;
+  }
+  const size_t head = m_capacity - offset;
+  memcpy(m_readScratch, m_data + offset, head);
+  memcpy(m_readScratch + head, m_data, bytes - head);
+  return m_readScratch;
+}
+
+void PcmRingBuffer::EndRead(size_t bytes) {
+  m_readPosition.store(m_readPosition.load(std::memory_order_relaxed) + bytes,
+                       std::memory_order_release);
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "Common.h"
+
+#include <atomic>
+#include <memory>
+
+// Fixed-capacity single-producer/single-consumer byte ring for PCM, used to
+// hand captured audio to the encoder in whole frames.
+//
+// Positions only ever grow; the producer publishes its write position with
+// a release store once the bytes are in place, and the consumer publishes
+// its read position the same way once it is done with them, so neither side
+// takes a lock. Each side keeps its position and its last copy of the
+// other's on a cache line of its own, and only reloads the other's position
+// when the copy says the ring looks full (or empty).
+//
+// Both sides work on contiguous views of the ring. The storage is mapped
+// twice, back to back, so a view that runs past the end continues into the
+// second mapping and wrapped frames need no copy. Where the system can't
+// make such a mapping the ring falls back to a plain buffer and copies the
+// wrapped part of a view through a scratch area instead. Either way nothing
+// is allocated or moved once Open returns.
+
+//! How a ring lays out its storage.
+enum class PcmRingMapping {
+  Mirrored, //!< mapped twice; wrapped views come straight from the ring
+  Copied,   //!< one mapping; wrapped views are copied through scratch
+};
+
+class PcmRingBuffer {
+public:
+  static const size_t CacheLineSize = 64;
+
+  PcmRingBuffer() = default;
+  PcmRingBuffer(const PcmRingBuffer &) = delete;
+  PcmRingBuffer &operator=(const PcmRingBuffer &) = delete;
+  ~PcmRingBuffer() { Close(); }
+
+  //! Allocates at least capacityBytes, rounded up to what the system maps
+  //! in; maxViewBytes is the largest view either side will ask for. A
+  //! mirrored ring that can't be mapped opens as a copied one. Not
+  //! thread-safe; call before the producer and consumer start.
+  HRESULT Open(size_t capacityBytes, size_t maxViewBytes,
+               PcmRingMapping mapping = PcmRingMapping::Mirrored);
+  void Close();
+
+  size_t GetCapacity() const { return m_capacity; }
+  PcmRingMapping GetMapping() const { return m_mapping; }
+
+  // Producer side.
+
+  //! Bytes the producer can write without overtaking the consumer.
+  size_t GetWritableBytes();
+  //! Returns a contiguous view for the next bytes bytes, at most
+  //! maxViewBytes, or null when there isn't room for them yet. The view is
+  //! filled in and then committed with EndWrite.
+  uint8_t *BeginWrite(size_t bytes);
+  //! Publishes the bytes written into the view from BeginWrite.
+  void EndWrite(size_t bytes);
+  //! Copies as much of data as fits and returns how many bytes that was.
+  size_t Write(const void *data, size_t bytes);
+
+  // Consumer side.
+
+  //! Bytes written and not yet consumed.
+  size_t GetReadableBytes();
+  //! Returns a contiguous view of the next bytes bytes, at most
+  //! maxViewBytes, or null when fewer are readable. The view stays valid
+  //! until EndRead.
+  const uint8_t *BeginRead(size_t bytes);
+  //! Releases bytes from the front of the ring back to the producer.
+  void EndRead(size_t bytes);
+
+private:
+  HRESULT MapMirrored(size_t capacityBytes);
+  HRESULT MapCopied(size_t capacityBytes, size_t maxViewBytes);
+
+  // Storage and layout, fixed between Open and Close.
+  uint8_t *m_data{nullptr};
+  size_t m_capacity{0};
+  size_t m_maxView{0};
+  PcmRingMapping m_mapping{PcmRingMapping::Mirrored};
+  std::unique_ptr<uint8_t[]> m_copiedStorage;
+  uint8_t *m_writeScratch{nullptr};
+  uint8_t *m_readScratch{nullptr};
+#ifdef _WIN32
+  HANDLE m_section{nullptr};
+#endif
+
+  // Producer state.
+  alignas(CacheLineSize) std::atomic<uint64_t> m_writePosition{0};
+  uint64_t m_cachedReadPosition{0};
+  bool m_isWriteCopied{false}; // the view from BeginWrite is scratch
+
+  // Consumer state.
+  alignas(CacheLineSize) std::atomic<uint64_t> m_readPosition{0};
+  uint64_t m_cachedWritePosition{0};
+};
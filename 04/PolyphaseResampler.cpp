@@ -0,0 +1,347 @@
+#include "PolyphaseResampler.h"
+
+#include "PcmConvert.h"
+
+#include <algorithm>
+#include <cstring>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) ||              \
+    defined(__i386__)
+#define POLYPHASE_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define POLYPHASE_TARGET_SSE2
+#define POLYPHASE_TARGET_AVX2
+#else
+#define POLYPHASE_TARGET_SSE2 __attribute__((target("sse2")))
+#define POLYPHASE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+////////////////////////////////////////////////////////////////////////////
+// Compile-time filter design.
+
+namespace {
+
+constexpr double Pi = 3.14159265358979323846;
+
+//! Sine by a Taylor series after reducing x to [-pi, pi].
+constexpr double ConstexprSin(double x) {
+  const double twoPi = 2 * Pi;
+  x -= (double)(long long)(x / twoPi) * twoPi;
+  if (x > Pi) {
+    x -= twoPi;
+  } else if (x < -Pi) {
+    x += twoPi;
+  }
+  double term = x;
+  double sum = x;
+  for (int n = 1; n < 16; ++n) {
+    term *= -x * x / ((2.0 * n) * (2.0 * n + 1));
+    sum += term;
+  }
+  return sum;
+}
+
+//! Square root by Newton's method; only needed on [0, 1].
+constexpr double ConstexprSqrt(double x) {
+  if (x <= 0) {
+    return 0;
+  }
+  double root = 1;
+  for (int i = 0; i < 20; ++i) {
+    root = 0.5 * (root + x / root);
+  }
+  return root;
+}
+
+//! Zeroth-order modified Bessel function of the first kind, by its series.
+constexpr double BesselI0(double x) {
+  double term = 1;
+  double sum = 1;
+  for (int k = 1; k < 32; ++k) {
+    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+    sum += term;
+  }
+  return sum;
+}
+
+//! Taps of a Kaiser-windowed sinc, one row per phase. Row p serves outputs
+//! that fall p/Phases of an input frame past the first tap's center plus
+//! Taps/2 - 1, and every row is scaled to unity gain at DC.
+template <int Phases, int Taps> struct PolyphaseTable {
+  alignas(32) float taps[Phases][Taps];
+};
+
+template <int Phases, int Taps>
+constexpr PolyphaseTable<Phases, Taps> MakePolyphaseTable(double cutoff,
+                                                          double beta) {
+  PolyphaseTable<Phases, Taps> table{};
+  const double windowScale = 1 / BesselI0(beta);
+  for (int p = 0; p < Phases; ++p) {
+    double row[Taps] = {};
+    double sum = 0;
+    for (int k = 0; k < Taps; ++k) {
+      // Distance from the output instant to this tap, in input frames.
+      const double d = k - (Taps / 2 - 1) - (double)p / Phases;
+      const double x = d / (Taps / 2);
+      const double window =
+          BesselI0(beta * ConstexprSqrt(1 - x * x)) * windowScale;
+      const double sinc = d == 0 ? 2 * cutoff
+                                 : ConstexprSin(2 * Pi * cutoff * d) / (Pi * d);
+      row[k] = sinc * window;
+      sum += row[k];
+    }
+    for (int k = 0; k < Taps; ++k) {
+      table.taps[p][k] = (float)(row[k] / sum);
+    }
+  }
+  return table;
+}
+
+// Both filters stop about 80 dB down (Kaiser beta 7.86). To 48 kHz the cutoff
+// sits 1.75 kHz under the input's Nyquist frequency; to 24 kHz, 1.2 kHz under
+// the output's, with half again as many taps for the narrower band.
+constexpr double KaiserBeta = 7.857;
+constexpr int Taps48k = 64;
+constexpr int Taps24k = 96;
+constexpr PolyphaseTable<160, Taps48k> Table44To48 =
+    MakePolyphaseTable<160, Taps48k>(20300.0 / 44100, KaiserBeta);
+constexpr PolyphaseTable<80, Taps24k> Table44To24 =
+    MakePolyphaseTable<80, Taps24k>(10800.0 / 44100, KaiserBeta);
+
+} // namespace
+
+//! One rate pair: outputs advance Step/Phases input frames at a time.
+struct PolyphaseFilter {
+  int inRate;
+  int outRate;
+  int phases;
+  int step;
+  int taps;
+  const float *coefficients; // phases rows of taps
+};
+
+static const PolyphaseFilter PolyphaseFilters[] = {
+    {44100, 48000, 160, 147, Taps48k, &Table44To48.taps[0][0]},
+    {44100, 24000, 80, 147, Taps24k, &Table44To24.taps[0][0]},
+};
+
+////////////////////////////////////////////////////////////////////////////
+// Dot product kernels. Each computes four dot products at once, one per
+// output, so the additions form independent chains instead of one long
+// dependency. Tap counts are multiples of eight.
+
+namespace {
+
+const int DotBatch = 4;
+
+using DotKernel = void (*)(const float *const *taps,
+                           const float *const *samples, int count,
+                           float *results);
+
+void DotScalar(const float *const *taps, const float *const *samples,
+               int count, float *results) {
+  for (int j = 0; j < DotBatch; ++j) {
+    float sum0 = 0;
+    float sum1 = 0;
+    for (int i = 0; i < count; i += 2) {
+      sum0 += taps[j][i] * samples[j][i];
+      sum1 += taps[j][i + 1] * samples[j][i + 1];
+    }
+    results[j] = sum0 + sum1;
+  }
+}
+
+#ifdef POLYPHASE_X86
+
+POLYPHASE_TARGET_SSE2 void DotSse2(const float *const *taps,
+                                   const float *const *samples, int count,
+                                   float *results) {
+  __m128 sum0 = _mm_setzero_ps();
+  __m128 sum1 = _mm_setzero_ps();
+  __m128 sum2 = _mm_setzero_ps();
+  __m128 sum3 = _mm_setzero_ps();
+  for (int i = 0; i < count; i += 4) {
+    sum0 = _mm_add_ps(sum0, _mm_mul_ps(_mm_load_ps(taps[0] + i),
+                                       _mm_loadu_ps(samples[0] + i)));
+    sum1 = _mm_add_ps(sum1, _mm_mul_ps(_mm_load_ps(taps[1] + i),
+                                       _mm_loadu_ps(samples[1] + i)));
+    sum2 = _mm_add_ps(sum2, _mm_mul_ps(_mm_load_ps(taps[2] + i),
+                                       _mm_loadu_ps(samples[2] + i)));
+    sum3 = _mm_add_ps(sum3, _mm_mul_ps(_mm_load_ps(taps[3] + i),
+                                       _mm_loadu_ps(samples[3] + i)));
+  }
+  // Transpose so each lane of the total belongs to one output.
+  _MM_TRANSPOSE4_PS(sum0, sum1, sum2, sum3);
+  _mm_storeu_ps(results,
+                _mm_add_ps(_mm_add_ps(sum0, sum1), _mm_add_ps(sum2, sum3)));
+}
+
+POLYPHASE_TARGET_AVX2 void DotAvx2(const float *const *taps,
+                                   const float *const *samples, int count,
+                                   float *results) {
+  __m256 sum0 = _mm256_setzero_ps();
+  __m256 sum1 = _mm256_setzero_ps();
+  __m256 sum2 = _mm256_setzero_ps();
+  __m256 sum3 = _mm256_setzero_ps();
+  for (int i = 0; i < count; i += 8) {
+    sum0 = _mm256_add_ps(sum0, _mm256_mul_ps(_mm256_load_ps(taps[0] + i),
+                                             _mm256_loadu_ps(samples[0] + i)));
+    sum1 = _mm256_add_ps(sum1, _mm256_mul_ps(_mm256_load_ps(taps[1] + i),
+                                             _mm256_loadu_ps(samples[1] + i)));
+    sum2 = _mm256_add_ps(sum2, _mm256_mul_ps(_mm256_load_ps(taps[2] + i),
+                                             _mm256_loadu_ps(samples[2] + i)));
+    sum3 = _mm256_add_ps(sum3, _mm256_mul_ps(_mm256_load_ps(taps[3] + i),
+                                             _mm256_loadu_ps(samples[3] + i)));
+  }
+  // Pairwise horizontal adds leave each output's total split across the
+  // two 128-bit halves.
+  const __m256 pairs = _mm256_hadd_ps(_mm256_hadd_ps(sum0, sum1),
+                                      _mm256_hadd_ps(sum2, sum3));
+  _mm_storeu_ps(results, _mm_add_ps(_mm256_castps256_ps128(pairs),
+                                    _mm256_extractf128_ps(pairs, 1)));
+}
+
+#endif // POLYPHASE_X86
+
+//! Follows the PCM conversion kernels' instruction set, so SetPcmConvertIsa
+//! also selects these.
+DotKernel GetDotKernel() {
+#ifdef POLYPHASE_X86
+  switch (GetPcmConvertIsa()) {
+  case PcmConvertIsa::Avx2:
+    return DotAvx2;
+  case PcmConvertIsa::Sse2:
+    return DotSse2;
+  case PcmConvertIsa::Scalar:
+    break;
+  }
+#endif
+  return DotScalar;
+}
+
+//! Input frames staged per channel between compactions, beyond the taps.
+const size_t HistoryBlockFrames = 1024;
+
+const PolyphaseFilter *FindPolyphaseFilter(int inRate, int outRate) {
+  for (const PolyphaseFilter &filter : PolyphaseFilters) {
+    if (filter.inRate == inRate && filter.outRate == outRate) {
+      return &filter;
+    }
+  }
+  return nullptr;
+}
+
+} // namespace
+
+////////////////////////////////////////////////////////////////////////////
+// Resampler.
+
+bool IsPolyphaseResamplerSupported(int inRate, int outRate) {
+  return FindPolyphaseFilter(inRate, outRate) != nullptr;
+}
+
+HRESULT PolyphaseResampler::Open(int channels, int inRate, int outRate) {
+  m_filter = FindPolyphaseFilter(inRate, outRate);
+  if (!m_filter || channels < 1 || channels > 255) {
+    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+  }
+  m_channels = channels;
+  m_capacity = m_filter->taps + HistoryBlockFrames;
+  m_history.assign(m_capacity * channels, 0.0f);
+  Reset();
+  return S_OK;
+}
+
+void PolyphaseResampler::Reset() {
+  // Taps/2 - 1 frames of silence put the first input frame where the first
+  // output's center tap expects it.
+  std::fill(m_history.begin(), m_history.end(), 0.0f);
+  m_length = m_filter ? m_filter->taps / 2 - 1 : 0;
+  m_position = 0;
+  m_phase = 0;
+}
+
+uint32_t PolyphaseResampler::GetInputLatency() const {
+  return m_filter ? m_filter->taps / 2 : 0;
+}
+
+void PolyphaseResampler::Process(const float *in, uint32_t inFrames,
+                                 uint32_t *inProcessed, float *out,
+                                 uint32_t outCapacity, uint32_t *outFrames) {
+  const DotKernel dot = GetDotKernel();
+  const int taps = m_filter->taps;
+  const int phases = m_filter->phases;
+  const int step = m_filter->step;
+  const int channels = m_channels;
+  uint32_t consumed = 0;
+  uint32_t produced = 0;
+  for (;;) {
+    while (produced < outCapacity && m_position + taps <= m_length) {
+      // Plan up to DotBatch outputs that the history already covers; short
+      // batches repeat the first output to fill the kernel's slots.
+      const float *rows[DotBatch];
+      size_t positions[DotBatch];
+      int batch = 0;
+      while (batch < DotBatch && produced + batch < outCapacity &&
+             m_position + taps <= m_length) {
+        rows[batch] = m_filter->coefficients + (size_t)m_phase * taps;
+        positions[batch] = m_position;
+        ++batch;
+        m_phase += step;
+        m_position += m_phase / phases;
+        m_phase %= phases;
+      }
+      for (int j = batch; j < DotBatch; ++j) {
+        rows[j] = rows[0];
+        positions[j] = positions[0];
+      }
+      for (int c = 0; c < channels; ++c) {
+        const float *history = m_history.data() + c * m_capacity;
+        const float *samples[DotBatch];
+        float results[DotBatch];
+        for (int j = 0; j < DotBatch; ++j) {
+          samples[j] = history + positions[j];
+        }
+        dot(rows, samples, taps, results);
+        for (int j = 0; j < batch; ++j) {
+          out[(size_t)(produced + j) * channels + c] = results[j];
+        }
+      }
+      produced += batch;
+    }
+    if (produced == outCapacity || consumed == inFrames) {
+      break;
+    }
+
+    // Drop the frames no output needs any more, then stage more input one
+    // channel at a time so the taps read contiguous samples.
+    if (m_position > 0) {
+      const size_t kept = m_length - m_position;
+      for (int c = 0; c < channels; ++c) {
+        float *history = m_history.data() + c * m_capacity;
+        memmove(history, history + m_position, kept * sizeof(float));
+      }
+      m_length = kept;
+      m_position = 0;
+    }
+    const size_t staged =
+        std::min<size_t>(inFrames - consumed, m_capacity - m_length);
+    for (int c = 0; c < channels; ++c) {
+      float *history = m_history.data() + c * m_capacity + m_length;
+      if (in) {
+        const float *source = in + (size_t)consumed * channels + c;
+        for (size_t i = 0; i < staged; ++i) {
+          history[i] = source[i * channels];
+        }
+      } else {
+        std::fill(history, history + staged, 0.0f);
+      }
+    }
+    m_length += staged;
+    consumed += (uint32_t)staged;
+  }
+  *inProcessed = consumed;
+  *outFrames = produced;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Common.h"
+
+#include <vector>
+
+// Fixed-ratio polyphase resampler for the conversions the sample does most:
+// 44.1 kHz to 48 kHz (160/147) and 44.1 kHz to 24 kHz (80/147). The filters
+// are Kaiser-windowed sincs whose tables are computed at compile time, one
+// row of taps per output phase, and the dot products run through the same
+// SSE2/AVX2 selection as the PCM conversion kernels (see PcmConvert.h).
+
+//! Whether the polyphase resampler has a filter for the rate pair.
+bool IsPolyphaseResamplerSupported(int inRate, int outRate);
+
+struct PolyphaseFilter;
+
+//! Resamples interleaved float audio a chunk at a time. Like
+//! StreamingResampler, the output is aligned with the input, and the last
+//! GetInputLatency() input frames only come out once that much silence (a
+//! null input) has been fed after them.
+class PolyphaseResampler {
+public:
+  PolyphaseResampler() = default;
+  PolyphaseResampler(const PolyphaseResampler &) = delete;
+  PolyphaseResampler &operator=(const PolyphaseResampler &) = delete;
+
+  //! Fails with ERROR_NOT_SUPPORTED for rate pairs without a filter.
+  HRESULT Open(int channels, int inRate, int outRate);
+
+  //! Clears the filter history, as if newly opened.
+  void Reset();
+
+  //! Resamples up to inFrames frames into at most outCapacity frames; a null
+  //! in is read as silence. Stops when either runs out.
+  void Process(const float *in, uint32_t inFrames, uint32_t *inProcessed,
+               float *out, uint32_t outCapacity, uint32_t *outFrames);
+
+  uint32_t GetInputLatency() const;
+
+private:
+  const PolyphaseFilter *m_filter{nullptr};
+  int m_channels{0};
+  std::vector<float> m_history; // planar, m_capacity frames per channel
+  size_t m_capacity{0};
+  size_t m_length{0};   // frames of history held
+  size_t m_position{0}; // first history frame under the next output's taps
+  int m_phase{0};       // next output's phase, in 1/L steps of an input frame
+};
@@ -0,0 +1,202 @@
+#include "RedisPublisher.h"
+
+#include <algorithm>
+
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
+redisContext *ConnectToRedis(const char *host, int port,
+                             const char *password) {
+  redisContext *rctx; // redis context object
+  redisReply *reply;  // redis reply object
+
+  printf("Connecting to redis server %s...\n", host);
+  rctx = redisConnect(host, port);
+  if (!rctx || rctx->err) {
+    if (rctx) {
+      printf("Failed to connect: %s\n", rctx->errstr);
+      redisFree(rctx);
+    } else {
+      printf("Failed to create redis context\n");
+    }
+    return nullptr;
+  }
+
+  if (password) {
+    printf("Authenticating with redis server...\n");
+    reply = (redisReply *)redisCommand(rctx, "AUTH %s", password);
+    if (!reply || rctx->err || reply->type == REDIS_REPLY_ERROR) {
+      printf("Failed redis authorization\n");
+      freeReplyObject(reply); // ok to call if null
+      redisFree(rctx);
+      return nullptr;
+    }
+    freeReplyObject(reply);
+  }
+  printf("Connected to redis server\n");
+  return rctx;
+}
+
+HRESULT RedisPublisher::Publish(const uint8_t *packet, size_t bytes) {
+  HRESULT hr = S_OK;
+  redisReply *reply = (redisReply *)redisCommand(
+      m_context, "PUBLISH %s %b", m_channel.c_str(), packet, bytes);
+  if (!reply) {
+    printf("Failed to publish: %s\n", m_context->errstr);
+    IFC(E_FAIL);
+  }
+  if (reply->type == REDIS_REPLY_ERROR) {
+    printf("Failed to publish: %s\n", reply->str);
+    IFC(E_FAIL);
+  }
+
+Cleanup:
+  freeReplyObject(reply);
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Pipelined publishing.
+
+//! Waits up to timeoutMs for the context's socket to have something to read.
+//! Returns S_FALSE on timeout.
+static HRESULT WaitForReadable(redisContext *context, int timeoutMs) {
+#ifdef _WIN32
+  WSAPOLLFD pfd = {};
+  pfd.fd = context->fd;
+  pfd.events = POLLRDNORM;
+  const int ready = WSAPoll(&pfd, 1, timeoutMs);
+  if (ready < 0) {
+    return HRESULT_FROM_WIN32(WSAGetLastError());
+  }
+#else
+  pollfd pfd = {};
+  pfd.fd = context->fd;
+  pfd.events = POLLIN;
+  int ready;
+  do {
+    ready = poll(&pfd, 1, timeoutMs);
+  } while (ready < 0 && errno == EINTR);
+  if (ready < 0) {
+    return HRESULT_FROM_ERRNO(errno);
+  }
+#endif
+  return ready == 0 ? S_FALSE : S_OK;
+}
+
+HRESULT PipelinedRedisPublisher::Publish(const uint8_t *packet,
+                                         size_t bytes) {
+  HRESULT hr = S_OK;
+  const auto now = std::chrono::steady_clock::now();
+
+  // Pick up whatever replies have come in, then make room in the window.
+  IFC(ReadReplies(false));
+  while (GetInFlight() >= m_options.maxInFlight) {
+    m_stats.windowWaits++;
+    IFC(Flush());
+    IFC(ReadReplies(true));
+  }
+
+  if (redisAppendCommand(m_context, "PUBLISH %s %b", m_channel.c_str(),
+                         packet, bytes) != REDIS_OK) {
+    printf("Failed to publish: %s\n", m_context->errstr);
+    IFC(E_FAIL);
+  }
+  if (m_bufferedCommands == 0) {
+    m_firstBufferedTime = now;
+  }
+  m_bufferedCommands++;
+  m_bufferedBytes += bytes;
+  m_stats.commands++;
+  m_stats.maxInFlight = std::max(m_stats.maxInFlight, GetInFlight());
+
+  if (m_bufferedBytes >= m_options.flushBytes ||
+      now - m_firstBufferedTime >=
+          std::chrono::microseconds(m_options.flushIntervalUs)) {
+    IFC(Flush());
+  }
+
+Cleanup:
+  return hr;
+}
+
+HRESULT PipelinedRedisPublisher::Flush() {
+  HRESULT hr = S_OK;
+  int isDone = 0;
+  if (m_bufferedCommands == 0) {
+    goto Cleanup;
+  }
+  // The socket blocks, so each call writes all it can; a short write only
+  // means the kernel buffer filled and the next call waits for room.
+  while (!isDone) {
+    if (redisBufferWrite(m_context, &isDone) != REDIS_OK) {
+      printf("Failed to publish: %s\n", m_context->errstr);
+      IFC(E_FAIL);
+    }
+  }
+  m_sentCommands += m_bufferedCommands;
+  m_bufferedCommands = 0;
+  m_bufferedBytes = 0;
+  m_stats.flushes++;
+
+Cleanup:
+  return hr;
+}
+
+HRESULT PipelinedRedisPublisher::Finish() {
+  HRESULT hr = S_OK;
+  IFC(Flush());
+  while (m_sentCommands > 0) {
+    IFC(ReadReplies(true));
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Takes the replies that have arrived. When isWaiting is set and none has,
+//! waits up to the reply timeout for at least one.
+HRESULT PipelinedRedisPublisher::ReadReplies(bool isWaiting) {
+  HRESULT hr = S_OK;
+  for (;;) {
+    void *reply = nullptr;
+    if (redisGetReplyFromReader(m_context, &reply) != REDIS_OK) {
+      printf("Failed to read reply: %s\n", m_context->errstr);
+      IFC(E_FAIL);
+    }
+    if (reply) {
+      redisReply *r = (redisReply *)reply;
+      if (r->type == REDIS_REPLY_ERROR) {
+        printf("Failed to publish: %s\n", r->str);
+        m_stats.errors++;
+      }
+      freeReplyObject(reply);
+      m_stats.replies++;
+      m_sentCommands--;
+      isWaiting = false;
+      continue;
+    }
+
+    // Nothing parsed; read more off the socket if it has any.
+    if (m_sentCommands == 0) {
+      break;
+    }
+    IFC(WaitForReadable(m_context, isWaiting ? m_options.replyTimeoutMs : 0));
+    if (hr == S_FALSE) {
+      if (isWaiting) {
+        printf("Timed out waiting for redis\n");
+        IFC(HRESULT_FROM_WIN32(ERROR_TIMEOUT));
+      }
+      hr = S_OK;
+      break;
+    }
+    if (redisBufferRead(m_context) != REDIS_OK) {
+      printf("Failed to read reply: %s\n", m_context->errstr);
+      IFC(E_FAIL);
+    }
+  }
+
+Cleanup:
+  return hr;
+}
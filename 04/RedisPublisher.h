@@ -0,0 +1,101 @@
+#pragma once
+
+#include "SenderPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+
+#include "hiredis.h"
+
+// Redis connection helpers shared by the sender and the receiver, and the
+// publishers that send packets to a redis channel.
+//
+// RedisPublisher waits for each PUBLISH to be answered before sending the
+// next, so a stream can't publish faster than one packet per round trip.
+// PipelinedRedisPublisher appends commands to the context's output buffer
+// and writes them out together once enough bytes have built up, once the
+// oldest has waited long enough, or when the sender has nothing more to
+// send for now. Replies are read whenever the socket has some, without
+// waiting; only a stream with a full window of unanswered commands waits.
+
+static const int DefaultRedisPort = 6379;
+
+//! Connects to a redis host and authenticates, printing progress as it
+//! goes. A null password skips AUTH. Returns null on failure.
+redisContext *ConnectToRedis(const char *host, int port,
+                             const char *password);
+
+//! Publishes each packet with a blocking PUBLISH, one round trip apiece.
+class RedisPublisher : public PacketPublisher {
+public:
+  //! context stays owned by the caller.
+  RedisPublisher(redisContext *context, const char *channel)
+      : m_context(context), m_channel(channel) {}
+
+  HRESULT Publish(const uint8_t *packet, size_t bytes) override;
+
+private:
+  redisContext *m_context;
+  std::string m_channel;
+};
+
+//! Options for PipelinedRedisPublisher.
+struct RedisPipelineOptions {
+  //! Write the buffered commands once they hold this many bytes.
+  size_t flushBytes = 16 * 1024;
+  //! Write the buffered commands once the oldest has waited this long, in
+  //! microseconds.
+  int flushIntervalUs = 2000;
+  //! Most commands sent or buffered without a reply. Publish waits for
+  //! replies rather than go past it. Anything under 1 is taken as 1, which
+  //! waits for each reply before the next command.
+  int maxInFlight = 64;
+  //! How long to wait for a reply when the window is full, in milliseconds.
+  int replyTimeoutMs = 5000;
+};
+
+//! Counters since the publisher was created.
+struct RedisPipelineStats {
+  uint64_t commands = 0; //!< PUBLISHes appended
+  uint64_t replies = 0;
+  uint64_t errors = 0;  //!< error replies
+  uint64_t flushes = 0; //!< writes of the buffered commands
+  uint64_t windowWaits = 0; //!< times Publish waited on a full window
+  int maxInFlight = 0;
+};
+
+//! Publishes with pipelined PUBLISH commands. Error replies are counted and
+//! printed but don't fail the stream, since the packets they answer are
+//! long gone by the time they arrive.
+class PipelinedRedisPublisher : public PacketPublisher {
+public:
+  //! context stays owned by the caller, and mustn't be used for anything
+  //! else while commands are in flight.
+  PipelinedRedisPublisher(redisContext *context, const char *channel,
+                          const RedisPipelineOptions &options = {})
+      : m_context(context), m_channel(channel), m_options(options) {
+    m_options.maxInFlight = std::max(m_options.maxInFlight, 1);
+  }
+
+  HRESULT Publish(const uint8_t *packet, size_t bytes) override;
+  HRESULT Flush() override;
+
+  //! Writes the buffered commands and waits for every reply.
+  HRESULT Finish();
+
+  const RedisPipelineStats &GetStats() const { return m_stats; }
+
+private:
+  HRESULT ReadReplies(bool isWaiting);
+  int GetInFlight() const { return (int)(m_sentCommands + m_bufferedCommands); }
+
+  redisContext *m_context;
+  std::string m_channel;
+  RedisPipelineOptions m_options;
+  uint64_t m_bufferedCommands{0}; // appended, not yet written
+  size_t m_bufferedBytes{0};
+  std::chrono::steady_clock::time_point m_firstBufferedTime;
+  uint64_t m_sentCommands{0}; // written, not yet answered
+  RedisPipelineStats m_stats;
+};
@@ -0,0 +1,255 @@
+#include "Resampler.h"
+
+#include "PcmConvert.h"
+#include "speex_resampler.h"
+
+#include <algorithm>
+
+static const int ResamplerQuality = SPEEX_RESAMPLER_QUALITY_DEFAULT;
+
+// Samples converted per block when int16 audio goes through the float-only
+// polyphase resampler.
+static const uint32_t PolyphaseBlockSamples = 2048;
+
+static ResamplerType g_resamplerType = ResamplerType::Speex;
+
+ResamplerType GetResamplerType() { return g_resamplerType; }
+
+void SetResamplerType(ResamplerType type) { g_resamplerType = type; }
+
+const char *GetResamplerTypeName(ResamplerType type) {
+  switch (type) {
+  case ResamplerType::Speex:
+    return "speex";
+  case ResamplerType::Polyphase:
+    return "polyphase";
+  }
+  return "unknown";
+}
+
+bool ParseResamplerType(const char *name, ResamplerType *type) {
+  for (ResamplerType candidate :
+       {ResamplerType::Speex, ResamplerType::Polyphase}) {
+    if (strcmp(name, GetResamplerTypeName(candidate)) == 0) {
+      *type = candidate;
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool UsePolyphase(int inRate, int outRate) {
+  return g_resamplerType == ResamplerType::Polyphase &&
+         IsPolyphaseResamplerSupported(inRate, outRate);
+}
+
+//! Runs float or int16 audio through the float-only polyphase resampler,
+//! converting int16 a block at a time. A null in is read as silence.
+static void ProcessPolyphase(PolyphaseResampler &resampler, int channels,
+                             bool isFloat, const void *in, uint32_t inFrames,
+                             uint32_t *inProcessed, void *out,
+                             uint32_t outCapacity, uint32_t *outFrames) {
+  if (isFloat) {
+    resampler.Process((const float *)in, inFrames, inProcessed, (float *)out,
+                      outCapacity, outFrames);
+    return;
+  }
+
+  float inBlock[PolyphaseBlockSamples];
+  float outBlock[PolyphaseBlockSamples];
+  const uint32_t blockFrames = PolyphaseBlockSamples / channels;
+  const int16_t *in16 = (const int16_t *)in;
+  int16_t *out16 = (int16_t *)out;
+  uint32_t consumed = 0;
+  uint32_t produced = 0;
+  for (;;) {
+    const uint32_t inCount = std::min(blockFrames, inFrames - consumed);
+    const uint32_t outCount = std::min(blockFrames, outCapacity - produced);
+    uint32_t blockProcessed;
+    uint32_t blockProduced;
+    if (in16) {
+      ConvertPcmToFloat(PcmSampleType::Int16, in16 + consumed * channels,
+                        inBlock, inCount * channels);
+    }
+    resampler.Process(in16 ? inBlock : nullptr, inCount, &blockProcessed,
+                      outBlock, outCount, &blockProduced);
+    ConvertPcmToInt16(PcmSampleType::Float32, outBlock,
+                      out16 + produced * channels, blockProduced * channels);
+    consumed += blockProcessed;
+    produced += blockProduced;
+    if (blockProcessed == 0 && blockProduced == 0) {
+      break;
+    }
+  }
+  *inProcessed = consumed;
+  *outFrames = produced;
+}
+
+ResamplerCache::~ResamplerCache() {
+  if (m_resampler) {
+    speex_resampler_destroy(m_resampler);
+  }
+}
+
+HRESULT ResamplerCache::Get(int channels, int inRate, int outRate,
+                            SpeexResamplerState **resampler) {
+  HRESULT hr = S_OK;
+  int err = 0;
+  *resampler = nullptr;
+  if (m_resampler && m_channels == channels && m_inRate == inRate &&
+      m_outRate == outRate) {
+    IFC_RESAMPLER(speex_resampler_reset_mem(m_resampler));
+    *resampler = m_resampler;
+    goto Cleanup;
+  }
+
+  if (m_resampler) {
+    speex_resampler_destroy(m_resampler);
+    m_resampler = nullptr;
+  }
+  m_resampler =
+      speex_resampler_init(channels, inRate, outRate, ResamplerQuality, &err);
+  IFC_RESAMPLER(err);
+  m_channels = channels;
+  m_inRate = inRate;
+  m_outRate = outRate;
+  *resampler = m_resampler;
+
+Cleanup:
+  return hr;
+}
+
+StreamingResampler::~StreamingResampler() {
+  if (m_ownedResampler) {
+    speex_resampler_destroy(m_ownedResampler);
+  }
+}
+
+HRESULT StreamingResampler::Open(int channels, int inRate, int outRate,
+                                 bool isFloat, ResamplerCache *cache) {
+  HRESULT hr = S_OK;
+  int err = 0;
+  if (m_ownedResampler) {
+    speex_resampler_destroy(m_ownedResampler);
+    m_ownedResampler = nullptr;
+  }
+  m_resampler = nullptr;
+  m_isPolyphase = UsePolyphase(inRate, outRate);
+  m_channels = channels;
+  m_isFloat = isFloat;
+  if (m_isPolyphase) {
+    IFC(m_polyphase.Open(channels, inRate, outRate));
+    m_drainFrames = m_polyphase.GetInputLatency();
+    goto Cleanup;
+  }
+  if (cache) {
+    IFC(cache->Get(channels, inRate, outRate, &m_resampler));
+  } else {
+    m_ownedResampler = speex_resampler_init(channels, inRate, outRate,
+                                            ResamplerQuality, &err);
+    IFC_RESAMPLER(err);
+    m_resampler = m_ownedResampler;
+  }
+  IFC_RESAMPLER(speex_resampler_skip_zeros(m_resampler));
+  m_drainFrames = speex_resampler_get_input_latency(m_resampler);
+
+Cleanup:
+  return hr;
+}
+
+HRESULT StreamingResampler::Process(const void *in, uint32_t inFrames,
+                                    uint32_t *inProcessed, void *out,
+                                    uint32_t outCapacity,
+                                    uint32_t *outFrames) {
+  HRESULT hr = S_OK;
+  *inProcessed = inFrames;
+  *outFrames = outCapacity;
+  if (m_isPolyphase) {
+    ProcessPolyphase(m_polyphase, m_channels, m_isFloat, in, inFrames,
+                     inProcessed, out, outCapacity, outFrames);
+  } else if (m_isFloat) {
+    IFC_RESAMPLER(speex_resampler_process_interleaved_float(
+        m_resampler, (const float *)in, inProcessed, (float *)out,
+        outFrames));
+  } else {
+    IFC_RESAMPLER(speex_resampler_process_interleaved_int(
+        m_resampler, (const short *)in, inProcessed, (short *)out,
+        outFrames));
+  }
+
+Cleanup:
+  return hr;
+}
+
+HRESULT StreamingResampler::Drain(void *out, uint32_t outCapacity,
+                                  uint32_t *outFrames) {
+  HRESULT hr = S_OK;
+  // Speex treats a null input as silence.
+  uint32_t inProcessed = 0;
+  *outFrames = 0;
+  if (m_drainFrames == 0) {
+    goto Cleanup;
+  }
+  IFC(Process(nullptr, m_drainFrames, &inProcessed, out, outCapacity,
+              outFrames));
+  m_drainFrames -= inProcessed;
+
+Cleanup:
+  return hr;
+}
+
+HRESULT ResampleWaveData(int channels, int inRate, int outRate, bool isFloat,
+                         const void *in, int inCount,
+                         unsigned int *inProcessed, void *out, int outSize,
+                         unsigned int *outCount, ResamplerCache *cache) {
+  int err = 0;
+  HRESULT hr = S_OK;
+  SpeexResamplerState *resampler = nullptr;
+  SpeexResamplerState *ownedResampler = nullptr;
+  if (UsePolyphase(inRate, outRate)) {
+    // The filter tables are static, so a resampler costs only its history.
+    PolyphaseResampler polyphase;
+    IFC(polyphase.Open(channels, inRate, outRate));
+    ProcessPolyphase(polyphase, channels, isFloat, in, inCount, inProcessed,
+                     out, outSize, outCount);
+    goto Cleanup;
+  }
+  if (cache) {
+    IFC(cache->Get(channels, inRate, outRate, &resampler));
+  } else {
+    ownedResampler = speex_resampler_init(channels, inRate, outRate,
+                                          ResamplerQuality, &err);
+    IFC_RESAMPLER(err);
+    resampler = ownedResampler;
+  }
+  *inProcessed = inCount;
+  *outCount = outSize;
+  if (channels > 1) {
+    // The interleaved calls run each channel's filter over a strided view,
+    // so there is no separate deinterleave pass.
+    if (isFloat) {
+      IFC_RESAMPLER(speex_resampler_process_interleaved_float(
+          resampler, (const float *)in, inProcessed, (float *)out,
+          outCount));
+    } else {
+      IFC_RESAMPLER(speex_resampler_process_interleaved_int(
+          resampler, (const short *)in, inProcessed, (short *)out,
+          outCount));
+    }
+  } else if (isFloat) {
+    int channelIdx = 0;
+    IFC_RESAMPLER(speex_resampler_process_float(resampler, channelIdx,
+                                                (const float *)in, inProcessed,
+                                                (float *)out, outCount));
+  } else {
+    int channelIdx = 0;
+    IFC_RESAMPLER(speex_resampler_process_int(resampler, channelIdx,
+                                              (const short *)in, inProcessed,
+                                              (short *)out, outCount));
+  }
+Cleanup:
+  if (ownedResampler) {
+    speex_resampler_destroy(ownedResampler);
+  }
+  return hr;
+}
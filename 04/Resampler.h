@@ -0,0 +1,92 @@
+#pragma once
+
+#include "Common.h"
+#include "PolyphaseResampler.h"
+
+typedef struct SpeexResamplerState_ SpeexResamplerState;
+
+//! Implementation behind ResampleWaveData and StreamingResampler.
+enum class ResamplerType {
+  Speex,     //!< the speex resampler from opus-tools, for any pair of rates
+  Polyphase, //!< PolyphaseResampler where it has a filter, speex otherwise
+};
+
+ResamplerType GetResamplerType();
+
+//! Picks the implementation for resamplers opened from now on. Not
+//! thread-safe with respect to resamplers being opened concurrently.
+void SetResamplerType(ResamplerType type);
+
+const char *GetResamplerTypeName(ResamplerType type);
+
+//! Parses a name returned by GetResamplerTypeName.
+bool ParseResamplerType(const char *name, ResamplerType *type);
+
+//! Keeps one resampler alive between calls with the same configuration, so
+//! batch jobs don't rebuild the filter tables for every file. Not thread-safe;
+//! give each worker its own.
+class ResamplerCache {
+public:
+  ResamplerCache() = default;
+  ResamplerCache(const ResamplerCache &) = delete;
+  ResamplerCache &operator=(const ResamplerCache &) = delete;
+  ~ResamplerCache();
+
+  //! Returns a resampler for the configuration with its history cleared.
+  HRESULT Get(int channels, int inRate, int outRate,
+              SpeexResamplerState **resampler);
+
+private:
+  SpeexResamplerState *m_resampler{nullptr};
+  int m_channels{0};
+  int m_inRate{0};
+  int m_outRate{0};
+};
+
+//! Resamples interleaved audio a chunk at a time. The filter history carries
+//! over between calls, so a stream of any length goes through a fixed amount
+//! of memory and the output matches resampling the whole stream at once. The
+//! output is aligned with the input: the filter delay is skipped at the start
+//! and Drain pushes the last input samples through at the end.
+class StreamingResampler {
+public:
+  StreamingResampler() = default;
+  StreamingResampler(const StreamingResampler &) = delete;
+  StreamingResampler &operator=(const StreamingResampler &) = delete;
+  ~StreamingResampler();
+
+  //! Samples are float if isFloat, int16 otherwise. With a cache, a speex
+  //! resampler comes from the cache and stays owned by it.
+  HRESULT Open(int channels, int inRate, int outRate, bool isFloat,
+               ResamplerCache *cache = nullptr);
+
+  //! Resamples up to inFrames frames into at most outCapacity frames.
+  //! Stops when either runs out; *inProcessed and *outFrames report how far
+  //! it got, so callers feed the rest of the input on the next call.
+  HRESULT Process(const void *in, uint32_t inFrames, uint32_t *inProcessed,
+                  void *out, uint32_t outCapacity, uint32_t *outFrames);
+
+  //! Flushes the input still held in the filter, in the same way as Process.
+  //! Call until *outFrames comes back smaller than outCapacity.
+  HRESULT Drain(void *out, uint32_t outCapacity, uint32_t *outFrames);
+
+private:
+  SpeexResamplerState *m_resampler{nullptr};
+  SpeexResamplerState *m_ownedResampler{nullptr};
+  PolyphaseResampler m_polyphase;
+  bool m_isPolyphase{false};
+  int m_channels{0};
+  bool m_isFloat{false};
+  uint32_t m_drainFrames{0}; // silent frames still to feed at the end
+};
+
+// Resamples a whole buffer of audio in a single call. Multichannel audio is
+// interleaved; inCount, outSize and the counts returned are in frames (one
+// sample per channel). With a cache, a speex resampler is reused rather than
+// created for the call. Speex output starts with the filter delay; polyphase
+// output is aligned with the input and ends that much early instead.
+HRESULT ResampleWaveData(int channels, int inRate, int outRate, bool isFloat,
+                         const void *in, int inCount,
+                         unsigned int *inProcessed, void *out, int outSize,
+                         unsigned int *outCount,
+                         ResamplerCache *cache = nullptr);
@@ -0,0 +1,184 @@
+#include "SenderEncoder.h"
+
+#include <opus_multistream.h>
+
+static HRESULT CheckWaveFormat(const WAVEFORMATEX *pwfx,
+                               PcmSampleType *sampleType) {
+  HRESULT hr = S_OK;
+  if (FAILED(GetPcmSampleType(pwfx, sampleType))) {
+    printf("Only supporting 16/24/32-bit integer or 32/64-bit float PCM "
+           "samples\n");
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  if (pwfx->nBlockAlign != pwfx->nChannels * GetPcmSampleSize(*sampleType)) {
+    printf("Padded sample containers are not supported (block-align=%u)\n",
+           (unsigned)pwfx->nBlockAlign);
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+Cleanup:
+  return hr;
+}
+
+SenderEncoder::~SenderEncoder() { opus_multistream_encoder_destroy(m_encoder); }
+
+HRESULT SenderEncoder::Open(const WAVEFORMATEX *pwfx, int frameDurationUs,
+                            const OpusEncoderSettings &settings,
+                            int mappingFamily) {
+  HRESULT hr = S_OK;
+  const int application =
+      GetEncoderApplication(OPUS_APPLICATION_VOIP, frameDurationUs);
+  const int captureRate = (int)pwfx->nSamplesPerSec;
+  const int channels = pwfx->nChannels;
+  int error;
+  size_t sampleSize;
+  SenderPacketHeader *header;
+
+  if (!IsOpusFrameDuration(frameDurationUs)) {
+    printf("Unsupported frame duration %d us\n", frameDurationUs);
+    IFC(E_INVALIDARG);
+  }
+  IFC(CheckWaveFormat(pwfx, &m_sampleType));
+  m_isFloat = m_sampleType != PcmSampleType::Int16;
+  m_needsConversion = m_isFloat && m_sampleType != PcmSampleType::Float32;
+  sampleSize = m_isFloat ? sizeof(float) : sizeof(int16_t);
+  m_frameBytes = channels * sampleSize;
+
+  // More than two channels go out as multistream packets: a surround layout
+  // with family 1, or independent channels such as a microphone array with
+  // family 255.
+  m_channelMapping.family =
+      mappingFamily >= 0 ? mappingFamily : GetDefaultMappingFamily(pwfx);
+  if (!IsChannelMappingFamilySupported(m_channelMapping.family, channels)) {
+    printf("Cannot encode %d channels with mapping family %d\n", channels,
+           m_channelMapping.family);
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+
+  // Setup resampler. Chunks stay a frame long at the capture rate; where
+  // that isn't a whole number of samples, the resampler makes up the
+  // difference over the following chunks.
+  m_isResampling = !IsOpusSampleRate(captureRate);
+  m_encodeRate = m_isResampling ? ResampleTargetRate : captureRate;
+  m_chunkFrames = (uint32_t)GetFrameSizeInSamples(captureRate, frameDurationUs);
+  m_chunkBytes = (size_t)m_chunkFrames * pwfx->nBlockAlign;
+  if (m_chunkFrames == 0) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  m_frameSizeInSamples =
+      GetFrameSizeInSamples(m_encodeRate, frameDurationUs);
+  if (m_isResampling) {
+    IFC(m_resampler.Open(channels, captureRate, m_encodeRate, m_isFloat));
+    m_resampledFrame.resize((size_t)m_frameSizeInSamples * m_frameBytes);
+    m_pendingFrames = 0;
+  }
+  if (m_needsConversion) {
+    m_convertedChunk.resize((size_t)m_chunkFrames * channels);
+  }
+
+  // Setup encoder.
+  m_channelMapping.channels = channels;
+  m_encoder = opus_multistream_surround_encoder_create(
+      m_encodeRate, channels, m_channelMapping.family,
+      &m_channelMapping.streamCount, &m_channelMapping.coupledStreamCount,
+      m_channelMapping.mapping, application, &error);
+  IFC_OPUS(error);
+  IFC(ApplyEncoderSettings(m_encoder, settings));
+  m_channelOrder = GetVorbisChannelOrder(m_channelMapping.family,
+                                         m_channelMapping.channels);
+  if (m_channelOrder) {
+    m_reorderedFrame.resize((size_t)m_frameSizeInSamples * m_frameBytes);
+  }
+
+  // Packets are laid out once; each frame only fills in the payload, its
+  // length and the frame index.
+  m_encodedDataCapacity =
+      (size_t)m_frameSizeInSamples * channels * 4; // 4 bytes per sample
+  m_mappingTableSize = GetChannelMappingTableSize(m_channelMapping);
+  m_packet.resize(sizeof(SenderPacketHeader) + m_mappingTableSize +
+                  m_encodedDataCapacity);
+  header = reinterpret_cast<SenderPacketHeader *>(m_packet.data());
+  header->channels = (uint8_t)channels;
+  header->frameIndex = 0;
+  header->mappingFamily = (uint8_t)m_channelMapping.family;
+  header->samplesPerSecond = m_encodeRate;
+  WriteChannelMappingTable(m_channelMapping,
+                           m_packet.data() + sizeof(SenderPacketHeader));
+
+Cleanup:
+  return hr;
+}
+
+HRESULT SenderEncoder::EncodeFrame(const void *frame,
+                                   const PacketCallback &onPacket) {
+  HRESULT hr = S_OK;
+  SenderPacketHeader *header =
+      reinterpret_cast<SenderPacketHeader *>(m_packet.data());
+  uint8_t *encodedData =
+      m_packet.data() + sizeof(SenderPacketHeader) + m_mappingTableSize;
+  opus_int32 lenOrErr;
+  if (m_channelOrder) {
+    const int channels = m_channelMapping.channels;
+    ReorderChannels(frame, m_reorderedFrame.data(), m_frameSizeInSamples,
+                    channels, m_frameBytes / channels, m_channelOrder);
+    frame = m_reorderedFrame.data();
+  }
+  lenOrErr = m_isFloat
+                 ? opus_multistream_encode_float(
+                       m_encoder, (const float *)frame, m_frameSizeInSamples,
+                       encodedData, (opus_int32)m_encodedDataCapacity)
+                 : opus_multistream_encode(
+                       m_encoder, (const int16_t *)frame,
+                       m_frameSizeInSamples, encodedData,
+                       (opus_int32)m_encodedDataCapacity);
+  if (lenOrErr < 0) {
+    printf("Failed to encode frame %u: %s\n",
+           (unsigned)header->frameIndex + 1, opus_strerror(lenOrErr));
+    IFC(E_FAIL);
+  }
+
+  // Now, packetize and hand it on.
+  header->frameIndex++;
+  header->dataLength = lenOrErr;
+  IFC(onPacket(m_packet.data(),
+               sizeof(*header) + m_mappingTableSize + lenOrErr));
+
+Cleanup:
+  return hr;
+}
+
+HRESULT SenderEncoder::Encode(const uint8_t *chunk,
+                              const PacketCallback &onPacket) {
+  HRESULT hr = S_OK;
+  const uint8_t *input = chunk;
+  uint32_t inFrames = m_chunkFrames;
+  if (m_needsConversion) {
+    ConvertPcmToFloat(m_sampleType, chunk, m_convertedChunk.data(),
+                      m_convertedChunk.size());
+    input = (const uint8_t *)m_convertedChunk.data();
+  }
+  if (!m_isResampling) {
+    IFC(EncodeFrame(input, onPacket));
+    goto Cleanup;
+  }
+
+  while (inFrames > 0) {
+    uint32_t inProcessed;
+    uint32_t outFrames;
+    IFC(m_resampler.Process(
+        input, inFrames, &inProcessed,
+        m_resampledFrame.data() + m_pendingFrames * m_frameBytes,
+        m_frameSizeInSamples - m_pendingFrames, &outFrames));
+    input += inProcessed * m_frameBytes;
+    inFrames -= inProcessed;
+    m_pendingFrames += outFrames;
+    if (m_pendingFrames == (uint32_t)m_frameSizeInSamples) {
+      m_pendingFrames = 0;
+      IFC(EncodeFrame(m_resampledFrame.data(), onPacket));
+    } else if (inProcessed == 0) {
+      break;
+    }
+  }
+
+Cleanup:
+  return hr;
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "FileCodec.h"
+#include "OpusChannelMapping.h"
+#include "PcmConvert.h"
+#include "Resampler.h"
+
+#include <functional>
+#include <vector>
+
+// Turns captured PCM into the packets the sender publishes, one chunk of
+// capture at a time: samples the encoder can't take are widened to float,
+// surround channels are put in Vorbis order, and whole frames are encoded
+// and laid out behind a SenderPacketHeader.
+//
+// Opus only runs at a few rates, so captures at any other rate, such as
+// 44.1 kHz devices, are resampled to ResampleTargetRate first. The
+// resampler lives as long as the encoder, so its filter history and
+// fractional position carry over from one chunk to the next and the encoder
+// sees one continuous stream whatever the chunk boundaries. Resampled audio
+// builds up in a staging frame that is encoded each time it fills, so a
+// chunk completes no frame, one, or now and then two.
+
+//! Starts every published packet. When mappingFamily is not 0 the header is
+//! followed by the channel mapping table (see OpusChannelMapping.h) and then
+//! the multistream payload; family 0 packets carry a plain Opus payload
+//! right after the header, as before. Repeating the table in each packet
+//! lets a receiver set up its decoder from whichever packet it sees first.
+struct SenderPacketHeader {
+  uint32_t dataLength; // payload bytes, not counting the mapping table
+  uint32_t samplesPerSecond;
+  uint16_t frameIndex;
+  uint8_t channels;
+  uint8_t mappingFamily;
+};
+
+class SenderEncoder {
+public:
+  //! Receives each packet; the bytes are only valid during the call.
+  using PacketCallback =
+      std::function<HRESULT(const uint8_t *packet, size_t bytes)>;
+
+  //! Encoder rate for captures at rates Opus doesn't take.
+  static const int ResampleTargetRate = 24000;
+
+  SenderEncoder() = default;
+  SenderEncoder(const SenderEncoder &) = delete;
+  SenderEncoder &operator=(const SenderEncoder &) = delete;
+  ~SenderEncoder();
+
+  //! Sets up for captures in format. mappingFamily is -1 to pick one from
+  //! the format.
+  HRESULT Open(const WAVEFORMATEX *format, int frameDurationUs,
+               const OpusEncoderSettings &settings, int mappingFamily);
+
+  //! The capture rate, or ResampleTargetRate when resampling.
+  int GetEncodeRate() const { return m_encodeRate; }
+  bool IsResampling() const { return m_isResampling; }
+  //! Captured bytes each Encode call takes: a frame's worth at the capture
+  //! rate.
+  size_t GetChunkBytes() const { return m_chunkBytes; }
+  //! Largest packet passed to the callback.
+  size_t GetMaxPacketBytes() const { return m_packet.size(); }
+
+  //! Encodes a chunk of GetChunkBytes() of captured audio, calling onPacket
+  //! for each packet it completes. Returns the first failure from either.
+  HRESULT Encode(const uint8_t *chunk, const PacketCallback &onPacket);
+
+private:
+  HRESULT EncodeFrame(const void *frame, const PacketCallback &onPacket);
+
+  OpusMSEncoder *m_encoder{nullptr};
+  OpusChannelMapping m_channelMapping;
+  PcmSampleType m_sampleType{PcmSampleType::Int16};
+  bool m_isFloat{false};         // encode through the float API
+  bool m_needsConversion{false}; // samples are neither int16 nor float
+  const uint8_t *m_channelOrder{nullptr}; // WAV to Vorbis, if they differ
+  int m_encodeRate{0};
+  int m_frameSizeInSamples{0}; // per channel, at the encode rate
+  size_t m_frameBytes{0};      // one int16 or float sample per channel
+  uint32_t m_chunkFrames{0};   // per channel, at the capture rate
+  size_t m_chunkBytes{0};
+  std::vector<float> m_convertedChunk;
+  std::vector<uint8_t> m_reorderedFrame;
+
+  // Resampling.
+  bool m_isResampling{false};
+  StreamingResampler m_resampler;
+  std::vector<uint8_t> m_resampledFrame;
+  uint32_t m_pendingFrames{0}; // resampled frames waiting for a full frame
+
+  // Header, mapping table and payload, laid out once.
+  std::vector<uint8_t> m_packet;
+  size_t m_mappingTableSize{0};
+  size_t m_encodedDataCapacity{0};
+};
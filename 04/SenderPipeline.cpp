@@ -0,0 +1,341 @@
+#include "SenderPipeline.h"
+
+#include "PacketQueue.h"
+#include "PcmRingBuffer.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t GetElapsedNs(Clock::time_point start) {
+  return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             Clock::now() - start)
+      .count();
+}
+
+static void AddBusyTime(SenderStageStats *stats, uint64_t ns) {
+  stats->busyNs += ns;
+  stats->maxNs = std::max(stats->maxNs, ns);
+}
+
+//! Parks a stage until its neighbour has work for it. Notify only takes the
+//! lock when someone is parked, so the hand-offs stay lock-free while both
+//! sides keep up. The fences order each side's check of the other after its
+//! own store; the timeout is a backstop, not part of the protocol.
+class StageSignal {
+public:
+  template <typename Ready> void Wait(Ready isReady) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_waiters.fetch_add(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!isReady()) {
+      m_condition.wait_for(lock, std::chrono::milliseconds(10));
+    }
+    m_waiters.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  void Notify() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (m_waiters.load(std::memory_order_relaxed) > 0) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_condition.notify_one();
+    }
+  }
+
+private:
+  std::mutex m_mutex;
+  std::condition_variable m_condition;
+  std::atomic<int> m_waiters{0};
+};
+
+//! One run of the pipeline. Open sets everything up on the calling thread;
+//! after that each Run method belongs to one thread, and only touches its
+//! own end of the ring and the queue and its own stage's counters.
+class SenderPipeline {
+public:
+  SenderPipeline(CaptureSource *source, PacketPublisher *publisher,
+                 const SenderOptions &options)
+      : m_source(source), m_publisher(publisher), m_options(options) {}
+  SenderPipeline(const SenderPipeline &) = delete;
+  SenderPipeline &operator=(const SenderPipeline &) = delete;
+
+  HRESULT Open();
+  void RunCapture();
+  void RunEncode();
+  void RunPublish();
+
+  HRESULT GetError() const { return m_error.load(std::memory_order_acquire); }
+  SenderStats &GetStats() { return m_stats; }
+
+private:
+  void Fail(HRESULT hr) {
+    HRESULT expected = S_OK;
+    m_error.compare_exchange_strong(expected, hr, std::memory_order_acq_rel);
+    // Wake every stage so it sees the failure.
+    m_ringSignal.Notify();
+    m_queueSignal.Notify();
+    m_spaceSignal.Notify();
+  }
+  bool HasFailed() const { return FAILED(GetError()); }
+  bool PushPacket(const uint8_t *packet, size_t bytes);
+
+  CaptureSource *m_source;
+  PacketPublisher *m_publisher;
+  SenderOptions m_options;
+
+  // Used by the encode thread once running.
+  SenderEncoder m_encoder;
+
+  // Hand-offs.
+  PcmRingBuffer m_ring;
+  PacketQueue m_queue;
+  StageSignal m_ringSignal;  // capture to encode: frames to encode
+  StageSignal m_queueSignal; // encode to publish: packets to publish
+  StageSignal m_spaceSignal; // publish to encode: room in the queue
+  std::atomic<bool> m_isCaptureDone{false};
+  std::atomic<bool> m_isEncodeDone{false};
+  std::atomic<HRESULT> m_error{S_OK};
+
+  SenderStats m_stats;
+};
+
+HRESULT SenderPipeline::Open() {
+  HRESULT hr = S_OK;
+  const WAVEFORMATEX *pwfx = m_source->GetFormat();
+  if (m_options.queuePackets <= 0) {
+    IFC(E_INVALIDARG);
+  }
+  IFC(m_encoder.Open(pwfx, m_options.frameDurationUs, m_options.encoder,
+                     m_options.mappingFamily));
+  if (m_encoder.IsResampling()) {
+    printf("Resampling %u Hz capture to %d Hz\n",
+           (unsigned)pwfx->nSamplesPerSec, m_encoder.GetEncodeRate());
+  }
+
+  // Room for the source's whole buffer plus a second of audio, far more
+  // than the encoder falls behind by. The encoder reads chunks straight out
+  // of the ring, wrapped or not.
+  IFC(m_ring.Open(((size_t)m_source->GetBufferFrameCount() +
+                   pwfx->nSamplesPerSec) *
+                      pwfx->nBlockAlign,
+                  m_encoder.GetChunkBytes()));
+  IFC(m_queue.Open((size_t)m_options.queuePackets,
+                   m_encoder.GetMaxPacketBytes()));
+
+Cleanup:
+  return hr;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Capture stage.
+
+void SenderPipeline::RunCapture() {
+  HRESULT hr = S_OK;
+  SenderStageStats &stats = m_stats.capture;
+  const size_t blockAlign = m_source->GetFormat()->nBlockAlign;
+  const Clock::time_point stopTime =
+      Clock::now() + std::chrono::milliseconds(m_options.durationMs);
+  const uint8_t *data;
+  uint32_t frameCount;
+  while (!HasFailed() &&
+         (m_options.durationMs <= 0 || Clock::now() < stopTime)) {
+    IFC(m_source->ReadPacket(&data, &frameCount));
+    if (hr == S_FALSE) {
+      break;
+    }
+    if (frameCount == 0) {
+      continue;
+    }
+
+    // Packets rarely line up with encoder frames, so each one is appended
+    // to the ring and handed straight back; the encoder then takes frames
+    // from the ring whatever packets they straddle. A packet that doesn't
+    // fit is dropped whole, keeping the ring frame-aligned.
+    const Clock::time_point start = Clock::now();
+    const size_t bytes = (size_t)frameCount * blockAlign;
+    const size_t writableBytes = m_ring.GetWritableBytes();
+    if (writableBytes >= bytes) {
+      m_ring.Write(data, bytes);
+      m_ringSignal.Notify();
+      ++stats.items;
+      m_stats.ringHighWaterBytes =
+          std::max(m_stats.ringHighWaterBytes,
+                   m_ring.GetCapacity() - writableBytes + bytes);
+    } else {
+      ++stats.drops;
+    }
+    IFC(m_source->ReleasePacket());
+    AddBusyTime(&stats, GetElapsedNs(start));
+  }
+
+Cleanup:
+  if (FAILED(hr)) {
+    Fail(hr);
+  }
+  m_isCaptureDone.store(true, std::memory_order_release);
+  m_ringSignal.Notify();
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Encode stage.
+
+//! Queues a packet by the overflow policy. Returns false when the pipeline
+//! failed while waiting for room.
+bool SenderPipeline::PushPacket(const uint8_t *packet, size_t bytes) {
+  SenderStageStats &stats = m_stats.encode;
+  while (!m_queue.TryPush(packet, bytes)) {
+    if (m_options.overflowPolicy == SenderOverflowPolicy::DropOldest) {
+      if (m_queue.TryDropOldest()) {
+        ++stats.drops;
+      }
+      continue;
+    }
+    if (HasFailed()) {
+      return false;
+    }
+    const Clock::time_point start = Clock::now();
+    m_spaceSignal.Wait([this]() {
+      return m_queue.GetSize() < m_queue.GetCapacity() || HasFailed();
+    });
+    stats.waitNs += GetElapsedNs(start);
+  }
+  m_stats.queueHighWater =
+      std::max(m_stats.queueHighWater, m_queue.GetSize());
+  m_queueSignal.Notify();
+  return true;
+}
+
+void SenderPipeline::RunEncode() {
+  HRESULT hr = S_OK;
+  SenderStageStats &stats = m_stats.encode;
+  const size_t chunkBytes = m_encoder.GetChunkBytes();
+  const SenderEncoder::PacketCallback onPacket =
+      [this, &stats](const uint8_t *packet, size_t bytes) {
+        if (!PushPacket(packet, bytes)) {
+          return E_ABORT;
+        }
+        ++stats.items;
+        return S_OK;
+      };
+  while (!HasFailed()) {
+    // Read the flag first: once capture is done, a ring without a whole
+    // chunk in it never gets one.
+    const bool isCaptureDone = m_isCaptureDone.load(std::memory_order_acquire);
+    const uint8_t *chunk = m_ring.BeginRead(chunkBytes);
+    if (!chunk) {
+      if (isCaptureDone) {
+        break;
+      }
+      m_ringSignal.Wait([this, chunkBytes]() {
+        return m_ring.GetReadableBytes() >= chunkBytes ||
+               m_isCaptureDone.load(std::memory_order_acquire) || HasFailed();
+      });
+      continue;
+    }
+
+    const Clock::time_point start = Clock::now();
+    const uint64_t waitNs = stats.waitNs;
+    hr = m_encoder.Encode(chunk, onPacket);
+    m_ring.EndRead(chunkBytes);
+    IFC(hr);
+    AddBusyTime(&stats, GetElapsedNs(start) - (stats.waitNs - waitNs));
+  }
+
+Cleanup:
+  if (FAILED(hr)) {
+    Fail(hr);
+  }
+  m_isEncodeDone.store(true, std::memory_order_release);
+  m_queueSignal.Notify();
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Publish stage.
+
+void SenderPipeline::RunPublish() {
+  HRESULT hr = S_OK;
+  SenderStageStats &stats = m_stats.publish;
+  std::vector<uint8_t> packet(m_encoder.GetMaxPacketBytes());
+  size_t bytes;
+  for (;;) {
+    const bool isEncodeDone = m_isEncodeDone.load(std::memory_order_acquire);
+    if (!m_queue.TryPop(packet.data(), &bytes)) {
+      if (HasFailed()) {
+        break;
+      }
+      IFC(m_publisher->Flush());
+      if (isEncodeDone) {
+        break;
+      }
+      m_queueSignal.Wait([this]() {
+        return m_queue.GetSize() > 0 ||
+               m_isEncodeDone.load(std::memory_order_acquire) || HasFailed();
+      });
+      continue;
+    }
+    m_spaceSignal.Notify();
+
+    const Clock::time_point start = Clock::now();
+    IFC(m_publisher->Publish(packet.data(), bytes));
+    ++stats.items;
+    AddBusyTime(&stats, GetElapsedNs(start));
+  }
+
+Cleanup:
+  if (FAILED(hr)) {
+    Fail(hr);
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Running and reporting.
+
+HRESULT RunSenderPipeline(CaptureSource *source, PacketPublisher *publisher,
+                          const SenderOptions &options, SenderStats *stats) {
+  HRESULT hr = S_OK;
+  SenderPipeline pipeline(source, publisher, options);
+  Clock::time_point start;
+  IFC(pipeline.Open());
+  IFC(source->Start());
+  start = Clock::now();
+  {
+    std::thread publishThread(&SenderPipeline::RunPublish, &pipeline);
+    std::thread encodeThread(&SenderPipeline::RunEncode, &pipeline);
+    pipeline.RunCapture();
+    source->Stop();
+    encodeThread.join();
+    publishThread.join();
+  }
+  pipeline.GetStats().seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+  if (stats) {
+    *stats = pipeline.GetStats();
+  }
+  IFC(pipeline.GetError());
+
+Cleanup:
+  return hr;
+}
+
+static void PrintStageStats(const char *name, const char *unit,
+                            const SenderStageStats &stats, double seconds) {
+  printf("%-8s %8llu %-7s %6llu dropped  busy %8.1f ms (%5.1f%%)  "
+         "max %8.1f us  blocked %8.1f ms\n",
+         name, (unsigned long long)stats.items, unit,
+         (unsigned long long)stats.drops, stats.busyNs / 1e6,
+         seconds > 0 ? stats.busyNs / 1e7 / seconds : 0.0,
+         stats.maxNs / 1e3, stats.waitNs / 1e6);
+}
+
+void PrintSenderStats(const SenderStats &stats) {
+  PrintStageStats("capture", "packets", stats.capture, stats.seconds);
+  PrintStageStats("encode", "frames", stats.encode, stats.seconds);
+  PrintStageStats("publish", "packets", stats.publish, stats.seconds);
+  printf("ring high water %zu bytes, queue high water %zu packets, %.2f s\n",
+         stats.ringHighWaterBytes, stats.queueHighWater, stats.seconds);
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "CaptureSource.h"
+#include "FileCodec.h"
+#include "SenderEncoder.h"
+
+// The sender runs as three threads, so that neither a slow encode nor a
+// network round trip per packet holds up capture:
+//
+//   capture  reads packets from a CaptureSource into a PcmRingBuffer
+//   encode   takes frame-sized chunks from the ring, runs them through a
+//            SenderEncoder, which resamples them first where the capture
+//            rate needs it, and pushes the packets onto a PacketQueue
+//   publish  pops packets off the queue and hands them to a PacketPublisher
+//
+// Neither hand-off takes a lock; a stage with nothing to do parks until its
+// neighbour signals it.
+//
+// Capture never waits, since a device overwrites whatever isn't read in
+// time: a packet that doesn't fit in the ring is dropped whole. The overflow
+// policy decides what happens when the publisher falls behind and the
+// packet queue fills. DropOldest discards the oldest waiting packet, which
+// keeps latency bounded by the queue; Block holds up the encoder instead,
+// so nothing is lost until the ring fills behind it.
+
+//! What the encoder does when the packet queue is full.
+enum class SenderOverflowPolicy {
+  DropOldest, //!< discard the oldest queued packet
+  Block,      //!< wait for the publisher to make room
+};
+
+//! Options for RunSenderPipeline.
+struct SenderOptions {
+  //! Opus frame duration in microseconds. 2.5 and 5 ms frames suit rooms
+  //! that need the lowest latency, at the cost of more bytes per second.
+  int frameDurationUs = DefaultFrameDurationUs;
+  OpusEncoderSettings encoder;
+  //! Channel mapping family, or -1 to pick one from the capture format.
+  int mappingFamily = -1;
+  //! Encoded packets that can wait for the publisher.
+  int queuePackets = 50;
+  SenderOverflowPolicy overflowPolicy = SenderOverflowPolicy::DropOldest;
+  //! How long to capture for, in milliseconds, or 0 to run until the
+  //! source ends.
+  int durationMs = 10 * 1000;
+};
+
+//! Counters for one stage of the pipeline.
+struct SenderStageStats {
+  uint64_t items = 0;  //!< packets the stage passed on
+  uint64_t busyNs = 0; //!< time spent working rather than waiting for input
+  uint64_t maxNs = 0;  //!< longest time spent on one item
+  uint64_t waitNs = 0; //!< time held up by a full queue
+  uint64_t drops = 0;  //!< items the stage had to drop
+};
+
+//! Counters for a whole run.
+struct SenderStats {
+  SenderStageStats capture; //!< items are capture packets
+  SenderStageStats encode;  //!< items are encoded frames, timed per chunk
+  SenderStageStats publish; //!< items are published packets
+  size_t ringHighWaterBytes = 0;
+  size_t queueHighWater = 0;
+  double seconds = 0; //!< from starting the source to the last publish
+};
+
+//! Where packets go once encoded, such as a redis channel. Called from the
+//! publish thread only.
+class PacketPublisher {
+public:
+  virtual ~PacketPublisher() = default;
+  virtual HRESULT Publish(const uint8_t *packet, size_t bytes) = 0;
+  //! Sends whatever packets the publisher is holding back to batch them.
+  //! Called whenever the queue runs dry, so batching never adds latency
+  //! once the publisher has caught up.
+  virtual HRESULT Flush() { return S_OK; }
+};
+
+//! Captures from source, encodes and publishes until the duration is up or
+//! the source ends, then drains the queues. Fails with the first error any
+//! stage hits. The source must be open and not started.
+HRESULT RunSenderPipeline(CaptureSource *source, PacketPublisher *publisher,
+                          const SenderOptions &options,
+                          SenderStats *stats = nullptr);
+
+//! Prints one line per stage.
+void PrintSenderStats(const SenderStats &stats);
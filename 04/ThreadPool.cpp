@@ -0,0 +1,111 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+// Index of the pool worker running on this thread, or -1 elsewhere.
+static thread_local const WorkStealingPool *t_pool = nullptr;
+static thread_local int t_workerIndex = -1;
+
+WorkStealingPool::WorkStealingPool(int threadCount) {
+  threadCount = std::max(1, threadCount);
+  for (int i = 0; i < threadCount; ++i) {
+    m_queues.push_back(std::make_unique<WorkerQueue>());
+  }
+  for (int i = 0; i < threadCount; ++i) {
+    m_threads.emplace_back(&WorkStealingPool::WorkerMain, this, i);
+  }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+  Wait();
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_workAvailable.notify_all();
+  for (std::thread &thread : m_threads) {
+    thread.join();
+  }
+}
+
+void WorkStealingPool::Submit(Task task) {
+  {
+    // The counts change together with the push, so a worker that sees a
+    // queued task can always find it. Workers never take m_mutex while
+    // holding a queue lock.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const size_t queueIndex = t_pool == this
+                                  ? (size_t)t_workerIndex
+                                  : m_nextQueue++ % m_queues.size();
+    WorkerQueue &queue = *m_queues[queueIndex];
+    std::lock_guard<std::mutex> queueLock(queue.mutex);
+    queue.tasks.push_back(std::move(task));
+    ++m_queued;
+    ++m_pending;
+  }
+  m_workAvailable.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_allDone.wait(lock, [this] { return m_pending == 0; });
+}
+
+uint64_t WorkStealingPool::GetStealCount() const {
+  return m_steals.load(std::memory_order_relaxed);
+}
+
+bool WorkStealingPool::TryTakeTask(int workerIndex, Task *task) {
+  {
+    WorkerQueue &own = *m_queues[workerIndex];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      *task = std::move(own.tasks.front());
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+
+  // Steal from the back, starting with the next worker so thieves spread out
+  // instead of all hitting queue zero.
+  const size_t queueCount = m_queues.size();
+  for (size_t i = 1; i < queueCount; ++i) {
+    WorkerQueue &victim = *m_queues[(workerIndex + i) % queueCount];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      *task = std::move(victim.tasks.back());
+      victim.tasks.pop_back();
+      m_steals.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkStealingPool::WorkerMain(int workerIndex) {
+  t_pool = this;
+  t_workerIndex = workerIndex;
+  for (;;) {
+    Task task;
+    if (TryTakeTask(workerIndex, &task)) {
+      {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_queued;
+      }
+      task(workerIndex);
+      task = nullptr;
+
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if (--m_pending == 0) {
+        m_allDone.notify_all();
+      }
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_workAvailable.wait(lock, [this] { return m_stopping || m_queued > 0; });
+    if (m_stopping && m_queued == 0) {
+      break;
+    }
+  }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//! Fixed-size thread pool where every worker owns a task queue. Tasks
+//! submitted from outside the pool are dealt round-robin across the queues;
+//! tasks submitted by a worker go to its own queue. A worker takes tasks from
+//! the front of its queue and, once that is empty, steals from the back of
+//! the others, so uneven jobs (a two-hour file next to a two-second one)
+//! don't leave threads idle while work remains.
+class WorkStealingPool {
+public:
+  //! Receives the index of the worker running it, in [0, GetThreadCount()),
+  //! so callers can keep per-worker state without locking.
+  using Task = std::function<void(int workerIndex)>;
+
+  explicit WorkStealingPool(int threadCount);
+  WorkStealingPool(const WorkStealingPool &) = delete;
+  WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+  //! Finishes the queued tasks, then joins the workers.
+  ~WorkStealingPool();
+
+  int GetThreadCount() const { return (int)m_threads.size(); }
+
+  void Submit(Task task);
+
+  //! Blocks until every task submitted so far has finished.
+  void Wait();
+
+  //! Tasks taken from another worker's queue since the pool started.
+  uint64_t GetStealCount() const;
+
+private:
+  struct WorkerQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void WorkerMain(int workerIndex);
+  bool TryTakeTask(int workerIndex, Task *task);
+
+  std::vector<std::unique_ptr<WorkerQueue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_workAvailable;
+  std::condition_variable m_allDone;
+  size_t m_queued{0};  // tasks sitting in some queue
+  size_t m_pending{0}; // tasks submitted and not yet finished
+  size_t m_nextQueue{0};
+  std::atomic<uint64_t> m_steals{0};
+  bool m_stopping{false};
+};
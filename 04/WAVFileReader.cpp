@@ -10,9 +10,24 @@
 // http://go.microsoft.com/fwlink/?LinkID=615561
 //-------------------------------------------------------------------------------------
 
+#ifdef _WIN32
 #define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
 #include <Windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+#include <algorithm>
 #include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
 
 #include "WAVFileReader.h"
 
@@ -28,12 +43,152 @@ using namespace DirectX;
 
 namespace
 {
+#ifdef _WIN32
     struct handle_closer { void operator()(HANDLE h) noexcept { if (h) CloseHandle(h); } };
 
     using ScopedHandle = std::unique_ptr<void, handle_closer>;
 
     inline HANDLE safe_handle(HANDLE h) noexcept { return (h == INVALID_HANDLE_VALUE) ? nullptr : h; }
 
+    HRESULT WriteAll(HANDLE hFile, _In_reads_bytes_(size) const void* data, uint64_t size) noexcept
+    {
+        auto ptr = static_cast<const uint8_t*>(data);
+        while (size > 0)
+        {
+            const DWORD request = static_cast<DWORD>(std::min<uint64_t>(size, 1u << 30));
+            DWORD written = 0;
+            if (!WriteFile(hFile, ptr, request, &written, nullptr))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            ptr += written;
+            size -= written;
+        }
+        return S_OK;
+    }
+
+    HRESULT ReadFileAt(HANDLE hFile, uint64_t offset, _Out_writes_bytes_(size) void* data, size_t size) noexcept
+    {
+        auto ptr = static_cast<uint8_t*>(data);
+        while (size > 0)
+        {
+            OVERLAPPED overlapped = {};
+            overlapped.Offset = static_cast<DWORD>(offset);
+            overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+
+            const DWORD request = static_cast<DWORD>(std::min<size_t>(size, 1u << 30));
+            DWORD bytesRead = 0;
+            if (!ReadFile(hFile, ptr, request, &bytesRead, &overlapped))
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            if (!bytesRead)
+            {
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
+            ptr += bytesRead;
+            offset += bytesRead;
+            size -= bytesRead;
+        }
+        return S_OK;
+    }
+#else
+    struct ScopedFd
+    {
+        explicit ScopedFd(int fd) noexcept : m_fd(fd) {}
+        ScopedFd(const ScopedFd&) = delete;
+        ScopedFd& operator=(const ScopedFd&) = delete;
+        ~ScopedFd() { if (m_fd >= 0) close(m_fd); }
+
+        int get() const noexcept { return m_fd; }
+        explicit operator bool() const noexcept { return m_fd >= 0; }
+
+    private:
+        int m_fd;
+    };
+
+    // wchar_t is UTF-32 on the POSIX hosts we build for; file names are UTF-8.
+    // WidenPath carries bytes that aren't UTF-8 over as U+DC80-U+DCFF, which
+    // are turned back into the original bytes here.
+    std::string NarrowPath(_In_z_ const wchar_t* szFileName)
+    {
+        std::string result;
+        for (const wchar_t* p = szFileName; *p; ++p)
+        {
+            auto c = static_cast<uint32_t>(*p);
+            if (c < 0x80)
+            {
+                result += static_cast<char>(c);
+            }
+            else if (c >= 0xDC80 && c <= 0xDCFF)
+            {
+                result += static_cast<char>(c & 0xFF);
+            }
+            else if (c < 0x800)
+            {
+                result += static_cast<char>(0xC0 | (c >> 6));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else if (c < 0x10000)
+            {
+                result += static_cast<char>(0xE0 | (c >> 12));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+            else
+            {
+                result += static_cast<char>(0xF0 | (c >> 18));
+                result += static_cast<char>(0x80 | ((c >> 12) & 0x3F));
+                result += static_cast<char>(0x80 | ((c >> 6) & 0x3F));
+                result += static_cast<char>(0x80 | (c & 0x3F));
+            }
+        }
+        return result;
+    }
+
+    HRESULT WriteAll(int fd, _In_reads_bytes_(size) const void* data, uint64_t size) noexcept
+    {
+        auto ptr = static_cast<const uint8_t*>(data);
+        while (size > 0)
+        {
+            const size_t request = static_cast<size_t>(std::min<uint64_t>(size, 1u << 30));
+            ssize_t written = write(fd, ptr, request);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return HRESULT_FROM_ERRNO(errno);
+            }
+            ptr += written;
+            size -= static_cast<uint64_t>(written);
+        }
+        return S_OK;
+    }
+
+    HRESULT ReadFileAt(int fd, uint64_t offset, _Out_writes_bytes_(size) void* data, size_t size) noexcept
+    {
+        auto ptr = static_cast<uint8_t*>(data);
+        while (size > 0)
+        {
+            ssize_t count = pread(fd, ptr, size, static_cast<off_t>(offset));
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return HRESULT_FROM_ERRNO(errno);
+            }
+            if (count == 0)
+            {
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
+            ptr += count;
+            offset += static_cast<uint64_t>(count);
+            size -= static_cast<size_t>(count);
+        }
+        return S_OK;
+    }
+#endif
+
     //---------------------------------------------------------------------------------
     // .WAV files
     //---------------------------------------------------------------------------------
@@ -47,6 +202,17 @@ namespace
     constexpr uint32_t FOURCC_XWMA_DPDS = MAKEFOURCC('d', 'p', 'd', 's');
     constexpr uint32_t FOURCC_XMA_SEEK = MAKEFOURCC('s', 'e', 'e', 'k');
 
+    //---------------------------------------------------------------------------------
+    // RF64 / BW64 (EBU Tech 3306, ITU-R BS.2088): 32-bit sizes that do not fit are
+    // set to 0xFFFFFFFF and the real values live in a 'ds64' chunk that must be
+    // the first chunk after the form type.
+    //---------------------------------------------------------------------------------
+    constexpr uint32_t FOURCC_RF64_TAG = MAKEFOURCC('R', 'F', '6', '4');
+    constexpr uint32_t FOURCC_BW64_TAG = MAKEFOURCC('B', 'W', '6', '4');
+    constexpr uint32_t FOURCC_DS64_TAG = MAKEFOURCC('d', 's', '6', '4');
+    constexpr uint32_t RF64_SIZE_PLACEHOLDER = 0xFFFFFFFF;
+    constexpr uint32_t FOURCC_JUNK_TAG = MAKEFOURCC('J', 'U', 'N', 'K');
+
 #pragma pack(push,1)
     struct RIFFChunk
     {
@@ -111,6 +277,14 @@ namespace
         uint32_t        loopCount;
         uint32_t        samplerData;
     };
+
+    struct DS64Chunk
+    {
+        uint64_t riffSize;
+        uint64_t dataSize;
+        uint64_t sampleCount;
+        uint32_t tableLength;
+    };
 #pragma pack(pop)
 
     static_assert(sizeof(RIFFChunk) == 8, "structure size mismatch");
@@ -119,22 +293,24 @@ namespace
     static_assert(sizeof(RIFFDLSSample) == 20, "structure size mismatch");
     static_assert(sizeof(MIDILoop) == 24, "structure size mismatch");
     static_assert(sizeof(RIFFMIDISample) == 36, "structure size mismatch");
+    static_assert(sizeof(DS64Chunk) == 28, "structure size mismatch");
 
     //---------------------------------------------------------------------------------
     const RIFFChunk* FindChunk(
         _In_reads_bytes_(sizeBytes) const uint8_t* data,
         _In_ size_t sizeBytes,
         _In_ const uint8_t* upperBound,
-        _In_ uint32_t tag) noexcept
+        _In_ uint32_t tag,
+        _In_ uint64_t dataSize64 = 0) noexcept
     {
-        if (!data)
+        if (!data || data > upperBound)
             return nullptr;
 
         if (sizeBytes < sizeof(RIFFChunk))
             return nullptr;
 
         const uint8_t* ptr = data;
-        const uint8_t* end = data + sizeBytes;
+        const uint8_t* end = data + std::min<size_t>(sizeBytes, static_cast<size_t>(upperBound - data));
 
         while (end > (ptr + sizeof(RIFFChunk)))
         {
@@ -142,15 +318,16 @@ namespace
             if (header->tag == tag)
                 return header;
 
-            const uint64_t offset = static_cast<uint64_t>(header->size) + sizeof(RIFFChunk);
+            uint64_t chunkSize = header->size;
+            if (chunkSize == RF64_SIZE_PLACEHOLDER && header->tag == FOURCC_DATA_TAG && dataSize64)
+                chunkSize = dataSize64;
+
+            const uint64_t offset = chunkSize + sizeof(RIFFChunk);
 
-            if (offset >= UINT32_MAX)
+            if (offset > static_cast<uint64_t>(upperBound - ptr))
                 return nullptr;
 
             ptr += static_cast<size_t>(offset);
-
-            if (ptr > upperBound)
-                return nullptr;
         }
 
         return nullptr;
@@ -158,57 +335,80 @@ namespace
 
 
     //---------------------------------------------------------------------------------
-    HRESULT WaveFindFormatAndData(
+    // Locates the RIFF header and the size of the chunk list that follows it. For
+    // RF64/BW64 files the sizes come from the 'ds64' chunk; pDataSize64 is zero for
+    // plain RIFF files.
+    HRESULT WaveFindRiffHeader(
         _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
         _In_ size_t wavDataSize,
-        _Outptr_ const WAVEFORMATEX** pwfx,
-        _Outptr_ const uint8_t** pdata,
-        _Out_ uint32_t* dataSize,
-        _Out_ bool& dpds,
-        _Out_ bool& seek) noexcept
+        _Outptr_ const RIFFChunkHeader** pRiffHeader,
+        _Out_ size_t* pRiffSize,
+        _Out_ uint64_t* pDataSize64) noexcept
     {
-        if (!wavData || !pwfx)
-            return E_POINTER;
-
-        dpds = seek = false;
+        *pRiffHeader = nullptr;
+        *pRiffSize = 0;
+        *pDataSize64 = 0;
 
-        if (wavDataSize < (sizeof(RIFFChunk) * 2 + sizeof(uint32_t) + sizeof(WAVEFORMAT)))
+        if (wavDataSize < sizeof(RIFFChunkHeader))
         {
             return E_FAIL;
         }
 
         const uint8_t* wavEnd = wavData + wavDataSize;
 
-        // Locate RIFF 'WAVE'
-        auto riffChunk = FindChunk(wavData, wavDataSize, wavEnd, FOURCC_RIFF_TAG);
-        if (!riffChunk || riffChunk->size < 4)
+        auto riffHeader = reinterpret_cast<const RIFFChunkHeader*>(wavData);
+        if (riffHeader->tag == FOURCC_RF64_TAG || riffHeader->tag == FOURCC_BW64_TAG)
         {
-            return E_FAIL;
-        }
+            auto ptr = wavData + sizeof(RIFFChunkHeader);
+            if ((ptr + sizeof(RIFFChunk) + sizeof(DS64Chunk)) > wavEnd)
+            {
+                return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
 
-        auto riffHeader = reinterpret_cast<const RIFFChunkHeader*>(riffChunk);
-        if (riffHeader->riff != FOURCC_WAVE_FILE_TAG && riffHeader->riff != FOURCC_XWMA_FILE_TAG)
-        {
-            return E_FAIL;
-        }
+            auto ds64Chunk = reinterpret_cast<const RIFFChunk*>(ptr);
+            if (ds64Chunk->tag != FOURCC_DS64_TAG || ds64Chunk->size < sizeof(DS64Chunk))
+            {
+                return E_FAIL;
+            }
 
-        // Locate 'fmt '
-        auto ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
-        if ((ptr + sizeof(RIFFChunk)) > wavEnd)
+            auto ds64 = reinterpret_cast<const DS64Chunk*>(ptr + sizeof(RIFFChunk));
+            *pRiffSize = static_cast<size_t>(std::min<uint64_t>(ds64->riffSize, SIZE_MAX));
+            *pDataSize64 = ds64->dataSize;
+        }
+        else
         {
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            auto riffChunk = FindChunk(wavData, wavDataSize, wavEnd, FOURCC_RIFF_TAG);
+            if (!riffChunk)
+            {
+                return E_FAIL;
+            }
+
+            riffHeader = reinterpret_cast<const RIFFChunkHeader*>(riffChunk);
+            *pRiffSize = riffHeader->size;
         }
 
-        auto fmtChunk = FindChunk(ptr, riffHeader->size, wavEnd, FOURCC_FORMAT_TAG);
-        if (!fmtChunk || fmtChunk->size < sizeof(PCMWAVEFORMAT))
+        if (*pRiffSize < 4)
         {
             return E_FAIL;
         }
 
-        ptr = reinterpret_cast<const uint8_t*>(fmtChunk) + sizeof(RIFFChunk);
-        if (ptr + fmtChunk->size > wavEnd)
+        *pRiffHeader = riffHeader;
+        return S_OK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    HRESULT ValidateWaveFormat(
+        _In_reads_bytes_(fmtSize) const uint8_t* ptr,
+        _In_ uint32_t fmtSize,
+        _Out_ bool& dpds,
+        _Out_ bool& seek) noexcept
+    {
+        dpds = seek = false;
+
+        if (fmtSize < sizeof(PCMWAVEFORMAT))
         {
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            return E_FAIL;
         }
 
         auto wf = reinterpret_cast<const WAVEFORMAT*>(ptr);
@@ -224,14 +424,14 @@ namespace
 
             default:
             {
-                if (fmtChunk->size < sizeof(WAVEFORMATEX))
+                if (fmtSize < sizeof(WAVEFORMATEX))
                 {
                     return E_FAIL;
                 }
 
                 auto wfx = reinterpret_cast<const WAVEFORMATEX*>(ptr);
 
-                if (fmtChunk->size < (sizeof(WAVEFORMATEX) + wfx->cbSize))
+                if (fmtSize < (sizeof(WAVEFORMATEX) + wfx->cbSize))
                 {
                     return E_FAIL;
                 }
@@ -244,7 +444,7 @@ namespace
                         break;
 
                     case  0x166 /*WAVE_FORMAT_XMA2*/: // XMA2 is supported by Xbox One
-                        if ((fmtChunk->size < 52 /*sizeof(XMA2WAVEFORMATEX)*/) || (wfx->cbSize < 34 /*( sizeof(XMA2WAVEFORMATEX) - sizeof(WAVEFORMATEX) )*/))
+                        if ((fmtSize < 52 /*sizeof(XMA2WAVEFORMATEX)*/) || (wfx->cbSize < 34 /*( sizeof(XMA2WAVEFORMATEX) - sizeof(WAVEFORMATEX) )*/))
                         {
                             return E_FAIL;
                         }
@@ -252,14 +452,14 @@ namespace
                         break;
 
                     case WAVE_FORMAT_ADPCM:
-                        if ((fmtChunk->size < (sizeof(WAVEFORMATEX) + 32)) || (wfx->cbSize < 32 /*MSADPCM_FORMAT_EXTRA_BYTES*/))
+                        if ((fmtSize < (sizeof(WAVEFORMATEX) + 32)) || (wfx->cbSize < 32 /*MSADPCM_FORMAT_EXTRA_BYTES*/))
                         {
                             return E_FAIL;
                         }
                         break;
 
                     case WAVE_FORMAT_EXTENSIBLE:
-                        if ((fmtChunk->size < sizeof(WAVEFORMATEXTENSIBLE)) || (wfx->cbSize < (sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))))
+                        if ((fmtSize < sizeof(WAVEFORMATEXTENSIBLE)) || (wfx->cbSize < (sizeof(WAVEFORMATEXTENSIBLE) - sizeof(WAVEFORMATEX))))
                         {
                             return E_FAIL;
                         }
@@ -301,27 +501,203 @@ namespace
             }
         }
 
-        // Locate 'data'
-        ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
-        if ((ptr + sizeof(RIFFChunk)) > wavEnd)
+        return S_OK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    // Locations of the chunks inside the RIFF body, gathered in a single pass so the
+    // lookups below never rescan large 'LIST'/'JUNK'/'bext' chunks.
+    struct WaveChunkIndex
+    {
+        struct Entry
+        {
+            uint32_t tag;
+            const uint8_t* data;    // chunk payload
+            uint64_t size;          // payload size, with RF64 'data' resolved
+        };
+
+        static constexpr size_t MaxEntries = 16;
+
+        const RIFFChunkHeader* riffHeader;
+        const uint8_t* wavEnd;
+        Entry entries[MaxEntries];
+        size_t count;
+
+        const Entry* Find(uint32_t tag) const noexcept
+        {
+            for (size_t j = 0; j < count; ++j)
+            {
+                if (entries[j].tag == tag)
+                    return &entries[j];
+            }
+            return nullptr;
+        }
+    };
+
+    // Tags the loaders look up; they keep their slot even when the index is full.
+    inline bool IsLookupTag(uint32_t tag) noexcept
+    {
+        return tag == FOURCC_FORMAT_TAG || tag == FOURCC_DATA_TAG ||
+            tag == FOURCC_DLS_SAMPLE || tag == FOURCC_MIDI_SAMPLE ||
+            tag == FOURCC_XWMA_DPDS || tag == FOURCC_XMA_SEEK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    HRESULT WaveBuildChunkIndex(
+        _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
+        _In_ size_t wavDataSize,
+        _Out_ WaveChunkIndex& index) noexcept
+    {
+        if (!wavData)
+            return E_POINTER;
+
+        index.riffHeader = nullptr;
+        index.wavEnd = wavData + wavDataSize;
+        index.count = 0;
+
+        if (wavDataSize < (sizeof(RIFFChunk) + sizeof(uint32_t)))
+        {
+            return E_FAIL;
+        }
+
+        // Locate RIFF 'WAVE'
+        const RIFFChunkHeader* riffHeader;
+        size_t riffSize;
+        uint64_t dataSize64;
+        HRESULT hr = WaveFindRiffHeader(wavData, wavDataSize, &riffHeader, &riffSize, &dataSize64);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        auto ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
+        if ((ptr + sizeof(RIFFChunk)) > index.wavEnd)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+
+        index.riffHeader = riffHeader;
+
+        // Walk the chunk list once; the first chunk with a given tag wins, as with FindChunk.
+        const uint8_t* end = ptr + std::min<size_t>(riffSize, static_cast<size_t>(index.wavEnd - ptr));
+        while (end > (ptr + sizeof(RIFFChunk)))
+        {
+            auto header = reinterpret_cast<const RIFFChunk*>(ptr);
+
+            uint64_t chunkSize = header->size;
+            if (chunkSize == RF64_SIZE_PLACEHOLDER && header->tag == FOURCC_DATA_TAG && dataSize64)
+                chunkSize = dataSize64;
+
+            if (!index.Find(header->tag))
+            {
+                WaveChunkIndex::Entry* slot = nullptr;
+                if (index.count < WaveChunkIndex::MaxEntries)
+                {
+                    slot = &index.entries[index.count++];
+                }
+                else if (IsLookupTag(header->tag))
+                {
+                    for (size_t j = WaveChunkIndex::MaxEntries; j-- > 0;)
+                    {
+                        if (!IsLookupTag(index.entries[j].tag))
+                        {
+                            slot = &index.entries[j];
+                            break;
+                        }
+                    }
+                }
+
+                if (slot)
+                {
+                    slot->tag = header->tag;
+                    slot->data = ptr + sizeof(RIFFChunk);
+                    slot->size = chunkSize;
+                }
+            }
+
+            const uint64_t offset = chunkSize + sizeof(RIFFChunk);
+            if (offset > static_cast<uint64_t>(index.wavEnd - ptr))
+                break;
+
+            ptr += static_cast<size_t>(offset);
+        }
+
+        return S_OK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    HRESULT WaveFindFormat(
+        _In_ const WaveChunkIndex& index,
+        _Outptr_ const WAVEFORMATEX** pwfx,
+        _Out_ bool& dpds,
+        _Out_ bool& seek) noexcept
+    {
+        if (!pwfx)
+            return E_POINTER;
+
+        dpds = seek = false;
+
+        if (index.riffHeader->riff != FOURCC_WAVE_FILE_TAG && index.riffHeader->riff != FOURCC_XWMA_FILE_TAG)
+        {
+            return E_FAIL;
+        }
+
+        // Locate 'fmt '
+        auto fmtChunk = index.Find(FOURCC_FORMAT_TAG);
+        if (!fmtChunk || fmtChunk->size < sizeof(PCMWAVEFORMAT))
+        {
+            return E_FAIL;
+        }
+
+        if (fmtChunk->size > static_cast<uint64_t>(index.wavEnd - fmtChunk->data))
         {
             return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
         }
 
-        auto dataChunk = FindChunk(ptr, riffChunk->size, wavEnd, FOURCC_DATA_TAG);
+        HRESULT hr = ValidateWaveFormat(fmtChunk->data, static_cast<uint32_t>(fmtChunk->size), dpds, seek);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        *pwfx = reinterpret_cast<const WAVEFORMATEX*>(fmtChunk->data);
+        return S_OK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    HRESULT WaveFindFormatAndData(
+        _In_ const WaveChunkIndex& index,
+        _Outptr_ const WAVEFORMATEX** pwfx,
+        _Outptr_ const uint8_t** pdata,
+        _Out_ uint64_t* dataSize,
+        _Out_ bool& dpds,
+        _Out_ bool& seek) noexcept
+    {
+        const WAVEFORMATEX* wfx;
+        HRESULT hr = WaveFindFormat(index, &wfx, dpds, seek);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        // Locate 'data'
+        auto dataChunk = index.Find(FOURCC_DATA_TAG);
         if (!dataChunk || !dataChunk->size)
         {
             return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
         }
 
-        ptr = reinterpret_cast<const uint8_t*>(dataChunk) + sizeof(RIFFChunk);
-        if (ptr + dataChunk->size > wavEnd)
+        if (dataChunk->size > static_cast<uint64_t>(index.wavEnd - dataChunk->data))
         {
             return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
         }
 
-        *pwfx = reinterpret_cast<const WAVEFORMATEX*>(wf);
-        *pdata = ptr;
+        *pwfx = wfx;
+        *pdata = dataChunk->data;
         *dataSize = dataChunk->size;
         return S_OK;
     }
@@ -329,55 +705,33 @@ namespace
 
     //---------------------------------------------------------------------------------
     HRESULT WaveFindLoopInfo(
-        _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
-        _In_ size_t wavDataSize,
+        _In_ const WaveChunkIndex& index,
         _Out_ uint32_t* pLoopStart,
         _Out_ uint32_t* pLoopLength) noexcept
     {
-        if (!wavData || !pLoopStart || !pLoopLength)
+        if (!pLoopStart || !pLoopLength)
             return E_POINTER;
 
-        if (wavDataSize < (sizeof(RIFFChunk) + sizeof(uint32_t)))
-        {
-            return E_FAIL;
-        }
-
         *pLoopStart = 0;
         *pLoopLength = 0;
 
-        const uint8_t* wavEnd = wavData + wavDataSize;
-
-        // Locate RIFF 'WAVE'
-        auto riffChunk = FindChunk(wavData, wavDataSize, wavEnd, FOURCC_RIFF_TAG);
-        if (!riffChunk || riffChunk->size < 4)
-        {
-            return E_FAIL;
-        }
-
-        auto riffHeader = reinterpret_cast<const RIFFChunkHeader*>(riffChunk);
-        if (riffHeader->riff == FOURCC_XWMA_FILE_TAG)
+        if (index.riffHeader->riff == FOURCC_XWMA_FILE_TAG)
         {
             // xWMA files do not contain loop information
             return S_OK;
         }
 
-        if (riffHeader->riff != FOURCC_WAVE_FILE_TAG)
+        if (index.riffHeader->riff != FOURCC_WAVE_FILE_TAG)
         {
             return E_FAIL;
         }
 
         // Locate 'wsmp' (DLS Chunk)
-        auto ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
-        if ((ptr + sizeof(RIFFChunk)) > wavEnd)
-        {
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
-        }
-
-        auto dlsChunk = FindChunk(ptr, riffChunk->size, wavEnd, FOURCC_DLS_SAMPLE);
+        auto dlsChunk = index.Find(FOURCC_DLS_SAMPLE);
         if (dlsChunk)
         {
-            ptr = reinterpret_cast<const uint8_t*>(dlsChunk) + sizeof(RIFFChunk);
-            if (ptr + dlsChunk->size > wavEnd)
+            auto ptr = dlsChunk->data;
+            if (dlsChunk->size > static_cast<uint64_t>(index.wavEnd - ptr))
             {
                 return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
             }
@@ -404,11 +758,11 @@ namespace
         }
 
         // Locate 'smpl' (Sample Chunk)
-        auto midiChunk = FindChunk(ptr, riffChunk->size, wavEnd, FOURCC_MIDI_SAMPLE);
+        auto midiChunk = index.Find(FOURCC_MIDI_SAMPLE);
         if (midiChunk)
         {
-            ptr = reinterpret_cast<const uint8_t*>(midiChunk) + sizeof(RIFFChunk);
-            if (ptr + midiChunk->size > wavEnd)
+            auto ptr = midiChunk->data;
+            if (midiChunk->size > static_cast<uint64_t>(index.wavEnd - ptr))
             {
                 return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
             }
@@ -440,50 +794,27 @@ namespace
 
     //---------------------------------------------------------------------------------
     HRESULT WaveFindTable(
-        _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
-        _In_ size_t wavDataSize,
+        _In_ const WaveChunkIndex& index,
         _In_ uint32_t tag,
         _Outptr_result_maybenull_ const uint32_t** pData,
         _Out_ uint32_t* dataCount) noexcept
     {
-        if (!wavData || !pData || !dataCount)
+        if (!pData || !dataCount)
             return E_POINTER;
 
-        if (wavDataSize < (sizeof(RIFFChunk) + sizeof(uint32_t)))
-        {
-            return E_FAIL;
-        }
-
-        *pData = nullptr;
-        *dataCount = 0;
-
-        const uint8_t* wavEnd = wavData + wavDataSize;
-
-        // Locate RIFF 'WAVE'
-        auto riffChunk = FindChunk(wavData, wavDataSize, wavEnd, FOURCC_RIFF_TAG);
-        if (!riffChunk || riffChunk->size < 4)
-        {
-            return E_FAIL;
-        }
-
-        auto riffHeader = reinterpret_cast<const RIFFChunkHeader*>(riffChunk);
-        if (riffHeader->riff != FOURCC_WAVE_FILE_TAG && riffHeader->riff != FOURCC_XWMA_FILE_TAG)
+        *pData = nullptr;
+        *dataCount = 0;
+
+        if (index.riffHeader->riff != FOURCC_WAVE_FILE_TAG && index.riffHeader->riff != FOURCC_XWMA_FILE_TAG)
         {
             return E_FAIL;
         }
 
         // Locate tag
-        auto ptr = reinterpret_cast<const uint8_t*>(riffHeader) + sizeof(RIFFChunkHeader);
-        if ((ptr + sizeof(RIFFChunk)) > wavEnd)
-        {
-            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
-        }
-
-        auto tableChunk = FindChunk(ptr, riffChunk->size, wavEnd, tag);
+        auto tableChunk = index.Find(tag);
         if (tableChunk)
         {
-            ptr = reinterpret_cast<const uint8_t*>(tableChunk) + sizeof(RIFFChunk);
-            if (ptr + tableChunk->size > wavEnd)
+            if (tableChunk->size > static_cast<uint64_t>(index.wavEnd - tableChunk->data))
             {
                 return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
             }
@@ -493,8 +824,8 @@ namespace
                 return E_FAIL;
             }
 
-            *pData = reinterpret_cast<const uint32_t*>(ptr);
-            *dataCount = tableChunk->size / 4;
+            *pData = reinterpret_cast<const uint32_t*>(tableChunk->data);
+            *dataCount = static_cast<uint32_t>(tableChunk->size / 4);
         }
 
         return S_OK;
@@ -510,6 +841,7 @@ namespace
         if (!szFileName)
             return E_INVALIDARG;
 
+    #ifdef _WIN32
         // open the file
     #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
         ScopedHandle hFile(safe_handle(CreateFile2(
@@ -568,6 +900,321 @@ namespace
         }
 
         return (*bytesRead < fileInfo.EndOfFile.LowPart) ? E_FAIL : S_OK;
+    #else
+        ScopedFd hFile(open(NarrowPath(szFileName).c_str(), O_RDONLY | O_CLOEXEC));
+        if (!hFile)
+        {
+            return HRESULT_FROM_ERRNO(errno);
+        }
+
+        struct stat fileInfo;
+        if (fstat(hFile.get(), &fileInfo) != 0)
+        {
+            return HRESULT_FROM_ERRNO(errno);
+        }
+
+        // File is too big for 32-bit allocation, so reject read
+        if (static_cast<uint64_t>(fileInfo.st_size) > UINT32_MAX)
+        {
+            return E_FAIL;
+        }
+
+        // Need at least enough data to have a valid minimal WAV file
+        const auto fileSize = static_cast<DWORD>(fileInfo.st_size);
+        if (fileSize < (sizeof(RIFFChunk) * 2 + sizeof(DWORD) + sizeof(WAVEFORMAT)))
+        {
+            return E_FAIL;
+        }
+
+        // create enough space for the file data
+        wavData.reset(new (std::nothrow) uint8_t[fileSize]);
+        if (!wavData)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        // read the data in
+        *bytesRead = 0;
+        while (*bytesRead < fileSize)
+        {
+            ssize_t count = read(hFile.get(), wavData.get() + *bytesRead, fileSize - *bytesRead);
+            if (count < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                return HRESULT_FROM_ERRNO(errno);
+            }
+            if (count == 0)
+                break;
+            *bytesRead += static_cast<DWORD>(count);
+        }
+
+        return (*bytesRead < fileSize) ? E_FAIL : S_OK;
+    #endif
+    }
+
+
+    //---------------------------------------------------------------------------------
+    HRESULT NarrowWAVData(_In_ const WAVData64& source, _Out_ WAVData& result) noexcept
+    {
+        if (source.audioBytes > UINT32_MAX)
+        {
+            return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+        }
+
+        result.wfx = source.wfx;
+        result.startAudio = source.startAudio;
+        result.audioBytes = static_cast<uint32_t>(source.audioBytes);
+        result.loopStart = source.loopStart;
+        result.loopLength = source.loopLength;
+        result.seek = source.seek;
+        result.seekCount = source.seekCount;
+        return S_OK;
+    }
+
+
+    //---------------------------------------------------------------------------------
+    // Writes 'fmt ' and 'data' with one write for the headers and one for the audio.
+    // Files whose RIFF size does not fit in 32 bits are written as RF64.
+    HRESULT WriteWAVFile(
+        _In_z_ const wchar_t* szFileName,
+        _In_ const WAVEFORMATEX* wfx,
+        _In_reads_bytes_(audioBytes) const uint8_t* startAudio,
+        _In_ uint64_t audioBytes) noexcept
+    {
+        if (!szFileName || !wfx || (!startAudio && audioBytes))
+            return E_INVALIDARG;
+
+        const uint32_t formatBytes = static_cast<uint32_t>(sizeof(WAVEFORMATEX)) + wfx->cbSize;
+        uint64_t riffSize =
+            sizeof(uint32_t) +
+            sizeof(RIFFChunk) + formatBytes +
+            sizeof(RIFFChunk) + audioBytes;
+        const bool isRF64 = riffSize > UINT32_MAX;
+        if (isRF64)
+        {
+            riffSize += sizeof(RIFFChunk) + sizeof(DS64Chunk);
+        }
+
+        const size_t headerCapacity =
+            sizeof(RIFFChunkHeader) +
+            sizeof(RIFFChunk) + sizeof(DS64Chunk) +
+            sizeof(RIFFChunk) + formatBytes +
+            sizeof(RIFFChunk);
+        std::unique_ptr<uint8_t[]> header(new (std::nothrow) uint8_t[headerCapacity]);
+        if (!header)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        size_t headerBytes = 0;
+        auto append = [&](const void* ptr, size_t size) noexcept
+        {
+            memcpy(header.get() + headerBytes, ptr, size);
+            headerBytes += size;
+        };
+
+        // RIFF 'WAVE' (or RF64 'WAVE' + 'ds64')
+        RIFFChunkHeader riffHeader;
+        riffHeader.tag = isRF64 ? FOURCC_RF64_TAG : FOURCC_RIFF_TAG;
+        riffHeader.size = isRF64 ? RF64_SIZE_PLACEHOLDER : static_cast<uint32_t>(riffSize);
+        riffHeader.riff = FOURCC_WAVE_FILE_TAG;
+        append(&riffHeader, sizeof(riffHeader));
+
+        if (isRF64)
+        {
+            RIFFChunk ds64Chunk = { FOURCC_DS64_TAG, sizeof(DS64Chunk) };
+            DS64Chunk ds64;
+            ds64.riffSize = riffSize;
+            ds64.dataSize = audioBytes;
+            ds64.sampleCount = wfx->nBlockAlign ? audioBytes / wfx->nBlockAlign : 0;
+            ds64.tableLength = 0;
+            append(&ds64Chunk, sizeof(ds64Chunk));
+            append(&ds64, sizeof(ds64));
+        }
+
+        // RIFF 'fmt '
+        RIFFChunk format = { FOURCC_FORMAT_TAG, formatBytes };
+        append(&format, sizeof(format));
+        append(wfx, formatBytes);
+
+        // RIFF 'data'
+        RIFFChunk dataChunk = { FOURCC_DATA_TAG, isRF64 ? RF64_SIZE_PLACEHOLDER : static_cast<uint32_t>(audioBytes) };
+        append(&dataChunk, sizeof(dataChunk));
+
+        // open the file
+    #ifdef _WIN32
+    #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+        ScopedHandle hFile(safe_handle(CreateFile2(
+            szFileName,
+            GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS,
+            nullptr)));
+    #else
+        ScopedHandle hFile(safe_handle(CreateFileW(
+            szFileName,
+            GENERIC_WRITE, FILE_SHARE_READ,
+            nullptr,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+            nullptr)));
+    #endif
+
+        if (!hFile)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+    #else
+        ScopedFd hFile(open(NarrowPath(szFileName).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (!hFile)
+        {
+            return HRESULT_FROM_ERRNO(errno);
+        }
+    #endif
+
+        HRESULT hr = WriteAll(hFile.get(), header.get(), headerBytes);
+        if (FAILED(hr))
+            return hr;
+
+        return WriteAll(hFile.get(), startAudio, audioBytes);
+    }
+}
+
+
+//-------------------------------------------------------------------------------------
+// WAVFileMapping
+//-------------------------------------------------------------------------------------
+DirectX::WAVFileMapping::WAVFileMapping(WAVFileMapping&& other) noexcept :
+    m_data(other.m_data),
+    m_size(other.m_size)
+{
+    other.m_data = nullptr;
+    other.m_size = 0;
+}
+
+DirectX::WAVFileMapping& DirectX::WAVFileMapping::operator=(WAVFileMapping&& other) noexcept
+{
+    if (this != &other)
+    {
+        Close();
+        m_data = other.m_data;
+        m_size = other.m_size;
+        other.m_data = nullptr;
+        other.m_size = 0;
+    }
+    return *this;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVFileMapping::Open(const wchar_t* szFileName) noexcept
+{
+    if (!szFileName)
+        return E_INVALIDARG;
+
+    Close();
+
+#ifdef _WIN32
+    #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    ScopedHandle hFile(safe_handle(CreateFile2(
+        szFileName,
+        GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING,
+        nullptr)));
+    #else
+    ScopedHandle hFile(safe_handle(CreateFileW(
+        szFileName,
+        GENERIC_READ, FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+        nullptr)));
+    #endif
+
+    if (!hFile)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    FILE_STANDARD_INFO fileInfo;
+    if (!GetFileInformationByHandleEx(hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const auto fileSize = static_cast<uint64_t>(fileInfo.EndOfFile.QuadPart);
+    if (fileSize < (sizeof(RIFFChunk) * 2 + sizeof(DWORD) + sizeof(WAVEFORMAT)))
+    {
+        return E_FAIL;
+    }
+
+    if (fileSize > SIZE_MAX)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    // The view keeps the section alive, so neither handle needs to outlive this call.
+    ScopedHandle hMapping(CreateFileMappingW(hFile.get(), nullptr, PAGE_READONLY, 0, 0, nullptr));
+    if (!hMapping)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    auto view = MapViewOfFile(hMapping.get(), FILE_MAP_READ, 0, 0, 0);
+    if (!view)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = fileSize;
+#else
+    ScopedFd hFile(open(NarrowPath(szFileName).c_str(), O_RDONLY | O_CLOEXEC));
+    if (!hFile)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+
+    struct stat fileInfo;
+    if (fstat(hFile.get(), &fileInfo) != 0)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+
+    const auto fileSize = static_cast<uint64_t>(fileInfo.st_size);
+    if (fileSize < (sizeof(RIFFChunk) * 2 + sizeof(DWORD) + sizeof(WAVEFORMAT)))
+    {
+        return E_FAIL;
+    }
+
+    if (fileSize > SIZE_MAX)
+    {
+        return HRESULT_FROM_WIN32(ERROR_ARITHMETIC_OVERFLOW);
+    }
+
+    // The mapping holds its own reference to the file, so the descriptor can close.
+    void* view = mmap(nullptr, static_cast<size_t>(fileSize), PROT_READ, MAP_PRIVATE, hFile.get(), 0);
+    if (view == MAP_FAILED)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+
+    // Audio is consumed front to back; let the kernel read ahead aggressively.
+    (void)madvise(view, static_cast<size_t>(fileSize), MADV_SEQUENTIAL);
+
+    m_data = static_cast<const uint8_t*>(view);
+    m_size = fileSize;
+#endif
+
+    return S_OK;
+}
+
+void DirectX::WAVFileMapping::Close() noexcept
+{
+    if (m_data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<uint8_t*>(m_data), static_cast<size_t>(m_size));
+#endif
+        m_data = nullptr;
+        m_size = 0;
     }
 }
 
@@ -593,11 +1240,25 @@ HRESULT DirectX::LoadWAVAudioInMemory(
         return E_FAIL;
     }
 
+    WaveChunkIndex index;
+    HRESULT hr = WaveBuildChunkIndex(wavData, wavDataSize, index);
+    if (FAILED(hr))
+        return hr;
+
     bool dpds, seek;
-    HRESULT hr = WaveFindFormatAndData(wavData, wavDataSize, wfx, startAudio, audioBytes, dpds, seek);
+    uint64_t dataSize;
+    hr = WaveFindFormatAndData(index, wfx, startAudio, &dataSize, dpds, seek);
     if (FAILED(hr))
         return hr;
 
+    if (dataSize > UINT32_MAX)
+    {
+        *wfx = nullptr;
+        *startAudio = nullptr;
+        return HRESULT_FROM_WIN32(ERROR_FILE_TOO_LARGE);
+    }
+
+    *audioBytes = static_cast<uint32_t>(dataSize);
     return (dpds || seek) ? E_FAIL : S_OK;
 }
 
@@ -625,12 +1286,7 @@ HRESULT DirectX::LoadWAVAudioFromFile(
         return hr;
     }
 
-    bool dpds, seek;
-    hr = WaveFindFormatAndData(wavData.get(), bytesRead, wfx, startAudio, audioBytes, dpds, seek);
-    if (FAILED(hr))
-        return hr;
-
-    return (dpds || seek) ? E_FAIL : S_OK;
+    return LoadWAVAudioInMemory(wavData.get(), bytesRead, wfx, startAudio, audioBytes);
 }
 
 
@@ -639,7 +1295,7 @@ _Use_decl_annotations_
 HRESULT DirectX::LoadWAVAudioInMemoryEx(
     const uint8_t* wavData,
     size_t wavDataSize,
-    DirectX::WAVData& result) noexcept
+    DirectX::WAVData64& result) noexcept
 {
     if (!wavData)
         return E_INVALIDARG;
@@ -652,24 +1308,29 @@ HRESULT DirectX::LoadWAVAudioInMemoryEx(
         return E_FAIL;
     }
 
+    WaveChunkIndex index;
+    HRESULT hr = WaveBuildChunkIndex(wavData, wavDataSize, index);
+    if (FAILED(hr))
+        return hr;
+
     bool dpds, seek;
-    HRESULT hr = WaveFindFormatAndData(wavData, wavDataSize, &result.wfx, &result.startAudio, &result.audioBytes, dpds, seek);
+    hr = WaveFindFormatAndData(index, &result.wfx, &result.startAudio, &result.audioBytes, dpds, seek);
     if (FAILED(hr))
         return hr;
 
-    hr = WaveFindLoopInfo(wavData, wavDataSize, &result.loopStart, &result.loopLength);
+    hr = WaveFindLoopInfo(index, &result.loopStart, &result.loopLength);
     if (FAILED(hr))
         return hr;
 
     if (dpds)
     {
-        hr = WaveFindTable(wavData, wavDataSize, FOURCC_XWMA_DPDS, &result.seek, &result.seekCount);
+        hr = WaveFindTable(index, FOURCC_XWMA_DPDS, &result.seek, &result.seekCount);
         if (FAILED(hr))
             return hr;
     }
     else if (seek)
     {
-        hr = WaveFindTable(wavData, wavDataSize, FOURCC_XMA_SEEK, &result.seek, &result.seekCount);
+        hr = WaveFindTable(index, FOURCC_XMA_SEEK, &result.seek, &result.seekCount);
         if (FAILED(hr))
             return hr;
     }
@@ -678,6 +1339,24 @@ HRESULT DirectX::LoadWAVAudioInMemoryEx(
 }
 
 
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::LoadWAVAudioInMemoryEx(
+    const uint8_t* wavData,
+    size_t wavDataSize,
+    DirectX::WAVData& result) noexcept
+{
+    memset(&result, 0, sizeof(result));
+
+    WAVData64 result64;
+    HRESULT hr = LoadWAVAudioInMemoryEx(wavData, wavDataSize, result64);
+    if (FAILED(hr))
+        return hr;
+
+    return NarrowWAVData(result64, result);
+}
+
+
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
 HRESULT DirectX::LoadWAVAudioFromFileEx(
@@ -697,96 +1376,993 @@ HRESULT DirectX::LoadWAVAudioFromFileEx(
         return hr;
     }
 
-    bool dpds, seek;
-    hr = WaveFindFormatAndData(wavData.get(), bytesRead, &result.wfx, &result.startAudio, &result.audioBytes, dpds, seek);
-    if (FAILED(hr))
-        return hr;
+    return LoadWAVAudioInMemoryEx(wavData.get(), bytesRead, result);
+}
 
-    hr = WaveFindLoopInfo(wavData.get(), bytesRead, &result.loopStart, &result.loopLength);
-    if (FAILED(hr))
-        return hr;
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::LoadWAVAudioFromFile(
+    const wchar_t* szFileName,
+    WAVFileMapping& wavData,
+    const WAVEFORMATEX** wfx,
+    const uint8_t** startAudio,
+    uint32_t* audioBytes) noexcept
+{
+    if (!szFileName || !wfx || !startAudio || !audioBytes)
+        return E_INVALIDARG;
 
-    if (dpds)
-    {
-        hr = WaveFindTable(wavData.get(), bytesRead, FOURCC_XWMA_DPDS, &result.seek, &result.seekCount);
-        if (FAILED(hr))
-            return hr;
-    }
-    else if (seek)
+    *wfx = nullptr;
+    *startAudio = nullptr;
+    *audioBytes = 0;
+
+    HRESULT hr = wavData.Open(szFileName);
+    if (FAILED(hr))
     {
-        hr = WaveFindTable(wavData.get(), bytesRead, FOURCC_XMA_SEEK, &result.seek, &result.seekCount);
-        if (FAILED(hr))
-            return hr;
+        return hr;
     }
 
-    return S_OK;
+    return LoadWAVAudioInMemory(wavData.data(), static_cast<size_t>(wavData.size()), wfx, startAudio, audioBytes);
 }
 
+
 //-------------------------------------------------------------------------------------
 _Use_decl_annotations_
-HRESULT DirectX::WriteWAVDataToFile(
+HRESULT DirectX::LoadWAVAudioFromFileEx(
     const wchar_t* szFileName,
-    const DirectX::WAVData& data) noexcept
+    WAVFileMapping& wavData,
+    DirectX::WAVData& result) noexcept
 {
     if (!szFileName)
         return E_INVALIDARG;
 
-    if (data.seek != nullptr || data.seekCount != 0 || data.loopLength != 0 || data.loopStart != 0)
-    {
-        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    memset(&result, 0, sizeof(result));
+
+    HRESULT hr = wavData.Open(szFileName);
+    if (FAILED(hr))
+    {
+        return hr;
     }
 
-    // open the file
-#if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    return LoadWAVAudioInMemoryEx(wavData.data(), static_cast<size_t>(wavData.size()), result);
+}
+
+
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::LoadWAVAudioFromFileEx(
+    const wchar_t* szFileName,
+    WAVFileMapping& wavData,
+    DirectX::WAVData64& result) noexcept
+{
+    if (!szFileName)
+        return E_INVALIDARG;
+
+    memset(&result, 0, sizeof(result));
+
+    HRESULT hr = wavData.Open(szFileName);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    return LoadWAVAudioInMemoryEx(wavData.data(), static_cast<size_t>(wavData.size()), result);
+}
+
+
+//-------------------------------------------------------------------------------------
+// Probing
+//-------------------------------------------------------------------------------------
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::ProbeWAVFile(
+    const wchar_t* szFileName,
+    std::unique_ptr<uint8_t[]>& headerData,
+    DirectX::WAVData64& result,
+    uint64_t* audioOffset) noexcept
+{
+    // The RIFF header, 'ds64' and 'fmt ' almost always fit in the first read.
+    constexpr size_t ProbePrefixBytes = 4096;
+
+    // Chunks copied into headerData are format descriptions, loop points and seek
+    // tables; anything larger than this is not a well-formed file.
+    constexpr uint32_t ProbeMaxChunkBytes = 16 * 1024 * 1024;
+
+    if (!szFileName)
+        return E_INVALIDARG;
+
+    memset(&result, 0, sizeof(result));
+    if (audioOffset)
+        *audioOffset = 0;
+
+#ifdef _WIN32
+    #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
     ScopedHandle hFile(safe_handle(CreateFile2(
         szFileName,
-        GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS,
+        GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING,
         nullptr)));
-#else
+    #else
     ScopedHandle hFile(safe_handle(CreateFileW(
         szFileName,
-        GENERIC_WRITE, FILE_SHARE_READ,
+        GENERIC_READ, FILE_SHARE_READ,
         nullptr,
-        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
         nullptr)));
-#endif
+    #endif
+
+    if (!hFile)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
+    FILE_STANDARD_INFO fileInfo;
+    if (!GetFileInformationByHandleEx(hFile.get(), FileStandardInfo, &fileInfo, sizeof(fileInfo)))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    const auto fileSize = static_cast<uint64_t>(fileInfo.EndOfFile.QuadPart);
+#else
+    ScopedFd hFile(open(NarrowPath(szFileName).c_str(), O_RDONLY | O_CLOEXEC));
     if (!hFile)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+
+    struct stat fileInfo;
+    if (fstat(hFile.get(), &fileInfo) != 0)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+
+    const auto fileSize = static_cast<uint64_t>(fileInfo.st_size);
+#endif
+
+    // Need at least enough data to have a valid minimal WAV file
+    if (fileSize < (sizeof(RIFFChunk) * 2 + sizeof(DWORD) + sizeof(WAVEFORMAT)))
+    {
+        return E_FAIL;
+    }
+
+    uint8_t prefix[ProbePrefixBytes];
+    const size_t prefixBytes = static_cast<size_t>(std::min<uint64_t>(fileSize, sizeof(prefix)));
+    HRESULT hr = ReadFileAt(hFile.get(), 0, prefix, prefixBytes);
+    if (FAILED(hr))
+        return hr;
+
+    // Locate RIFF 'WAVE'
+    const RIFFChunkHeader* riffHeader;
+    size_t riffSize;
+    uint64_t dataSize64;
+    hr = WaveFindRiffHeader(prefix, prefixBytes, &riffHeader, &riffSize, &dataSize64);
+    if (FAILED(hr))
+        return hr;
+
+    const auto riffOffset = static_cast<uint64_t>(reinterpret_cast<const uint8_t*>(riffHeader) - prefix);
+    const uint64_t riffEnd = std::min<uint64_t>(riffOffset + sizeof(RIFFChunk) + riffSize, fileSize);
+
+    // Walk the chunk headers, reading past the prefix only when needed. The 'data'
+    // payload is skipped; the chunks the loaders look at are remembered so they
+    // can be copied into a compact RIFF image below.
+    struct ProbeChunk
+    {
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    ProbeChunk chunks[WaveChunkIndex::MaxEntries];
+    size_t chunkCount = 0;
+    size_t imageBytes = sizeof(RIFFChunkHeader);
+    uint64_t dataOffset = 0;
+    uint64_t dataSize = 0;
+    bool foundData = false;
+
+    uint64_t offset = riffOffset + sizeof(RIFFChunkHeader);
+    while (riffEnd > (offset + sizeof(RIFFChunk)))
+    {
+        RIFFChunk header;
+        if (offset + sizeof(RIFFChunk) <= prefixBytes)
+        {
+            memcpy(&header, prefix + offset, sizeof(header));
+        }
+        else
+        {
+            hr = ReadFileAt(hFile.get(), offset, &header, sizeof(header));
+            if (FAILED(hr))
+                return hr;
+        }
+
+        uint64_t chunkSize = header.size;
+        if (header.tag == FOURCC_DATA_TAG)
+        {
+            if (chunkSize == RF64_SIZE_PLACEHOLDER && dataSize64)
+                chunkSize = dataSize64;
+
+            if (!foundData)
+            {
+                foundData = true;
+                dataOffset = offset + sizeof(RIFFChunk);
+                dataSize = chunkSize;
+            }
+        }
+        else if ((header.tag == FOURCC_DS64_TAG || IsLookupTag(header.tag)) && chunkCount < WaveChunkIndex::MaxEntries)
+        {
+            if (header.size > ProbeMaxChunkBytes)
+            {
+                return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            }
+
+            chunks[chunkCount++] = { offset, header.size };
+            imageBytes += sizeof(RIFFChunk) + header.size;
+        }
+
+        offset += chunkSize + sizeof(RIFFChunk);
+    }
+
+    // Copy the RIFF header and the remembered chunks into one allocation
+    std::unique_ptr<uint8_t[]> image(new (std::nothrow) uint8_t[imageBytes]);
+    if (!image)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    memcpy(image.get(), riffHeader, sizeof(RIFFChunkHeader));
+    size_t imageUsed = sizeof(RIFFChunkHeader);
+    for (size_t j = 0; j < chunkCount; ++j)
+    {
+        const size_t bytes = sizeof(RIFFChunk) + chunks[j].size;
+        if (chunks[j].offset + bytes <= prefixBytes)
+        {
+            memcpy(image.get() + imageUsed, prefix + chunks[j].offset, bytes);
+        }
+        else
+        {
+            hr = ReadFileAt(hFile.get(), chunks[j].offset, image.get() + imageUsed, bytes);
+            if (FAILED(hr))
+                return hr;
+        }
+        imageUsed += bytes;
+    }
+
+    WaveChunkIndex index;
+    hr = WaveBuildChunkIndex(image.get(), imageBytes, index);
+    if (FAILED(hr))
+        return hr;
+
+    bool dpds, seek;
+    hr = WaveFindFormat(index, &result.wfx, dpds, seek);
+    if (FAILED(hr))
+        return hr;
+
+    if (!foundData || !dataSize)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    if (dataSize > fileSize - dataOffset)
+    {
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    hr = WaveFindLoopInfo(index, &result.loopStart, &result.loopLength);
+    if (FAILED(hr))
+        return hr;
+
+    if (dpds)
+    {
+        hr = WaveFindTable(index, FOURCC_XWMA_DPDS, &result.seek, &result.seekCount);
+        if (FAILED(hr))
+            return hr;
+    }
+    else if (seek)
+    {
+        hr = WaveFindTable(index, FOURCC_XMA_SEEK, &result.seek, &result.seekCount);
+        if (FAILED(hr))
+            return hr;
+    }
+
+    result.audioBytes = dataSize;
+    headerData = std::move(image);
+    if (audioOffset)
+        *audioOffset = dataOffset;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::ProbeWAVFile(
+    const wchar_t* szFileName,
+    std::unique_ptr<uint8_t[]>& headerData,
+    DirectX::WAVData& result,
+    uint64_t* audioOffset) noexcept
+{
+    memset(&result, 0, sizeof(result));
+
+    WAVData64 result64;
+    HRESULT hr = ProbeWAVFile(szFileName, headerData, result64, audioOffset);
+    if (FAILED(hr))
+        return hr;
+
+    return NarrowWAVData(result64, result);
+}
+
+
+//-------------------------------------------------------------------------------------
+// WAVStreamReader
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamReader::Open(const wchar_t* szFileName, size_t bufferBytes) noexcept
+{
+    if (!szFileName || !bufferBytes)
+        return E_INVALIDARG;
+
+    Close();
+
+#ifdef _WIN32
+    #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    CREATEFILE2_EXTENDED_PARAMETERS params = { sizeof(params) };
+    params.dwFileFlags = FILE_FLAG_SEQUENTIAL_SCAN;
+    m_hFile = safe_handle(CreateFile2(
+        szFileName,
+        GENERIC_READ, FILE_SHARE_READ, OPEN_EXISTING,
+        &params));
+    #else
+    m_hFile = safe_handle(CreateFileW(
+        szFileName,
+        GENERIC_READ, FILE_SHARE_READ,
+        nullptr,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN,
+        nullptr));
+    #endif
+
+    if (!m_hFile)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    m_fd = open(NarrowPath(szFileName).c_str(), O_RDONLY | O_CLOEXEC);
+    if (m_fd < 0)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+    (void)posix_fadvise(m_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    // Locate RIFF 'WAVE'
+    RIFFChunkHeader riffHeader;
+    HRESULT hr = ReadFromFile(&riffHeader, sizeof(riffHeader));
+    if (FAILED(hr))
+    {
+        Close();
+        return hr;
+    }
+
+    const bool isRF64 = riffHeader.tag == FOURCC_RF64_TAG || riffHeader.tag == FOURCC_BW64_TAG;
+    if ((riffHeader.tag != FOURCC_RIFF_TAG && !isRF64) || riffHeader.size < 4 || riffHeader.riff != FOURCC_WAVE_FILE_TAG)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    uint64_t riffSize = riffHeader.size;
+    uint64_t dataSize64 = 0;
+    if (isRF64)
+    {
+        RIFFChunk ds64Chunk;
+        DS64Chunk ds64;
+        hr = ReadFromFile(&ds64Chunk, sizeof(ds64Chunk));
+        if (SUCCEEDED(hr) && (ds64Chunk.tag != FOURCC_DS64_TAG || ds64Chunk.size < sizeof(DS64Chunk)))
+            hr = E_FAIL;
+        if (SUCCEEDED(hr))
+            hr = ReadFromFile(&ds64, sizeof(ds64));
+        if (FAILED(hr))
+        {
+            Close();
+            return hr;
+        }
+
+        riffSize = ds64.riffSize;
+        dataSize64 = ds64.dataSize;
+    }
+
+    // Walk the chunk list once, keeping only 'fmt ' and the position of 'data'.
+    const uint64_t riffEnd = sizeof(RIFFChunk) + riffSize;
+    uint64_t offset = sizeof(RIFFChunkHeader);
+    uint32_t fmtSize = 0;
+    bool haveData = false;
+    while (offset + sizeof(RIFFChunk) <= riffEnd)
+    {
+        RIFFChunk chunk;
+        hr = SeekFile(offset);
+        if (SUCCEEDED(hr))
+            hr = ReadFromFile(&chunk, sizeof(chunk));
+        if (FAILED(hr))
+            break;
+
+        if (chunk.tag == FOURCC_FORMAT_TAG && !m_format)
+        {
+            if (chunk.size < sizeof(PCMWAVEFORMAT) || chunk.size > UINT16_MAX)
+            {
+                Close();
+                return E_FAIL;
+            }
+
+            // PCMWAVEFORMAT has no cbSize; zero-fill so callers can treat it as WAVEFORMATEX.
+            fmtSize = chunk.size;
+            const size_t allocSize = std::max<size_t>(fmtSize, sizeof(WAVEFORMATEX));
+            m_format.reset(new (std::nothrow) uint8_t[allocSize]);
+            if (!m_format)
+            {
+                Close();
+                return E_OUTOFMEMORY;
+            }
+            memset(m_format.get(), 0, allocSize);
+
+            hr = ReadFromFile(m_format.get(), fmtSize);
+            if (FAILED(hr))
+            {
+                Close();
+                return hr;
+            }
+        }
+
+        uint64_t chunkSize = chunk.size;
+        if (chunk.tag == FOURCC_DATA_TAG && chunkSize == RF64_SIZE_PLACEHOLDER && isRF64)
+        {
+            chunkSize = dataSize64;
+        }
+
+        if (chunk.tag == FOURCC_DATA_TAG && !haveData)
+        {
+            haveData = true;
+            m_dataOffset = offset + sizeof(RIFFChunk);
+            m_audioBytes = chunkSize;
+        }
+
+        if (m_format && haveData)
+            break;
+
+        offset += sizeof(RIFFChunk) + chunkSize;
+    }
+
+    if (!m_format)
+    {
+        Close();
+        return E_FAIL;
+    }
+
+    if (!haveData || !m_audioBytes)
+    {
+        Close();
+        return HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    bool dpds, seek;
+    hr = ValidateWaveFormat(m_format.get(), fmtSize, dpds, seek);
+    if (SUCCEEDED(hr) && (dpds || seek))
+    {
+        // Compressed formats need their seek tables; use the in-memory loaders.
+        hr = E_FAIL;
+    }
+
+    // Always hand out whole blocks, so the buffer must hold at least one.
+    const size_t blockAlign = std::max<size_t>(GetFormat()->nBlockAlign, 1);
+    if (SUCCEEDED(hr))
+    {
+        m_bufferBytes = std::max(bufferBytes - (bufferBytes % blockAlign), blockAlign);
+        m_buffer.reset(new (std::nothrow) uint8_t[m_bufferBytes]);
+        if (!m_buffer)
+            hr = E_OUTOFMEMORY;
+    }
+
+    if (SUCCEEDED(hr))
+        hr = SeekFile(m_dataOffset);
+
+    if (FAILED(hr))
+    {
+        Close();
+        return hr;
+    }
+
+    return S_OK;
+}
+
+void DirectX::WAVStreamReader::Close() noexcept
+{
+#ifdef _WIN32
+    if (m_hFile)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = nullptr;
+    }
+#else
+    if (m_fd >= 0)
+    {
+        close(m_fd);
+        m_fd = -1;
+    }
+#endif
+    m_format.reset();
+    m_buffer.reset();
+    m_bufferBytes = m_bufferStart = m_bufferEnd = 0;
+    m_dataOffset = 0;
+    m_audioBytes = m_consumed = m_fileRead = 0;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamReader::ReadBlock(size_t maxBytes, const uint8_t** data, size_t* bytes) noexcept
+{
+    if (!data || !bytes)
+        return E_INVALIDARG;
+
+    *data = nullptr;
+    *bytes = 0;
+
+    if (!m_buffer)
+        return E_UNEXPECTED;
+
+    const size_t blockAlign = std::max<size_t>(GetFormat()->nBlockAlign, 1);
+    size_t want = static_cast<size_t>(std::min<uint64_t>({ maxBytes, m_bufferBytes, GetRemainingBytes() }));
+    want -= want % blockAlign;
+    if (!want)
+    {
+        // A trailing partial block is dropped, as the in-memory loaders would hand it out unaligned.
+        return S_OK;
+    }
+
+    if (m_bufferEnd - m_bufferStart < want)
+    {
+        // Slide the unread tail to the front and top the buffer up from the file.
+        const size_t pending = m_bufferEnd - m_bufferStart;
+        memmove(m_buffer.get(), m_buffer.get() + m_bufferStart, pending);
+        m_bufferStart = 0;
+        m_bufferEnd = pending;
+
+        const size_t toRead = static_cast<size_t>(std::min<uint64_t>(m_bufferBytes - pending, m_audioBytes - m_fileRead));
+        HRESULT hr = ReadFromFile(m_buffer.get() + pending, toRead);
+        if (FAILED(hr))
+            return hr;
+
+        m_bufferEnd += toRead;
+        m_fileRead += toRead;
+    }
+
+    *data = m_buffer.get() + m_bufferStart;
+    *bytes = want;
+    m_bufferStart += want;
+    m_consumed += want;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamReader::Seek(uint64_t audioOffset) noexcept
+{
+    if (!m_buffer)
+        return E_UNEXPECTED;
+
+    if (audioOffset > m_audioBytes || (audioOffset % std::max<uint64_t>(GetFormat()->nBlockAlign, 1)) != 0)
+        return E_INVALIDARG;
+
+    HRESULT hr = SeekFile(m_dataOffset + audioOffset);
+    if (FAILED(hr))
+        return hr;
+
+    m_bufferStart = m_bufferEnd = 0;
+    m_consumed = m_fileRead = audioOffset;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamReader::ReadFromFile(void* dest, size_t size) noexcept
+{
+    auto ptr = static_cast<uint8_t*>(dest);
+    while (size > 0)
+    {
+#ifdef _WIN32
+        DWORD bytesRead = 0;
+        const DWORD request = static_cast<DWORD>(std::min<size_t>(size, UINT32_MAX));
+        if (!ReadFile(m_hFile, ptr, request, &bytesRead, nullptr))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+#else
+        ssize_t bytesRead = read(m_fd, ptr, size);
+        if (bytesRead < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return HRESULT_FROM_ERRNO(errno);
+        }
+#endif
+        if (bytesRead == 0)
+        {
+            return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+        }
+        ptr += bytesRead;
+        size -= static_cast<size_t>(bytesRead);
+    }
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamReader::SeekFile(uint64_t offset) noexcept
+{
+#ifdef _WIN32
+    LARGE_INTEGER distance;
+    distance.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(m_hFile, distance, nullptr, FILE_BEGIN))
     {
         return HRESULT_FROM_WIN32(GetLastError());
     }
+#else
+    if (lseek(m_fd, static_cast<off_t>(offset), SEEK_SET) < 0)
+    {
+        return HRESULT_FROM_ERRNO(errno);
+    }
+#endif
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------------------------
+// WAVStreamWriter
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+size_t DirectX::WAVStreamWriter::GetHeaderBytes(const WAVEFORMATEX* wfx) noexcept
+{
+    // RIFF 'WAVE' + 'JUNK' (room for 'ds64') + 'fmt ' + 'data'; sizes are patched on Close.
+    return sizeof(RIFFChunkHeader) +
+        sizeof(RIFFChunk) + sizeof(DS64Chunk) +
+        sizeof(RIFFChunk) + sizeof(WAVEFORMATEX) + wfx->cbSize +
+        sizeof(RIFFChunk);
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamWriter::Open(const wchar_t* szFileName, const WAVEFORMATEX* wfx, size_t bufferBytes) noexcept
+{
+    if (!szFileName || !wfx)
+        return E_INVALIDARG;
+
+    // The header goes out from the buffer, so check it fits before the file is touched.
+    const size_t headerBytes = GetHeaderBytes(wfx);
+    if (headerBytes > bufferBytes)
+        return E_INVALIDARG;
+
+    (void)Close();
+
+    m_buffer.reset(new (std::nothrow) uint8_t[bufferBytes]);
+    if (!m_buffer)
+    {
+        return E_OUTOFMEMORY;
+    }
+    m_bufferBytes = bufferBytes;
+
+#ifdef _WIN32
+    #if (_WIN32_WINNT >= _WIN32_WINNT_WIN8)
+    m_hFile = safe_handle(CreateFile2(
+        szFileName,
+        GENERIC_WRITE, FILE_SHARE_READ, CREATE_ALWAYS,
+        nullptr));
+    #else
+    m_hFile = safe_handle(CreateFileW(
+        szFileName,
+        GENERIC_WRITE, FILE_SHARE_READ,
+        nullptr,
+        CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+        nullptr));
+    #endif
+
+    if (!m_hFile)
+    {
+        m_buffer.reset();
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+#else
+    m_fd = open(NarrowPath(szFileName).c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_fd < 0)
+    {
+        m_buffer.reset();
+        return HRESULT_FROM_ERRNO(errno);
+    }
+#endif
+
+    const uint32_t formatBytes = static_cast<uint32_t>(sizeof(WAVEFORMATEX)) + wfx->cbSize;
+    uint8_t* ptr = m_buffer.get();
+    RIFFChunkHeader riffHeader = { FOURCC_RIFF_TAG, 0, FOURCC_WAVE_FILE_TAG };
+    memcpy(ptr, &riffHeader, sizeof(riffHeader));
+    ptr += sizeof(riffHeader);
+
+    RIFFChunk junk = { FOURCC_JUNK_TAG, sizeof(DS64Chunk) };
+    memcpy(ptr, &junk, sizeof(junk));
+    ptr += sizeof(junk);
+    memset(ptr, 0, sizeof(DS64Chunk));
+    ptr += sizeof(DS64Chunk);
+
+    RIFFChunk format = { FOURCC_FORMAT_TAG, formatBytes };
+    memcpy(ptr, &format, sizeof(format));
+    ptr += sizeof(format);
+    memcpy(ptr, wfx, formatBytes);
+    ptr += formatBytes;
+
+    m_dataChunkOffset = static_cast<uint32_t>(ptr - m_buffer.get());
+    RIFFChunk dataChunk = { FOURCC_DATA_TAG, 0 };
+    memcpy(ptr, &dataChunk, sizeof(dataChunk));
+
+    m_bufferUsed = headerBytes;
+    m_audioBytes = 0;
+    m_blockAlign = wfx->nBlockAlign;
+    m_hr = S_OK;
+    return S_OK;
+}
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamWriter::Write(const void* data, size_t bytes) noexcept
+{
+    if (!m_buffer)
+        return E_UNEXPECTED;
+
+    if (FAILED(m_hr))
+        return m_hr;
+
+    if (!data && bytes)
+        return E_INVALIDARG;
+
+    if (m_bufferUsed + bytes <= m_bufferBytes)
+    {
+        memcpy(m_buffer.get() + m_bufferUsed, data, bytes);
+        m_bufferUsed += bytes;
+    }
+    else
+    {
+        // Write out what is buffered together with the new block, without copying it.
+        m_hr = Flush(data, bytes);
+        if (FAILED(m_hr))
+            return m_hr;
+    }
+
+    m_audioBytes += bytes;
+    return S_OK;
+}
+
+HRESULT DirectX::WAVStreamWriter::Close() noexcept
+{
+    if (!m_buffer)
+        return S_OK;
 
-    DWORD written;
-    // RIFF 'WAVE'
+    HRESULT hr = m_hr;
+    if (SUCCEEDED(hr))
+        hr = Flush(nullptr, 0);
+
+    if (SUCCEEDED(hr))
     {
-        RIFFChunkHeader header;
-        header.tag = FOURCC_RIFF_TAG;
-        header.size =
-            sizeof(header.riff) +
-            sizeof(RIFFChunk) +
-            data.wfx->cbSize + sizeof(WAVEFORMATEX) +
-            sizeof(RIFFChunk) + data.audioBytes;
-        header.riff = FOURCC_WAVE_FILE_TAG;
-        WriteFile(hFile.get(), &header, sizeof(header), &written, NULL);
+        const uint64_t riffSize = m_dataChunkOffset + sizeof(RIFFChunk) + m_audioBytes - sizeof(RIFFChunk);
+        if (riffSize <= UINT32_MAX)
+        {
+            const auto riffSize32 = static_cast<uint32_t>(riffSize);
+            const auto audioBytes32 = static_cast<uint32_t>(m_audioBytes);
+            hr = WriteAt(offsetof(RIFFChunkHeader, size), &riffSize32, sizeof(riffSize32));
+            if (SUCCEEDED(hr))
+                hr = WriteAt(m_dataChunkOffset + offsetof(RIFFChunk, size), &audioBytes32, sizeof(audioBytes32));
+        }
+        else
+        {
+            // Promote to RF64: the reserved 'JUNK' chunk becomes 'ds64'.
+            const uint32_t rf64Tag = FOURCC_RF64_TAG;
+            const uint32_t placeholder = RF64_SIZE_PLACEHOLDER;
+            uint8_t ds64Bytes[sizeof(RIFFChunk) + sizeof(DS64Chunk)];
+            RIFFChunk ds64Chunk = { FOURCC_DS64_TAG, sizeof(DS64Chunk) };
+            DS64Chunk ds64;
+            ds64.riffSize = riffSize;
+            ds64.dataSize = m_audioBytes;
+            ds64.sampleCount = m_blockAlign ? m_audioBytes / m_blockAlign : 0;
+            ds64.tableLength = 0;
+            memcpy(ds64Bytes, &ds64Chunk, sizeof(ds64Chunk));
+            memcpy(ds64Bytes + sizeof(ds64Chunk), &ds64, sizeof(ds64));
+
+            hr = WriteAt(offsetof(RIFFChunkHeader, tag), &rf64Tag, sizeof(rf64Tag));
+            if (SUCCEEDED(hr))
+                hr = WriteAt(offsetof(RIFFChunkHeader, size), &placeholder, sizeof(placeholder));
+            if (SUCCEEDED(hr))
+                hr = WriteAt(sizeof(RIFFChunkHeader), ds64Bytes, sizeof(ds64Bytes));
+            if (SUCCEEDED(hr))
+                hr = WriteAt(m_dataChunkOffset + offsetof(RIFFChunk, size), &placeholder, sizeof(placeholder));
+        }
     }
 
-    // RIFF 'fmt '
+#ifdef _WIN32
+    if (m_hFile)
+    {
+        CloseHandle(m_hFile);
+        m_hFile = nullptr;
+    }
+#else
+    if (m_fd >= 0)
     {
-        RIFFChunk format;
-        format.tag = FOURCC_FORMAT_TAG;
-        format.size = data.wfx->cbSize + sizeof(WAVEFORMATEX);
-        WriteFile(hFile.get(), &format, sizeof(format), &written, NULL);
-        WriteFile(hFile.get(), data.wfx, data.wfx->cbSize + sizeof(WAVEFORMATEX), &written, NULL);
+        if (close(m_fd) != 0 && SUCCEEDED(hr))
+            hr = HRESULT_FROM_ERRNO(errno);
+        m_fd = -1;
     }
+#endif
+
+    m_buffer.reset();
+    m_bufferBytes = m_bufferUsed = 0;
+    m_hr = S_OK;
+    return hr;
+}
 
-    // RIFF 'data'
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamWriter::Flush(const void* extra, size_t extraBytes) noexcept
+{
+#ifdef _WIN32
+    HRESULT hr = WriteAll(m_hFile, m_buffer.get(), m_bufferUsed);
+    if (SUCCEEDED(hr))
+        hr = WriteAll(m_hFile, extra, extraBytes);
+    if (FAILED(hr))
+        return hr;
+#else
+    // One gathered write for the buffered bytes and the caller's block.
+    struct iovec iov[2] = {
+        { m_buffer.get(), m_bufferUsed },
+        { const_cast<void*>(extra), extraBytes },
+    };
+    int iovIndex = 0;
+    while (iovIndex < 2)
     {
-        RIFFChunk dataChunk;
-        dataChunk.tag = FOURCC_DATA_TAG;
-        dataChunk.size = data.audioBytes;
-        WriteFile(hFile.get(), &dataChunk, sizeof(dataChunk), &written, NULL);
-        WriteFile(hFile.get(), data.startAudio, data.audioBytes, &written, NULL);
+        if (iov[iovIndex].iov_len == 0)
+        {
+            ++iovIndex;
+            continue;
+        }
+
+        ssize_t written = writev(m_fd, iov + iovIndex, 2 - iovIndex);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return HRESULT_FROM_ERRNO(errno);
+        }
+
+        auto remaining = static_cast<size_t>(written);
+        while (iovIndex < 2 && remaining >= iov[iovIndex].iov_len)
+        {
+            remaining -= iov[iovIndex].iov_len;
+            iov[iovIndex].iov_len = 0;
+            ++iovIndex;
+        }
+        if (iovIndex < 2)
+        {
+            iov[iovIndex].iov_base = static_cast<uint8_t*>(iov[iovIndex].iov_base) + remaining;
+            iov[iovIndex].iov_len -= remaining;
+        }
     }
+#endif
 
+    m_bufferUsed = 0;
     return S_OK;
 }
+
+_Use_decl_annotations_
+HRESULT DirectX::WAVStreamWriter::WriteAt(uint64_t offset, const void* data, size_t size) noexcept
+{
+#ifdef _WIN32
+    LARGE_INTEGER distance;
+    distance.QuadPart = static_cast<LONGLONG>(offset);
+    if (!SetFilePointerEx(m_hFile, distance, nullptr, FILE_BEGIN))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    return WriteAll(m_hFile, data, size);
+#else
+    auto ptr = static_cast<const uint8_t*>(data);
+    while (size > 0)
+    {
+        ssize_t written = pwrite(m_fd, ptr, size, static_cast<off_t>(offset));
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return HRESULT_FROM_ERRNO(errno);
+        }
+        ptr += written;
+        offset += static_cast<uint64_t>(written);
+        size -= static_cast<size_t>(written);
+    }
+    return S_OK;
+#endif
+}
+
+
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::WriteWAVDataToFile(
+    const wchar_t* szFileName,
+    const DirectX::WAVData& data) noexcept
+{
+    if (!szFileName)
+        return E_INVALIDARG;
+
+    if (data.seek != nullptr || data.seekCount != 0 || data.loopLength != 0 || data.loopStart != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    return WriteWAVFile(szFileName, data.wfx, data.startAudio, data.audioBytes);
+}
+
+
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+HRESULT DirectX::WriteWAVDataToFile(
+    const wchar_t* szFileName,
+    const DirectX::WAVData64& data) noexcept
+{
+    if (!szFileName)
+        return E_INVALIDARG;
+
+    if (data.seek != nullptr || data.seekCount != 0 || data.loopLength != 0 || data.loopStart != 0)
+    {
+        return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
+    }
+
+    return WriteWAVFile(szFileName, data.wfx, data.startAudio, data.audioBytes);
+}
+
+
+#ifndef _WIN32
+//-------------------------------------------------------------------------------------
+_Use_decl_annotations_
+std::wstring DirectX::WidenPath(const char* szFileName)
+{
+    std::wstring result;
+    auto p = reinterpret_cast<const uint8_t*>(szFileName);
+    while (*p)
+    {
+        uint32_t c = *p;
+        size_t length = 1;
+        uint32_t minimum = 0;
+        if (c >= 0xF0 && c <= 0xF4)
+        {
+            length = 4;
+            c &= 0x07;
+            minimum = 0x10000;
+        }
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            length = 3;
+            c &= 0x0F;
+            minimum = 0x800;
+        }
+        else if (c >= 0xC2 && c <= 0xDF)
+        {
+            length = 2;
+            c &= 0x1F;
+            minimum = 0x80;
+        }
+
+        size_t i = 1;
+        for (; i < length && (p[i] & 0xC0) == 0x80; ++i)
+        {
+            c = (c << 6) | (p[i] & 0x3F);
+        }
+
+        if (*p < 0x80)
+        {
+            result += static_cast<wchar_t>(*p);
+        }
+        else if (i == length && length > 1 && c >= minimum && c <= 0x10FFFF
+                 && (c < 0xD800 || c > 0xDFFF))
+        {
+            result += static_cast<wchar_t>(c);
+        }
+        else
+        {
+            // Not UTF-8: escape the lead byte and resync on the next one.
+            result += static_cast<wchar_t>(0xDC00 | *p);
+            length = 1;
+        }
+        p += length;
+    }
+    return result;
+}
+#endif
@@ -12,11 +12,16 @@
 
 #pragma once
 
+#ifdef _WIN32
 #include <objbase.h>
+#include <mmreg.h>
+#else
+#include "WinCompat.h"
+#endif
 
 #include <cstdint>
 #include <memory>
-#include <mmreg.h>
+#include <string>
 
 
 namespace DirectX
@@ -46,17 +51,205 @@ namespace DirectX
         uint32_t seekCount;
     };
 
+    // Same as WAVData, with a 64-bit audio size for RF64/BW64 files.
+    struct WAVData64
+    {
+        const WAVEFORMATEX* wfx;
+        const uint8_t* startAudio;
+        uint64_t audioBytes;
+        uint32_t loopStart;
+        uint32_t loopLength;
+        const uint32_t* seek;       // Note: XMA Seek data is Big-Endian
+        uint32_t seekCount;
+    };
+
     HRESULT LoadWAVAudioInMemoryEx(
         _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
         _In_ size_t wavDataSize,
         _Out_ WAVData& result) noexcept;
 
+    HRESULT LoadWAVAudioInMemoryEx(
+        _In_reads_bytes_(wavDataSize) const uint8_t* wavData,
+        _In_ size_t wavDataSize,
+        _Out_ WAVData64& result) noexcept;
+
     HRESULT LoadWAVAudioFromFileEx(
         _In_z_ const wchar_t* szFileName,
         _Inout_ std::unique_ptr<uint8_t[]>& wavData,
         _Out_ WAVData& result) noexcept;
 
+    // Read-only memory mapping of a whole file. Owns the view; pointers handed
+    // out by the mapped loaders below stay valid until the mapping is closed
+    // or destroyed.
+    class WAVFileMapping
+    {
+    public:
+        WAVFileMapping() noexcept = default;
+        WAVFileMapping(WAVFileMapping&& other) noexcept;
+        WAVFileMapping& operator=(WAVFileMapping&& other) noexcept;
+        WAVFileMapping(const WAVFileMapping&) = delete;
+        WAVFileMapping& operator=(const WAVFileMapping&) = delete;
+        ~WAVFileMapping() { Close(); }
+
+        HRESULT Open(_In_z_ const wchar_t* szFileName) noexcept;
+        void Close() noexcept;
+
+        const uint8_t* data() const noexcept { return m_data; }
+        uint64_t size() const noexcept { return m_size; }
+        explicit operator bool() const noexcept { return m_data != nullptr; }
+
+    private:
+        const uint8_t* m_data = nullptr;
+        uint64_t m_size = 0;
+    };
+
+    HRESULT LoadWAVAudioFromFile(
+        _In_z_ const wchar_t* szFileName,
+        _Inout_ WAVFileMapping& wavData,
+        _Outptr_ const WAVEFORMATEX** wfx,
+        _Outptr_ const uint8_t** startAudio,
+        _Out_ uint32_t* audioBytes) noexcept;
+
+    HRESULT LoadWAVAudioFromFileEx(
+        _In_z_ const wchar_t* szFileName,
+        _Inout_ WAVFileMapping& wavData,
+        _Out_ WAVData& result) noexcept;
+
+    HRESULT LoadWAVAudioFromFileEx(
+        _In_z_ const wchar_t* szFileName,
+        _Inout_ WAVFileMapping& wavData,
+        _Out_ WAVData64& result) noexcept;
+
+    // Reads the chunk headers and the small chunks the loaders use ('fmt ', loop
+    // points, seek tables) without touching the audio. headerData owns what the
+    // result points at; result.startAudio is null and audioOffset receives the
+    // file offset of the first audio byte.
+    HRESULT ProbeWAVFile(
+        _In_z_ const wchar_t* szFileName,
+        _Inout_ std::unique_ptr<uint8_t[]>& headerData,
+        _Out_ WAVData& result,
+        _Out_opt_ uint64_t* audioOffset = nullptr) noexcept;
+
+    HRESULT ProbeWAVFile(
+        _In_z_ const wchar_t* szFileName,
+        _Inout_ std::unique_ptr<uint8_t[]>& headerData,
+        _Out_ WAVData64& result,
+        _Out_opt_ uint64_t* audioOffset = nullptr) noexcept;
+
+    // Pull-based reader for uncompressed WAV and RF64/BW64 files. Only the format chunk and a
+    // fixed-size staging buffer are held in memory; audio is handed out in
+    // caller-sized blocks, so memory use does not depend on the file length.
+    class WAVStreamReader
+    {
+    public:
+        static constexpr size_t DefaultBufferBytes = 256 * 1024;
+
+        WAVStreamReader() noexcept = default;
+        WAVStreamReader(const WAVStreamReader&) = delete;
+        WAVStreamReader& operator=(const WAVStreamReader&) = delete;
+        ~WAVStreamReader() { Close(); }
+
+        HRESULT Open(_In_z_ const wchar_t* szFileName, _In_ size_t bufferBytes = DefaultBufferBytes) noexcept;
+        void Close() noexcept;
+
+        const WAVEFORMATEX* GetFormat() const noexcept { return reinterpret_cast<const WAVEFORMATEX*>(m_format.get()); }
+        uint64_t GetAudioBytes() const noexcept { return m_audioBytes; }
+        uint64_t GetRemainingBytes() const noexcept { return m_audioBytes - m_consumed; }
+
+        // Returns a view of up to maxBytes of audio (rounded down to whole blocks
+        // and capped at the staging buffer size) that stays valid until the next
+        // call. *bytes is zero once the 'data' chunk is exhausted.
+        HRESULT ReadBlock(
+            _In_ size_t maxBytes,
+            _Outptr_ const uint8_t** data,
+            _Out_ size_t* bytes) noexcept;
+
+        // Repositions the stream at a block-aligned offset into the 'data' chunk.
+        HRESULT Seek(_In_ uint64_t audioOffset) noexcept;
+
+    private:
+        HRESULT ReadFromFile(_Out_writes_bytes_(size) void* dest, _In_ size_t size) noexcept;
+        HRESULT SeekFile(_In_ uint64_t offset) noexcept;
+
+    #ifdef _WIN32
+        void* m_hFile = nullptr;
+    #else
+        int m_fd = -1;
+    #endif
+        std::unique_ptr<uint8_t[]> m_format;
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_bufferBytes = 0;
+        size_t m_bufferStart = 0;
+        size_t m_bufferEnd = 0;
+        uint64_t m_dataOffset = 0;
+        uint64_t m_audioBytes = 0;
+        uint64_t m_consumed = 0;
+        uint64_t m_fileRead = 0;
+    };
+
+    // Incremental writer for PCM audio. Blocks are appended through a fixed-size
+    // buffer and the RIFF/'data' sizes are patched in on Close. A 'JUNK' chunk
+    // reserves room for 'ds64', so a file that grows past 4 GB is finished as RF64.
+    class WAVStreamWriter
+    {
+    public:
+        static constexpr size_t DefaultBufferBytes = 1024 * 1024;
+
+        WAVStreamWriter() noexcept = default;
+        WAVStreamWriter(const WAVStreamWriter&) = delete;
+        WAVStreamWriter& operator=(const WAVStreamWriter&) = delete;
+        ~WAVStreamWriter() { (void)Close(); }
+
+        // Bytes the header takes for wfx. Open fails with E_INVALIDARG, leaving the
+        // file alone, when bufferBytes can't hold them.
+        static size_t GetHeaderBytes(_In_ const WAVEFORMATEX* wfx) noexcept;
+
+        HRESULT Open(
+            _In_z_ const wchar_t* szFileName,
+            _In_ const WAVEFORMATEX* wfx,
+            _In_ size_t bufferBytes = DefaultBufferBytes) noexcept;
+
+        HRESULT Write(_In_reads_bytes_(bytes) const void* data, _In_ size_t bytes) noexcept;
+
+        // Flushes buffered audio and fills in the header sizes. Safe to call twice.
+        HRESULT Close() noexcept;
+
+        uint64_t GetAudioBytes() const noexcept { return m_audioBytes; }
+
+    private:
+        HRESULT Flush(_In_reads_bytes_(extraBytes) const void* extra, _In_ size_t extraBytes) noexcept;
+        HRESULT WriteAt(_In_ uint64_t offset, _In_reads_bytes_(size) const void* data, _In_ size_t size) noexcept;
+
+    #ifdef _WIN32
+        void* m_hFile = nullptr;
+    #else
+        int m_fd = -1;
+    #endif
+        std::unique_ptr<uint8_t[]> m_buffer;
+        size_t m_bufferBytes = 0;
+        size_t m_bufferUsed = 0;
+        uint64_t m_audioBytes = 0;
+        uint32_t m_dataChunkOffset = 0;
+        uint32_t m_blockAlign = 0;
+        HRESULT m_hr = S_OK;
+    };
+
     HRESULT WriteWAVDataToFile(
         _In_z_ const wchar_t* szFileName,
         _In_ const WAVData& data) noexcept;
+
+    // Writes RF64 instead of RIFF when the file would exceed 4 GB.
+    HRESULT WriteWAVDataToFile(
+        _In_z_ const wchar_t* szFileName,
+        _In_ const WAVData64& data) noexcept;
+
+    // Converts a native file name, such as std::filesystem::path::c_str(), to the
+    // wide name the functions above take. Unlike path::wstring(), it doesn't depend
+    // on the locale or throw on names that aren't UTF-8; those bytes are carried
+    // through so that the name still opens.
+#ifdef _WIN32
+    inline std::wstring WidenPath(_In_z_ const wchar_t* szFileName) { return szFileName; }
+#else
+    std::wstring WidenPath(_In_z_ const char* szFileName);
+#endif
 }
@@ -0,0 +1,164 @@
+//--------------------------------------------------------------------------------------
+// File: WinCompat.h
+//
+// Minimal subset of the Windows SDK types and macros used by WAVFileReader and
+// the portable parts of this sample, so they can be built on POSIX hosts.
+//
+// Only include this header when _WIN32 is not defined.
+//-------------------------------------------------------------------------------------
+
+#pragma once
+
+#ifdef _WIN32
+#error "WinCompat.h is only meant for non-Windows builds"
+#endif
+
+#include <cstdint>
+#include <cstring>
+
+//---------------------------------------------------------------------------------
+// SAL annotations compile away.
+#define _In_
+#define _In_z_
+#define _In_opt_
+#define _Out_
+#define _Out_opt_
+#define _Inout_
+#define _Outptr_
+#define _Outptr_result_maybenull_
+#define _In_reads_(x)
+#define _In_reads_bytes_(x)
+#define _Out_writes_(x)
+#define _Out_writes_bytes_(x)
+#define _Out_writes_bytes_to_(x, y)
+#define _Use_decl_annotations_
+
+//---------------------------------------------------------------------------------
+// Basic types.
+typedef int32_t HRESULT;
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef uint32_t UINT32;
+typedef int BOOL;
+
+#ifndef TRUE
+#define TRUE 1
+#define FALSE 0
+#endif
+
+//---------------------------------------------------------------------------------
+// HRESULT helpers.
+#define SUCCEEDED(hr) (((HRESULT)(hr)) >= 0)
+#define FAILED(hr) (((HRESULT)(hr)) < 0)
+#define MAKE_HRESULT(sev, fac, code)                                           \
+  ((HRESULT)(((uint32_t)(sev) << 31) | ((uint32_t)(fac) << 16) |              \
+             ((uint32_t)(code))))
+
+#define FACILITY_WIN32 7
+#define HRESULT_FROM_WIN32(x)                                                  \
+  ((HRESULT)(x) <= 0 ? ((HRESULT)(x))                                          \
+                     : MAKE_HRESULT(1, FACILITY_WIN32, (x) & 0x0000FFFF))
+
+#define S_OK ((HRESULT)0)
+#define S_FALSE ((HRESULT)1)
+#define E_NOTIMPL ((HRESULT)0x80004001L)
+#define E_POINTER ((HRESULT)0x80004003L)
+#define E_ABORT ((HRESULT)0x80004004L)
+#define E_FAIL ((HRESULT)0x80004005L)
+#define E_UNEXPECTED ((HRESULT)0x8000FFFFL)
+#define E_OUTOFMEMORY ((HRESULT)0x8007000EL)
+#define E_INVALIDARG ((HRESULT)0x80070057L)
+
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_HANDLE_EOF 38L
+#define ERROR_NOT_SUPPORTED 50L
+#define ERROR_FILE_TOO_LARGE 223L
+#define ERROR_ARITHMETIC_OVERFLOW 534L
+#define ERROR_TIMEOUT 1460L
+#define ERROR_CANCELLED 1223L
+#define ERROR_NOT_FOUND 1168L
+
+// Error codes from C libraries (0n150) - 0x8096xxxx
+#ifndef FACILITY_ERRNO
+#define FACILITY_ERRNO (0x96)
+#define HRESULT_FROM_ERRNO(x) MAKE_HRESULT(1, FACILITY_ERRNO, (x))
+#endif
+
+//---------------------------------------------------------------------------------
+// GUIDs.
+struct GUID {
+  uint32_t Data1;
+  uint16_t Data2;
+  uint16_t Data3;
+  uint8_t Data4[8];
+};
+
+inline bool IsEqualGUID(const GUID &a, const GUID &b) noexcept {
+  return memcmp(&a, &b, sizeof(GUID)) == 0;
+}
+
+inline bool operator==(const GUID &a, const GUID &b) noexcept {
+  return IsEqualGUID(a, b);
+}
+
+inline bool operator!=(const GUID &a, const GUID &b) noexcept {
+  return !IsEqualGUID(a, b);
+}
+
+//---------------------------------------------------------------------------------
+// Audio format descriptions (mmreg.h / ksmedia.h).
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_ADPCM 0x0002
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_WMAUDIO2 0x0161
+#define WAVE_FORMAT_WMAUDIO3 0x0162
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+#pragma pack(push, 1)
+typedef struct waveformat_tag {
+  WORD wFormatTag;
+  WORD nChannels;
+  DWORD nSamplesPerSec;
+  DWORD nAvgBytesPerSec;
+  WORD nBlockAlign;
+} WAVEFORMAT;
+
+typedef struct pcmwaveformat_tag {
+  WAVEFORMAT wf;
+  WORD wBitsPerSample;
+} PCMWAVEFORMAT;
+
+typedef struct tWAVEFORMATEX {
+  WORD wFormatTag;
+  WORD nChannels;
+  DWORD nSamplesPerSec;
+  DWORD nAvgBytesPerSec;
+  WORD nBlockAlign;
+  WORD wBitsPerSample;
+  WORD cbSize;
+} WAVEFORMATEX;
+
+typedef struct {
+  WAVEFORMATEX Format;
+  union {
+    WORD wValidBitsPerSample;
+    WORD wSamplesPerBlock;
+    WORD wReserved;
+  } Samples;
+  DWORD dwChannelMask;
+  GUID SubFormat;
+} WAVEFORMATEXTENSIBLE;
+#pragma pack(pop)
+
+static_assert(sizeof(WAVEFORMAT) == 14, "structure size mismatch");
+static_assert(sizeof(PCMWAVEFORMAT) == 16, "structure size mismatch");
+static_assert(sizeof(WAVEFORMATEX) == 18, "structure size mismatch");
+static_assert(sizeof(WAVEFORMATEXTENSIBLE) == 40, "structure size mismatch");
+
+constexpr GUID KSDATAFORMAT_SUBTYPE_PCM = {
+    0x00000001, 0x0000, 0x0010, {0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71}};
+constexpr GUID KSDATAFORMAT_SUBTYPE_IEEE_FLOAT = {
+    0x00000003, 0x0000, 0x0010, {0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71}};
@@ -0,0 +1,1704 @@
+#include "AsyncRedis.h"
+#include "FileCodec.h"
+#include "PcmConvert.h"
+#include "PcmRingBuffer.h"
+#include "RedisPublisher.h"
+#include "Resampler.h"
+#include "SenderEncoder.h"
+#include "WAVFileReader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Microbenchmarks for the sample's building blocks. Run with no arguments to
+// execute every suite, or name the suites to run on the command line.
+//
+// Usage: bench [--json FILE] [suite...]
+//
+// With --json, every row the suites print is also written to FILE as one
+// record of named metrics, along with the Opus version and conversion ISA,
+// so results from two builds can be diffed to catch regressions.
+//
+// The redispublish suite talks to a real server, such as a local
+// redis-server, and is skipped when none answers.
+//
+// The oggseek suite writes its scratch files to the temp directory and
+// removes them when it is done.
+
+////////////////////////////////////////////////////////////////////////////
+// Shared helpers.
+
+namespace fs = std::filesystem;
+
+using BenchClock = std::chrono::steady_clock;
+
+//! Runs fn repeatedly for roughly minSeconds and returns nanoseconds per call.
+template <typename TFn> double MeasureNsPerCall(TFn &&fn, double minSeconds) {
+  uint64_t iterations = 0;
+  uint64_t batch = 1;
+  auto start = BenchClock::now();
+  std::chrono::duration<double> elapsed{};
+  do {
+    for (uint64_t i = 0; i < batch; ++i) {
+      fn();
+    }
+    iterations += batch;
+    batch *= 2;
+    elapsed = BenchClock::now() - start;
+  } while (elapsed.count() < minSeconds);
+  return elapsed.count() * 1e9 / (double)iterations;
+}
+
+//! One printed row, kept for the JSON report.
+struct BenchRecord {
+  const char *suite;
+  std::string name;
+  std::vector<std::pair<const char *, double>> metrics;
+};
+
+static std::vector<BenchRecord> g_records;
+
+static void Record(const char *suite, std::string name,
+                   std::vector<std::pair<const char *, double>> metrics) {
+  g_records.push_back({suite, std::move(name), std::move(metrics)});
+}
+
+static void AppendBytes(std::vector<uint8_t> &buffer, const void *ptr,
+                        size_t len) {
+  const uint8_t *bytes = (const uint8_t *)ptr;
+  buffer.insert(buffer.end(), bytes, bytes + len);
+}
+
+static void AppendTag(std::vector<uint8_t> &buffer, const char tag[4]) {
+  AppendBytes(buffer, tag, 4);
+}
+
+static void AppendU32(std::vector<uint8_t> &buffer, uint32_t value) {
+  AppendBytes(buffer, &value, sizeof(value));
+}
+
+static void AppendChunk(std::vector<uint8_t> &buffer, const char tag[4],
+                        uint32_t size) {
+  AppendTag(buffer, tag);
+  AppendU32(buffer, size);
+  buffer.resize(buffer.size() + size + (size & 1));
+}
+
+////////////////////////////////////////////////////////////////////////////
+// WAV parsing.
+
+//! Builds an in-memory 16-bit mono WAV file with metadata chunks placed
+//! before 'fmt ' and 'data', the way broadcast and DAW exports lay them out.
+static std::vector<uint8_t> MakeWavWithMetadata(uint32_t metadataChunks,
+                                                uint32_t metadataBytes,
+                                                uint32_t audioBytes) {
+  static const char *const Tags[] = {"LIST", "JUNK", "bext", "iXML"};
+  std::vector<uint8_t> wav;
+  AppendTag(wav, "RIFF");
+  AppendU32(wav, 0);
+  AppendTag(wav, "WAVE");
+  for (uint32_t i = 0; i < metadataChunks; ++i) {
+    AppendChunk(wav, Tags[i % 4], metadataBytes);
+  }
+
+  PCMWAVEFORMAT fmt = {};
+  fmt.wf.wFormatTag = WAVE_FORMAT_PCM;
+  fmt.wf.nChannels = 1;
+  fmt.wf.nSamplesPerSec = 24000;
+  fmt.wf.nBlockAlign = 2;
+  fmt.wf.nAvgBytesPerSec = 48000;
+  fmt.wBitsPerSample = 16;
+  AppendTag(wav, "fmt ");
+  AppendU32(wav, sizeof(fmt));
+  AppendBytes(wav, &fmt, sizeof(fmt));
+
+  AppendChunk(wav, "data", audioBytes);
+
+  uint32_t riffSize = (uint32_t)(wav.size() - 8);
+  memcpy(wav.data() + 4, &riffSize, sizeof(riffSize));
+  return wav;
+}
+
+//! The previous parser's access pattern: every lookup walks the chunk list
+//! from the start of the RIFF body. Kept here as the baseline to compare to.
+static const uint8_t *LegacyFindChunk(const uint8_t *wav, size_t size,
+                                      const char tag[4], uint32_t *chunkSize) {
+  const uint8_t *ptr = wav + 12;
+  const uint8_t *end = wav + size;
+  while (end > ptr + 8) {
+    uint32_t len;
+    memcpy(&len, ptr + 4, sizeof(len));
+    if (memcmp(ptr, tag, 4) == 0) {
+      *chunkSize = len;
+      return ptr + 8;
+    }
+    ptr += (size_t)len + 8;
+  }
+  return nullptr;
+}
+
+static bool LegacyParse(const uint8_t *wav, size_t size) {
+  uint32_t fmtSize = 0, dataSize = 0, dlsSize = 0, midiSize = 0;
+  const uint8_t *fmt = LegacyFindChunk(wav, size, "fmt ", &fmtSize);
+  const uint8_t *data = LegacyFindChunk(wav, size, "data", &dataSize);
+  const uint8_t *dls = LegacyFindChunk(wav, size, "wsmp", &dlsSize);
+  const uint8_t *midi = LegacyFindChunk(wav, size, "smpl", &midiSize);
+  return fmt && data && !dls && !midi;
+}
+
+static int RunWavParseBench() {
+  struct Case {
+    const char *name;
+    uint32_t metadataChunks;
+    uint32_t metadataBytes;
+  };
+  const Case cases[] = {
+      {"plain", 0, 0},
+      {"few-large-chunks", 4, 64 * 1024},
+      {"many-small-chunks", 256, 16},
+      {"very-many-chunks", 4096, 8},
+  };
+
+  printf("wavparse: ns per parse (legacy rescan per tag vs. chunk index)\n");
+  printf("%-20s %10s %12s %12s %8s\n", "case", "chunks", "legacy", "indexed",
+         "speedup");
+  for (const Case &c : cases) {
+    std::vector<uint8_t> wav =
+        MakeWavWithMetadata(c.metadataChunks, c.metadataBytes, 48000);
+
+    DirectX::WAVData64 result;
+    if (FAILED(DirectX::LoadWAVAudioInMemoryEx(wav.data(), wav.size(),
+                                                result)) ||
+        !LegacyParse(wav.data(), wav.size())) {
+      printf("wavparse: failed to parse case %s\n", c.name);
+      return 1;
+    }
+
+    volatile bool sink = false;
+    double legacyNs = MeasureNsPerCall(
+        [&] { sink = LegacyParse(wav.data(), wav.size()); }, 0.2);
+    double indexedNs = MeasureNsPerCall(
+        [&] {
+          sink = SUCCEEDED(
+              DirectX::LoadWAVAudioInMemoryEx(wav.data(), wav.size(), result));
+        },
+        0.2);
+    (void)sink;
+
+    printf("%-20s %10u %12.1f %12.1f %7.2fx\n", c.name, c.metadataChunks + 2,
+           legacyNs, indexedNs, legacyNs / indexedNs);
+    Record("wavparse", c.name,
+           {{"chunks", c.metadataChunks + 2},
+            {"legacy_ns", legacyNs},
+            {"indexed_ns", indexedNs}});
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// PCM conversion.
+
+static int RunPcmConvertBench() {
+  const size_t sampleCount = 1 << 20;
+  const PcmSampleType types[] = {PcmSampleType::Int16, PcmSampleType::Int24,
+                                 PcmSampleType::Int32, PcmSampleType::Float32,
+                                 PcmSampleType::Float64};
+  const char *const typeNames[] = {"int16", "int24", "int32", "float32",
+                                   "float64"};
+  const PcmConvertIsa isas[] = {PcmConvertIsa::Scalar, PcmConvertIsa::Sse2,
+                                PcmConvertIsa::Avx2};
+  const PcmConvertIsa bestIsa = GetPcmConvertIsa();
+
+  // Source bytes are a ramp rather than zeros, and floats stay in range, so
+  // every kernel does its full amount of work.
+  std::vector<uint8_t> source(sampleCount * sizeof(double));
+  for (size_t i = 0; i < source.size(); ++i) {
+    source[i] = (uint8_t)(i * 131);
+  }
+  std::vector<float> floatSource(sampleCount);
+  std::vector<double> doubleSource(sampleCount);
+  for (size_t i = 0; i < sampleCount; ++i) {
+    floatSource[i] = (float)((int)(i % 2001) - 1000) / 1000.0f;
+    doubleSource[i] = floatSource[i];
+  }
+  std::vector<float> floatOut(sampleCount);
+  std::vector<int16_t> int16Out(sampleCount);
+
+  printf("pcmconvert: source GB/s over %zu samples (best isa: %s)\n",
+         sampleCount, GetPcmConvertIsaName(bestIsa));
+  printf("%-8s %-7s %12s %12s\n", "source", "isa", "to-float", "to-int16");
+  for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t) {
+    const void *src = source.data();
+    if (types[t] == PcmSampleType::Float32) {
+      src = floatSource.data();
+    } else if (types[t] == PcmSampleType::Float64) {
+      src = doubleSource.data();
+    }
+    const double sourceBytes =
+        (double)(sampleCount * GetPcmSampleSize(types[t]));
+    for (PcmConvertIsa isa : isas) {
+      if (isa > bestIsa) {
+        continue;
+      }
+      SetPcmConvertIsa(isa);
+      double toFloatNs = MeasureNsPerCall(
+          [&] {
+            ConvertPcmToFloat(types[t], src, floatOut.data(), sampleCount);
+          },
+          0.1);
+      double toInt16Ns = MeasureNsPerCall(
+          [&] {
+            ConvertPcmToInt16(types[t], src, int16Out.data(), sampleCount);
+          },
+          0.1);
+      printf("%-8s %-7s %12.2f %12.2f\n", typeNames[t],
+             GetPcmConvertIsaName(isa), sourceBytes / toFloatNs,
+             sourceBytes / toInt16Ns);
+      Record("pcmconvert",
+             std::string(typeNames[t]) + "/" + GetPcmConvertIsaName(isa),
+             {{"to_float_GBps", sourceBytes / toFloatNs},
+              {"to_int16_GBps", sourceBytes / toInt16Ns}});
+    }
+  }
+  SetPcmConvertIsa(bestIsa);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Parallel encoding.
+
+//! Fills interleaved float samples with a few tones over low-level noise, so
+//! the encoder has to spend bits on every band.
+static std::vector<float> MakeTestSignal(int sampleRate, int channels,
+                                         double seconds) {
+  const size_t frames = (size_t)(sampleRate * seconds);
+  std::vector<float> samples(frames * channels);
+  const double pi = 3.14159265358979323846;
+  uint32_t noise = 1;
+  for (size_t i = 0; i < frames; ++i) {
+    const double t = (double)i / sampleRate;
+    for (int c = 0; c < channels; ++c) {
+      noise = noise * 1664525u + 1013904223u;
+      samples[i * channels + c] =
+          (float)(0.3 * sin(2 * pi * (220.0 + 110.0 * c) * t) +
+                  0.2 * sin(2 * pi * 3520.0 * t) +
+                  0.05 * ((double)(noise >> 8) / (1 << 24) - 0.5));
+    }
+  }
+  return samples;
+}
+
+static int RunParallelEncodeBench() {
+  const int sampleRate = 48000;
+  const int channels = 2;
+  const double seconds = 60.0;
+  const size_t frameCount = (size_t)(seconds * 100);
+  std::vector<float> samples = MakeTestSignal(sampleRate, channels, seconds);
+  const unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+  printf("parallelencode: %.0f s of %d Hz %d-channel audio\n", seconds,
+         sampleRate, channels);
+  printf("%8s %10s %12s %8s\n", "threads", "seconds", "realtime", "speedup");
+  double singleThreadSeconds = 0;
+  for (unsigned threads = 1;; threads = std::min(threads * 2, maxThreads)) {
+    std::vector<uint8_t> encoded;
+    auto start = BenchClock::now();
+    HRESULT hr = EncodePcmSegmented(
+        samples.data(), PcmSampleType::Float32, sampleRate, channels, 0,
+        DefaultFrameDurationUs, samples.size() / channels, frameCount,
+        (int)threads, OpusEncoderSettings(), &encoded);
+    std::chrono::duration<double> elapsed = BenchClock::now() - start;
+    if (FAILED(hr)) {
+      printf("parallelencode: failed with 0x%08x\n", (unsigned)hr);
+      return 1;
+    }
+    if (threads == 1) {
+      singleThreadSeconds = elapsed.count();
+    }
+    printf("%8u %10.3f %11.1fx %7.2fx\n", threads, elapsed.count(),
+           seconds / elapsed.count(), singleThreadSeconds / elapsed.count());
+    Record("parallelencode", std::to_string(threads) + " threads",
+           {{"threads", threads},
+            {"seconds", elapsed.count()},
+            {"realtime", seconds / elapsed.count()},
+            {"speedup", singleThreadSeconds / elapsed.count()}});
+    if (threads == maxThreads) {
+      break;
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Frame duration.
+
+//! Encodes the same signal at every Opus frame duration on one thread and
+//! reports what each costs: encoder CPU per second of audio, bytes per second
+//! with and without the packet container's per-packet overhead (a 4-byte
+//! length prefix and a 16-byte index entry), and the algorithmic latency,
+//! which is the frame duration plus the encoder's lookahead.
+static int RunFrameDurationBench() {
+  const int sampleRate = 48000;
+  const int channels = 2;
+  const double seconds = 30.0;
+  const int durationsUs[] = {2500,  5000,  10000,  20000, 40000,
+                             60000, 80000, 100000, 120000};
+  const size_t containerBytesPerPacket =
+      sizeof(int32_t) + sizeof(OpusContainerIndexEntry);
+  std::vector<float> samples = MakeTestSignal(sampleRate, channels, seconds);
+
+  printf("framedur: %.0f s of %d Hz %d-channel audio, 1 thread\n", seconds,
+         sampleRate, channels);
+  printf("%8s %14s %12s %14s %12s\n", "frame_ms", "cpu_ms/audio_s",
+         "payload_B/s", "container_B/s", "latency_ms");
+  for (int frameDurationUs : durationsUs) {
+    const size_t frameCount = (size_t)(seconds * 1e6 / frameDurationUs);
+    const int application =
+        GetEncoderApplication(OPUS_APPLICATION_AUDIO, frameDurationUs);
+    int err = OPUS_OK;
+    opus_int32 lookahead = 0;
+    OpusEncoder *enc =
+        opus_encoder_create(sampleRate, channels, application, &err);
+    if (err != OPUS_OK ||
+        opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead)) != OPUS_OK) {
+      printf("framedur: encoder failed with %d\n", err);
+      opus_encoder_destroy(enc);
+      return 1;
+    }
+    opus_encoder_destroy(enc);
+
+    std::vector<uint8_t> encoded;
+    const std::clock_t cpuStart = std::clock();
+    HRESULT hr = EncodePcmSegmented(
+        samples.data(), PcmSampleType::Float32, sampleRate, channels, 0,
+        frameDurationUs, samples.size() / channels, frameCount, 1,
+        OpusEncoderSettings(), &encoded);
+    const double cpuSeconds =
+        (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    if (FAILED(hr)) {
+      printf("framedur: failed with 0x%08x\n", (unsigned)hr);
+      return 1;
+    }
+
+    // encoded already carries a length prefix per packet.
+    const double audioSeconds = (double)frameCount * frameDurationUs / 1e6;
+    const double payloadBytes =
+        (double)encoded.size() - (double)frameCount * sizeof(int32_t);
+    const double containerBytes =
+        payloadBytes + (double)frameCount * containerBytesPerPacket;
+    const double latencyMs =
+        frameDurationUs / 1000.0 + lookahead * 1000.0 / sampleRate;
+    printf("%8.1f %14.3f %12.0f %14.0f %12.1f\n", frameDurationUs / 1000.0,
+           cpuSeconds * 1000.0 / audioSeconds, payloadBytes / audioSeconds,
+           containerBytes / audioSeconds, latencyMs);
+    Record("framedur", std::to_string(frameDurationUs) + " us",
+           {{"frame_ms", frameDurationUs / 1000.0},
+            {"cpu_ms_per_audio_s", cpuSeconds * 1000.0 / audioSeconds},
+            {"payload_Bps", payloadBytes / audioSeconds},
+            {"container_Bps", containerBytes / audioSeconds},
+            {"latency_ms", latencyMs}});
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Resampling.
+
+//! Stereo resampled the way callers had to before interleaved support:
+//! split the channels, resample each as mono, and interleave the results.
+static HRESULT ResampleStereoSplit(int inRate, int outRate, const float *in,
+                                   int inFrames, std::vector<float> *planes,
+                                   float *out, int outFrames,
+                                   ResamplerCache *cache) {
+  HRESULT hr = S_OK;
+  std::vector<float> &inPlane = planes[0];
+  std::vector<float> &outPlane = planes[1];
+  for (int c = 0; c < 2; ++c) {
+    unsigned int inProcessed = 0;
+    unsigned int outCount = 0;
+    for (int i = 0; i < inFrames; ++i) {
+      inPlane[i] = in[i * 2 + c];
+    }
+    IFC(ResampleWaveData(1, inRate, outRate, true, inPlane.data(), inFrames,
+                         &inProcessed, outPlane.data(), outFrames, &outCount,
+                         cache));
+    for (unsigned int i = 0; i < outCount; ++i) {
+      out[i * 2 + c] = outPlane[i];
+    }
+  }
+
+Cleanup:
+  return hr;
+}
+
+static int RunResampleBench() {
+  const int inRate = 44100;
+  const int outRates[] = {48000, 24000};
+  const double seconds = 1.0;
+  const int inFrames = (int)(inRate * seconds);
+  std::vector<float> mono = MakeTestSignal(inRate, 1, seconds);
+  std::vector<float> stereo = MakeTestSignal(inRate, 2, seconds);
+
+  printf("resample: %.0f s of %d Hz float audio per call\n", seconds, inRate);
+  printf("%8s %-18s %12s %12s\n", "out_Hz", "path", "ns/frame",
+         "realtime");
+  for (int outRate : outRates) {
+    const int outFrames = (int)((int64_t)inFrames * outRate / inRate) + 1;
+    std::vector<float> out((size_t)outFrames * 2);
+    std::vector<float> planes[2] = {std::vector<float>(inFrames),
+                                    std::vector<float>(outFrames)};
+    ResamplerCache cache;
+    HRESULT hr = S_OK;
+    struct {
+      const char *name;
+      int channels;
+      bool isSplit;
+    } paths[] = {{"mono", 1, false},
+                 {"stereo interleaved", 2, false},
+                 {"stereo split", 2, true}};
+    for (const auto &path : paths) {
+      const float *in = path.channels == 1 ? mono.data() : stereo.data();
+      double ns = MeasureNsPerCall(
+          [&] {
+            unsigned int inProcessed = 0;
+            unsigned int outCount = 0;
+            if (path.isSplit) {
+              hr = ResampleStereoSplit(inRate, outRate, in, inFrames, planes,
+                                       out.data(), outFrames, &cache);
+            } else {
+              hr = ResampleWaveData(path.channels, inRate, outRate, true, in,
+                                    inFrames, &inProcessed, out.data(),
+                                    outFrames, &outCount, &cache);
+            }
+          },
+          0.5);
+      if (FAILED(hr)) {
+        printf("resample: failed with 0x%08x\n", (unsigned)hr);
+        return 1;
+      }
+      printf("%8d %-18s %12.2f %11.1fx\n", outRate, path.name,
+             ns / inFrames, seconds * 1e9 / ns);
+      Record("resample", std::to_string(outRate) + "/" + path.name,
+             {{"out_Hz", outRate},
+              {"ns_per_frame", ns / inFrames},
+              {"realtime", seconds * 1e9 / ns}});
+    }
+  }
+  return 0;
+}
+
+//! Least-squares fit of a sine at frequency to signal[first, last), returning
+//! the amplitude and the RMS of what the sine does not explain. The fit finds
+//! its own phase, so resampler delay does not matter.
+static void FitSine(const std::vector<float> &signal, size_t first,
+                    size_t last, double frequency, int sampleRate,
+                    double *amplitude, double *residualRms) {
+  const double pi = 3.14159265358979323846;
+  const double w = 2 * pi * frequency / sampleRate;
+  double ss = 0, cc = 0, sc = 0, ys = 0, yc = 0;
+  for (size_t i = first; i < last; ++i) {
+    const double s = sin(w * i);
+    const double c = cos(w * i);
+    ss += s * s;
+    cc += c * c;
+    sc += s * c;
+    ys += signal[i] * s;
+    yc += signal[i] * c;
+  }
+  const double det = ss * cc - sc * sc;
+  const double a = (ys * cc - yc * sc) / det;
+  const double b = (yc * ss - ys * sc) / det;
+  double residual = 0;
+  for (size_t i = first; i < last; ++i) {
+    const double e = signal[i] - a * sin(w * i) - b * cos(w * i);
+    residual += e * e;
+  }
+  *amplitude = sqrt(a * a + b * b);
+  *residualRms = sqrt(residual / (double)(last - first));
+}
+
+//! Compares the speex and polyphase resamplers from 44.1 kHz: throughput on
+//! stereo audio, and across passband tones, the worst gain error and the
+//! worst level of everything that is not the tone (aliasing, imaging and
+//! filter noise) relative to the tone.
+static int RunPolyphaseBench() {
+  const int inRate = 44100;
+  const int channels = 2;
+  const double seconds = 1.0;
+  const int inFrames = (int)(inRate * seconds);
+  const double toneAmplitude = 0.5;
+  struct {
+    int outRate;
+    std::vector<double> tones;
+  } cases[] = {{48000, {100, 1000, 5000, 10000, 15000, 18000}},
+               {24000, {100, 1000, 3000, 6000, 8000, 9500}}};
+  const ResamplerType types[] = {ResamplerType::Speex,
+                                 ResamplerType::Polyphase};
+  const ResamplerType savedType = GetResamplerType();
+  std::vector<float> stereo = MakeTestSignal(inRate, channels, seconds);
+  std::vector<float> tone(inFrames);
+
+  printf("polyphase: %d Hz to each rate, %s kernels\n", inRate,
+         GetPcmConvertIsaName(GetPcmConvertIsa()));
+  printf("%8s %-10s %10s %10s %14s %14s\n", "out_Hz", "resampler",
+         "ns/frame", "realtime", "max_gain_dB", "max_error_dB");
+  for (const auto &c : cases) {
+    const int outFrames = (int)((int64_t)inFrames * c.outRate / inRate) + 1;
+    std::vector<float> out((size_t)outFrames * channels);
+    for (ResamplerType type : types) {
+      ResamplerCache cache;
+      HRESULT hr = S_OK;
+      unsigned int inProcessed = 0;
+      unsigned int outCount = 0;
+      SetResamplerType(type);
+      double ns = MeasureNsPerCall(
+          [&] {
+            hr = ResampleWaveData(channels, inRate, c.outRate, true,
+                                  stereo.data(), inFrames, &inProcessed,
+                                  out.data(), outFrames, &outCount, &cache);
+          },
+          0.5);
+
+      double maxGainDb = 0;
+      double maxErrorDb = -200;
+      for (double frequency : c.tones) {
+        const double pi = 3.14159265358979323846;
+        double amplitude;
+        double residualRms;
+        for (int i = 0; i < inFrames; ++i) {
+          tone[i] = (float)(toneAmplitude * sin(2 * pi * frequency * i /
+                                                inRate));
+        }
+        if (SUCCEEDED(hr)) {
+          hr = ResampleWaveData(1, inRate, c.outRate, true, tone.data(),
+                                inFrames, &inProcessed, out.data(), outFrames,
+                                &outCount, &cache);
+        }
+        if (FAILED(hr) || outCount < 4096) {
+          break;
+        }
+        // Skip the edges, where the filters run into silence.
+        std::vector<float> resampled(out.begin(), out.begin() + outCount);
+        FitSine(resampled, 1024, outCount - 1024, frequency, c.outRate,
+                &amplitude, &residualRms);
+        const double gainDb = 20 * log10(amplitude / toneAmplitude);
+        const double errorDb =
+            20 * log10(residualRms * sqrt(2.0) / amplitude + 1e-12);
+        maxGainDb = fabs(gainDb) > fabs(maxGainDb) ? gainDb : maxGainDb;
+        maxErrorDb = std::max(maxErrorDb, errorDb);
+      }
+      if (FAILED(hr)) {
+        printf("polyphase: failed with 0x%08x\n", (unsigned)hr);
+        SetResamplerType(savedType);
+        return 1;
+      }
+      printf("%8d %-10s %10.2f %9.1fx %14.4f %14.1f\n", c.outRate,
+             GetResamplerTypeName(type), ns / inFrames, seconds * 1e9 / ns,
+             maxGainDb, maxErrorDb);
+      Record("polyphase",
+             std::to_string(c.outRate) + "/" + GetResamplerTypeName(type),
+             {{"out_Hz", c.outRate},
+              {"ns_per_frame", ns / inFrames},
+              {"realtime", seconds * 1e9 / ns},
+              {"max_gain_dB", maxGainDb},
+              {"max_error_dB", maxErrorDb}});
+    }
+  }
+  SetResamplerType(savedType);
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Codec round trip.
+
+enum class BenchSignal { Sweep, Noise, Speech };
+
+static const char *GetBenchSignalName(BenchSignal signal) {
+  switch (signal) {
+  case BenchSignal::Sweep:
+    return "sweep";
+  case BenchSignal::Noise:
+    return "noise";
+  default:
+    return "speech";
+  }
+}
+
+//! Deterministic synthetic signals, so every run encodes the same audio:
+//! an exponential sine sweep from 20 Hz to just under Nyquist, white noise,
+//! or speech-like bursts (voiced syllables with a gliding pitch and a few
+//! harmonics, unvoiced noise bursts, and pauses between them). Channels
+//! differ in level, and noise differs per channel, so stereo is not mono
+//! twice.
+static std::vector<float> MakeBenchSignal(BenchSignal signal, int sampleRate,
+                                          int channels, double seconds) {
+  const size_t frames = (size_t)(sampleRate * seconds);
+  std::vector<float> samples(frames * channels);
+  const double pi = 3.14159265358979323846;
+  uint32_t noise = 1;
+  auto nextNoise = [&noise]() {
+    noise = noise * 1664525u + 1013904223u;
+    return (double)(noise >> 8) / (1 << 24) - 0.5;
+  };
+
+  if (signal == BenchSignal::Sweep) {
+    const double startHz = 20.0;
+    const double sweepRate = log(0.45 * sampleRate / startHz) / seconds;
+    for (size_t i = 0; i < frames; ++i) {
+      const double t = (double)i / sampleRate;
+      const double phase =
+          2 * pi * startHz * (exp(sweepRate * t) - 1) / sweepRate;
+      for (int c = 0; c < channels; ++c) {
+        samples[i * channels + c] = (float)((0.5 - 0.1 * c) * sin(phase));
+      }
+    }
+  } else if (signal == BenchSignal::Noise) {
+    for (float &sample : samples) {
+      sample = (float)(0.5 * nextNoise());
+    }
+  } else {
+    size_t i = 0;
+    double phase = 0;
+    while (i < frames) {
+      const size_t burst =
+          (size_t)((0.15 + 0.15 * (nextNoise() + 0.5)) * sampleRate);
+      const size_t pause =
+          (size_t)((0.05 + 0.1 * (nextNoise() + 0.5)) * sampleRate);
+      const bool isVoiced = nextNoise() < 0.25;
+      const double startHz = 100.0 + 120.0 * (nextNoise() + 0.5);
+      const double glideHz = 40.0 * nextNoise();
+      const int harmonics =
+          std::max(1, std::min(12, (int)(4000.0 / startHz)));
+      for (size_t n = 0; n < burst && i < frames; ++n, ++i) {
+        const double envelope = 0.5 - 0.5 * cos(2 * pi * n / burst);
+        double value = 0;
+        if (isVoiced) {
+          phase += 2 * pi * (startHz + glideHz * n / burst) / sampleRate;
+          for (int h = 1; h <= harmonics; ++h) {
+            value += sin(h * phase) / h;
+          }
+          value *= 0.3;
+        } else {
+          value = 0.2 * nextNoise();
+        }
+        for (int c = 0; c < channels; ++c) {
+          samples[i * channels + c] =
+              (float)((1.0 - 0.2 * c) * envelope * value);
+        }
+      }
+      i += pause;
+    }
+  }
+  return samples;
+}
+
+//! Encodes frameCount frames of samples with enc, then decodes every packet
+//! with dec, timing each pass.
+static HRESULT RunCodecRoundTrip(const void *samples, bool isFloat,
+                                 int channels, int frameSize,
+                                 size_t frameCount, OpusEncoder *enc,
+                                 OpusDecoder *dec, double *encodeSeconds,
+                                 double *decodeSeconds, size_t *encodedBytes) {
+  HRESULT hr = S_OK;
+  const size_t maxPacketBytes = 1275 * 3 + 7;
+  const size_t frameSamples = (size_t)frameSize * channels;
+  std::vector<uint8_t> packets(frameCount * maxPacketBytes);
+  std::vector<int32_t> lengths(frameCount);
+  std::vector<float> floatOut(frameSamples);
+  std::vector<opus_int16> int16Out(frameSamples);
+  BenchClock::time_point start;
+
+  *encodedBytes = 0;
+  IFC_OPUS(opus_encoder_ctl(enc, OPUS_RESET_STATE));
+  IFC_OPUS(opus_decoder_ctl(dec, OPUS_RESET_STATE));
+
+  start = BenchClock::now();
+  for (size_t i = 0; i < frameCount; ++i) {
+    uint8_t *packet = packets.data() + i * maxPacketBytes;
+    if (isFloat) {
+      lengths[i] = opus_encode_float(
+          enc, (const float *)samples + i * frameSamples, frameSize, packet,
+          (opus_int32)maxPacketBytes);
+    } else {
+      lengths[i] = opus_encode(
+          enc, (const opus_int16 *)samples + i * frameSamples, frameSize,
+          packet, (opus_int32)maxPacketBytes);
+    }
+    IFC_OPUS(lengths[i]);
+    *encodedBytes += lengths[i];
+  }
+  *encodeSeconds =
+      std::chrono::duration<double>(BenchClock::now() - start).count();
+
+  start = BenchClock::now();
+  for (size_t i = 0; i < frameCount; ++i) {
+    const uint8_t *packet = packets.data() + i * maxPacketBytes;
+    if (isFloat) {
+      IFC_OPUS(opus_decode_float(dec, packet, lengths[i], floatOut.data(),
+                                 frameSize, 0));
+    } else {
+      IFC_OPUS(opus_decode(dec, packet, lengths[i], int16Out.data(),
+                           frameSize, 0));
+    }
+  }
+  *decodeSeconds =
+      std::chrono::duration<double>(BenchClock::now() - start).count();
+
+Cleanup:
+  return hr;
+}
+
+//! Encodes and decodes each synthetic signal at every Opus rate up to
+//! 48 kHz, mono and stereo, through the int16 and float APIs, with default
+//! encoder settings and 20 ms frames. Each case keeps the fastest of a few
+//! passes, which is steadier between runs than the mean.
+static int RunCodecBench() {
+  const int sampleRates[] = {8000, 16000, 24000, 48000};
+  const BenchSignal signals[] = {BenchSignal::Sweep, BenchSignal::Noise,
+                                 BenchSignal::Speech};
+  const double seconds = 5.0;
+  const int frameDurationUs = 20000;
+  const int passes = 3;
+
+  printf("codec: %.0f s per case, %d ms frames, best of %d passes\n", seconds,
+         frameDurationUs / 1000, passes);
+  printf("%8s %4s %-7s %-7s %12s %12s %10s\n", "rate_Hz", "ch", "type",
+         "signal", "enc_rt", "dec_rt", "kbps");
+  for (int sampleRate : sampleRates) {
+    for (int channels = 1; channels <= 2; ++channels) {
+      const int frameSize = GetFrameSizeInSamples(sampleRate, frameDurationUs);
+      const size_t frameCount = (size_t)(seconds * 1e6 / frameDurationUs);
+      int err = OPUS_OK;
+      OpusEncoder *enc = opus_encoder_create(sampleRate, channels,
+                                             OPUS_APPLICATION_AUDIO, &err);
+      OpusDecoder *dec = err == OPUS_OK
+                             ? opus_decoder_create(sampleRate, channels, &err)
+                             : nullptr;
+      if (err != OPUS_OK ||
+          FAILED(ApplyEncoderSettings(enc, OpusEncoderSettings()))) {
+        printf("codec: codec creation failed with %d\n", err);
+        opus_encoder_destroy(enc);
+        opus_decoder_destroy(dec);
+        return 1;
+      }
+
+      for (BenchSignal signal : signals) {
+        std::vector<float> floatSamples =
+            MakeBenchSignal(signal, sampleRate, channels, seconds);
+        std::vector<int16_t> int16Samples(floatSamples.size());
+        ConvertPcmToInt16(PcmSampleType::Float32, floatSamples.data(),
+                          int16Samples.data(), int16Samples.size());
+        for (int isFloat = 0; isFloat <= 1; ++isFloat) {
+          const void *samples = isFloat ? (const void *)floatSamples.data()
+                                        : (const void *)int16Samples.data();
+          double bestEncode = 0;
+          double bestDecode = 0;
+          size_t encodedBytes = 0;
+          for (int pass = 0; pass < passes; ++pass) {
+            double encodeSeconds;
+            double decodeSeconds;
+            HRESULT hr = RunCodecRoundTrip(
+                samples, isFloat != 0, channels, frameSize, frameCount, enc,
+                dec, &encodeSeconds, &decodeSeconds, &encodedBytes);
+            if (FAILED(hr)) {
+              printf("codec: failed with 0x%08x\n", (unsigned)hr);
+              opus_encoder_destroy(enc);
+              opus_decoder_destroy(dec);
+              return 1;
+            }
+            bestEncode = pass == 0 ? encodeSeconds
+                                   : std::min(bestEncode, encodeSeconds);
+            bestDecode = pass == 0 ? decodeSeconds
+                                   : std::min(bestDecode, decodeSeconds);
+          }
+
+          const char *typeName = isFloat ? "float" : "int16";
+          const double kbps = encodedBytes * 8.0 / seconds / 1000.0;
+          printf("%8d %4d %-7s %-7s %11.1fx %11.1fx %10.1f\n", sampleRate,
+                 channels, typeName, GetBenchSignalName(signal),
+                 seconds / bestEncode, seconds / bestDecode, kbps);
+          Record("codec",
+                 std::to_string(sampleRate) + "/" + std::to_string(channels) +
+                     "ch/" + typeName + "/" + GetBenchSignalName(signal),
+                 {{"rate_Hz", sampleRate},
+                  {"channels", channels},
+                  {"encode_realtime", seconds / bestEncode},
+                  {"decode_realtime", seconds / bestDecode},
+                  {"kbps", kbps}});
+        }
+      }
+      opus_encoder_destroy(enc);
+      opus_decoder_destroy(dec);
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Ogg Opus seeking.
+
+static HRESULT WriteFloatWav(const fs::path &path, int sampleRate,
+                             int channels, const std::vector<float> &samples) {
+  HRESULT hr = S_OK;
+  DirectX::WAVStreamWriter writer;
+  WAVEFORMATEX format = {};
+  format.wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+  format.nChannels = (WORD)channels;
+  format.nSamplesPerSec = sampleRate;
+  format.nBlockAlign = (WORD)(channels * sizeof(float));
+  format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+  format.wBitsPerSample = 32;
+  IFC(writer.Open(DirectX::WidenPath(path.c_str()).c_str(), &format));
+  IFC(writer.Write(samples.data(), samples.size() * sizeof(float)));
+  IFC(writer.Close());
+
+Cleanup:
+  return hr;
+}
+
+//! Compresses a sweep that doesn't end on a frame boundary to Ogg Opus
+//! through the streaming and the segmented encoders, and checks the file
+//! plays back exactly as many samples as went in. A 44.1 kHz source is
+//! resampled first, so it is checked to the nearest 48 kHz sample pair (one
+//! sample at the 24 kHz it is encoded at), and both encoders must agree on
+//! its length. Then times short range decodes from random positions, each of
+//! which seeks, and compares them with the same stretch of a decode from the
+//! start.
+static int RunOggSeekBench() {
+  const int sampleRates[] = {16000, 44100, 48000};
+  const int threadCounts[] = {1, 4};
+  const int channels = 2;
+  const double seconds = 20.0137;
+  const uint64_t rangeSamples = OggOpusGranuleRate * 20 / 1000;
+  const int seeks = 200;
+  const fs::path wavPath = fs::temp_directory_path() / "bench_oggseek.wav";
+  const fs::path oggPath = fs::temp_directory_path() / "bench_oggseek.opus";
+  int result = 0;
+
+  printf("oggseek: %.4f s sweeps, %d channels, 20 ms frames\n", seconds,
+         channels);
+  printf("%8s %8s %12s %12s %8s\n", "rate_Hz", "threads", "in_48k",
+         "played_48k", "result");
+  for (int sampleRate : sampleRates) {
+    const std::vector<float> samples =
+        MakeBenchSignal(BenchSignal::Sweep, sampleRate, channels, seconds);
+    const bool isResampled = !IsOpusSampleRate(sampleRate);
+    const uint64_t expected =
+        (samples.size() / channels * OggOpusGranuleRate + sampleRate / 2) /
+        sampleRate;
+    uint64_t firstPlayed = 0;
+    if (FAILED(WriteFloatWav(wavPath, sampleRate, channels, samples))) {
+      printf("oggseek: cannot write %s\n", wavPath.string().c_str());
+      return 1;
+    }
+    for (int threads : threadCounts) {
+      FileCompressOptions options;
+      OggOpusReader reader;
+      options.container = FileContainerFormat::Ogg;
+      options.threadCount = threads;
+      HRESULT hr = RunFileCompress(DirectX::WidenPath(wavPath.c_str()).c_str(),
+                                   oggPath.string().c_str(), options);
+      if (SUCCEEDED(hr)) {
+        hr = reader.Open(oggPath.string().c_str());
+      }
+      if (FAILED(hr)) {
+        printf("oggseek: failed with 0x%08x\n", (unsigned)hr);
+        result = 1;
+        break;
+      }
+      const uint64_t played = reader.GetTotalSamples();
+      if (threads == threadCounts[0]) {
+        firstPlayed = played;
+      }
+      const uint64_t tolerance = isResampled ? 2 : 0;
+      const bool isExact = played == firstPlayed &&
+                           played + tolerance >= expected &&
+                           played <= expected + tolerance;
+      printf("%8d %8d %12llu %12llu %8s\n", sampleRate, threads,
+             (unsigned long long)expected, (unsigned long long)played,
+             isExact ? "ok" : "FAILED");
+      Record("oggseek",
+             "length/" + std::to_string(sampleRate) + "/" +
+                 std::to_string(threads) + " threads",
+             {{"rate_Hz", sampleRate},
+              {"threads", threads},
+              {"input_samples", (double)expected},
+              {"played_samples", (double)played}});
+      if (!isExact) {
+        result = 1;
+      }
+    }
+  }
+
+  // The last file written is the 48 kHz one.
+  if (result == 0) {
+    OggOpusReader reader;
+    std::vector<int16_t> reference;
+    std::vector<int16_t> range;
+    double seekSeconds = 0;
+    double worstSnrDb = INFINITY;
+    bool isComplete = true;
+    uint32_t state = 5;
+    HRESULT hr = reader.Open(oggPath.string().c_str());
+    if (SUCCEEDED(hr)) {
+      hr = DecodeOggRange(reader, 0, reader.GetTotalSamples(), &reference);
+    }
+    for (int i = 0; i < seeks && SUCCEEDED(hr); ++i) {
+      state = state * 1664525u + 1013904223u;
+      const uint64_t start = (uint64_t)((double)(state >> 8) / (1 << 24) *
+                                        reader.GetTotalSamples());
+      auto begin = BenchClock::now();
+      hr = DecodeOggRange(reader, start, rangeSamples, &range);
+      seekSeconds +=
+          std::chrono::duration<double>(BenchClock::now() - begin).count();
+      const uint64_t expectedSamples =
+          std::min(rangeSamples, reader.GetTotalSamples() - start);
+      if (range.size() != expectedSamples * channels) {
+        isComplete = false;
+        continue;
+      }
+      double signal = 0;
+      double error = 0;
+      for (size_t j = 0; j < range.size(); ++j) {
+        const double want = reference[(size_t)start * channels + j];
+        signal += want * want;
+        error += (range[j] - want) * (range[j] - want);
+      }
+      if (signal > 0) {
+        worstSnrDb = std::min(
+            worstSnrDb, error > 0 ? 10 * log10(signal / error) : INFINITY);
+      }
+    }
+    if (FAILED(hr)) {
+      printf("oggseek: failed with 0x%08x\n", (unsigned)hr);
+      result = 1;
+    } else {
+      printf("%d seeks of 20 ms: %.3f ms each, worst SNR against a full "
+             "decode %.1f dB, %s\n",
+             seeks, seekSeconds * 1000 / seeks, worstSnrDb,
+             isComplete ? "ok" : "FAILED");
+      Record("oggseek", "seek/48000/20 ms",
+             {{"ms_per_seek", seekSeconds * 1000 / seeks},
+              {"worst_snr_dB", worstSnrDb}});
+      if (!isComplete) {
+        result = 1;
+      }
+    }
+  }
+
+  std::error_code ec;
+  fs::remove(wavPath, ec);
+  fs::remove(oggPath, ec);
+  return result;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Capture ring buffer.
+
+//! The sender's previous frame assembly: frames come straight from the
+//! capture packet when they fit, otherwise the packet is appended to a
+//! managed buffer that grows as needed, and every release from that buffer
+//! moves what remains down to its start. Kept here as the baseline.
+class LegacyFrameAssembler {
+public:
+  explicit LegacyFrameAssembler(size_t frameBytes)
+      : m_frameBytes(frameBytes) {}
+
+  void HandleAudioData(const uint8_t *data, size_t bytes) {
+    m_data = data;
+    m_available = bytes;
+  }
+
+  const uint8_t *AcquireFrame() {
+    if (m_managedSize >= m_frameBytes) {
+      return m_managed.data();
+    }
+    if (m_managedSize > 0) {
+      if (m_managedSize + m_available < m_frameBytes) {
+        return nullptr;
+      }
+      Append(m_frameBytes - m_managedSize);
+      return m_managed.data();
+    }
+    return m_available >= m_frameBytes ? m_data : nullptr;
+  }
+
+  void ReleaseFrame(const uint8_t *frame) {
+    if (frame == m_managed.data()) {
+      m_managedSize -= m_frameBytes;
+      memmove(m_managed.data(), m_managed.data() + m_frameBytes,
+              m_managedSize);
+    } else {
+      m_data += m_frameBytes;
+      m_available -= m_frameBytes;
+    }
+  }
+
+  void PrepareToRelease() {
+    Append(m_available);
+    m_data = nullptr;
+  }
+
+private:
+  void Append(size_t bytes) {
+    if (m_managedSize + bytes > m_managed.size()) {
+      m_managed.resize(m_managedSize + bytes);
+    }
+    memcpy(m_managed.data() + m_managedSize, m_data, bytes);
+    m_managedSize += bytes;
+    m_available -= bytes;
+    m_data += bytes;
+  }
+
+  size_t m_frameBytes;
+  const uint8_t *m_data{nullptr};
+  size_t m_available{0};
+  std::vector<uint8_t> m_managed;
+  size_t m_managedSize{0};
+};
+
+//! Capture packet sizes in frames, spread between 1 and maxFrames the way
+//! shared-mode capture delivers them when the engine period and the device
+//! period disagree.
+static std::vector<uint32_t> MakePacketSizes(size_t count, uint32_t maxFrames,
+                                             uint32_t seed) {
+  std::vector<uint32_t> sizes(count);
+  uint32_t state = seed;
+  for (uint32_t &size : sizes) {
+    state = state * 1664525u + 1013904223u;
+    size = 1 + (state >> 8) % maxFrames;
+  }
+  return sizes;
+}
+
+//! Pushes a running count through a ring from one thread to another, with
+//! randomized packet sizes on the producer side and fixed frames on the
+//! consumer side, and checks every value arrives once and in order. Packets
+//! alternate between the copying Write and the BeginWrite view. Returns the
+//! bytes per second moved, or 0 when a value is out of place.
+static double RunRingStress(PcmRingMapping mapping, size_t capacityBytes,
+                            size_t frameBytes, uint64_t totalBytes,
+                            PcmRingMapping *actualMapping,
+                            size_t *actualCapacity) {
+  const uint32_t blockAlign = 8; // stereo float
+  const std::vector<uint32_t> packetFrames =
+      MakePacketSizes(4096, (uint32_t)(frameBytes / blockAlign * 2), 7);
+  PcmRingBuffer ring;
+  if (FAILED(ring.Open(capacityBytes, frameBytes, mapping))) {
+    return 0;
+  }
+  *actualMapping = ring.GetMapping();
+  *actualCapacity = ring.GetCapacity();
+  totalBytes -= totalBytes % frameBytes;
+
+  std::atomic<bool> isBroken{false};
+  auto start = BenchClock::now();
+  std::thread producer([&] {
+    std::vector<uint32_t> packet(frameBytes / sizeof(uint32_t) * 2);
+    uint32_t next = 0;
+    uint64_t written = 0;
+    for (size_t i = 0; written < totalBytes && !isBroken; ++i) {
+      const size_t bytes = std::min<uint64_t>(
+          (uint64_t)packetFrames[i % packetFrames.size()] * blockAlign,
+          totalBytes - written);
+      const size_t values = bytes / sizeof(uint32_t);
+      if (bytes <= frameBytes && (i & 1) != 0) {
+        uint8_t *view;
+        while ((view = ring.BeginWrite(bytes)) == nullptr && !isBroken) {
+          std::this_thread::yield();
+        }
+        for (size_t v = 0; view && v < values; ++v, ++next) {
+          memcpy(view + v * sizeof(uint32_t), &next, sizeof(next));
+        }
+        ring.EndWrite(bytes);
+      } else {
+        for (size_t v = 0; v < values; ++v) {
+          packet[v] = next++;
+        }
+        while (ring.GetWritableBytes() < bytes && !isBroken) {
+          std::this_thread::yield();
+        }
+        ring.Write(packet.data(), bytes);
+      }
+      written += bytes;
+    }
+  });
+
+  uint32_t expected = 0;
+  for (uint64_t read = 0; read < totalBytes && !isBroken;) {
+    const uint8_t *frame = ring.BeginRead(frameBytes);
+    if (!frame) {
+      std::this_thread::yield();
+      continue;
+    }
+    for (size_t v = 0; v < frameBytes / sizeof(uint32_t); ++v, ++expected) {
+      uint32_t value;
+      memcpy(&value, frame + v * sizeof(uint32_t), sizeof(value));
+      if (value != expected) {
+        isBroken = true;
+        break;
+      }
+    }
+    ring.EndRead(frameBytes);
+    read += frameBytes;
+  }
+  producer.join();
+  std::chrono::duration<double> elapsed = BenchClock::now() - start;
+  return isBroken ? 0 : (double)totalBytes / elapsed.count();
+}
+
+static int RunRingBufferBench() {
+  const int sampleRate = 48000;
+  const uint32_t blockAlign = 8; // stereo float
+  const int frameDurationsUs[] = {2500, 10000, 20000};
+  const PcmRingMapping mappings[] = {PcmRingMapping::Mirrored,
+                                     PcmRingMapping::Copied};
+
+  // Cross-thread correctness first: a ring only a few frames long, so the
+  // positions wrap constantly and the two threads keep meeting.
+  printf("ringbuffer: stress, 256 MB through a 2-thread ring\n");
+  printf("%-9s %10s %10s %10s %8s\n", "mapping", "frame_B", "capacity",
+         "GB/s", "result");
+  for (PcmRingMapping mapping : mappings) {
+    for (int frameDurationUs : frameDurationsUs) {
+      const size_t frameBytes =
+          (size_t)GetFrameSizeInSamples(sampleRate, frameDurationUs) *
+          blockAlign;
+      const size_t capacityBytes = frameBytes * 3 + blockAlign * 7;
+      PcmRingMapping actualMapping = mapping;
+      size_t actualCapacity = 0;
+      const double bytesPerSecond =
+          RunRingStress(mapping, capacityBytes, frameBytes, 256 << 20,
+                        &actualMapping, &actualCapacity);
+      const char *mappingName =
+          actualMapping == PcmRingMapping::Mirrored ? "mirrored" : "copied";
+      printf("%-9s %10zu %10zu %10.2f %8s\n", mappingName, frameBytes,
+             actualCapacity, bytesPerSecond / 1e9,
+             bytesPerSecond > 0 ? "ok" : "FAILED");
+      if (bytesPerSecond <= 0) {
+        return 1;
+      }
+      Record("ringbuffer",
+             std::string("stress/") + mappingName + "/" +
+                 std::to_string(frameDurationUs) + " us",
+             {{"frame_bytes", frameBytes}, {"GBps", bytesPerSecond / 1e9}});
+    }
+  }
+
+  // Single-threaded cost of turning capture packets into frames, with the
+  // same randomized packet sizes for every path. With a stall of 1 the
+  // encoder drains after every packet; with a larger one it drains after
+  // that many packets, as it does when it falls behind, which is where
+  // compaction moves the whole backlog down for every frame taken.
+  printf("ringbuffer: ns per encoder frame, packets of 1-30 ms\n");
+  printf("%8s %6s %12s %12s %12s\n", "frame_ms", "stall", "legacy",
+         "mirrored", "copied");
+  const uint32_t maxPacketFrames = sampleRate * 30 / 1000;
+  const std::vector<uint32_t> packetFrames =
+      MakePacketSizes(4096, maxPacketFrames, 11);
+  const size_t stalls[] = {1, 8};
+  std::vector<uint8_t> capture((size_t)maxPacketFrames * blockAlign);
+  for (size_t i = 0; i < capture.size(); ++i) {
+    capture[i] = (uint8_t)(i * 131);
+  }
+  uint64_t totalBytes = 0;
+  for (uint32_t frames : packetFrames) {
+    totalBytes += (uint64_t)frames * blockAlign;
+  }
+  for (int frameDurationUs : frameDurationsUs) {
+    const size_t frameBytes =
+        (size_t)GetFrameSizeInSamples(sampleRate, frameDurationUs) *
+        blockAlign;
+    const double frameCount = (double)(totalBytes / frameBytes);
+    for (size_t stall : stalls) {
+      volatile uint32_t sink = 0;
+      LegacyFrameAssembler legacy(frameBytes);
+      const double legacyNs = MeasureNsPerCall(
+          [&] {
+            for (size_t i = 0; i < packetFrames.size(); ++i) {
+              legacy.HandleAudioData(capture.data(),
+                                     packetFrames[i] * blockAlign);
+              if (i % stall == stall - 1) {
+                while (const uint8_t *frame = legacy.AcquireFrame()) {
+                  sink = sink + frame[frameBytes - 1];
+                  legacy.ReleaseFrame(frame);
+                }
+              }
+              legacy.PrepareToRelease();
+            }
+          },
+          0.2);
+
+      double ringNs[2] = {};
+      for (size_t m = 0; m < 2; ++m) {
+        PcmRingBuffer ring;
+        if (FAILED(ring.Open((size_t)maxPacketFrames * blockAlign *
+                                     (stall + 1) +
+                                 frameBytes,
+                             frameBytes, mappings[m]))) {
+          printf("ringbuffer: open failed\n");
+          return 1;
+        }
+        ringNs[m] = MeasureNsPerCall(
+            [&] {
+              for (size_t i = 0; i < packetFrames.size(); ++i) {
+                ring.Write(capture.data(), packetFrames[i] * blockAlign);
+                if (i % stall != stall - 1) {
+                  continue;
+                }
+                while (const uint8_t *frame = ring.BeginRead(frameBytes)) {
+                  sink = sink + frame[frameBytes - 1];
+                  ring.EndRead(frameBytes);
+                }
+              }
+            },
+            0.2);
+      }
+      (void)sink;
+
+      printf("%8.1f %6zu %12.1f %12.1f %12.1f\n", frameDurationUs / 1000.0,
+             stall, legacyNs / frameCount, ringNs[0] / frameCount,
+             ringNs[1] / frameCount);
+      Record("ringbuffer",
+             std::to_string(frameDurationUs) + " us/stall " +
+                 std::to_string(stall),
+             {{"frame_ms", frameDurationUs / 1000.0},
+              {"stall", stall},
+              {"legacy_ns_per_frame", legacyNs / frameCount},
+              {"mirrored_ns_per_frame", ringNs[0] / frameCount},
+              {"copied_ns_per_frame", ringNs[1] / frameCount}});
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Sender encoding.
+
+//! Feeds SenderEncoder a capture one chunk at a time, as the sender's encode
+//! stage does, and times each chunk against the frame duration it has to
+//! keep up with. Rates Opus doesn't take go through the streaming resampler
+//! to 24 kHz first; 48 kHz is the direct path to compare against. Captures
+//! are float, like the WASAPI shared-mode mix format, or int16.
+static int RunSenderEncodeBench() {
+  const int captureRates[] = {44100, 22050, 32000, 96000, 48000};
+  const double seconds = 10.0;
+  const int frameDurationUs = 10000;
+
+  printf("senderencode: %.0f s of speech per case, %d ms frames\n", seconds,
+         frameDurationUs / 1000);
+  printf("%8s %4s %-7s %9s %9s %9s %9s %9s\n", "rate_Hz", "ch", "type",
+         "encode_Hz", "mean_us", "p99_us", "max_us", "budget_%");
+  for (int captureRate : captureRates) {
+    for (int channels = 1; channels <= 2; ++channels) {
+      const std::vector<float> floatSamples = MakeBenchSignal(
+          BenchSignal::Speech, captureRate, channels, seconds);
+      std::vector<int16_t> int16Samples(floatSamples.size());
+      ConvertPcmToInt16(PcmSampleType::Float32, floatSamples.data(),
+                        int16Samples.data(), int16Samples.size());
+      for (int isFloat = 0; isFloat <= 1; ++isFloat) {
+        const char *typeName = isFloat ? "float" : "int16";
+        const uint8_t *data =
+            isFloat ? (const uint8_t *)floatSamples.data()
+                    : (const uint8_t *)int16Samples.data();
+        WAVEFORMATEX format = {};
+        SenderEncoder encoder;
+        size_t packets = 0;
+        std::vector<double> chunkUs;
+        format.wFormatTag = isFloat ? WAVE_FORMAT_IEEE_FLOAT : WAVE_FORMAT_PCM;
+        format.nChannels = (WORD)channels;
+        format.nSamplesPerSec = captureRate;
+        format.wBitsPerSample = isFloat ? 32 : 16;
+        format.nBlockAlign = (WORD)(channels * format.wBitsPerSample / 8);
+        format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+        if (FAILED(encoder.Open(&format, frameDurationUs,
+                                OpusEncoderSettings(), -1))) {
+          printf("senderencode: encoder creation failed\n");
+          return 1;
+        }
+
+        const SenderEncoder::PacketCallback onPacket =
+            [&packets](const uint8_t *, size_t) {
+              ++packets;
+              return S_OK;
+            };
+        const size_t chunkBytes = encoder.GetChunkBytes();
+        const size_t totalBytes =
+            floatSamples.size() / channels * format.nBlockAlign;
+        for (size_t offset = 0; offset + chunkBytes <= totalBytes;
+             offset += chunkBytes) {
+          const BenchClock::time_point start = BenchClock::now();
+          if (FAILED(encoder.Encode(data + offset, onPacket))) {
+            printf("senderencode: encode failed\n");
+            return 1;
+          }
+          chunkUs.push_back(std::chrono::duration<double, std::micro>(
+                                BenchClock::now() - start)
+                                .count());
+        }
+
+        double sumUs = 0;
+        for (double us : chunkUs) {
+          sumUs += us;
+        }
+        std::sort(chunkUs.begin(), chunkUs.end());
+        const double meanUs = sumUs / chunkUs.size();
+        const double p99Us = chunkUs[chunkUs.size() * 99 / 100];
+        const double maxUs = chunkUs.back();
+        const double budgetPercent = maxUs * 100.0 / frameDurationUs;
+        printf("%8d %4d %-7s %9d %9.1f %9.1f %9.1f %9.2f\n", captureRate,
+               channels, typeName, encoder.GetEncodeRate(), meanUs, p99Us,
+               maxUs, budgetPercent);
+        Record("senderencode",
+               std::to_string(captureRate) + "/" + std::to_string(channels) +
+                   "ch/" + typeName,
+               {{"rate_Hz", captureRate},
+                {"channels", channels},
+                {"encode_Hz", encoder.GetEncodeRate()},
+                {"packets", (double)packets},
+                {"mean_us", meanUs},
+                {"p99_us", p99Us},
+                {"max_us", maxUs},
+                {"max_budget_pct", budgetPercent}});
+      }
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Redis publishing.
+
+struct RedisPublishResult {
+  double seconds = 0;
+  RedisPipelineStats pipeline; //!< summed over the streams
+};
+
+//! Publishes messageCount packets on each of streamCount connections, one
+//! thread per stream, and times the slowest. A window of 0 publishes with a
+//! blocking PUBLISH per packet; otherwise the commands are pipelined with up
+//! to window of them in flight.
+static bool RunRedisPublishCase(const char *host, const char *password,
+                                int streamCount, int window,
+                                size_t messageCount, size_t packetBytes,
+                                RedisPublishResult *result) {
+  std::vector<redisContext *> contexts;
+  std::vector<RedisPipelineStats> stats(streamCount);
+  std::vector<std::thread> threads;
+  std::atomic<bool> isFailed{false};
+  const std::vector<uint8_t> packet(packetBytes, 0x5a);
+  for (int i = 0; i < streamCount; ++i) {
+    redisContext *context = ConnectToRedis(host, DefaultRedisPort, password);
+    if (!context) {
+      break;
+    }
+    contexts.push_back(context);
+  }
+  if ((int)contexts.size() < streamCount) {
+    for (redisContext *context : contexts) {
+      redisFree(context);
+    }
+    return false;
+  }
+
+  const BenchClock::time_point start = BenchClock::now();
+  for (int i = 0; i < streamCount; ++i) {
+    threads.emplace_back([&, i]() {
+      const std::string channel = "bench" + std::to_string(i);
+      HRESULT hr = S_OK;
+      if (window == 0) {
+        RedisPublisher publisher(contexts[i], channel.c_str());
+        for (size_t m = 0; m < messageCount && SUCCEEDED(hr); ++m) {
+          hr = publisher.Publish(packet.data(), packet.size());
+        }
+      } else {
+        RedisPipelineOptions options;
+        options.maxInFlight = window;
+        PipelinedRedisPublisher publisher(contexts[i], channel.c_str(),
+                                          options);
+        for (size_t m = 0; m < messageCount && SUCCEEDED(hr); ++m) {
+          hr = publisher.Publish(packet.data(), packet.size());
+        }
+        if (SUCCEEDED(hr)) {
+          hr = publisher.Finish();
+        }
+        stats[i] = publisher.GetStats();
+      }
+      if (FAILED(hr)) {
+        isFailed = true;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  result->seconds =
+      std::chrono::duration<double>(BenchClock::now() - start).count();
+  result->pipeline = {};
+  for (const RedisPipelineStats &s : stats) {
+    result->pipeline.commands += s.commands;
+    result->pipeline.flushes += s.flushes;
+    result->pipeline.windowWaits += s.windowWaits;
+    result->pipeline.maxInFlight =
+        std::max(result->pipeline.maxInFlight, s.maxInFlight);
+  }
+  for (redisContext *context : contexts) {
+    redisFree(context);
+  }
+  return !isFailed;
+}
+
+//! Like RunRedisPublishCase, but each stream publishes through an
+//! AsyncRedisPublisher, and one event loop thread drives every connection.
+static bool RunAsyncRedisPublishCase(const char *host, const char *password,
+                                     int streamCount, int window,
+                                     size_t messageCount, size_t packetBytes,
+                                     RedisPublishResult *result) {
+  EventLoop loop;
+  AsyncRedisOptions options;
+  std::vector<std::unique_ptr<AsyncRedisPublisher>> publishers;
+  std::vector<std::thread> threads;
+  std::atomic<bool> isFailed{false};
+  const std::vector<uint8_t> packet(packetBytes, 0x5a);
+  options.maxInFlight = window;
+  if (FAILED(loop.Open()) || FAILED(loop.Start())) {
+    return false;
+  }
+  for (int i = 0; i < streamCount; ++i) {
+    const std::string channel = "bench" + std::to_string(i);
+    publishers.push_back(
+        std::make_unique<AsyncRedisPublisher>(&loop, channel.c_str(), options));
+    if (FAILED(publishers.back()->Open(host, DefaultRedisPort, password))) {
+      return false;
+    }
+  }
+
+  const BenchClock::time_point start = BenchClock::now();
+  for (int i = 0; i < streamCount; ++i) {
+    threads.emplace_back([&, i]() {
+      HRESULT hr = S_OK;
+      for (size_t m = 0; m < messageCount && SUCCEEDED(hr); ++m) {
+        hr = publishers[i]->Publish(packet.data(), packet.size());
+      }
+      if (SUCCEEDED(hr)) {
+        hr = publishers[i]->Finish();
+      }
+      if (FAILED(hr)) {
+        isFailed = true;
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  result->seconds =
+      std::chrono::duration<double>(BenchClock::now() - start).count();
+  result->pipeline = {};
+  for (const std::unique_ptr<AsyncRedisPublisher> &publisher : publishers) {
+    const RedisPipelineStats s = publisher->GetStats();
+    result->pipeline.commands += s.commands;
+    result->pipeline.flushes += s.flushes;
+    result->pipeline.windowWaits += s.windowWaits;
+    result->pipeline.maxInFlight =
+        std::max(result->pipeline.maxInFlight, s.maxInFlight);
+  }
+  publishers.clear();
+  return SUCCEEDED(loop.Stop()) && !isFailed;
+}
+
+//! Publishes sender-sized packets to the redis server REDIS_HOST names
+//! (127.0.0.1 by default, authenticating with REDIS_PWD if it is set),
+//! first one blocking round trip at a time, then pipelined with a range of
+//! in-flight windows, and then through the async publisher, on one stream
+//! and on several. Skipped when no server answers.
+static int RunRedisPublishBench() {
+  const char *host = getenv("REDIS_HOST") ? getenv("REDIS_HOST") : "127.0.0.1";
+  const char *password = getenv("REDIS_PWD");
+  // A window of 0 is the blocking publisher.
+  const struct {
+    bool isAsync;
+    int window;
+  } modes[] = {{false, 0},  {false, 1},  {false, 8}, {false, 64},
+               {false, 256}, {true, 64}, {true, 256}};
+  const int streamCounts[] = {1, 4};
+  const size_t messageCount = 20000;
+  const size_t packetBytes = 200; // about a 20 ms frame at 64 kbps
+  redisContext *probe = ConnectToRedis(host, DefaultRedisPort, password);
+  if (!probe) {
+    printf("redispublish: no redis server at %s, skipped\n", host);
+    return 0;
+  }
+  redisFree(probe);
+
+  printf("redispublish: %zu messages of %zu bytes per stream to %s\n",
+         messageCount, packetBytes, host);
+  printf("%7s %-9s %12s %9s %10s %9s %7s\n", "streams", "mode", "msgs/s",
+         "MB/s", "flushes", "waits", "max_in");
+  for (int streamCount : streamCounts) {
+    for (const auto &mode : modes) {
+      RedisPublishResult result;
+      const bool isAsync = mode.isAsync;
+      const int window = mode.window;
+      if (isAsync ? !RunAsyncRedisPublishCase(host, password, streamCount,
+                                              window, messageCount,
+                                              packetBytes, &result)
+                  : !RunRedisPublishCase(host, password, streamCount, window,
+                                         messageCount, packetBytes,
+                                         &result)) {
+        printf("redispublish: publishing failed\n");
+        return 1;
+      }
+      const std::string modeName =
+          isAsync       ? "async" + std::to_string(window)
+          : window == 0 ? "sync"
+                        : "window" + std::to_string(window);
+      const double messages = (double)messageCount * streamCount;
+      const double msgsPerSec = messages / result.seconds;
+      const double mbPerSec = msgsPerSec * packetBytes / 1e6;
+      printf("%7d %-9s %12.0f %9.2f %10llu %9llu %7d\n", streamCount,
+             modeName.c_str(), msgsPerSec, mbPerSec,
+             (unsigned long long)result.pipeline.flushes,
+             (unsigned long long)result.pipeline.windowWaits,
+             result.pipeline.maxInFlight);
+      Record("redispublish", std::to_string(streamCount) + "x/" + modeName,
+             {{"streams", streamCount},
+              {"window", window},
+              {"async", isAsync},
+              {"msgs_per_s", msgsPerSec},
+              {"MB_per_s", mbPerSec},
+              {"flushes", (double)result.pipeline.flushes},
+              {"window_waits", (double)result.pipeline.windowWaits},
+              {"max_in_flight", result.pipeline.maxInFlight}});
+    }
+  }
+  return 0;
+}
+
+////////////////////////////////////////////////////////////////////////////
+// Main.
+
+struct BenchSuite {
+  const char *name;
+  int (*run)();
+};
+
+static const BenchSuite Suites[] = {
+    {"wavparse", RunWavParseBench},
+    {"pcmconvert", RunPcmConvertBench},
+    {"codec", RunCodecBench},
+    {"oggseek", RunOggSeekBench},
+    {"ringbuffer", RunRingBufferBench},
+    {"parallelencode", RunParallelEncodeBench},
+    {"framedur", RunFrameDurationBench},
+    {"resample", RunResampleBench},
+    {"polyphase", RunPolyphaseBench},
+    {"senderencode", RunSenderEncodeBench},
+    {"redispublish", RunRedisPublishBench},
+};
+
+static void WriteJsonString(FILE *file, const char *value) {
+  fputc('"', file);
+  for (const char *p = value; *p; ++p) {
+    if (*p == '"' || *p == '\\') {
+      fputc('\\', file);
+    }
+    fputc(*p, file);
+  }
+  fputc('"', file);
+}
+
+//! Writes the records as JSON. Non-finite values, which a failed or
+//! zero-length measurement can produce, are written as null.
+static bool WriteJsonReport(const char *fileName, const char *const *suites,
+                            size_t suiteCount) {
+  FILE *file = fopen(fileName, "w");
+  if (!file) {
+    return false;
+  }
+  char timestamp[32];
+  const time_t now = time(nullptr);
+  strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+  fprintf(file, "{\n  \"timestamp\": ");
+  WriteJsonString(file, timestamp);
+  fprintf(file, ",\n  \"opus_version\": ");
+  WriteJsonString(file, opus_get_version_string());
+  fprintf(file, ",\n  \"pcm_convert_isa\": ");
+  WriteJsonString(file, GetPcmConvertIsaName(GetPcmConvertIsa()));
+  fprintf(file, ",\n  \"hardware_threads\": %u,\n  \"suites\": [",
+          std::thread::hardware_concurrency());
+  for (size_t i = 0; i < suiteCount; ++i) {
+    fprintf(file, "%s", i == 0 ? "" : ", ");
+    WriteJsonString(file, suites[i]);
+  }
+  fprintf(file, "],\n  \"results\": [");
+  for (size_t r = 0; r < g_records.size(); ++r) {
+    const BenchRecord &record = g_records[r];
+    fprintf(file, "%s\n    {\"suite\": ", r == 0 ? "" : ",");
+    WriteJsonString(file, record.suite);
+    fprintf(file, ", \"name\": ");
+    WriteJsonString(file, record.name.c_str());
+    for (const auto &metric : record.metrics) {
+      fprintf(file, ", ");
+      WriteJsonString(file, metric.first);
+      if (std::isfinite(metric.second)) {
+        fprintf(file, ": %.17g", metric.second);
+      } else {
+        fprintf(file, ": null");
+      }
+    }
+    fprintf(file, "}");
+  }
+  fprintf(file, "%s]\n}\n", g_records.empty() ? "" : "\n  ");
+  return fclose(file) == 0;
+}
+
+int main(int argc, char *argv[]) {
+  int result = 0;
+  const char *jsonFileName = nullptr;
+  std::vector<const char *> names;
+  std::vector<const char *> ran;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp("--json", argv[i]) == 0 && i + 1 < argc) {
+      jsonFileName = argv[++i];
+    } else {
+      names.push_back(argv[i]);
+    }
+  }
+
+  for (const BenchSuite &suite : Suites) {
+    bool selected = names.empty();
+    for (const char *name : names) {
+      if (strcmp(suite.name, name) == 0) {
+        selected = true;
+      }
+    }
+    if (!selected) {
+      continue;
+    }
+    ran.push_back(suite.name);
+    if (suite.run() != 0) {
+      result = 1;
+    }
+  }
+
+  if (jsonFileName &&
+      !WriteJsonReport(jsonFileName, ran.data(), ran.size())) {
+    printf("Cannot write %s\n", jsonFileName);
+    result = 1;
+  }
+  return result;
+}
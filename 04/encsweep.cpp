@@ -0,0 +1,407 @@
+#include "FileCodec.h"
+#include "PcmConvert.h"
+#include "Resampler.h"
+#include "WAVFileReader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+// Encodes a reference corpus of WAV files across a matrix of encoder settings
+// and reports, for every file and combination, the encoder's time per frame,
+// the bytes it produced and the SNR of the decoded audio against the source.
+// Rows go to stdout as CSV unless --csv or --json name files.
+//
+// Usage: encsweep [--frame-ms MS] [--complexity LIST] [--bitrate LIST]
+//                 [--vbr LIST] [--dtx LIST] [--signal LIST]
+//                 [--bandwidth LIST] [--csv FILE] [--json FILE]
+//                 <file or directory>...
+//
+// Each LIST is comma-separated and takes the values ParseEncoderSetting does,
+// e.g. --bitrate 16000,32000,auto. Files at rates Opus does not take are
+// resampled to 48 kHz first. The time covers opus_encode only; file loading,
+// conversion and decoding are left out.
+
+namespace fs = std::filesystem;
+
+//! One axis of the settings matrix: a ParseEncoderSetting name and the values
+//! to sweep it over.
+struct SweepAxis {
+  const char *name;
+  std::vector<std::string> values;
+};
+
+//! Reference audio, interleaved float at an Opus rate.
+struct SweepSource {
+  std::string name;
+  int sampleRate;
+  int channels;
+  std::vector<float> samples;
+};
+
+struct SweepResult {
+  const SweepSource *source;
+  std::vector<std::string> settings; // one value per axis
+  size_t frameCount;
+  double encodeUsPerFrame;
+  size_t encodedBytes;
+  double kbps;
+  double snrDb;
+};
+
+static std::vector<std::string> SplitList(const char *list) {
+  std::vector<std::string> values;
+  std::string value;
+  for (const char *p = list;; ++p) {
+    if (*p == ',' || *p == '\0') {
+      if (!value.empty()) {
+        values.push_back(value);
+      }
+      value.clear();
+      if (*p == '\0') {
+        break;
+      }
+    } else {
+      value += *p;
+    }
+  }
+  return values;
+}
+
+static HRESULT LoadSource(const fs::path &path, SweepSource *source) {
+  HRESULT hr = S_OK;
+  DirectX::WAVFileMapping mapping;
+  DirectX::WAVData64 data;
+  PcmSampleType sampleType;
+  size_t sampleCount;
+  std::vector<float> samples;
+  IFC(DirectX::LoadWAVAudioFromFileEx(DirectX::WidenPath(path.c_str()).c_str(),
+                                      mapping, data));
+  IFC(GetPcmSampleType(data.wfx, &sampleType));
+  if (data.wfx->nBlockAlign !=
+      data.wfx->nChannels * GetPcmSampleSize(sampleType)) {
+    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+  }
+  source->name = path.string();
+  source->channels = data.wfx->nChannels;
+  sampleCount = (size_t)data.audioBytes / GetPcmSampleSize(sampleType);
+  samples.resize(sampleCount);
+  ConvertPcmToFloat(sampleType, data.startAudio, samples.data(), sampleCount);
+
+  if (IsOpusSampleRate(data.wfx->nSamplesPerSec)) {
+    source->sampleRate = data.wfx->nSamplesPerSec;
+    source->samples.swap(samples);
+  } else {
+    const int inRate = data.wfx->nSamplesPerSec;
+    const int outRate = 48000;
+    const int channels = source->channels;
+    const size_t inFrames = sampleCount / channels;
+    const size_t outCapacity = (size_t)((double)inFrames * outRate / inRate);
+    unsigned int inProcessed = 0;
+    unsigned int outCount = 0;
+    source->sampleRate = outRate;
+    source->samples.resize(outCapacity * channels);
+    IFC(ResampleWaveData(channels, inRate, outRate, true, samples.data(),
+                         (int)inFrames, &inProcessed, source->samples.data(),
+                         (int)outCapacity, &outCount));
+    source->samples.resize((size_t)outCount * channels);
+  }
+
+Cleanup:
+  return hr;
+}
+
+//! Encodes source with settings and fills in the measurements of result.
+static HRESULT RunSweepCase(const SweepSource &source,
+                            const OpusEncoderSettings &settings,
+                            int frameDurationUs, SweepResult *result) {
+  HRESULT hr = S_OK;
+  int error;
+  OpusEncoder *enc = nullptr;
+  OpusDecoder *dec = nullptr;
+  opus_int32 lookahead = 0;
+  const int channels = source.channels;
+  const int frameSize = GetFrameSizeInSamples(source.sampleRate,
+                                              frameDurationUs);
+  const size_t frameCount = source.samples.size() / channels / frameSize;
+  std::vector<uint8_t> encoded;
+  std::vector<opus_int32> packetLengths;
+  std::vector<unsigned char> packet(1275 * 6 + 12);
+  std::vector<float> decoded;
+  std::chrono::duration<double> encodeTime{};
+  double signalEnergy = 0;
+  double noiseEnergy = 0;
+
+  enc = opus_encoder_create(
+      source.sampleRate, channels,
+      GetEncoderApplication(OPUS_APPLICATION_AUDIO, frameDurationUs), &error);
+  IFC_OPUS(error);
+  IFC(ApplyEncoderSettings(enc, settings));
+  IFC_OPUS(opus_encoder_ctl(enc, OPUS_GET_LOOKAHEAD(&lookahead)));
+
+  packetLengths.reserve(frameCount);
+  for (size_t frame = 0; frame < frameCount; ++frame) {
+    const float *frameData =
+        source.samples.data() + frame * frameSize * channels;
+    auto start = std::chrono::steady_clock::now();
+    opus_int32 length = opus_encode_float(enc, frameData, frameSize,
+                                          packet.data(), (int)packet.size());
+    encodeTime += std::chrono::steady_clock::now() - start;
+    IFC_OPUS(length);
+    encoded.insert(encoded.end(), packet.data(), packet.data() + length);
+    packetLengths.push_back(length);
+  }
+
+  dec = opus_decoder_create(source.sampleRate, channels, &error);
+  IFC_OPUS(error);
+  decoded.resize(frameCount * frameSize * channels);
+  {
+    const uint8_t *data = encoded.data();
+    float *pcm = decoded.data();
+    for (opus_int32 length : packetLengths) {
+      int samples = opus_decode_float(dec, data, length, pcm, frameSize, 0);
+      IFC_OPUS(samples);
+      data += length;
+      pcm += samples * channels;
+    }
+  }
+
+  // The decoded audio trails the source by the encoder's lookahead.
+  for (size_t i = (size_t)lookahead * channels; i < decoded.size(); ++i) {
+    const double reference = source.samples[i - lookahead * channels];
+    const double difference = decoded[i] - reference;
+    signalEnergy += reference * reference;
+    noiseEnergy += difference * difference;
+  }
+
+  result->frameCount = frameCount;
+  result->encodeUsPerFrame =
+      frameCount ? encodeTime.count() * 1e6 / (double)frameCount : 0;
+  result->encodedBytes = encoded.size();
+  result->kbps = frameCount ? (double)encoded.size() * 8 /
+                                  ((double)frameCount * frameDurationUs / 1e3)
+                            : 0;
+  result->snrDb =
+      10 * log10((signalEnergy + 1e-20) / (noiseEnergy + 1e-20));
+
+Cleanup:
+  opus_encoder_destroy(enc);
+  opus_decoder_destroy(dec);
+  return hr;
+}
+
+static std::string JsonString(const std::string &value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+//! Quotes a CSV field, doubling any quotes inside it.
+static std::string CsvString(const std::string &value) {
+  std::string quoted = "\"";
+  for (char c : value) {
+    if (c == '"') {
+      quoted += '"';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+static void WriteCsv(FILE *file, const std::vector<SweepAxis> &axes,
+                     double frameMs, const std::vector<SweepResult> &results) {
+  fprintf(file, "file,sample_rate,channels,frame_ms");
+  for (const SweepAxis &axis : axes) {
+    fprintf(file, ",%s", axis.name);
+  }
+  fprintf(file, ",frames,encode_us_per_frame,bytes,kbps,snr_db\n");
+  for (const SweepResult &result : results) {
+    fprintf(file, "%s,%d,%d,%g", CsvString(result.source->name).c_str(),
+            result.source->sampleRate, result.source->channels, frameMs);
+    for (const std::string &value : result.settings) {
+      fprintf(file, ",%s", value.c_str());
+    }
+    fprintf(file, ",%zu,%.3f,%zu,%.3f,%.3f\n", result.frameCount,
+            result.encodeUsPerFrame, result.encodedBytes, result.kbps,
+            result.snrDb);
+  }
+}
+
+static void WriteJson(FILE *file, const std::vector<SweepAxis> &axes,
+                      double frameMs, const std::vector<SweepResult> &results) {
+  fprintf(file, "[\n");
+  for (size_t i = 0; i < results.size(); ++i) {
+    const SweepResult &result = results[i];
+    fprintf(file,
+            "  {\"file\": %s, \"sample_rate\": %d, \"channels\": %d, "
+            "\"frame_ms\": %g",
+            JsonString(result.source->name).c_str(), result.source->sampleRate,
+            result.source->channels, frameMs);
+    for (size_t a = 0; a < axes.size(); ++a) {
+      fprintf(file, ", \"%s\": %s", axes[a].name,
+              JsonString(result.settings[a]).c_str());
+    }
+    fprintf(file,
+            ", \"frames\": %zu, \"encode_us_per_frame\": %.3f, "
+            "\"bytes\": %zu, \"kbps\": %.3f, \"snr_db\": %.3f}%s\n",
+            result.frameCount, result.encodeUsPerFrame, result.encodedBytes,
+            result.kbps, result.snrDb, i + 1 < results.size() ? "," : "");
+  }
+  fprintf(file, "]\n");
+}
+
+int main(int argc, char *argv[]) {
+  std::vector<SweepAxis> axes = {
+      {"complexity", {"0", "2", "5", "8", "10"}},
+      {"bitrate", {"12000", "24000", "32000", "64000", "128000"}},
+      {"vbr", {"off", "constrained", "on"}},
+      {"dtx", {"off", "on"}},
+      {"signal", {"auto"}},
+      {"bandwidth", {"fb"}},
+  };
+  int frameDurationUs = 20000;
+  const char *csvFileName = nullptr;
+  const char *jsonFileName = nullptr;
+  std::vector<fs::path> files;
+  for (int i = 1; i < argc; ++i) {
+    bool isAxis = false;
+    for (SweepAxis &axis : axes) {
+      if (strncmp("--", argv[i], 2) == 0 &&
+          strcmp(axis.name, argv[i] + 2) == 0 && i + 1 < argc) {
+        axis.values = SplitList(argv[++i]);
+        isAxis = true;
+      }
+    }
+    if (isAxis) {
+      continue;
+    }
+    if (strcmp("--frame-ms", argv[i]) == 0 && i + 1 < argc) {
+      frameDurationUs = (int)(atof(argv[++i]) * 1000 + 0.5);
+    } else if (strcmp("--csv", argv[i]) == 0 && i + 1 < argc) {
+      csvFileName = argv[++i];
+    } else if (strcmp("--json", argv[i]) == 0 && i + 1 < argc) {
+      jsonFileName = argv[++i];
+    } else {
+      std::error_code ec;
+      fs::path root = argv[i];
+      if (fs::is_directory(root, ec)) {
+        for (auto it = fs::recursive_directory_iterator(root, ec);
+             it != fs::recursive_directory_iterator(); it.increment(ec)) {
+          if (it->is_regular_file(ec) && it->path().extension() == ".wav") {
+            files.push_back(it->path());
+          }
+        }
+      } else {
+        files.push_back(root);
+      }
+    }
+  }
+
+  if (files.empty()) {
+    fprintf(stderr,
+            "Usage: %s [--frame-ms MS] [--complexity LIST] [--bitrate LIST] "
+            "[--vbr LIST] [--dtx LIST] [--signal LIST] [--bandwidth LIST] "
+            "[--csv FILE] [--json FILE] <file or directory>...\n",
+            argv[0]);
+    return 1;
+  }
+  if (!IsOpusFrameDuration(frameDurationUs)) {
+    fprintf(stderr, "Unsupported frame duration %d us\n", frameDurationUs);
+    return 1;
+  }
+
+  // Check every value up front rather than failing halfway through a sweep.
+  for (const SweepAxis &axis : axes) {
+    OpusEncoderSettings settings;
+    if (axis.values.empty()) {
+      fprintf(stderr, "No values for --%s\n", axis.name);
+      return 1;
+    }
+    for (const std::string &value : axis.values) {
+      if (FAILED(ParseEncoderSetting(axis.name, value.c_str(), &settings))) {
+        fprintf(stderr, "Bad value for --%s: %s\n", axis.name, value.c_str());
+        return 1;
+      }
+    }
+  }
+
+  std::vector<SweepSource> sources;
+  sources.reserve(files.size());
+  for (const fs::path &file : files) {
+    SweepSource source;
+    HRESULT hr = LoadSource(file, &source);
+    if (FAILED(hr)) {
+      fprintf(stderr, "Skipping %s: error 0x%08x\n", file.string().c_str(),
+              (unsigned)hr);
+      continue;
+    }
+    sources.push_back(std::move(source));
+  }
+
+  size_t caseCount = 1;
+  for (const SweepAxis &axis : axes) {
+    caseCount *= axis.values.size();
+  }
+
+  std::vector<SweepResult> results;
+  int failures = 0;
+  for (const SweepSource &source : sources) {
+    fprintf(stderr, "%s: %zu settings\n", source.name.c_str(), caseCount);
+    for (size_t n = 0; n < caseCount; ++n) {
+      // Odometer over the axes, the last axis turning fastest.
+      SweepResult result = {};
+      OpusEncoderSettings settings;
+      size_t rest = n;
+      result.source = &source;
+      result.settings.resize(axes.size());
+      for (size_t a = axes.size(); a-- > 0;) {
+        const std::string &value = axes[a].values[rest % axes[a].values.size()];
+        rest /= axes[a].values.size();
+        result.settings[a] = value;
+        (void)ParseEncoderSetting(axes[a].name, value.c_str(), &settings);
+      }
+      HRESULT hr = RunSweepCase(source, settings, frameDurationUs, &result);
+      if (FAILED(hr)) {
+        fprintf(stderr, "%s: case %zu failed with 0x%08x\n",
+                source.name.c_str(), n, (unsigned)hr);
+        ++failures;
+        continue;
+      }
+      results.push_back(std::move(result));
+    }
+  }
+
+  const double frameMs = frameDurationUs / 1000.0;
+  if (csvFileName || !jsonFileName) {
+    FILE *file = csvFileName ? fopen(csvFileName, "w") : stdout;
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", csvFileName);
+      return 1;
+    }
+    WriteCsv(file, axes, frameMs, results);
+    if (file != stdout) {
+      fclose(file);
+    }
+  }
+  if (jsonFileName) {
+    FILE *file = fopen(jsonFileName, "w");
+    if (!file) {
+      fprintf(stderr, "Cannot open %s\n", jsonFileName);
+      return 1;
+    }
+    WriteJson(file, axes, frameMs, results);
+    fclose(file);
+  }
+  return failures ? 2 : 0;
+}
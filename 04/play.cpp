@@ -1,9 +1,11 @@
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <Windows.h>
+#include "Common.h"
+
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
 #include <cstdio>
 #include <memory>
+#include <mutex>
 #include <thread>
 #include <vector>
 
@@ -13,11 +15,19 @@
 #include <xaudio2.h>
 
 #include <opus.h>
+#include <opus_multistream.h>
 #pragma comment(lib, "opus.lib")
 
 #include "hiredis.h"
 
-#include "speex_resampler.h"
+#include "AsyncRedis.h"
+#include "CaptureSource.h"
+#include "FileCodec.h"
+#include "OpusChannelMapping.h"
+#include "PacketQueue.h"
+#include "Resampler.h"
+#include "SenderPipeline.h"
+#include "WAVFileReader.h"
 
 #define REFTIMES_PER_SEC 10000000
 #define REFTIMES_PER_MILLISEC 10000
@@ -26,143 +36,20 @@ const wchar_t PlayFileName[] =
     LR"(directx-sdk-samples\Media\Wavs\MusicMono.wav)";
 const char CompressedFileName[] = "scratch.opus";
 const wchar_t DecompressedFileName[] = L"scratch.opus.wav";
+const wchar_t ReceivedFileName[] = L"scratch_received.wav";
 
 const CLSID CLSID_MMDeviceEnumerator = __uuidof(MMDeviceEnumerator);
 const IID IID_IMMDeviceEnumerator = __uuidof(IMMDeviceEnumerator);
 const IID IID_IAudioClient = __uuidof(IAudioClient);
 const IID IID_IAudioCaptureClient = __uuidof(IAudioCaptureClient);
 
-// Error codes from C libraries (0n150) - 0x8096xxxx
-#define FACILITY_ERRNO (0x96)
-#define HRESULT_FROM_ERRNO(x) MAKE_HRESULT(1, FACILITY_ERRNO, (x))
-
-// Error handling.
-#define IFC(x)                                                                 \
-  do {                                                                         \
-    hr = x;                                                                    \
-    if (FAILED(hr)) {                                                          \
-      printf("Failed with 0x%08x at %d\n", hr, __LINE__); \
-      goto Cleanup;                                                            \
-    }                                                                          \
-  } while (false)
-#define IFC_OPUS(x)                                                            \
-  do {                                                                         \
-    int __opus_err = (x);                                                      \
-    if (__opus_err < 0) {                                                      \
-      hr = E_FAIL;                                                             \
-      goto Cleanup;                                                            \
-    }                                                                          \
-  } while (false)
-#define IFC_RESAMPLER(x)                                                       \
-  do {                                                                         \
-    int __resampler_err = (x);                                                 \
-    if (__resampler_err != RESAMPLER_ERR_SUCCESS) {                            \
-      hr = E_FAIL;                                                             \
-      goto Cleanup;                                                            \
-    }                                                                          \
-  } while (false)
-
 ////////////////////////////////////////////////////////////////////////////
 // Shared declarations.
 
-struct SenderPacketHeader {
-  uint32_t dataLength;
-  uint32_t samplesPerSecond;
-  uint16_t frameIndex;
-  uint8_t channels;
-  uint8_t padding;
-};
-
 const char *g_rhost;
 const char *g_rpwd;
-const int g_rport = 6379;
 const char *g_broadcastTopic = "convo";
 
-bool IsFormatOrSubFormat(const WAVEFORMATEX *wfx, WORD format,
-                         const GUID &subFormat) {
-  return wfx->wFormatTag == format ||
-         (wfx->wFormatTag == WAVE_FORMAT_EXTENSIBLE &&
-          IsEqualGUID(((const WAVEFORMATEXTENSIBLE *)wfx)->SubFormat,
-                      subFormat));
-}
-
-HRESULT CheckFloatOrInt16(const WAVEFORMATEX *wfx, bool *isFloat) {
-  if (IsFormatOrSubFormat(wfx, WAVE_FORMAT_IEEE_FLOAT,
-                          KSDATAFORMAT_SUBTYPE_IEEE_FLOAT)) {
-    *isFloat = true;
-  } else if (IsFormatOrSubFormat(wfx, WAVE_FORMAT_PCM,
-                                 KSDATAFORMAT_SUBTYPE_PCM)) {
-    *isFloat = false;
-  } else {
-    return HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED);
-  }
-  return S_OK;
-}
-
-//! Create a connection to a redis host.
-static redisContext *connectToHost(const char *rhost, const char *rpwd) {
-  redisContext *rctx; // redis context object
-  redisReply *reply;  // redis reply object
-
-  printf("Connecting to redis server %s...\n", rhost);
-  rctx = redisConnect(rhost, g_rport);
-  if (!rctx || rctx->err) {
-    if (rctx) {
-      printf("Failed to connect: %s\n", rctx->errstr);
-    } else {
-      printf("Failed to create redis context\n");
-    }
-    return 0;
-  }
-
-  printf("Authenticating with redis server...\n");
-  reply = (redisReply *)redisCommand(rctx, "AUTH %s", rpwd);
-  if (!reply || rctx->err) {
-    printf("Failed redis authorization\n");
-    freeReplyObject(reply); // ok to call if null
-    redisFree(rctx);
-    return 0;
-  }
-  freeReplyObject(reply);
-  printf("Connected to redis server\n");
-  return rctx;
-}
-
-static HRESULT CheckWaveFormat(WAVEFORMATEX *pwfx, bool *isFloat) {
-  HRESULT hr = S_OK;
-  // Should probably support WAVE_FORMAT_PCM as well.
-  if (pwfx->wFormatTag == WAVE_FORMAT_IEEE_FLOAT) {
-    *isFloat = true;
-  } else {
-    WAVEFORMATEXTENSIBLE
-        *extensible; // pointer into extensible area of audio format description
-    if (pwfx->wFormatTag != WAVE_FORMAT_EXTENSIBLE) {
-      wprintf(L"Only supporting WAVE_FORMAT_IEEE_FLOAT(%u) or "
-              L"WAVE_FORMAT_EXTENSIBLE(%u) format\n",
-              (unsigned)WAVE_FORMAT_PCM, (unsigned)WAVE_FORMAT_EXTENSIBLE);
-      IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
-    }
-    extensible = (WAVEFORMATEXTENSIBLE *)pwfx;
-    if (extensible->SubFormat == KSDATAFORMAT_SUBTYPE_IEEE_FLOAT) {
-      *isFloat = true;
-    } else if (extensible->SubFormat == KSDATAFORMAT_SUBTYPE_PCM) {
-      if (pwfx->wBitsPerSample != 16 ||
-          extensible->Samples.wValidBitsPerSample != 16) {
-        wprintf(L"Only 16-bit int PCM samples are supported\n");
-        IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
-      }
-      *isFloat = false;
-    } else {
-      wprintf(L"Only supporting KSDATAFORMAT_SUBTYPE_IEEE_FLOAT for "
-              L"WAVE_FORMAT_EXTENSIBLE(%u) format\n",
-              (unsigned)WAVE_FORMAT_EXTENSIBLE);
-      IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
-    }
-  }
-Cleanup:
-  return hr;
-}
-
 static void PrintWaveFormat(WAVEFORMATEX *pwfx) {
   wprintf(
       L"Data format tag=%u channels=%u samples-per-sec=%u avg-bytes-per-sec=%u "
@@ -173,244 +60,67 @@ static void PrintWaveFormat(WAVEFORMATEX *pwfx) {
       (unsigned)pwfx->cbSize);
 }
 
-static HRESULT ResampleWaveData(int channels, int inRate, int outRate,
-                                bool isFloat, const void *in, int inCount,
-                                unsigned int *inProcessed, void *out,
-                                int outSize, unsigned int *outCount) {
-  const int quality = SPEEX_RESAMPLER_QUALITY_DEFAULT;
-  int err = 0;
-  HRESULT hr = S_OK;
-  SpeexResamplerState *resampler = nullptr;
-  if (channels > 1) {
-    // Not yet implemented - need different function for interleaved
-    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
-  }
-  resampler = speex_resampler_init(channels, inRate, outRate, quality, &err);
-  IFC_RESAMPLER(err);
-  if (isFloat) {
-    *inProcessed = inCount;
-    *outCount = outSize;
-    int channelIdx = 0;
-    IFC_RESAMPLER(speex_resampler_process_float(resampler, channelIdx,
-                                                (const float *)in, inProcessed,
-                                                (float *)out, outCount));
-  } else {
-    *inProcessed = inCount;
-    *outCount = outSize;
-    int channelIdx = 0;
-    IFC_RESAMPLER(speex_resampler_process_int(resampler, channelIdx,
-                                              (const short *)in, inProcessed,
-                                              (short *)out, outCount));
-  }
-Cleanup:
-  if (resampler) {
-    speex_resampler_destroy(resampler);
-  }
-  return hr;
-}
-
-HRESULT WriteToFile(const void *ptr, size_t len, FILE *fp) {
-  size_t written = fwrite(ptr, 1, len, fp);
-  if (written != len) {
-    return HRESULT_FROM_ERRNO(errno);
-  }
-  return S_OK;
-}
-
-template <typename T> HRESULT WriteValueToFile(const T &value, FILE *fp) {
-  return WriteToFile(&value, sizeof(T), fp);
-}
-
-template <typename T, typename TOther>
-void AppendBufferByMemcpy(std::vector<T> &value, const TOther *ptr,
-                          size_t elementCount) {
-  static_assert(sizeof(TOther) % sizeof(T) == 0);
-  size_t s = value.size();
-  size_t destSize = elementCount * sizeof(TOther) / sizeof(T);
-  value.resize(value.size() + destSize);
-  memcpy(value.data() + s, ptr, elementCount * sizeof(TOther));
-}
-
 ////////////////////////////////////////////////////////////////////////////
 // Sender.
 
-//! Use this class to manage audio frame data from the microphone.
-class MicrophoneAudioFrameDataController {
+//! The default communications microphone, captured through WASAPI in
+//! shared mode.
+class WasapiCaptureSource : public CaptureSource {
 public:
-  void Setup(size_t frameDataForTenMsInBytes) {
-    m_frameDataForTenMsInBytes = frameDataForTenMsInBytes;
-  }
-
-  void HandleAudioData(const uint8_t *pData, size_t dataSizeInBytes) {
-    assert(m_pData == nullptr);
-    assert(m_numBytesAvailableInData == 0);
-    m_pData = pData;
-    m_numBytesAvailableInData = dataSizeInBytes;
-  }
-
-  bool AcquireFrameData(const uint8_t **pOutData, uint32_t *outDataSize) {
-    *pOutData = nullptr;
-    *outDataSize = 0;
-    // If we have enough data in the managed buffer, return it.
-    if (m_frameDataSize >= m_frameDataForTenMsInBytes) {
-      *pOutData = m_frameData.data();
-      *outDataSize = m_frameDataForTenMsInBytes;
-      return true;
-    }
-
-    // If we have a bit left over, see if we can move some data into it and
-    // return a continguous buffer.
-    if (m_frameDataSize > 0) {
-      if (m_frameDataSize + m_numBytesAvailableInData >=
-          m_frameDataForTenMsInBytes) {
-        AppendDataIntoManagedBuffer(m_frameDataForTenMsInBytes -
-                                    m_frameDataSize);
-        *pOutData = m_frameData.data();
-        *outDataSize = m_frameDataForTenMsInBytes;
-        return true;
-      } else {
-        return false;
-      }
-    }
-
-    // If the managed buffer is empty, see if we can return some data from the
-    // audio buffer.
-    assert(m_frameDataSize == 0);
-    if (m_frameDataForTenMsInBytes <= m_numBytesAvailableInData) {
-      *pOutData = m_pData;
-      *outDataSize = m_frameDataForTenMsInBytes;
-      return true;
-    }
-
-    return false;
-  }
-
-  void ReleaseFrameData(const uint8_t *ptr, uint32_t dataSize) {
-    if (ptr == m_frameData.data()) {
-      if (dataSize == m_frameDataSize) {
-        m_frameDataSize = 0;
-      } else {
-        m_frameDataSize -= dataSize;
-        memcpy(m_frameData.data(), m_frameData.data() + dataSize,
-               m_frameDataSize);
-      }
-    } else {
-      assert(ptr == m_pData);
-      assert(dataSize <= m_numBytesAvailableInData);
-      m_pData += dataSize;
-      m_numBytesAvailableInData -= dataSize;
-    }
-  }
-
-  void PrepareToRelease() {
-    // Move the remainder of available data into managed buffer.
-    if (m_numBytesAvailableInData > 0) {
-      AppendDataIntoManagedBuffer(m_numBytesAvailableInData);
-      assert(m_numBytesAvailableInData == 0);
-    }
-    m_pData = nullptr;
+  ~WasapiCaptureSource() { Close(); }
+
+  HRESULT Open();
+  void Close();
+
+  const WAVEFORMATEX *GetFormat() const override { return m_pwfx; }
+  uint32_t GetBufferFrameCount() const override { return m_bufferFrameCount; }
+  HRESULT Start() override { return m_pAudioClient->Start(); }
+  void Stop() override { m_pAudioClient->Stop(); }
+  HRESULT ReadPacket(const uint8_t **data, uint32_t *frameCount) override;
+  HRESULT ReleasePacket() override {
+    return m_pCaptureClient->ReleaseBuffer(m_packetFrameCount);
   }
 
 private:
-  void AppendDataIntoManagedBuffer(uint32_t dataInBytes) {
-    assert(dataInBytes <= m_numBytesAvailableInData);
-    if (m_frameDataSize + dataInBytes > m_frameData.size()) {
-      m_frameData.resize(m_frameDataSize + dataInBytes);
-    }
-    uint8_t *end = m_frameData.data() + m_frameDataSize;
-    memcpy(end, m_pData, dataInBytes);
-    m_frameDataSize += dataInBytes;
-    m_numBytesAvailableInData -= dataInBytes;
-    m_pData += dataInBytes;
-  }
-
-  const uint8_t *m_pData{nullptr};
-  size_t m_numBytesAvailableInData{0};
-  size_t m_frameDataForTenMsInBytes{0};
-  size_t m_frameDataSize{0};
-  std::vector<uint8_t> m_frameData;
+  IMMDeviceEnumerator *m_pEnumerator{nullptr}; // used to find microphone
+  IMMDevice *m_pDevice{nullptr};               // used to find microphone
+  IPropertyStore *m_pDeviceProperties{nullptr};
+  // Used to create and initialize an audio stream between the app and the
+  // audio engine.
+  IAudioClient *m_pAudioClient{nullptr};
+  // Used to read input data from a capture endpoint buffer.
+  IAudioCaptureClient *m_pCaptureClient{nullptr};
+  WAVEFORMATEX *m_pwfx{nullptr}; // audio format for audio client
+  // Maximum number of frames in audio client buffer.
+  UINT32 m_bufferFrameCount{0};
+  REFERENCE_TIME m_hnsActualDuration{0}; // duration of the allocated buffer
+  UINT32 m_packetFrameCount{0};          // frames in the packet being read
 };
 
-HRESULT RunSender() {
+HRESULT WasapiCaptureSource::Open() {
   HRESULT hr = S_OK;
-
-  // Time control.
-  ULONGLONG senderTimeMs = GetTickCount64();
-  ULONGLONG exitTimeMs = senderTimeMs + 10 * 1000;
-
-  // Audio client (microphone) and buffers.
   REFERENCE_TIME hnsRequestedDuration =
-      REFTIMES_PER_MILLISEC * 10;   // initial desired duration
-  REFERENCE_TIME hnsActualDuration; // actual duration in allocated buffer
-  UINT32 bufferFrameCount; // maximum number of frames in audio client buffer
-  UINT32
-      numFramesAvailable; // available number of frames in audio client buffer
-  IMMDeviceEnumerator *pEnumerator = NULL; // used to find microphone
-  IMMDevice *pDevice = NULL;               // used to find microphone
-  IPropertyStore *pDeviceProperties = nullptr;
-  IAudioClient *pAudioClient =
-      NULL; // used to create and initialize an audio stream between e app and
-            // the audio engine
-  IAudioCaptureClient *pCaptureClient =
-      NULL; // used to read input data from a capture endpoint buffer
-  WAVEFORMATEX *pwfx = NULL; // audio format for audio client
-  WAVEFORMATEXTENSIBLE *extensible =
-      NULL; // pointer into extensible area of audio format description
-  UINT32 packetLength = 0; // number of frames in the next data packet in the
-                           // capture endpoint buffer
-  BOOL bDone = FALSE;
-  BYTE *pData; // pointer into the capture client buffer for the next data
-               // packet to be read
-  DWORD flags; // flags about bufffer
-  MicrophoneAudioFrameDataController
-      audioFrameData; // controller for audio frame data
-
-  // Resampler and buffers.
-  const int quality = SPEEX_RESAMPLER_QUALITY_DEFAULT;
-  int err = 0;
-  SpeexResamplerState *resampler = nullptr;
-  const int application = OPUS_APPLICATION_VOIP;
-  int error;
-  int maxFrameSizeInSamples = 0;
-  bool isFloat;
-  bool isOpusSampleRate;
-  void *resampledData = nullptr;
-  size_t audioSampleCount = 0; // count of audio samples in buffer
-  size_t audioSampleSize;      // size of a single audio sample, in bytes
-  const int resampleTargetRate = 24000;
-  int audioSamplesPerSec;
-  unsigned numFramesIn10Ms;
-
-  // Encoder and buffers.
-  OpusEncoder *enc = nullptr;
-  std::vector<uint8_t> packetBuffer;
-  SenderPacketHeader *packetHeader = nullptr;
-  unsigned char *encodedData = nullptr;
-  size_t encodedDataCapacity = 0;
-
-  // Connection.
-  redisContext *senderContext = nullptr;
-  redisReply *senderReply = nullptr;
-
-  // Setup microphone, resampler, encoder, connection.
+      REFTIMES_PER_MILLISEC * 10; // initial desired duration
+
   IFC(CoCreateInstance(CLSID_MMDeviceEnumerator, NULL, CLSCTX_ALL,
-                       IID_IMMDeviceEnumerator, (void **)&pEnumerator));
-  hr = pEnumerator->GetDefaultAudioEndpoint(eCapture, eCommunications, &pDevice);
+                       IID_IMMDeviceEnumerator, (void **)&m_pEnumerator));
+  hr = m_pEnumerator->GetDefaultAudioEndpoint(eCapture, eCommunications,
+                                              &m_pDevice);
   if (hr == HRESULT_FROM_WIN32(ERROR_NOT_FOUND))
   {
     printf("You do not seem to have a microphone connected.\n");
   }
   IFC(hr);
-  IFC(pDevice->OpenPropertyStore(STGM_READ, &pDeviceProperties));
+  IFC(m_pDevice->OpenPropertyStore(STGM_READ, &m_pDeviceProperties));
   {
     DWORD c;
-    IFC(pDeviceProperties->GetCount(&c));
-    for (DWORD i = 0; i < c; ++c) {
+    IFC(m_pDeviceProperties->GetCount(&c));
+    for (DWORD i = 0; i < c; ++i) {
       PROPERTYKEY key;
       PROPVARIANT pv;
       PropVariantInit(&pv);
-      IFC(pDeviceProperties->GetAt(i, &key));
-      IFC(pDeviceProperties->GetValue(key, &pv));
+      IFC(m_pDeviceProperties->GetAt(i, &key));
+      IFC(m_pDeviceProperties->GetValue(key, &pv));
       if (pv.vt == VT_BSTR) {
         wprintf(L"%s\n", pv.bstrVal);
       } else {
@@ -419,23 +129,21 @@ HRESULT RunSender() {
       IFC(PropVariantClear(&pv));
     }
   }
-  IFC(pDevice->Activate(IID_IAudioClient, CLSCTX_ALL, NULL,
-                        (void **)&pAudioClient));
-  IFC(pAudioClient->GetMixFormat(&pwfx));
-  IFC(pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0,
-                               hnsRequestedDuration, 0, pwfx, NULL));
-  IFC(pAudioClient->GetBufferSize(&bufferFrameCount));
-  IFC(pAudioClient->GetService(IID_IAudioCaptureClient,
-                               (void **)&pCaptureClient));
-  PrintWaveFormat(pwfx);
-  IFC(CheckWaveFormat(pwfx, &isFloat));
+  IFC(m_pDevice->Activate(IID_IAudioClient, CLSCTX_ALL, NULL,
+                          (void **)&m_pAudioClient));
+  IFC(m_pAudioClient->GetMixFormat(&m_pwfx));
+  IFC(m_pAudioClient->Initialize(AUDCLNT_SHAREMODE_SHARED, 0,
+                                 hnsRequestedDuration, 0, m_pwfx, NULL));
+  IFC(m_pAudioClient->GetBufferSize(&m_bufferFrameCount));
+  IFC(m_pAudioClient->GetService(IID_IAudioCaptureClient,
+                                 (void **)&m_pCaptureClient));
+  PrintWaveFormat(m_pwfx);
   // Calculate the actual duration of the allocated buffer.
-  hnsActualDuration =
-      (double)REFTIMES_PER_SEC * bufferFrameCount / pwfx->nSamplesPerSec;
+  m_hnsActualDuration =
+      (double)REFTIMES_PER_SEC * m_bufferFrameCount / m_pwfx->nSamplesPerSec;
   printf("Actual buffer duration in ms: %u bufferFrameCount=%u\n",
-         (unsigned)(hnsActualDuration / REFTIMES_PER_MILLISEC),
-         bufferFrameCount);
-  audioSamplesPerSec = pwfx->nSamplesPerSec;
+         (unsigned)(m_hnsActualDuration / REFTIMES_PER_MILLISEC),
+         m_bufferFrameCount);
 
   // Example values:
   // pwfx->wFormatTag = WAVE_FORMAT_EXTENSIBLE
@@ -448,196 +156,248 @@ HRESULT RunSender() {
   // (front left and right speakers) extensible->SubFormat =
   // WAVE_FORMAT_IEEE_FLOAT
 
-  // Setup resampler.
-  isOpusSampleRate = audioSamplesPerSec == 8000 ||
-                     audioSamplesPerSec == 12000 ||
-                     audioSamplesPerSec == 16000 ||
-                     audioSamplesPerSec == 24000 || audioSamplesPerSec == 48000;
+Cleanup:
+  return hr;
+}
 
-  if (pwfx->nChannels > 2) {
-    // Supporting only mono or stereo.
-    IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+void WasapiCaptureSource::Close() {
+  if (m_pAudioClient) {
+    m_pAudioClient->Stop();
+    m_pAudioClient->Release();
+    m_pAudioClient = nullptr;
   }
-  audioSamplesPerSec = pwfx->nSamplesPerSec;
-  audioSampleSize = isFloat ? sizeof(float) : sizeof(uint16_t);
-  maxFrameSizeInSamples = audioSamplesPerSec / 100; // (10 ms intervals)
-  if (!isOpusSampleRate) {
-    resampler = speex_resampler_init(pwfx->nChannels, audioSamplesPerSec,
-                                     resampleTargetRate, quality, &err);
-    IFC_RESAMPLER(err);
+  CoTaskMemFree(m_pwfx);
+  m_pwfx = nullptr;
+  if (m_pEnumerator) {
+    m_pEnumerator->Release();
+    m_pEnumerator = nullptr;
   }
-
-  // Setup encoder.
-  enc = opus_encoder_create(audioSamplesPerSec, pwfx->nChannels, application,
-                            &error);
-  IFC_OPUS(error);
-  numFramesIn10Ms = (audioSamplesPerSec / 100) * pwfx->nChannels;
-  encodedDataCapacity =
-      (audioSamplesPerSec / 100) * 4 *
-      pwfx->nChannels; // 4 bytes per sample for each 10ms, per channel
-  packetBuffer.resize(sizeof(SenderPacketHeader) + encodedDataCapacity);
-  packetHeader = reinterpret_cast<SenderPacketHeader *>(packetBuffer.data());
-  encodedData = reinterpret_cast<unsigned char *>(packetHeader + 1);
-  packetHeader->channels = pwfx->nChannels;
-  packetHeader->frameIndex = 0;
-  packetHeader->padding = 0;
-  packetHeader->samplesPerSecond = audioSamplesPerSec;
-  audioFrameData.Setup(pwfx->nAvgBytesPerSec / 100);
-
-  // Setup connection.
-  senderContext = connectToHost(g_rhost, g_rpwd);
-  if (!senderContext) {
-    printf("Failed to create sender context\n");
-    return 1;
+  if (m_pDeviceProperties) {
+    m_pDeviceProperties->Release();
+    m_pDeviceProperties = nullptr;
   }
+  if (m_pDevice) {
+    m_pDevice->Release();
+    m_pDevice = nullptr;
+  }
+  if (m_pCaptureClient) {
+    m_pCaptureClient->Release();
+    m_pCaptureClient = nullptr;
+  }
+}
 
-  // Loop: read microphone, resample, encode, transmit.
-  IFC(pAudioClient->Start());
-  for (;;) {
-    if (GetTickCount64() >= exitTimeMs) {
-      break;
-    }
-
+HRESULT WasapiCaptureSource::ReadPacket(const uint8_t **data,
+                                        uint32_t *frameCount) {
+  HRESULT hr = S_OK;
+  BYTE *pData; // the capture client buffer for the next data packet
+  DWORD flags; // flags about buffer
+  *frameCount = 0;
+  IFC(m_pCaptureClient->GetBuffer(&pData, &m_packetFrameCount, &flags, NULL,
+                                  NULL));
+  if (hr == AUDCLNT_S_BUFFER_EMPTY) {
     // Sleep for half the buffer duration.
-    Sleep(hnsActualDuration / REFTIMES_PER_MILLISEC / 2);
-
-    for (;;) {
-      if (GetTickCount64() >= exitTimeMs) {
-        break;
-      }
+    Sleep((DWORD)(m_hnsActualDuration / REFTIMES_PER_MILLISEC / 2));
+    hr = S_OK;
+  } else {
+    *data = pData;
+    *frameCount = m_packetFrameCount;
+  }
 
-      // Packets may be smaller than 10ms, in which case we should copy the data
-      // to concatenate with data in future packets.
-      // TODO: copy and append into buffer, extract (or try and be clever and
-      // minimize copies)
-      //
-      // Get the available data in the shared buffer.
-      IFC(pCaptureClient->GetBuffer(&pData, &numFramesAvailable, &flags, NULL,
-                                    NULL));
-      if (hr == AUDCLNT_S_BUFFER_EMPTY) {
-        break;
-      }
-      audioFrameData.HandleAudioData(
-          pData, numFramesAvailable * pwfx->nBlockAlign * pwfx->nChannels);
-      opus_int32 lenOrErr;
-      if (!isOpusSampleRate) {
-        // TODO: resample and encode
-      } else {
-        const uint8_t *encodingFrameData;
-        uint32_t encodingFrameDataSizeInBytes;
-        while (audioFrameData.AcquireFrameData(&encodingFrameData,
-                                               &encodingFrameDataSizeInBytes)) {
-          unsigned encodingFrameDataSizeInFrames =
-              encodingFrameDataSizeInBytes /
-              (pwfx->nBlockAlign * pwfx->nChannels);
-          lenOrErr =
-              isFloat ? opus_encode_float(enc, (const float *)encodingFrameData,
-                                          encodingFrameDataSizeInFrames,
-                                          encodedData, encodedDataCapacity)
-                      : opus_encode(enc, (const int16_t *)encodingFrameData,
-                                    encodingFrameDataSizeInFrames, encodedData,
-                                    encodedDataCapacity);
-          if (lenOrErr < 0) {
-            // The last frame might not be an acceptable frame size, drop the
-            // last few milliseconds.
-            printf("Failed with numFramesAvailable=%u numFramesIn10Ms=%u\n",
-                   (unsigned)encodingFrameDataSizeInFrames, numFramesIn10Ms);
-            break;
-          }
-          audioFrameData.ReleaseFrameData(encodingFrameData,
-                                          encodingFrameDataSizeInBytes);
-
-          // Now, packetize and send it out.
-          packetHeader->frameIndex++;
-          packetHeader->dataLength = lenOrErr;
-          size_t packetLength = sizeof(*packetHeader) + lenOrErr;
-          void *senderReply =
-              redisCommand(senderContext, "PUBLISH %s %b", g_broadcastTopic,
-                           packetHeader, packetLength);
-          freeReplyObject(senderReply);
-          printf("Sent packet %u len %u\n", packetHeader->frameIndex,
-                 (unsigned)packetLength);
-        }
-      }
+Cleanup:
+  return hr;
+}
 
-      audioFrameData.PrepareToRelease();
-      IFC(pCaptureClient->ReleaseBuffer(numFramesAvailable));
-    }
+//! Captures from the microphone and publishes to the broadcast topic, with
+//! capture, encoding and publishing each on a thread of their own. The
+//! publisher hands packets to an event loop thread that owns the socket, so
+//! a slow round trip to the server doesn't cap the packet rate.
+HRESULT RunSender(const SenderOptions &options) {
+  HRESULT hr = S_OK;
+  WasapiCaptureSource source;
+  EventLoop loop;
+  AsyncRedisPublisher publisher(&loop, g_broadcastTopic);
+  SenderStats stats;
+
+  IFC(source.Open());
+  IFC(loop.Open());
+  IFC(loop.Start());
+  IFC(publisher.Open(g_rhost, DefaultRedisPort, g_rpwd));
+  hr = RunSenderPipeline(&source, &publisher, options, &stats);
+  if (SUCCEEDED(hr)) {
+    hr = publisher.Finish();
   }
+  PrintSenderStats(stats);
+  IFC(hr);
 
 Cleanup:
-  // Cleanup microphone, resampler, encoder, connection.
-  if (pAudioClient) {
-    pAudioClient->Stop();
-    pAudioClient->Release();
-  }
-  CoTaskMemFree(pwfx);
-  if (pEnumerator)
-    pEnumerator->Release();
-  if (pDeviceProperties)
-    pDeviceProperties->Release();
-  if (pDevice)
-    pDevice->Release();
-  if (pCaptureClient)
-    pCaptureClient->Release();
-  if (resampler) {
-    speex_resampler_destroy(resampler);
-  }
-  opus_encoder_destroy(enc);
-  redisFree(senderContext);
+  publisher.Close();
+  (void)loop.Stop();
   return hr;
 }
 
 ////////////////////////////////////////////////////////////////////////////
 // Receiver.
 
-static redisContext *g_receiverContext;
+const int ReceiveDurationMs = 30 * 1000;
+// Comfortably more than any packet the sender produces; larger messages on
+// the topic are dropped.
+const size_t ReceivedPacketMaxBytes = 64 * 1024;
+const size_t ReceiveQueuePackets = 100;
+
+//! Decodes published packets into a WAV file. The decoder and file are set
+//! up from the first packet's header and mapping table; packets in any other
+//! format are dropped.
+class ReceivedPacketDecoder {
+public:
+  ~ReceivedPacketDecoder() {
+    (void)m_writer.Close();
+    opus_multistream_decoder_destroy(m_decoder);
+  }
+
+  HRESULT Decode(const uint8_t *message, size_t messageSize) {
+    HRESULT hr = S_OK;
+    SenderPacketHeader header;
+    OpusChannelMapping mapping;
+    size_t mappingTableSize;
+    const uint8_t *payload;
+    int sampleCount;
+    if (messageSize < sizeof(header)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+    memcpy(&header, message, sizeof(header));
+    mappingTableSize = header.mappingFamily == 0 ? 0 : 2 + header.channels;
+    if (messageSize < sizeof(header) + mappingTableSize + header.dataLength ||
+        !IsOpusSampleRate((int)header.samplesPerSecond)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+    IFC(ReadChannelMappingTable(header.mappingFamily, header.channels,
+                                message + sizeof(header), mappingTableSize,
+                                &mapping));
+    payload = message + sizeof(header) + mappingTableSize;
+
+    // Decode straight into WAV channel order.
+    mapping = GetWavOrderMapping(mapping);
+    if (!m_decoder) {
+      IFC(Open((int)header.samplesPerSecond, mapping));
+    } else if ((int)header.samplesPerSecond != m_sampleRate ||
+               !IsSameChannelMapping(mapping, m_mapping)) {
+      IFC(HRESULT_FROM_WIN32(ERROR_NOT_SUPPORTED));
+    }
 
-void RunReceiverNetwork() {
+    sampleCount = opus_multistream_decode(
+        m_decoder, payload, (opus_int32)header.dataLength, m_pcm.data(),
+        (int)(m_pcm.size() / m_mapping.channels), 0);
+    IFC_OPUS(sampleCount);
+    IFC(m_writer.Write(m_pcm.data(), (size_t)sampleCount *
+                                         m_mapping.channels *
+                                         sizeof(opus_int16)));
+
+  Cleanup:
+    return hr;
+  }
+
+private:
+  HRESULT Open(int sampleRate, const OpusChannelMapping &mapping) {
+    HRESULT hr = S_OK;
+    int error;
+    WAVEFORMATEX format;
+    m_decoder = opus_multistream_decoder_create(
+        sampleRate, mapping.channels, mapping.streamCount,
+        mapping.coupledStreamCount, mapping.mapping, &error);
+    IFC_OPUS(error);
+    m_sampleRate = sampleRate;
+    m_mapping = mapping;
+    m_pcm.resize((size_t)GetFrameSizeInSamples(sampleRate, 120000) *
+                 mapping.channels); // 120 ms max
+
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = (WORD)mapping.channels;
+    format.nSamplesPerSec = sampleRate;
+    format.nBlockAlign = (WORD)(mapping.channels * sizeof(opus_int16));
+    format.nAvgBytesPerSec = format.nSamplesPerSec * format.nBlockAlign;
+    format.wBitsPerSample = 16;
+    format.cbSize = 0;
+    IFC(m_writer.Open(ReceivedFileName, &format));
+
+  Cleanup:
+    return hr;
+  }
+
+  OpusMSDecoder *m_decoder{nullptr};
+  int m_sampleRate{0};
+  OpusChannelMapping m_mapping;
+  std::vector<opus_int16> m_pcm;
+  DirectX::WAVStreamWriter m_writer;
+};
+
+//! Subscribes to the broadcast topic and decodes what arrives for a while.
+//! The subscription lives on an event loop thread, which only queues each
+//! message; this thread decodes them, so a slow decode never holds up the
+//! socket, and shutting down is a cancel of the loop.
+HRESULT RunReceiver() {
   HRESULT hr = S_OK;
   FILE *fp = nullptr;
-  redisContext *rc = connectToHost(g_rhost, g_rpwd);
-  redisReply *reply;
-  g_receiverContext = rc;
+  EventLoop loop;
+  PacketQueue queue;
+  std::mutex receivedMutex;
+  std::condition_variable received;
+  std::vector<uint8_t> message(ReceivedPacketMaxBytes);
+  size_t messageSize;
+  ReceivedPacketDecoder decoder;
+  const auto deadline = std::chrono::steady_clock::now() +
+                        std::chrono::milliseconds(ReceiveDurationMs);
+  AsyncRedisSubscriber subscriber(
+      &loop, g_broadcastTopic, [&](const uint8_t *data, size_t bytes) {
+        if (bytes > ReceivedPacketMaxBytes) {
+          printf("Dropped a %zu-byte message\n", bytes);
+          return;
+        }
+        // Drop the oldest rather than hold up the loop when decoding falls
+        // behind.
+        if (!queue.TryPush(data, bytes)) {
+          (void)queue.TryDropOldest();
+          (void)queue.TryPush(data, bytes);
+        }
+        std::lock_guard<std::mutex> lock(receivedMutex);
+        received.notify_one();
+      });
+
+  IFC(queue.Open(ReceiveQueuePackets, ReceivedPacketMaxBytes));
   fp = fopen("scratch_received.bin", "wb");
-  reply = (redisReply *)redisCommand(rc, "SUBSCRIBE %s", g_broadcastTopic);
-  if (reply) {
-    freeReplyObject(reply);
-    reply = NULL;
+  if (!fp) {
+    IFC(HRESULT_FROM_ERRNO(errno));
   }
-
-  // struct timeval tv = { 0, 1000 };
-  // redisSetTimeout(rc, tv);
-  for (;;) {
-    if (redisGetReply(rc, (void **)&reply) != REDIS_OK) {
-      printf("Failed to read reply\n");
-      break;
+  IFC(loop.Open());
+  IFC(loop.Start());
+  IFC(subscriber.Open(g_rhost, DefaultRedisPort, g_rpwd));
+
+  while (std::chrono::steady_clock::now() < deadline &&
+         !subscriber.IsClosed()) {
+    if (!queue.TryPop(message.data(), &messageSize)) {
+      // A message that lands between the pop and the wait only waits for
+      // the next check.
+      std::unique_lock<std::mutex> lock(receivedMutex);
+      received.wait_for(lock, std::chrono::milliseconds(10));
+      continue;
     }
-    if (reply->type == REDIS_REPLY_ARRAY && reply->elements == 3) {
-      printf("Broadcast listener message: %d\n", (int)reply->element[2]->len);
-      IFC(WriteToFile(reply->element[2]->str, reply->element[2]->len, fp));
-    } else {
-      printf("did not understand reply\n");
+    printf("Broadcast listener message: %d\n", (int)messageSize);
+    IFC(WriteToFile(message.data(), messageSize, fp));
+    if (FAILED(decoder.Decode(message.data(), messageSize))) {
+      printf("Dropped a packet that could not be decoded\n");
     }
-    freeReplyObject(reply);
-    reply = NULL;
   }
+  if (subscriber.IsClosed()) {
+    IFC(subscriber.GetStatus());
+  }
+  printf("Shutting down receiver...\n");
+
 Cleanup:
+  // Cancelling the loop unsubscribes and closes the connection.
+  (void)loop.Stop();
   if (fp) {
     fclose(fp);
   }
-  g_receiverContext = nullptr;
-  redisFree(rc);
-}
-
-HRESULT RunReceiver() {
-  std::thread receiverNetwork(RunReceiverNetwork);
-  Sleep(30 * 1000);
-  printf("Shutting down receiver...");
-  closesocket(g_receiverContext->fd);
-  receiverNetwork.join();
-Cleanup:
-  return S_OK;
+  return hr;
 }
 
 ////////////////////////////////////////////////////////////////////////////
@@ -647,19 +407,14 @@ int main(int argc, char *argv[]) {
   HRESULT hr = S_OK;
   bool isSender = true;
   bool isReceiver = false;
+  bool isCompressor = false;
+  bool isDecompressor = false;
+  FileCompressOptions compressOptions;
+  FileDecompressOptions decompressOptions;
+  SenderOptions senderOptions;
 
   IFC(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
 
-  g_rhost = getenv("REDIS_HOST");
-  g_rpwd = getenv("REDIS_PWD");
-  // g_rhost = "127.0.0.1"; // override if you're too lazy to set an env variable
-  // g_rpwd = "pwd";
-  isSender = true;
-  if (g_rhost == nullptr || g_rpwd == nullptr) {
-    printf("Specify the REDIS_HOST and REDIS_PWD env variables\n");
-    IFC(E_FAIL);
-  }
-
   for (int i = 0; i < argc; i++) {
     if (strcmp("--send", argv[i]) == 0) {
       isSender = true;
@@ -667,7 +422,61 @@ int main(int argc, char *argv[]) {
     } else if (strcmp("--receive", argv[i]) == 0) {
       isReceiver = true;
       isSender = false;
+    } else if (strcmp("--compress", argv[i]) == 0) {
+      isCompressor = true;
+    } else if (strcmp("--decompress", argv[i]) == 0) {
+      isDecompressor = true;
+    } else if (strcmp("--decode-rate", argv[i]) == 0 && i + 1 < argc) {
+      decompressOptions.outputSampleRate = atoi(argv[++i]);
+    } else if (strcmp("--decode-float", argv[i]) == 0) {
+      decompressOptions.isFloat = true;
+    } else if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc) {
+      compressOptions.threadCount = atoi(argv[++i]);
+    } else if (strcmp("--ogg", argv[i]) == 0) {
+      compressOptions.container = FileContainerFormat::Ogg;
+    } else if (strcmp("--resampler", argv[i]) == 0 && i + 1 < argc) {
+      ResamplerType resamplerType;
+      if (ParseResamplerType(argv[++i], &resamplerType)) {
+        SetResamplerType(resamplerType);
+      }
+    } else if (strcmp("--mapping-family", argv[i]) == 0 && i + 1 < argc) {
+      // 1 for speaker layouts up to 7.1, 255 for microphone arrays.
+      compressOptions.mappingFamily = atoi(argv[++i]);
+      senderOptions.mappingFamily = compressOptions.mappingFamily;
+    } else if (strcmp("--frame-ms", argv[i]) == 0 && i + 1 < argc) {
+      // Accepts 2.5 as well as whole milliseconds.
+      int frameDurationUs = (int)(atof(argv[++i]) * 1000 + 0.5);
+      compressOptions.frameDurationUs = frameDurationUs;
+      senderOptions.frameDurationUs = frameDurationUs;
+    } else if (strncmp("--", argv[i], 2) == 0 && i + 1 < argc &&
+               SUCCEEDED(ParseEncoderSetting(argv[i] + 2, argv[i + 1],
+                                             &senderOptions.encoder))) {
+      // --complexity, --bitrate, --vbr, --dtx, --signal, --bandwidth
+      compressOptions.encoder = senderOptions.encoder;
+      ++i;
+    }
+  }
+
+  // File roles run locally and don't need a redis connection.
+  if (isCompressor || isDecompressor) {
+    if (isCompressor) {
+      IFC(RunFileCompress(PlayFileName, CompressedFileName, compressOptions));
     }
+    if (isDecompressor) {
+      IFC(RunFileDecompress(CompressedFileName, DecompressedFileName,
+                            decompressOptions));
+    }
+    goto Cleanup;
+  }
+
+  g_rhost = getenv("REDIS_HOST");
+  g_rpwd = getenv("REDIS_PWD");
+  // g_rhost = "127.0.0.1"; // override if you're too lazy to set an env variable
+  // g_rpwd = "pwd";
+  if (g_rhost == nullptr) {
+    printf("Specify the REDIS_HOST env variable, and REDIS_PWD if the "
+           "server needs one\n");
+    IFC(E_FAIL);
   }
 
   if (isSender == isReceiver) {
@@ -676,7 +485,7 @@ int main(int argc, char *argv[]) {
   }
 
   if (isSender) {
-    IFC(RunSender());
+    IFC(RunSender(senderOptions));
   } else if (isReceiver) {
     IFC(RunReceiver());
   }
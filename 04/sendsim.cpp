@@ -0,0 +1,266 @@
+#include "AsyncRedis.h"
+#include "CaptureSource.h"
+#include "FileCodec.h"
+#include "RedisPublisher.h"
+#include "SenderPipeline.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <thread>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+// Runs the sender pipeline without a microphone: audio comes from a WAV file
+// or from raw PCM on stdin, handed out in packets at the pace a capture
+// device would deliver them, and packets go to redis or nowhere. Prints the
+// per-stage counters at the end, so it doubles as a load test: raise --speed
+// to push more audio through than real time, or --publish-delay-ms to see
+// how the queue and overflow policy cope with a slow network.
+//
+// Usage: sendsim [--rate HZ] [--channels N] [--sample-format s16|s24|s32|f32]
+//                [--packet-ms MS] [--speed X] [--loop] [--seconds S]
+//                [--queue N] [--overflow drop|block] [--publish-delay-ms MS]
+//                [--redis] [--async] [--channel NAME] [--window N]
+//                [--flush-bytes N] [--flush-us US] [--frame-ms MS]
+//                [--mapping-family 0|1|255] [encoder settings]
+//                <file.wav | ->
+//
+// "-" reads stdin, in the format --rate, --channels and --sample-format give
+// (48000 Hz mono s16 by default). Without --redis packets are counted and
+// discarded; with it they are published to the channel (convo by default)
+// on the server REDIS_HOST names, authenticating with REDIS_PWD if it is
+// set, as play --send does.
+// PUBLISHes are pipelined with up to --window of them awaiting a reply
+// (64 by default), written out once --flush-bytes have built up or the
+// oldest has waited --flush-us; a window of 0 waits for every reply in turn.
+// --async publishes through hiredis' async API on an event loop thread
+// instead, with the same window.
+
+namespace fs = std::filesystem;
+
+//! Counts packets and throws them away, optionally after a fixed delay that
+//! stands in for a network round trip.
+class NullPublisher : public PacketPublisher {
+public:
+  explicit NullPublisher(double delayMs) : m_delayMs(delayMs) {}
+
+  HRESULT Publish(const uint8_t *packet, size_t bytes) override {
+    (void)packet;
+    if (m_delayMs > 0) {
+      std::this_thread::sleep_for(
+          std::chrono::duration<double, std::milli>(m_delayMs));
+    }
+    m_bytes += bytes;
+    return S_OK;
+  }
+
+  uint64_t GetBytes() const { return m_bytes; }
+
+private:
+  double m_delayMs;
+  uint64_t m_bytes{0};
+};
+
+static bool ParseSampleFormat(const char *name, WAVEFORMATEX *format) {
+  if (strcmp(name, "s16") == 0 || strcmp(name, "s24") == 0 ||
+      strcmp(name, "s32") == 0) {
+    format->wFormatTag = WAVE_FORMAT_PCM;
+    format->wBitsPerSample = (WORD)atoi(name + 1);
+  } else if (strcmp(name, "f32") == 0) {
+    format->wFormatTag = WAVE_FORMAT_IEEE_FLOAT;
+    format->wBitsPerSample = 32;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+  HRESULT hr = S_OK;
+  WAVEFORMATEX rawFormat = {};
+  WavCaptureOptions captureOptions;
+  SenderOptions senderOptions;
+  double publishDelayMs = 0;
+  bool isRedis = false;
+  bool isAsync = false;
+  RedisPipelineOptions pipelineOptions;
+  const char *channel = "convo";
+  const char *input = nullptr;
+  WavCaptureSource source;
+  std::unique_ptr<PacketPublisher> publisher;
+  NullPublisher *nullPublisher = nullptr;
+  PipelinedRedisPublisher *pipelinedPublisher = nullptr;
+  AsyncRedisPublisher *asyncPublisher = nullptr;
+  EventLoop loop;
+  redisContext *context = nullptr;
+  SenderStats stats;
+
+  rawFormat.wFormatTag = WAVE_FORMAT_PCM;
+  rawFormat.nChannels = 1;
+  rawFormat.nSamplesPerSec = 48000;
+  rawFormat.wBitsPerSample = 16;
+  senderOptions.durationMs = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp("--rate", argv[i]) == 0 && i + 1 < argc) {
+      rawFormat.nSamplesPerSec = (DWORD)atoi(argv[++i]);
+    } else if (strcmp("--channels", argv[i]) == 0 && i + 1 < argc) {
+      rawFormat.nChannels = (WORD)atoi(argv[++i]);
+    } else if (strcmp("--sample-format", argv[i]) == 0 && i + 1 < argc) {
+      if (!ParseSampleFormat(argv[++i], &rawFormat)) {
+        fprintf(stderr, "Unknown sample format %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp("--packet-ms", argv[i]) == 0 && i + 1 < argc) {
+      captureOptions.packetDurationUs = (int)(atof(argv[++i]) * 1000 + 0.5);
+    } else if (strcmp("--speed", argv[i]) == 0 && i + 1 < argc) {
+      captureOptions.speed = atof(argv[++i]);
+    } else if (strcmp("--loop", argv[i]) == 0) {
+      captureOptions.isLooping = true;
+    } else if (strcmp("--seconds", argv[i]) == 0 && i + 1 < argc) {
+      senderOptions.durationMs = (int)(atof(argv[++i]) * 1000 + 0.5);
+    } else if (strcmp("--queue", argv[i]) == 0 && i + 1 < argc) {
+      senderOptions.queuePackets = atoi(argv[++i]);
+    } else if (strcmp("--overflow", argv[i]) == 0 && i + 1 < argc) {
+      ++i;
+      if (strcmp(argv[i], "drop") == 0) {
+        senderOptions.overflowPolicy = SenderOverflowPolicy::DropOldest;
+      } else if (strcmp(argv[i], "block") == 0) {
+        senderOptions.overflowPolicy = SenderOverflowPolicy::Block;
+      } else {
+        fprintf(stderr, "Unknown overflow policy %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp("--publish-delay-ms", argv[i]) == 0 && i + 1 < argc) {
+      publishDelayMs = atof(argv[++i]);
+    } else if (strcmp("--redis", argv[i]) == 0) {
+      isRedis = true;
+    } else if (strcmp("--async", argv[i]) == 0) {
+      isAsync = true;
+    } else if (strcmp("--channel", argv[i]) == 0 && i + 1 < argc) {
+      channel = argv[++i];
+    } else if (strcmp("--window", argv[i]) == 0 && i + 1 < argc) {
+      pipelineOptions.maxInFlight = atoi(argv[++i]);
+    } else if (strcmp("--flush-bytes", argv[i]) == 0 && i + 1 < argc) {
+      pipelineOptions.flushBytes = (size_t)atoi(argv[++i]);
+    } else if (strcmp("--flush-us", argv[i]) == 0 && i + 1 < argc) {
+      pipelineOptions.flushIntervalUs = atoi(argv[++i]);
+    } else if (strcmp("--mapping-family", argv[i]) == 0 && i + 1 < argc) {
+      senderOptions.mappingFamily = atoi(argv[++i]);
+    } else if (strcmp("--frame-ms", argv[i]) == 0 && i + 1 < argc) {
+      senderOptions.frameDurationUs = (int)(atof(argv[++i]) * 1000 + 0.5);
+    } else if (strncmp("--", argv[i], 2) == 0 && i + 1 < argc &&
+               SUCCEEDED(ParseEncoderSetting(argv[i] + 2, argv[i + 1],
+                                             &senderOptions.encoder))) {
+      // --complexity, --bitrate, --vbr, --dtx, --signal, --bandwidth
+      ++i;
+    } else {
+      input = argv[i];
+    }
+  }
+
+  if (!input) {
+    fprintf(stderr,
+            "Usage: %s [--rate HZ] [--channels N] "
+            "[--sample-format s16|s24|s32|f32] [--packet-ms MS] [--speed X] "
+            "[--loop] [--seconds S] [--queue N] [--overflow drop|block] "
+            "[--publish-delay-ms MS] [--redis] [--async] [--channel NAME] "
+            "[--window N] [--flush-bytes N] [--flush-us US] "
+            "[--frame-ms MS] [--mapping-family 0|1|255] "
+            "[--complexity N] [--bitrate BPS] [--vbr on|off|constrained] "
+            "[--dtx on|off] [--signal auto|voice|music] "
+            "[--bandwidth nb|mb|wb|swb|fb] <file.wav | ->\n",
+            argv[0]);
+    return 1;
+  }
+
+  if (strcmp(input, "-") == 0) {
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    rawFormat.nBlockAlign =
+        (WORD)(rawFormat.nChannels * rawFormat.wBitsPerSample / 8);
+    rawFormat.nAvgBytesPerSec =
+        rawFormat.nSamplesPerSec * rawFormat.nBlockAlign;
+    IFC(source.OpenStream(stdin, &rawFormat, captureOptions));
+  } else {
+    IFC(source.Open(fs::path(input).wstring().c_str(), captureOptions));
+  }
+
+  if (isRedis) {
+    const char *host = getenv("REDIS_HOST");
+    const char *password = getenv("REDIS_PWD");
+    if (host == nullptr) {
+      printf("Specify the REDIS_HOST env variable, and REDIS_PWD if the "
+             "server needs one\n");
+      IFC(E_FAIL);
+    }
+    if (isAsync) {
+      AsyncRedisOptions asyncOptions;
+      asyncOptions.maxInFlight = std::max(pipelineOptions.maxInFlight, 1);
+      IFC(loop.Open());
+      IFC(loop.Start());
+      asyncPublisher = new AsyncRedisPublisher(&loop, channel, asyncOptions);
+      publisher.reset(asyncPublisher);
+      IFC(asyncPublisher->Open(host, DefaultRedisPort, password));
+    } else {
+      context = ConnectToRedis(host, DefaultRedisPort, password);
+      if (!context) {
+        IFC(E_FAIL);
+      }
+      if (pipelineOptions.maxInFlight > 0) {
+        pipelinedPublisher =
+            new PipelinedRedisPublisher(context, channel, pipelineOptions);
+        publisher.reset(pipelinedPublisher);
+      } else {
+        publisher.reset(new RedisPublisher(context, channel));
+      }
+    }
+  } else {
+    nullPublisher = new NullPublisher(publishDelayMs);
+    publisher.reset(nullPublisher);
+  }
+
+  hr = RunSenderPipeline(&source, publisher.get(), senderOptions, &stats);
+  if (pipelinedPublisher && SUCCEEDED(hr)) {
+    hr = pipelinedPublisher->Finish();
+  }
+  if (asyncPublisher && SUCCEEDED(hr)) {
+    hr = asyncPublisher->Finish();
+  }
+  PrintSenderStats(stats);
+  if (pipelinedPublisher || asyncPublisher) {
+    const RedisPipelineStats pipelineStats =
+        pipelinedPublisher ? pipelinedPublisher->GetStats()
+                           : asyncPublisher->GetStats();
+    printf("redis: %llu commands in %llu writes, %llu replies, %llu errors, "
+           "%d most in flight, window full %llu times\n",
+           (unsigned long long)pipelineStats.commands,
+           (unsigned long long)pipelineStats.flushes,
+           (unsigned long long)pipelineStats.replies,
+           (unsigned long long)pipelineStats.errors, pipelineStats.maxInFlight,
+           (unsigned long long)pipelineStats.windowWaits);
+  }
+  if (nullPublisher && stats.seconds > 0) {
+    printf("%llu bytes, %.1f kbps\n",
+           (unsigned long long)nullPublisher->GetBytes(),
+           nullPublisher->GetBytes() * 8 / 1000.0 / stats.seconds);
+  }
+  IFC(hr);
+
+Cleanup:
+  publisher.reset();
+  (void)loop.Stop();
+  redisFree(context);
+  if (FAILED(hr)) {
+    printf("Failed with error 0x%08x\n", hr);
+  }
+  return FAILED(hr) ? 1 : 0;
+}
@@ -0,0 +1,372 @@
+#include "EncodeCache.h"
+#include "FileCodec.h"
+#include "ThreadPool.h"
+#include "WAVFileReader.h"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+// Transcodes many files in one process: WAV to compressed files, or with
+// --decode, compressed files back to WAV. Jobs run on a work-stealing pool
+// and each worker reuses its own encoder, decoder and resampler between
+// files. Prints one tab-separated line per file on stdout and a throughput
+// and latency summary on stderr.
+//
+// Usage: transcode [--threads N] [--decode] [--decode-rate HZ]
+//                  [--decode-float] [--ogg] [--mapping-family 0|1|255]
+//                  [--frame-ms MS]
+//                  [--complexity N] [--bitrate BPS] [--vbr on|off|constrained]
+//                  [--dtx on|off] [--signal auto|voice|music]
+//                  [--bandwidth nb|mb|wb|swb|fb] [--resampler speex|polyphase]
+//                  [--cache DIR] [--cache-max-mb MB]
+//                  [--out DIR] [--manifest FILE] <file or directory>...
+//
+// Decoding keeps each stream's rate and writes 16-bit PCM unless
+// --decode-rate picks another Opus rate or --decode-float asks for float.
+//
+// Sources with more than two channels are encoded as multistream packets:
+// family 1 for surround layouts up to 7.1 and 255 for other channel sets,
+// unless --mapping-family says otherwise.
+//
+// With --cache, encodes go through a content-addressed cache (see
+// EncodeCache.h), so sources whose audio and settings match an earlier run
+// are linked from the cache instead of encoded again. The cache is capped at
+// --cache-max-mb megabytes, 10 GB by default.
+//
+// A manifest lists one input path per line. Outputs go next to their inputs
+// unless --out names a directory: x.wav encodes to x.opus, and x.opus decodes
+// to x.opus.wav. Under --out, files found by walking a directory argument
+// keep their path below it, and other files keep only their name. Runs where
+// two inputs would write the same output are refused before anything starts.
+
+namespace fs = std::filesystem;
+
+struct TranscodeInput {
+  fs::path path;
+  fs::path outRelative; // where the output goes under --out
+};
+
+struct TranscodeJob {
+  fs::path input;
+  fs::path output;
+  uintmax_t inputBytes;
+  HRESULT hr;
+  bool isCacheHit;
+  double milliseconds;
+  double audioSeconds;
+};
+
+static std::string LowerExtension(const fs::path &path) {
+  std::string ext = path.extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(),
+                 [](unsigned char c) { return (char)tolower(c); });
+  return ext;
+}
+
+static bool IsInputExtension(const fs::path &path, bool isDecode) {
+  const std::string ext = LowerExtension(path);
+  if (isDecode) {
+    return ext == ".opus" || ext == ".ogg";
+  }
+  return ext == ".wav" || ext == ".wave" || ext == ".bwf" || ext == ".rf64";
+}
+
+static fs::path GetOutputPath(const TranscodeInput &input,
+                              const fs::path &outDir, bool isDecode) {
+  fs::path output = outDir.empty() ? input.path : outDir / input.outRelative;
+  if (isDecode) {
+    output += ".wav";
+  } else {
+    output.replace_extension(".opus");
+  }
+  return output;
+}
+
+//! Playing time of a WAV file, from its header alone.
+static double GetWavSeconds(const fs::path &path) {
+  std::unique_ptr<uint8_t[]> headerData;
+  DirectX::WAVData64 data;
+  HRESULT hr = DirectX::ProbeWAVFile(DirectX::WidenPath(path.c_str()).c_str(),
+                                     headerData, data);
+  if (FAILED(hr) || data.wfx->nBlockAlign == 0 ||
+      data.wfx->nSamplesPerSec == 0) {
+    return 0;
+  }
+  return (double)(data.audioBytes / data.wfx->nBlockAlign) /
+         (double)data.wfx->nSamplesPerSec;
+}
+
+static void RunJob(TranscodeJob *job, bool isDecode,
+                   const FileCompressOptions &options,
+                   const FileDecompressOptions &decodeOptions,
+                   EncodeCache *cache, FileCodecState *state) {
+  auto start = std::chrono::steady_clock::now();
+  if (isDecode) {
+    job->hr = RunFileDecompress(
+        job->input.string().c_str(),
+        DirectX::WidenPath(job->output.c_str()).c_str(), decodeOptions,
+        state);
+  } else if (cache) {
+    job->hr = cache->Compress(DirectX::WidenPath(job->input.c_str()).c_str(),
+                              job->output.string().c_str(), options, state,
+                              &job->isCacheHit);
+  } else {
+    job->hr = RunFileCompress(DirectX::WidenPath(job->input.c_str()).c_str(),
+                              job->output.string().c_str(), options, state);
+  }
+  job->milliseconds = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+  if (SUCCEEDED(job->hr)) {
+    job->audioSeconds = GetWavSeconds(isDecode ? job->output : job->input);
+  }
+}
+
+//! Nearest-rank percentile of sorted values.
+static double Percentile(const std::vector<double> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t rank = (size_t)(p / 100.0 * (double)sorted.size() + 0.5);
+  rank = std::min(std::max<size_t>(rank, 1), sorted.size());
+  return sorted[rank - 1];
+}
+
+int main(int argc, char *argv[]) {
+  int threadCount = (int)std::max(1u, std::thread::hardware_concurrency());
+  bool isDecode = false;
+  FileCompressOptions options;
+  FileDecompressOptions decodeOptions;
+  fs::path outDir;
+  const char *cacheDir = nullptr;
+  uint64_t cacheMaxBytes = EncodeCache::DefaultMaxBytes;
+  std::vector<fs::path> roots;
+  std::vector<TranscodeInput> files;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp("--threads", argv[i]) == 0 && i + 1 < argc) {
+      threadCount = std::max(1, atoi(argv[++i]));
+    } else if (strcmp("--decode", argv[i]) == 0) {
+      isDecode = true;
+    } else if (strcmp("--decode-rate", argv[i]) == 0 && i + 1 < argc) {
+      decodeOptions.outputSampleRate = atoi(argv[++i]);
+      if (!IsOpusSampleRate(decodeOptions.outputSampleRate)) {
+        fprintf(stderr, "Cannot decode at %s Hz\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp("--decode-float", argv[i]) == 0) {
+      decodeOptions.isFloat = true;
+    } else if (strcmp("--ogg", argv[i]) == 0) {
+      options.container = FileContainerFormat::Ogg;
+    } else if (strcmp("--mapping-family", argv[i]) == 0 && i + 1 < argc) {
+      options.mappingFamily = atoi(argv[++i]);
+      if (options.mappingFamily != 0 && options.mappingFamily != 1 &&
+          options.mappingFamily != 255) {
+        fprintf(stderr, "Unknown channel mapping family %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp("--frame-ms", argv[i]) == 0 && i + 1 < argc) {
+      options.frameDurationUs = (int)(atof(argv[++i]) * 1000 + 0.5);
+    } else if (strncmp("--", argv[i], 2) == 0 && i + 1 < argc &&
+               SUCCEEDED(ParseEncoderSetting(argv[i] + 2, argv[i + 1],
+                                             &options.encoder))) {
+      ++i;
+    } else if (strcmp("--resampler", argv[i]) == 0 && i + 1 < argc) {
+      ResamplerType resamplerType;
+      if (!ParseResamplerType(argv[++i], &resamplerType)) {
+        fprintf(stderr, "Unknown resampler %s\n", argv[i]);
+        return 1;
+      }
+      SetResamplerType(resamplerType);
+    } else if (strcmp("--cache", argv[i]) == 0 && i + 1 < argc) {
+      cacheDir = argv[++i];
+    } else if (strcmp("--cache-max-mb", argv[i]) == 0 && i + 1 < argc) {
+      cacheMaxBytes =
+          (uint64_t)(std::max(0.0, atof(argv[++i])) * 1024 * 1024);
+    } else if (strcmp("--out", argv[i]) == 0 && i + 1 < argc) {
+      outDir = argv[++i];
+    } else if (strcmp("--manifest", argv[i]) == 0 && i + 1 < argc) {
+      std::ifstream manifest(argv[++i]);
+      if (!manifest) {
+        fprintf(stderr, "Cannot open manifest %s\n", argv[i]);
+        return 1;
+      }
+      std::string line;
+      while (std::getline(manifest, line)) {
+        if (!line.empty() && line.back() == '\r') {
+          line.pop_back();
+        }
+        if (!line.empty() && line[0] != '#') {
+          fs::path path(line);
+          files.push_back({path, path.filename()});
+        }
+      }
+    } else {
+      roots.emplace_back(argv[i]);
+    }
+  }
+
+  if (roots.empty() && files.empty()) {
+    fprintf(stderr,
+            "Usage: %s [--threads N] [--decode] [--decode-rate HZ] "
+            "[--decode-float] [--ogg] [--mapping-family 0|1|255] "
+            "[--frame-ms MS] "
+            "[--complexity N] [--bitrate BPS] [--vbr on|off|constrained] "
+            "[--dtx on|off] [--signal auto|voice|music] "
+            "[--bandwidth nb|mb|wb|swb|fb] [--resampler speex|polyphase] "
+            "[--cache DIR] [--cache-max-mb MB] "
+            "[--out DIR] [--manifest FILE] <file or directory>...\n",
+            argv[0]);
+    return 1;
+  }
+
+  for (const fs::path &root : roots) {
+    std::error_code ec;
+    if (fs::is_regular_file(root, ec)) {
+      files.push_back({root, root.filename()});
+      continue;
+    }
+    fs::recursive_directory_iterator it(
+        root, fs::directory_options::skip_permission_denied, ec);
+    if (ec) {
+      fprintf(stderr, "Cannot open %s: %s\n", root.string().c_str(),
+              ec.message().c_str());
+      continue;
+    }
+    for (; it != fs::recursive_directory_iterator(); it.increment(ec)) {
+      if (it->is_regular_file(ec) && IsInputExtension(it->path(), isDecode)) {
+        files.push_back({it->path(), it->path().lexically_relative(root)});
+      }
+    }
+  }
+
+  // Largest files first, so the long jobs don't all start at the end and
+  // leave one thread finishing alone.
+  std::vector<TranscodeJob> jobs(files.size());
+  std::map<fs::path, const fs::path *> outputs;
+  for (size_t i = 0; i < files.size(); ++i) {
+    std::error_code ec;
+    jobs[i].input = files[i].path;
+    jobs[i].output = GetOutputPath(files[i], outDir, isDecode);
+    jobs[i].inputBytes = fs::file_size(files[i].path, ec);
+    if (ec) {
+      jobs[i].inputBytes = 0;
+    }
+
+    // Two workers writing one file at once would leave it corrupt.
+    auto inserted = outputs.emplace(jobs[i].output.lexically_normal(),
+                                    &files[i].path);
+    if (!inserted.second) {
+      fprintf(stderr, "%s and %s would both write %s\n",
+              inserted.first->second->string().c_str(),
+              files[i].path.string().c_str(),
+              jobs[i].output.string().c_str());
+      return 1;
+    }
+    if (!outDir.empty()) {
+      fs::create_directories(jobs[i].output.parent_path(), ec);
+    }
+  }
+  std::stable_sort(jobs.begin(), jobs.end(),
+                   [](const TranscodeJob &a, const TranscodeJob &b) {
+                     return a.inputBytes > b.inputBytes;
+                   });
+
+  std::unique_ptr<EncodeCache> cache;
+  if (cacheDir && !isDecode) {
+    cache = std::make_unique<EncodeCache>();
+    HRESULT hr = cache->Open(cacheDir, cacheMaxBytes);
+    if (FAILED(hr)) {
+      fprintf(stderr, "Cannot open cache %s: 0x%08x\n", cacheDir,
+              (unsigned)hr);
+      return 1;
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  threadCount =
+      (int)std::min<size_t>(threadCount, std::max<size_t>(1, jobs.size()));
+  WorkStealingPool pool(threadCount);
+  std::unique_ptr<FileCodecState[]> states(new FileCodecState[threadCount]);
+  for (TranscodeJob &job : jobs) {
+    TranscodeJob *jobPtr = &job;
+    pool.Submit([jobPtr, isDecode, &options, &decodeOptions, &cache,
+                 &states](int workerIndex) {
+      // A job that throws fails on its own instead of ending the batch.
+      try {
+        RunJob(jobPtr, isDecode, options, decodeOptions, cache.get(),
+               &states[workerIndex]);
+      } catch (const std::bad_alloc &) {
+        jobPtr->hr = E_OUTOFMEMORY;
+      } catch (const std::exception &) {
+        jobPtr->hr = E_FAIL;
+      }
+    });
+  }
+  pool.Wait();
+  auto elapsed = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start);
+
+  size_t failures = 0;
+  double totalAudioSeconds = 0;
+  std::vector<double> latencies;
+  printf("input\toutput\tstatus\tms\taudio_seconds\n");
+  for (const TranscodeJob &job : jobs) {
+    if (FAILED(job.hr)) {
+      ++failures;
+      printf("%s\t%s\terror 0x%08x\t%.3f\t\n", job.input.string().c_str(),
+             job.output.string().c_str(), (unsigned)job.hr, job.milliseconds);
+      continue;
+    }
+    totalAudioSeconds += job.audioSeconds;
+    latencies.push_back(job.milliseconds);
+    printf("%s\t%s\t%s\t%.3f\t%.3f\n", job.input.string().c_str(),
+           job.output.string().c_str(), job.isCacheHit ? "cached" : "ok",
+           job.milliseconds, job.audioSeconds);
+  }
+  std::sort(latencies.begin(), latencies.end());
+
+  const double wallSeconds = elapsed.count() > 0 ? elapsed.count() : 1e-9;
+  fprintf(stderr,
+          "%zu files (%zu failed), %.2f hours of audio, %d threads, %.3f s, "
+          "%llu steals\n",
+          jobs.size(), failures, totalAudioSeconds / 3600.0, threadCount,
+          elapsed.count(), (unsigned long long)pool.GetStealCount());
+  fprintf(stderr,
+          "throughput: %.1f files/s, %.4f audio-hours/s (%.1fx realtime)\n",
+          (double)jobs.size() / wallSeconds,
+          totalAudioSeconds / 3600.0 / wallSeconds,
+          totalAudioSeconds / wallSeconds);
+  fprintf(stderr,
+          "latency ms: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f\n",
+          Percentile(latencies, 50), Percentile(latencies, 90),
+          Percentile(latencies, 99),
+          latencies.empty() ? 0.0 : latencies.back());
+  if (cache) {
+    HRESULT hr = cache->Close();
+    const EncodeCacheStats stats = cache->GetStats();
+    const uint64_t lookups = stats.hits + stats.misses;
+    fprintf(stderr,
+            "cache: %llu hits, %llu misses (%.1f%% hit rate), %.1f MB "
+            "reused, %llu added, %llu evicted (%.1f MB)%s\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses,
+            lookups ? 100.0 * (double)stats.hits / (double)lookups : 0.0,
+            (double)stats.hitBytes / (1024 * 1024),
+            (unsigned long long)stats.insertions,
+            (unsigned long long)stats.evictions,
+            (double)stats.evictedBytes / (1024 * 1024),
+            FAILED(hr) ? ", index not saved" : "");
+  }
+  return failures ? 2 : 0;
+}